@@ -0,0 +1,83 @@
+#!/bin/sh
+#  BBASIC, an interpreter for a subset of BBC BASIC II.
+#  Copyright (C) 2021 Paul Griffiths.
+#
+#  This program is free software; you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation; either version 3, or (at your option)
+#  any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; If not, see <https://www.gnu.org/licenses/>.
+
+# Runs benchmark programs several times each, and writes a JSON array
+# to standard output with the median run time, statements executed
+# per second and peak resident set size for each program. The figures
+# are taken from the interpreter's own --stats-json report, so the run
+# time excludes parsing and process start-up.
+#
+# Usage: bench.sh BBASIC RUNS PROGRAM...
+
+if [ $# -lt 3 ]; then
+    echo "Usage: $0 BBASIC RUNS PROGRAM..." >&2
+    exit 1
+fi
+
+bbasic=$1
+runs=$2
+shift 2
+
+stats=bench.stats.$$
+trap 'rm -f $stats' EXIT
+
+# Prints the value of a top-level numeric field in the stats report
+field() {
+    sed -n "s/^  \"$1\": \([0-9.e+-]*\),*$/\1/p" $stats
+}
+
+echo "["
+first=1
+for prog in "$@"; do
+    name=`basename $prog .basic`
+    times=
+    statements=0
+    rss=0
+
+    i=0
+    while [ $i -lt $runs ]; do
+        if ! $bbasic --no-cache --stats-json $prog 2> $stats > /dev/null; then
+            echo "$prog failed:" >&2
+            cat $stats >&2
+            exit 1
+        fi
+
+        times="$times `field run_time`"
+        statements=`field statements`
+        r=`field peak_rss`
+        if [ "$r" != "" ] && [ "$r" -gt "$rss" ]; then
+            rss=$r
+        fi
+        i=`expr $i + 1`
+    done
+
+    median=`for t in $times; do echo $t; done | sort -n | \
+        awk '{ t[NR] = $1 } END { print (NR % 2) ? t[(NR + 1) / 2] : (t[NR / 2] + t[NR / 2 + 1]) / 2 }'`
+    rate=`echo $statements $median | \
+        awk '{ printf "%.0f", ($2 > 0) ? $1 / $2 : 0 }'`
+
+    if [ $first -eq 0 ]; then
+        echo ","
+    fi
+    first=0
+    printf '  {"name": "%s", "runs": %d, "median_time": %s, ' \
+        $name $runs $median
+    printf '"statements": %s, "statements_per_second": %s, "peak_rss": %s}' \
+        $statements $rate $rss
+done
+echo
+echo "]"
@@ -0,0 +1,364 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Microbenchmarks for the core data structures. Each benchmark is
+ * run for a fixed number of operations and reported in nanoseconds
+ * per operation, so that a change to one structure can be measured
+ * without the noise of lexing, parsing and running a whole program.
+ *
+ * Usage: microbench [NAME...]
+ *
+ * With no arguments every benchmark is run, otherwise only those
+ * whose names begin with one of the arguments.
+ */
+
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hash.h"
+#include "line_map.h"
+#include "stack_addr.h"
+#include "symbols.h"
+#include "util.h"
+#include "value.h"
+
+/* Symbol table sizes to measure lookups against, at most 4096 */
+static const int table_sizes[] = { 16, 256, 4096 };
+
+#define NUM_TABLE_SIZES (sizeof table_sizes / sizeof table_sizes[0])
+#define NAME_LEN (16)
+
+/* A single benchmark */
+struct bench {
+    const char * name;
+    long ops;
+    void (*run)(long ops);
+};
+
+/* Keeps results alive so the compiler cannot discard the work */
+static volatile size_t sink;
+
+/* Variable names in the symbol table, and how many, set by
+ * symbol_fill() so that lookups don't time the name formatting
+ */
+static char names[4096][NAME_LEN];
+static int table_size;
+
+/* Static function declarations */
+static void bench_djb2hash(long ops);
+static void bench_int_hash(long ops);
+static void bench_line_map_add(long ops);
+static void bench_line_map_find(long ops);
+static void bench_stack_addr(long ops);
+static void bench_value_churn(long ops);
+static void bench_value_to_string_int(long ops);
+static void bench_value_to_string_float(long ops);
+static void bench_symbol_insert(long ops);
+static void bench_symbol_assign(long ops);
+static void bench_symbol_lookup(long ops);
+
+static double now(void);
+static bool selected(const char * name, int argc, char ** argv);
+static void symbol_fill(int n);
+
+/* The benchmarks, in the order they are reported */
+static const struct bench benches[] = {
+    { "djb2hash", 10000000, bench_djb2hash },
+    { "int_hash", 50000000, bench_int_hash },
+    { "line_map_add", 2000000, bench_line_map_add },
+    { "line_map_find", 20000000, bench_line_map_find },
+    { "stack_addr_push_pop", 50000000, bench_stack_addr },
+    { "value_new_free", 10000000, bench_value_churn },
+    { "value_to_string_int", 5000000, bench_value_to_string_int },
+    { "value_to_string_float", 2000000, bench_value_to_string_float },
+    { "symbol_insert", 2000000, bench_symbol_insert },
+    { "symbol_assign", 2000000, bench_symbol_assign },
+    { "symbol_lookup", 10000000, bench_symbol_lookup }
+};
+
+/* Main function */
+int
+main(int argc, char ** argv) {
+    symbol_table_init();
+
+    printf("%-28s %12s %10s\n", "benchmark", "ops", "ns/op");
+    for ( size_t i = 0; i < sizeof benches / sizeof benches[0]; i++ ) {
+        const struct bench * b = &benches[i];
+        if ( !selected(b->name, argc, argv) ) {
+            continue;
+        }
+
+        if ( b->run == bench_symbol_insert || b->run == bench_symbol_assign
+                || b->run == bench_symbol_lookup ) {
+            /* Report these once per table size */
+            for ( size_t j = 0; j < NUM_TABLE_SIZES; j++ ) {
+                char name[64];
+                snprintf(name, sizeof name, "%s/%d", b->name, table_sizes[j]);
+
+                symbol_fill(table_sizes[j]);
+                const double start = now();
+                b->run(b->ops);
+                const double elapsed = now() - start;
+                symbol_table_free();
+
+                printf("%-28s %12ld %10.2f\n", name, b->ops,
+                        elapsed * 1e9 / b->ops);
+            }
+            continue;
+        }
+
+        const double start = now();
+        b->run(b->ops);
+        const double elapsed = now() - start;
+
+        printf("%-28s %12ld %10.2f\n", b->name, b->ops,
+                elapsed * 1e9 / b->ops);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+/*********************************************************************
+ *                                                                   *
+ * Benchmarks                                                        *
+ *                                                                   *
+ *********************************************************************/
+
+/* Hashes variable names of typical length */
+static void
+bench_djb2hash(long ops) {
+    static const char * ids[] = {
+        "I%", "count%", "total", "name$", "LONGVARIABLENAME", "x"
+    };
+    size_t total = 0;
+
+    for ( long i = 0; i < ops; i++ ) {
+        total += djb2hash(ids[i % 6], 257);
+    }
+
+    sink = total;
+}
+
+/* Hashes line numbers */
+static void
+bench_int_hash(long ops) {
+    size_t total = 0;
+
+    for ( long i = 0; i < ops; i++ ) {
+        total += int_hash((int32_t)(i % 32768), 257);
+    }
+
+    sink = total;
+}
+
+/* Adds lines to the line map, as when building a program */
+static void
+bench_line_map_add(long ops) {
+    const long batch = 10000;
+
+    for ( long done = 0; done < ops; done += batch ) {
+        for ( long i = 0; i < batch; i++ ) {
+            line_map_add((int)(i + 1) * 10, NULL);
+        }
+        line_map_free();
+    }
+}
+
+/* Finds lines in a map the size of a large program, as GOTO,
+ * GOSUB and RESTORE do
+ */
+static void
+bench_line_map_find(long ops) {
+    const int lines = 10000;
+    size_t total = 0;
+
+    for ( int i = 0; i < lines; i++ ) {
+        line_map_add((i + 1) * 10, (struct statement *)(size_t)(i + 1));
+    }
+
+    for ( long i = 0; i < ops; i++ ) {
+        total += (size_t)line_map_find((int)(i % lines + 1) * 10);
+    }
+
+    line_map_free();
+    sink = total;
+}
+
+/* Pushes and pops return addresses, as nested GOSUBs do */
+static void
+bench_stack_addr(long ops) {
+    struct stack_addr stack = { NULL, 0, 0 };
+    const long depth = 16;
+    size_t total = 0;
+
+    for ( long done = 0; done < ops; done += depth ) {
+        for ( long i = 0; i < depth; i++ ) {
+            stack_addr_push(&stack, (struct statement *)(size_t)(i + 1));
+        }
+        for ( long i = 0; i < depth; i++ ) {
+            total += (size_t)stack_addr_pop(&stack);
+        }
+    }
+
+    stack_addr_free(&stack);
+    sink = total;
+}
+
+/* Creates and frees values of each type, as expression
+ * evaluation does for every intermediate result
+ */
+static void
+bench_value_churn(long ops) {
+    size_t total = 0;
+
+    for ( long i = 0; i < ops; i += 3 ) {
+        struct value * a = value_int_new((int32_t)i);
+        struct value * b = value_float_new((double)i);
+        struct value * c = value_string_new("HELLO");
+        total += (size_t)value_int(a);
+        value_free(a);
+        value_free(b);
+        value_free(c);
+    }
+
+    sink = total;
+}
+
+/* Converts integers to strings, as PRINT and STR$ do */
+static void
+bench_value_to_string_int(long ops) {
+    struct value * v = value_int_new(0);
+    size_t total = 0;
+
+    for ( long i = 0; i < ops; i++ ) {
+        char * s = value_to_string(v, true);
+        total += strlen(s);
+        x_free(s);
+    }
+
+    value_free(v);
+    sink = total;
+}
+
+/* Converts floats to strings, as PRINT and STR$ do */
+static void
+bench_value_to_string_float(long ops) {
+    struct value * v = value_float_new(3.14159265);
+    size_t total = 0;
+
+    for ( long i = 0; i < ops; i++ ) {
+        char * s = value_to_string(v, true);
+        total += strlen(s);
+        x_free(s);
+    }
+
+    value_free(v);
+    sink = total;
+}
+
+/* Inserts new variables into an emptied table until it reaches the
+ * current size, over and over, as a program's first assignments do
+ */
+static void
+bench_symbol_insert(long ops) {
+    struct value * v = value_float_new(1.0);
+
+    for ( long done = 0; done < ops; done += table_size ) {
+        symbol_table_free();
+        for ( int i = 0; i < table_size && done + i < ops; i++ ) {
+            symbol_variable_assign(names[i], v);
+        }
+    }
+
+    value_free(v);
+}
+
+/* Assigns to existing variables in a table of the current size */
+static void
+bench_symbol_assign(long ops) {
+    struct value * v = value_float_new(1.0);
+
+    for ( long i = 0; i < ops; i++ ) {
+        symbol_variable_assign(names[i % table_size], v);
+    }
+
+    value_free(v);
+}
+
+/* Looks up variables in a table of the current size */
+static void
+bench_symbol_lookup(long ops) {
+    size_t total = 0;
+
+    for ( long i = 0; i < ops; i++ ) {
+        struct value * v = symbol_variable_eval(names[i % table_size]);
+        total += (size_t)value_float(v);
+        value_free(v);
+    }
+
+    sink = total;
+}
+
+
+/*********************************************************************
+ *                                                                   *
+ * Static functions                                                  *
+ *                                                                   *
+ *********************************************************************/
+
+/* Returns the monotonic clock time in seconds */
+static double
+now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Returns true if a benchmark was selected on the command line */
+static bool
+selected(const char * name, int argc, char ** argv) {
+    if ( argc < 2 ) {
+        return true;
+    }
+
+    for ( int i = 1; i < argc; i++ ) {
+        if ( !strncmp(name, argv[i], strlen(argv[i])) ) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Fills the symbol table with n floating point variables */
+static void
+symbol_fill(int n) {
+    struct value * v = value_float_new(1.0);
+
+    for ( int i = 0; i < n; i++ ) {
+        snprintf(names[i], NAME_LEN, "var%d", i);
+        symbol_variable_assign(names[i], v);
+    }
+
+    value_free(v);
+    table_size = n;
+}
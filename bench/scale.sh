@@ -0,0 +1,205 @@
+#!/bin/sh
+#  BBASIC, an interpreter for a subset of BBC BASIC II.
+#  Copyright (C) 2021 Paul Griffiths.
+#
+#  This program is free software; you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation; either version 3, or (at your option)
+#  any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; If not, see <https://www.gnu.org/licenses/>.
+
+# Generates BASIC programs which grow along one dimension at a time,
+# runs each several times, and writes a table of the best times and
+# peak memory use against the size. The dimensions are:
+#
+#   lines      number of program lines, each branching to the next
+#   variables  number of distinct variables assigned and read back
+#   depth      recursion depth of an FN
+#   array      number of elements in an array filled and summed
+#   channels   number of files open at once, each written in turn
+#
+# The sizes double at each step, and the "growth" column is the
+# exponent relating the total time to the size over the previous
+# step: about 1 for linear growth and about 2 for quadratic growth.
+#
+# Usage: scale.sh BBASIC RUNS [DIMENSION...]
+
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 BBASIC RUNS [DIMENSION...]" >&2
+    exit 1
+fi
+
+bbasic=$1
+runs=$2
+shift 2
+
+if [ $# -eq 0 ]; then
+    set -- lines variables depth array channels
+fi
+
+prog=scale.$$.basic
+stats=scale.stats.$$
+trap 'rm -f $prog $stats scale.$$.dat' EXIT
+
+# Prints the value of a top-level numeric field in the stats report
+field() {
+    sed -n "s/^  \"$1\": \([0-9.e+-]*\),*$/\1/p" $stats
+}
+
+# Writes a program of about N lines, each branching to the next
+gen_lines() {
+    awk -v n=$1 'BEGIN {
+        for ( i = 1; i < n; i++ ) {
+            printf "%d A%%=A%%+1:GOTO %d\n", i * 10, (i + 1) * 10
+        }
+        printf "%d PRINT A%%\n", n * 10
+    }'
+}
+
+# Writes a program which assigns N distinct variables and then
+# reads them all back
+gen_variables() {
+    awk -v n=$1 'BEGIN {
+        printf "5 S=0\n"
+        line = 10
+        for ( i = 0; i < n; i += 10 ) {
+            printf "%d V%d=%d", line, i, i
+            for ( j = i + 1; j < i + 10 && j < n; j++ ) {
+                printf ":V%d=%d", j, j
+            }
+            printf "\n"
+            line += 10
+        }
+        for ( i = 0; i < n; i += 10 ) {
+            printf "%d S=S+V%d", line, i
+            for ( j = i + 1; j < i + 10 && j < n; j++ ) {
+                printf "+V%d", j
+            }
+            printf "\n"
+            line += 10
+        }
+        printf "%d PRINT S\n", line
+    }'
+}
+
+# Writes a program which recurses N deep in an FN several times
+gen_depth() {
+    awk -v n=$1 'BEGIN {
+        printf "10 FOR J%%=1 TO 20\n"
+        printf "20 X%%=FNr(%d)\n", n
+        printf "30 NEXT\n"
+        printf "40 PRINT X%%\n"
+        printf "50 END\n"
+        printf "60 DEF FNr(N%%)\n"
+        printf "70 IF N%%=0 THEN R%%=0 ELSE R%%=1+FNr(N%%-1)\n"
+        printf "80 =R%%\n"
+    }'
+}
+
+# Writes a program which fills and sums an array of N elements
+gen_array() {
+    awk -v n=$1 'BEGIN {
+        printf "5 S=0\n"
+        printf "10 DIM A(%d)\n", n
+        printf "20 FOR I%%=0 TO %d\n", n
+        printf "30 A(I%%)=I%%\n"
+        printf "40 NEXT\n"
+        printf "50 FOR I%%=0 TO %d\n", n
+        printf "60 S=S+A(I%%)\n"
+        printf "70 NEXT\n"
+        printf "80 PRINT S\n"
+    }'
+}
+
+# Writes a program which opens N channels at once, writes to each
+# in turn several times, and closes them
+gen_channels() {
+    awk -v n=$1 -v f=scale.$$.dat 'BEGIN {
+        printf "10 DIM C%%(%d)\n", n
+        printf "20 FOR I%%=1 TO %d\n", n
+        printf "30 C%%(I%%)=OPENOUT(\"%s\")\n", f
+        printf "40 NEXT\n"
+        printf "50 FOR J%%=1 TO 20\n"
+        printf "60 FOR I%%=1 TO %d\n", n
+        printf "70 C%%=C%%(I%%)\n"
+        printf "80 BPUT#C%%,65\n"
+        printf "90 NEXT\n"
+        printf "100 NEXT\n"
+        printf "110 FOR I%%=1 TO %d\n", n
+        printf "120 CLOSE#C%%(I%%)\n"
+        printf "130 NEXT\n"
+    }'
+}
+
+# Prints the sizes to run a dimension at
+sizes() {
+    case $1 in
+        lines)     echo 1000 2000 4000 8000 16000 ;;
+        variables) echo 250 500 1000 2000 4000 ;;
+        depth)     echo 250 500 1000 2000 4000 ;;
+        array)     echo 25000 50000 100000 200000 400000 ;;
+        channels)  echo 32 64 128 256 512 ;;
+    esac
+}
+
+printf '%-10s %7s %9s %9s %9s %9s %10s %10s %6s\n' dimension size \
+    parse build run total peak_heap peak_rss growth
+
+for dim in "$@"; do
+    if [ "`sizes $dim`" = "" ]; then
+        echo "$0: unknown dimension $dim" >&2
+        exit 1
+    fi
+
+    last_size=
+    last_total=
+    for n in `sizes $dim`; do
+        gen_$dim $n > $prog
+
+        best=
+        i=0
+        while [ $i -lt $runs ]; do
+            if ! $bbasic --no-cache --stats-json $prog 2> $stats > /dev/null; then
+                echo "$dim $n failed:" >&2
+                cat $stats >&2
+                exit 1
+            fi
+
+            parse=`field parse_time`
+            build=`field build_time`
+            run=`field run_time`
+            total=`echo $parse $build $run | awk '{ printf "%f", $1 + $2 + $3 }'`
+            if [ "$best" = "" ] || \
+                    [ `echo $total $best | awk '{ print ($1 < $2) }'` -eq 1 ]; then
+                best=$total
+                line=`printf '%-10s %7d %9.4f %9.4f %9.4f %9.4f %10d %10d' \
+                    $dim $n $parse $build $run $total \
+                    \`field peak_heap\` \`field peak_rss\``
+            fi
+            i=`expr $i + 1`
+        done
+
+        if [ "$last_total" = "" ]; then
+            growth=-
+        else
+            growth=`echo $best $last_total $n $last_size | awk '{
+                if ( $1 > 0 && $2 > 0 ) {
+                    printf "%.2f", log($1 / $2) / log($3 / $4)
+                } else {
+                    print "-"
+                }
+            }'`
+        fi
+        printf '%s %6s\n' "$line" $growth
+
+        last_size=$n
+        last_total=$best
+    done
+done
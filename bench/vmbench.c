@@ -0,0 +1,193 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Runs programs through libbbasic, first one at a time and then on
+ * several threads at once, each with its own VM. The output of every
+ * concurrent run is checked against the output of the first, and the
+ * times are reported, so this both exercises and measures running
+ * programs concurrently in one process.
+ *
+ * Usage: vmbench THREADS FILE...
+ */
+
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "bbasic.h"
+
+/* A single run of a program */
+struct job {
+    const char * source;
+    size_t len;
+    char * output;
+    size_t output_len;
+    int status;
+};
+
+/* Static function declarations */
+static double now(void);
+static char * read_file(const char * filename, size_t * len);
+static void * run_job(void * arg);
+
+/* Main function */
+int
+main(int argc, char ** argv) {
+    if ( argc < 3 || atoi(argv[1]) < 1 ) {
+        fprintf(stderr, "Usage: %s THREADS FILE...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const int nthreads = atoi(argv[1]);
+    struct job * jobs = calloc(nthreads, sizeof *jobs);
+    pthread_t * threads = calloc(nthreads, sizeof *threads);
+    if ( !jobs || !threads ) {
+        perror("calloc failed");
+        return EXIT_FAILURE;
+    }
+
+    int failures = 0;
+    printf("%-24s %8s %10s %10s %8s\n", "program", "threads",
+            "serial", "threaded", "speedup");
+
+    for ( int i = 2; i < argc; i++ ) {
+        size_t len;
+        char * source = read_file(argv[i], &len);
+        if ( !source ) {
+            return EXIT_FAILURE;
+        }
+
+        /* Run once for the expected output, and time that */
+        struct job expected = { source, len, NULL, 0, 0 };
+        const double serial_start = now();
+        run_job(&expected);
+        const double serial = now() - serial_start;
+
+        /* Run the same program on every thread at once */
+        const double threaded_start = now();
+        for ( int t = 0; t < nthreads; t++ ) {
+            jobs[t] = expected;
+            jobs[t].output = NULL;
+            if ( pthread_create(&threads[t], NULL, run_job, &jobs[t]) ) {
+                fprintf(stderr, "%s: couldn't create thread\n", argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        for ( int t = 0; t < nthreads; t++ ) {
+            pthread_join(threads[t], NULL);
+        }
+        const double threaded = now() - threaded_start;
+
+        for ( int t = 0; t < nthreads; t++ ) {
+            if ( jobs[t].status != expected.status ||
+                    jobs[t].output_len != expected.output_len ||
+                    memcmp(jobs[t].output, expected.output,
+                        expected.output_len) ) {
+                fprintf(stderr, "%s: thread %d output differs\n",
+                        argv[i], t);
+                failures++;
+            }
+            free(jobs[t].output);
+        }
+
+        const char * name = strrchr(argv[i], '/');
+        printf("%-24s %8d %10.4f %10.4f %8.2f\n", name ? name + 1 : argv[i],
+                nthreads, serial * nthreads, threaded,
+                serial * nthreads / threaded);
+
+        free(expected.output);
+        free(source);
+    }
+
+    free(threads);
+    free(jobs);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+/*********************************************************************
+ *                                                                   *
+ * Static functions                                                  *
+ *                                                                   *
+ *********************************************************************/
+
+/* Returns the monotonic clock time in seconds */
+static double
+now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Reads a whole file into memory */
+static char *
+read_file(const char * filename, size_t * len) {
+    FILE * fp = fopen(filename, "rb");
+    if ( !fp ) {
+        perror(filename);
+        return NULL;
+    }
+
+    char * buffer = NULL;
+    size_t capacity = 0;
+    size_t n = 0;
+    do {
+        if ( n == capacity ) {
+            capacity = capacity ? capacity * 2 : 4096;
+            buffer = realloc(buffer, capacity);
+            if ( !buffer ) {
+                perror("realloc failed");
+                exit(EXIT_FAILURE);
+            }
+        }
+        n += fread(buffer + n, 1, capacity - n, fp);
+    } while ( n == capacity );
+
+    fclose(fp);
+    *len = n;
+    return buffer;
+}
+
+/* Loads and runs a job's program in a new VM, with its output
+ * written to memory
+ */
+static void *
+run_job(void * arg) {
+    struct job * job = arg;
+
+    FILE * out = open_memstream(&job->output, &job->output_len);
+    if ( !out ) {
+        perror("open_memstream failed");
+        exit(EXIT_FAILURE);
+    }
+
+    struct bbasic_vm * vm = bbasic_vm_new();
+    bbasic_vm_set_streams(vm, NULL, out, out);
+    job->status = bbasic_vm_load(vm, job->source, job->len);
+    if ( job->status == 0 ) {
+        job->status = bbasic_vm_run(vm);
+    }
+    bbasic_vm_free(vm);
+    fclose(out);
+
+    return NULL;
+}
@@ -48,7 +48,7 @@ set_int_free(struct set_int * s) {
     struct set_int_node * current = s->head;
     while ( current ) {
         struct set_int_node * tmp = current->next;
-        free(current);
+        x_free(current);
         current = tmp;
     }
 }
@@ -77,7 +77,7 @@ set_int_pop(struct set_int *s) {
     struct set_int_node * node = s->head;
     s->head = node->next;
     const int n = node->n;
-    free(node);
+    x_free(node);
 
     return n;
 }
@@ -94,7 +94,7 @@ set_int_remove(struct set_int * s, const int n) {
             } else {
                 prev->next = current->next;
             }
-            free(current);
+            x_free(current);
             break;
         }
         current = current->next;
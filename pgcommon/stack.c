@@ -62,7 +62,7 @@ stack_int_pop(struct stack_int * s) {
     int n = s->head->n;
     struct stack_int_node * node = s->head;
     s->head = node->next;
-    free(node);
+    x_free(node);
 
     return n;
 }
@@ -73,7 +73,7 @@ stack_int_free(struct stack_int * s) {
     struct stack_int_node * current = s->head;
     while ( current ) {
         struct stack_int_node * tmp = current->next;
-        free(current);
+        x_free(current);
         current = tmp;
     }
 }
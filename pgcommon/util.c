@@ -22,8 +22,46 @@
 #include <string.h>
 #include <stdarg.h>
 
+#if HAVE_MALLOC_H
+#include <malloc.h>
+#endif
+
 #include "util.h"
 
+/* Allocation statistics for memory allocated and freed through
+ * these wrappers, which are read by the profiler and by --stats.
+ * The heap size is only tracked if malloc_usable_size is available.
+ * They are counted per thread, so memory allocated on one thread and
+ * freed on another is not balanced in either.
+ */
+THREAD_LOCAL unsigned long x_alloc_count;
+THREAD_LOCAL unsigned long x_free_count;
+THREAD_LOCAL size_t x_heap_size;
+THREAD_LOCAL size_t x_heap_peak;
+
+/* Adds the size of a newly allocated block to the heap size */
+static void
+heap_add(void * p) {
+#if HAVE_MALLOC_USABLE_SIZE
+    x_heap_size += malloc_usable_size(p);
+    if ( x_heap_size > x_heap_peak ) {
+        x_heap_peak = x_heap_size;
+    }
+#else
+    (void) p;
+#endif
+}
+
+/* Subtracts the size of a block about to be freed from the heap size */
+static void
+heap_sub(void * p) {
+#if HAVE_MALLOC_USABLE_SIZE
+    x_heap_size -= malloc_usable_size(p);
+#else
+    (void) p;
+#endif
+}
+
 /* Prototype for function defined by lexer */
 int
 yylex_destroy(void);
@@ -42,51 +80,77 @@ defer_lex_finalize(void) {
 /* Wraps malloc and exits on failure */
 void *
 x_malloc(size_t size) {
+    x_alloc_count++;
     void * p = malloc(size);
     if ( p == NULL ) {
         perror("failed to allocate memory");
         exit(EXIT_FAILURE);
     }
 
+    heap_add(p);
     return p;
 }
 
 /* Wraps calloc and exits on failure */
 void *
 x_calloc(size_t nmemb, size_t size) {
+    x_alloc_count++;
     void * p = calloc(nmemb, size);
     if ( p == NULL ) {
         perror("failed to allocate memory");
         exit(EXIT_FAILURE);
     }
 
+    heap_add(p);
     return p;
 }
 
-/* Wraps realloc and exits on failure */
+/* Wraps realloc and exits on failure. Resizing an existing block
+ * isn't counted as an allocation, so that allocations and frees
+ * balance.
+ */
 void *
 x_realloc(void * ptr, size_t size) {
+    if ( ptr ) {
+        heap_sub(ptr);
+    } else {
+        x_alloc_count++;
+    }
+
     void * p = realloc(ptr, size);
     if ( p == NULL ) {
         perror("failed to reallocate memory");
         exit(EXIT_FAILURE);
     }
 
+    heap_add(p);
     return p;
 }
 
 /* Wraps strdup and exits on failure */
 char *
 x_strdup(const char * s) {
+    x_alloc_count++;
     char * p = strdup(s);
     if ( p == NULL ) {
         perror("failed to duplicate string");
         exit(EXIT_FAILURE);
     }
 
+    heap_add(p);
     return p;
 }
 
+/* Wraps free, for memory allocated by the functions above */
+void
+x_free(void * ptr) {
+    if ( ptr ) {
+        x_free_count++;
+        heap_sub(ptr);
+        free(ptr);
+    }
+}
+
 /* Wraps fopen and exits on failure */
 FILE *
 x_fopen(const char * pathname, const char * mode) {
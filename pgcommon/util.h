@@ -40,11 +40,17 @@
     fprintf(stderr, fmt, __VA_ARGS__); fputc('\n', stderr); fflush(stderr); abort();
 #endif
 
+extern THREAD_LOCAL unsigned long x_alloc_count;
+extern THREAD_LOCAL unsigned long x_free_count;
+extern THREAD_LOCAL size_t x_heap_size;
+extern THREAD_LOCAL size_t x_heap_peak;
+
 void defer_lex_finalize(void);
 void * x_malloc(size_t size);
 void * x_calloc(size_t nmemb, size_t size);
 void * x_realloc(void * ptr, size_t size);
 char * x_strdup(const char * s);
+void x_free(void * ptr);
 FILE * x_fopen(const char * pathname, const char * mode);
 void x_fclose(FILE * stream);
 void x_atexit(void (*function)(void));
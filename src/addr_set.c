@@ -100,10 +100,10 @@ addr_set_free(struct addr_set * set) {
             struct entry * current = set->buckets[i];
             while ( current ) {
                 struct entry * tmp = current->next;
-                free(current);
+                x_free(current);
                 current = tmp;
             }
         }
     }
-    free(set);
+    x_free(set);
 }
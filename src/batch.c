@@ -0,0 +1,580 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Batch runner for the --batch and --jobs options.
+ *
+ * A manifest lists one job per line: a program file, and optionally
+ * an input file and an output file, separated by spaces, with "-"
+ * for no input or for output to standard output. Blank lines and
+ * lines starting with # are ignored. Each job runs in its own VM, on
+ * a pool of worker threads.
+ *
+ * The jobs are dealt out to the workers in turn. Each worker runs the
+ * jobs in its own queue from the front, and when its queue is empty
+ * steals from the back of another worker's queue, so that a worker
+ * held up by a long job doesn't leave the rest of its jobs waiting.
+ *
+ * Each distinct program is read once. If the compiled program cache
+ * is in use, it is also parsed and cached once before the workers
+ * start, so that the jobs load its image concurrently rather than
+ * taking turns with the parser.
+ *
+ * Output written to standard output by a job is collected and written
+ * in one piece when the job finishes. A report of each job's status
+ * and time, and the total throughput, is written to standard error.
+ */
+
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#include "batch.h"
+#include "bbasic.h"
+#include "cache.h"
+#include "options.h"
+#include "runtime.h"
+#include "util.h"
+#include "yydecls.h"
+
+/* Size of the buffer for copying collected output */
+#define COPY_BUFFER_SIZE (8192)
+
+/* A program named in the manifest, and why it couldn't be read if
+ * it has no source
+ */
+struct program_file {
+    char * filename;
+    char * source;
+    size_t len;
+    char * image;
+    const char * problem;
+};
+
+/* A job, and its result */
+struct job {
+    int line;
+    struct program_file * program;
+    char * input;
+    char * output;
+    const char * problem;
+    int status;
+    int worker;
+    double seconds;
+};
+
+/* A worker's queue of job indices. The owner takes jobs from the
+ * front, and other workers steal them from the back.
+ */
+struct queue {
+#if HAVE_PTHREAD_H
+    pthread_mutex_t lock;
+#endif
+    size_t * jobs;
+    size_t front;
+    size_t back;
+};
+
+/* A worker thread */
+struct worker {
+    int index;
+#if HAVE_PTHREAD_H
+    pthread_t thread;
+#endif
+};
+
+/* The jobs, the programs they run, and the workers' queues */
+static struct job * jobs;
+static size_t num_jobs;
+static struct program_file ** programs;
+static size_t num_programs;
+static struct queue * queues;
+static int num_workers;
+
+#if HAVE_PTHREAD_H
+/* Lock held while writing collected output */
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Static function declarations */
+static bool read_manifest(const char * filename);
+static char * next_field(char ** p);
+static struct program_file * find_program(const char * filename);
+static void prepare_program(struct program_file * program);
+static void * work(void * arg);
+static bool take_job(const int worker, size_t * index);
+static void run_job(struct job * job);
+static void copy_output(FILE * fp);
+static void report(const double elapsed);
+static void free_batch(void);
+static int default_workers(void);
+static double now(void);
+
+
+/*********************************************************************
+ *                                                                   *
+ * Public batch functions                                            *
+ *                                                                   *
+ *********************************************************************/
+
+/* Runs the jobs listed in a manifest, on nworkers threads, or one per
+ * processor if nworkers is zero. Returns the exit status for bbasic,
+ * which is failure if any job failed.
+ */
+int
+batch_run(const char * manifest, long nworkers) {
+    if ( !read_manifest(manifest) ) {
+        free_batch();
+        return EXIT_FAILURE;
+    }
+
+    if ( !no_cache_flag && cache_start(cache_dir, cache_size) ) {
+        for ( size_t i = 0; i < num_programs; i++ ) {
+            if ( programs[i]->source ) {
+                prepare_program(programs[i]);
+            }
+        }
+        cache_finish();
+    }
+
+    if ( nworkers == 0 ) {
+        nworkers = default_workers();
+    }
+#if !HAVE_PTHREAD_H
+    nworkers = 1;
+#endif
+    if ( (size_t) nworkers > num_jobs ) {
+        nworkers = num_jobs ? num_jobs : 1;
+    }
+    num_workers = nworkers;
+
+    /* Deal the jobs out to the workers' queues in turn */
+    queues = x_calloc(num_workers, sizeof *queues);
+    for ( int w = 0; w < num_workers; w++ ) {
+        queues[w].jobs = x_malloc((num_jobs / num_workers + 1) *
+                sizeof *queues[w].jobs);
+#if HAVE_PTHREAD_H
+        pthread_mutex_init(&queues[w].lock, NULL);
+#endif
+    }
+    for ( size_t i = 0; i < num_jobs; i++ ) {
+        struct queue * q = &queues[i % num_workers];
+        q->jobs[q->back++] = i;
+    }
+
+    const double start = now();
+
+#if HAVE_PTHREAD_H
+    struct worker * workers = x_calloc(num_workers, sizeof *workers);
+    for ( int w = 1; w < num_workers; w++ ) {
+        workers[w].index = w;
+        if ( pthread_create(&workers[w].thread, NULL, work, &workers[w]) ) {
+            fprintf(stderr, "%s: couldn't create worker thread\n", PACKAGE);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* This thread is the first worker */
+    work(&workers[0]);
+
+    for ( int w = 1; w < num_workers; w++ ) {
+        pthread_join(workers[w].thread, NULL);
+    }
+    x_free(workers);
+#else
+    struct worker worker = { 0 };
+    work(&worker);
+#endif
+
+    report(now() - start);
+
+    int status = EXIT_SUCCESS;
+    for ( size_t i = 0; i < num_jobs; i++ ) {
+        if ( jobs[i].status != 0 ) {
+            status = EXIT_FAILURE;
+        }
+    }
+
+    free_batch();
+    return status;
+}
+
+
+/*********************************************************************
+ *                                                                   *
+ * Static functions                                                  *
+ *                                                                   *
+ *********************************************************************/
+
+/* Reads the jobs from a manifest, and returns false on error */
+static bool
+read_manifest(const char * filename) {
+    FILE * fp = fopen(filename, "r");
+    if ( !fp ) {
+        fprintf(stderr, "%s: %s: %s\n", PACKAGE, filename, strerror(errno));
+        return false;
+    }
+
+    size_t capacity = 0;
+    char buffer[4096];
+    int line = 0;
+
+    while ( fgets(buffer, sizeof buffer, fp) ) {
+        line++;
+
+        char * p = buffer;
+        char * program = next_field(&p);
+        if ( !program || *program == '#' ) {
+            continue;
+        }
+        char * input = next_field(&p);
+        char * output = next_field(&p);
+
+        if ( next_field(&p) ) {
+            fprintf(stderr, "%s: %s:%d: too many fields\n",
+                    PACKAGE, filename, line);
+            fclose(fp);
+            return false;
+        }
+
+        if ( num_jobs == capacity ) {
+            capacity = capacity ? capacity * 2 : 64;
+            jobs = x_realloc(jobs, capacity * sizeof *jobs);
+        }
+
+        struct job * job = &jobs[num_jobs++];
+        memset(job, 0, sizeof *job);
+        job->line = line;
+        job->program = find_program(program);
+        if ( input && strcmp(input, "-") ) {
+            job->input = x_strdup(input);
+        }
+        if ( output && strcmp(output, "-") ) {
+            job->output = x_strdup(output);
+        }
+    }
+
+    fclose(fp);
+    return true;
+}
+
+/* Returns the next space-separated field of a manifest line, and
+ * advances p past it, or returns NULL if there are no more.
+ */
+static char *
+next_field(char ** p) {
+    char * s = *p;
+    while ( isspace((unsigned char) *s) ) {
+        s++;
+    }
+    if ( *s == '\0' ) {
+        return NULL;
+    }
+
+    char * field = s;
+    while ( *s && !isspace((unsigned char) *s) ) {
+        s++;
+    }
+    if ( *s ) {
+        *s++ = '\0';
+    }
+    *p = s;
+
+    return field;
+}
+
+/* Returns the program with a given file name, reading its source the
+ * first time it is named. A program which can't be read is still
+ * returned, so that only its own jobs fail.
+ */
+static struct program_file *
+find_program(const char * filename) {
+    for ( size_t i = 0; i < num_programs; i++ ) {
+        if ( !strcmp(programs[i]->filename, filename) ) {
+            return programs[i];
+        }
+    }
+
+    struct program_file * program = x_calloc(1, sizeof *program);
+    program->filename = x_strdup(filename);
+    program->source = cache_try_read_source(filename, &program->len,
+            &program->problem);
+
+    programs = x_realloc(programs, (num_programs + 1) * sizeof *programs);
+    programs[num_programs++] = program;
+
+    return program;
+}
+
+/* Makes sure a program has an image in the cache, parsing and storing
+ * it if it hasn't, so that its jobs can load the image. A program
+ * with a syntax error is left without one, and its jobs report the
+ * error when they parse it themselves.
+ */
+static void
+prepare_program(struct program_file * program) {
+    char * path = cache_image_path(program->source, program->len);
+
+#if HAVE_UNISTD_H
+    if ( access(path, R_OK) == 0 ) {
+        program->image = path;
+        return;
+    }
+#endif
+
+    /* The lexer scans in place, so scan a copy of the source */
+    char * buffer = x_malloc(program->len + 2);
+    memcpy(buffer, program->source, program->len + 2);
+
+    FILE * devnull = fopen("/dev/null", "w");
+    program_set_streams(NULL, NULL, devnull);
+    yy_scan_buffer(buffer, program->len + 2);
+    const int status = yyparse();
+    yylex_destroy();
+    program_set_streams(NULL, NULL, NULL);
+    if ( devnull ) {
+        fclose(devnull);
+    }
+    x_free(buffer);
+
+    if ( status == 0 ) {
+        cache_store(path);
+        program->image = path;
+    } else {
+        x_free(path);
+    }
+    runtime_free();
+}
+
+/* Runs jobs until there are none left in any queue */
+static void *
+work(void * arg) {
+    const struct worker * worker = arg;
+    size_t index;
+
+    while ( take_job(worker->index, &index) ) {
+        jobs[index].worker = worker->index;
+        run_job(&jobs[index]);
+    }
+
+    return NULL;
+}
+
+/* Takes the next job from a worker's own queue, or else steals one
+ * from another worker. Returns false if there are none left.
+ */
+static bool
+take_job(const int worker, size_t * index) {
+    for ( int i = 0; i < num_workers; i++ ) {
+        const bool own = i == 0;
+        struct queue * q = &queues[(worker + i) % num_workers];
+        bool found = false;
+
+#if HAVE_PTHREAD_H
+        pthread_mutex_lock(&q->lock);
+#endif
+        if ( q->front < q->back ) {
+            *index = own ? q->jobs[q->front++] : q->jobs[--q->back];
+            found = true;
+        }
+#if HAVE_PTHREAD_H
+        pthread_mutex_unlock(&q->lock);
+#endif
+
+        if ( found ) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Runs a job in a new VM, and records its status and time */
+static void
+run_job(struct job * job) {
+    const double start = now();
+
+    if ( !job->program->source ) {
+        job->problem = job->program->problem;
+        job->status = EXIT_FAILURE;
+        return;
+    }
+
+    FILE * in = fopen(job->input ? job->input : "/dev/null", "r");
+    if ( !in ) {
+        job->problem = "can't open input";
+        job->status = EXIT_FAILURE;
+        return;
+    }
+
+    FILE * out = job->output ? fopen(job->output, "w") : tmpfile();
+    if ( !out ) {
+        fclose(in);
+        job->problem = "can't open output";
+        job->status = EXIT_FAILURE;
+        return;
+    }
+
+    struct bbasic_vm * vm = bbasic_vm_new();
+    bbasic_vm_set_streams(vm, in, out, out);
+
+    const struct program_file * program = job->program;
+    int status = -1;
+    if ( program->image ) {
+        status = bbasic_vm_load_image(vm, program->image);
+    }
+    if ( status != 0 ) {
+        status = bbasic_vm_load(vm, program->source, program->len);
+    }
+
+    if ( status == 0 ) {
+        job->status = bbasic_vm_run(vm);
+    } else {
+        job->problem = "syntax error";
+        job->status = EXIT_FAILURE;
+    }
+    bbasic_vm_free(vm);
+
+    if ( !job->output ) {
+        copy_output(out);
+    }
+    fclose(out);
+    fclose(in);
+
+    job->seconds = now() - start;
+}
+
+/* Copies a job's collected output to standard output */
+static void
+copy_output(FILE * fp) {
+    char buffer[COPY_BUFFER_SIZE];
+    size_t n;
+
+    rewind(fp);
+#if HAVE_PTHREAD_H
+    pthread_mutex_lock(&output_lock);
+#endif
+    while ( (n = fread(buffer, 1, sizeof buffer, fp)) > 0 ) {
+        fwrite(buffer, 1, n, stdout);
+    }
+    fflush(stdout);
+#if HAVE_PTHREAD_H
+    pthread_mutex_unlock(&output_lock);
+#endif
+}
+
+/* Writes the status and time of each job, and the totals */
+static void
+report(const double elapsed) {
+    FILE * fp = stderr;
+    double busy = 0.0;
+    size_t failed = 0;
+
+    fprintf(fp, "%s: batch of %zu jobs on %d workers\n",
+            PACKAGE, num_jobs, num_workers);
+    fprintf(fp, "  %6s %6s %10s %6s  %s\n",
+            "Line", "Status", "Seconds", "Worker", "Program [input]");
+    for ( size_t i = 0; i < num_jobs; i++ ) {
+        const struct job * job = &jobs[i];
+        busy += job->seconds;
+        if ( job->status != 0 ) {
+            failed++;
+        }
+
+        fprintf(fp, "  %6d %6d %10.4f %6d  %s", job->line, job->status,
+                job->seconds, job->worker, job->program->filename);
+        if ( job->input ) {
+            fprintf(fp, " %s", job->input);
+        }
+        if ( job->problem ) {
+            fprintf(fp, " (%s)", job->problem);
+        }
+        fputc('\n', fp);
+    }
+
+    fprintf(fp, "  Jobs: %zu, failed: %zu\n", num_jobs, failed);
+    fprintf(fp, "  Elapsed: %.4f s, job time: %.4f s\n", elapsed, busy);
+    if ( elapsed > 0.0 ) {
+        fprintf(fp, "  Throughput: %.2f jobs/s, parallelism: %.2f\n",
+                num_jobs / elapsed, busy / elapsed);
+    }
+}
+
+/* Frees the jobs, programs and queues */
+static void
+free_batch(void) {
+    for ( size_t i = 0; i < num_jobs; i++ ) {
+        x_free(jobs[i].input);
+        x_free(jobs[i].output);
+    }
+    x_free(jobs);
+    jobs = NULL;
+    num_jobs = 0;
+
+    for ( size_t i = 0; i < num_programs; i++ ) {
+        x_free(programs[i]->filename);
+        x_free(programs[i]->source);
+        x_free(programs[i]->image);
+        x_free(programs[i]);
+    }
+    x_free(programs);
+    programs = NULL;
+    num_programs = 0;
+
+    for ( int w = 0; queues && w < num_workers; w++ ) {
+#if HAVE_PTHREAD_H
+        pthread_mutex_destroy(&queues[w].lock);
+#endif
+        x_free(queues[w].jobs);
+    }
+    x_free(queues);
+    queues = NULL;
+}
+
+/* Returns the number of processors online, or one if unknown */
+static int
+default_workers(void) {
+#if HAVE_UNISTD_H && defined(_SC_NPROCESSORS_ONLN)
+    const long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if ( n > 0 ) {
+        return n;
+    }
+#endif
+
+    return 1;
+}
+
+/* Returns the monotonic clock time in seconds */
+static double
+now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,78 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Public interface to libbbasic, for running BASIC programs from
+ * another program.
+ *
+ * A VM holds one loaded program and the streams it reads and writes.
+ * Separate threads may load and run programs in separate VMs at the
+ * same time. A VM may be used from any thread, but by only one
+ * thread at a time.
+ *
+ * The --profile, --recorder and --stats options of the command line
+ * interpreter have no library equivalent, and GET and INKEY always
+ * read the terminal.
+ */
+
+#ifndef PG_BBASIC_BBASIC_H
+#define PG_BBASIC_BBASIC_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* Opaque VM type */
+struct bbasic_vm;
+
+/* Creates a VM, which reads from standard input and writes to
+ * standard output and standard error until other streams are set.
+ */
+struct bbasic_vm * bbasic_vm_new(void);
+
+/* Sets the streams from which INPUT reads, to which PRINT and other
+ * statements write, and to which syntax and run time error messages
+ * are written. NULL selects the corresponding standard stream. Use
+ * open_memstream() or tmpfile() to capture output.
+ */
+void bbasic_vm_set_streams(struct bbasic_vm * vm,
+        FILE * in, FILE * out, FILE * err);
+
+/* Loads a program from len bytes of source text, replacing any
+ * program already loaded. Returns zero on success, or -1 if the
+ * program has a syntax error, which is written to the error stream.
+ */
+int bbasic_vm_load(struct bbasic_vm * vm, const char * source,
+        const size_t len);
+
+/* Loads a program from an image written by bbasic --compile,
+ * replacing any program already loaded. Returns zero on success, or
+ * -1 if the image can't be read or wasn't written by this version.
+ * Unlike loading source, this can happen on several threads at once.
+ */
+int bbasic_vm_load_image(struct bbasic_vm * vm, const char * filename);
+
+/* Runs the loaded program, and returns zero if it ran to completion,
+ * the BASIC error number if it stopped with an untrapped error, or
+ * 1 if it stopped with some other failure or no program was loaded.
+ * The program is unloaded when it finishes, so load it again to run
+ * it again.
+ */
+int bbasic_vm_run(struct bbasic_vm * vm);
+
+/* Frees a VM and any program loaded into it */
+void bbasic_vm_free(struct bbasic_vm * vm);
+
+#endif  /* PG_BBASIC_BBASIC_H */
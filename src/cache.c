@@ -0,0 +1,402 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Cache of compiled program images.
+ *
+ * When a program is run from a file, its source text is read into
+ * memory and hashed together with the interpreter version, and the
+ * hash names an image in the cache directory. If that image exists
+ * and is valid the program is loaded from it, and otherwise the
+ * source is parsed as usual and its image is stored for next time.
+ *
+ * Images are written to a temporary file and renamed into place, so
+ * programs started at the same time never see each other's partial
+ * images. After each store, the directory is trimmed back below its
+ * size limit by removing the least recently used images, and any
+ * temporary files left behind by a writer which died.
+ */
+
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if HAVE_DIRENT_H
+#include <dirent.h>
+#endif
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#if HAVE_UTIME_H
+#include <utime.h>
+#endif
+
+#include "cache.h"
+#include "image.h"
+#include "runtime.h"
+#include "tokenised.h"
+#include "util.h"
+
+/* Default size limit in megabytes */
+#define DEFAULT_SIZE (64)
+
+/* Trim to this percentage of the size limit, so that a full cache
+ * isn't trimmed again on every store.
+ */
+#define TRIM_PERCENT (75)
+
+/* Age in seconds after which a temporary file is presumed abandoned */
+#define STALE_TMP_AGE (3600)
+
+#define IMAGE_SUFFIX ".bbi"
+#define TMP_SUFFIX ".tmp"
+
+/* Problem given when a program's file can't be opened or read */
+static const char read_problem[] = "can't read program";
+
+/* A file in the cache directory, for trimming */
+struct cache_file {
+    char * path;
+    off_t size;
+    time_t mtime;
+};
+
+/* Cache directory, and its size limit in bytes */
+static char * cache_dir;
+static uint64_t size_limit;
+
+/* Static function declarations */
+static bool make_dir(char * path);
+static bool has_suffix(const char * s, const char * suffix);
+static int compare_mtime(const void * a, const void * b);
+static void trim(void);
+
+
+/*********************************************************************
+ *                                                                   *
+ * Public cache functions                                            *
+ *                                                                   *
+ *********************************************************************/
+
+/* Starts using the cache in dir, or the default directory if dir is
+ * NULL, with a size limit of size megabytes, or a default if size is
+ * zero. Returns false if there is no usable cache directory.
+ */
+bool
+cache_start(const char * dir, const long size) {
+    if ( dir ) {
+        cache_dir = x_strdup(dir);
+    } else {
+        const char * xdg = getenv("XDG_CACHE_HOME");
+        const char * home = getenv("HOME");
+        const char * base;
+        const char * sub;
+
+        if ( xdg && *xdg == '/' ) {
+            base = xdg;
+            sub = "/" PACKAGE;
+        } else if ( home && *home ) {
+            base = home;
+            sub = "/.cache/" PACKAGE;
+        } else {
+            return false;
+        }
+
+        cache_dir = x_malloc(strlen(base) + strlen(sub) + 1);
+        strcpy(cache_dir, base);
+        strcat(cache_dir, sub);
+    }
+
+    if ( !make_dir(cache_dir) ) {
+        cache_finish();
+        return false;
+    }
+
+    size_limit = (uint64_t) (size ? size : DEFAULT_SIZE) * 1024 * 1024;
+    return true;
+}
+
+/* Reads the source of a program into memory with two terminating
+ * null characters, as yy_scan_buffer() requires, and sets len to its
+ * length without them. A tokenised program is decoded into text.
+ * Exits if the program can't be read.
+ */
+char *
+cache_read_source(const char * filename, size_t * len) {
+    const char * problem;
+    char * source = cache_try_read_source(filename, len, &problem);
+    if ( !source ) {
+        if ( problem == read_problem ) {
+            perror(filename);
+        } else {
+            fprintf(stderr, "%s: %s: %s\n", PACKAGE, filename, problem);
+        }
+        exit(EXIT_FAILURE);
+    }
+
+    return source;
+}
+
+/* Reads the source of a program as cache_read_source() does, but
+ * returns NULL if it can't be read, and sets problem to say why.
+ * errno is left as the failed call set it if the file couldn't be
+ * opened or read.
+ */
+char *
+cache_try_read_source(const char * filename, size_t * len,
+        const char ** problem) {
+    FILE * fp = fopen(filename, "rb");
+    if ( !fp ) {
+        *problem = read_problem;
+        return NULL;
+    }
+
+    size_t capacity = 4096;
+    char * source = x_malloc(capacity);
+    size_t n = 0;
+
+    while ( true ) {
+        if ( capacity - n <= 2 ) {
+            capacity *= 2;
+            source = x_realloc(source, capacity);
+        }
+
+        const size_t got = fread(source + n, 1, capacity - n - 2, fp);
+        if ( got == 0 ) {
+            break;
+        }
+        n += got;
+    }
+
+    if ( ferror(fp) ) {
+        const int error = errno;
+        fclose(fp);
+        x_free(source);
+        errno = error;
+        *problem = read_problem;
+        return NULL;
+    }
+    fclose(fp);
+
+    source[n] = '\0';
+    source[n + 1] = '\0';
+    *len = n;
+
+    if ( tokenised_detect(source, n) ) {
+        char * text = tokenised_decode(source, n, len);
+        x_free(source);
+        if ( !text ) {
+            *problem = "bad tokenised program";
+            return NULL;
+        }
+
+        source = text;
+    }
+
+    return source;
+}
+
+/* Returns the path of the cached image for a program's source, which
+ * may not exist yet. The name is made of two different 64-bit hashes
+ * of the version and source, so that a collision is very unlikely.
+ */
+char *
+cache_image_path(const char * source, const size_t len) {
+    uint64_t fnv = UINT64_C(14695981039346656037);
+    uint64_t djb = 5381;
+
+    const char * parts[] = { PACKAGE_VERSION, source };
+    const size_t sizes[] = { sizeof PACKAGE_VERSION, len };
+    for ( size_t i = 0; i < 2; i++ ) {
+        for ( size_t j = 0; j < sizes[i]; j++ ) {
+            const unsigned char c = parts[i][j];
+            fnv = (fnv ^ c) * UINT64_C(1099511628211);
+            djb = djb * 33 + c;
+        }
+    }
+
+    const size_t size = strlen(cache_dir) + 40;
+    char * path = x_malloc(size);
+    snprintf(path, size, "%s/%016llx%016llx" IMAGE_SUFFIX, cache_dir,
+            (unsigned long long) fnv, (unsigned long long) djb);
+
+    return path;
+}
+
+/* Loads a program from the cache, and returns false if it isn't
+ * there or can't be loaded.
+ */
+bool
+cache_load(const char * path) {
+    if ( image_load(path, false) != STATUS_OK ) {
+        return false;
+    }
+
+    /* Mark the image as recently used */
+#if HAVE_UTIME_H
+    utime(path, NULL);
+#endif
+
+    return true;
+}
+
+/* Stores the parsed program in the cache, and trims the cache. Any
+ * failure is ignored, since the program can still be run.
+ */
+void
+cache_store(const char * path) {
+    if ( image_write(path, false) == STATUS_OK ) {
+        trim();
+    }
+}
+
+/* Stops using the cache */
+void
+cache_finish(void) {
+    x_free(cache_dir);
+    cache_dir = NULL;
+}
+
+
+/*********************************************************************
+ *                                                                   *
+ * Static functions                                                  *
+ *                                                                   *
+ *********************************************************************/
+
+/* Creates a directory and any missing parents, readable only by the
+ * user, and returns false on failure.
+ */
+static bool
+make_dir(char * path) {
+    for ( char * p = path + 1; ; p++ ) {
+        if ( *p != '/' && *p != '\0' ) {
+            continue;
+        }
+
+        const char c = *p;
+        *p = '\0';
+        const int status = mkdir(path, 0700);
+        *p = c;
+
+        if ( status == -1 && errno != EEXIST ) {
+            return false;
+        }
+
+        if ( c == '\0' ) {
+            break;
+        }
+    }
+
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/* Returns true if s ends with suffix */
+static bool
+has_suffix(const char * s, const char * suffix) {
+    const size_t n = strlen(s);
+    const size_t m = strlen(suffix);
+    return n >= m && !strcmp(s + n - m, suffix);
+}
+
+/* Compares cache files by modification time, oldest first */
+static int
+compare_mtime(const void * a, const void * b) {
+    const struct cache_file * fa = a;
+    const struct cache_file * fb = b;
+    return (fa->mtime > fb->mtime) - (fa->mtime < fb->mtime);
+}
+
+/* Removes abandoned temporary files, and if the images in the cache
+ * exceed the size limit, removes the least recently used ones until
+ * they are well within it. Another process may be trimming at the same
+ * time, so files which have already gone are ignored.
+ */
+static void
+trim(void) {
+#if HAVE_DIRENT_H
+    DIR * dir = opendir(cache_dir);
+    if ( dir == NULL ) {
+        return;
+    }
+
+    struct cache_file * files = NULL;
+    size_t num_files = 0;
+    size_t capacity = 0;
+    uint64_t total = 0;
+    const time_t now = time(NULL);
+
+    struct dirent * entry;
+    while ( (entry = readdir(dir)) != NULL ) {
+        const bool is_image = has_suffix(entry->d_name, IMAGE_SUFFIX);
+        const bool is_tmp = has_suffix(entry->d_name, TMP_SUFFIX);
+        if ( !is_image && !is_tmp ) {
+            continue;
+        }
+
+        const size_t len = strlen(cache_dir) + strlen(entry->d_name) + 2;
+        char * path = x_malloc(len);
+        snprintf(path, len, "%s/%s", cache_dir, entry->d_name);
+
+        struct stat st;
+        if ( stat(path, &st) == -1 || !S_ISREG(st.st_mode) ) {
+            x_free(path);
+            continue;
+        }
+
+        if ( is_tmp ) {
+            if ( now - st.st_mtime > STALE_TMP_AGE ) {
+                unlink(path);
+            }
+            x_free(path);
+            continue;
+        }
+
+        if ( num_files == capacity ) {
+            capacity = capacity ? capacity * 2 : 64;
+            files = x_realloc(files, capacity * sizeof *files);
+        }
+        files[num_files++] = (struct cache_file){ path, st.st_size, st.st_mtime };
+        total += st.st_size;
+    }
+    closedir(dir);
+
+    if ( total > size_limit ) {
+        const uint64_t target = size_limit / 100 * TRIM_PERCENT;
+        qsort(files, num_files, sizeof *files, compare_mtime);
+        for ( size_t i = 0; i < num_files && total > target; i++ ) {
+            unlink(files[i].path);
+            total -= files[i].size;
+        }
+    }
+
+    for ( size_t i = 0; i < num_files; i++ ) {
+        x_free(files[i].path);
+    }
+    x_free(files);
+#endif
+}
@@ -0,0 +1,34 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PG_BBASIC_INTERNAL_CACHE_H
+#define PG_BBASIC_INTERNAL_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Compiled program cache functions */
+bool cache_start(const char * dir, const long size);
+char * cache_read_source(const char * filename, size_t * len);
+char * cache_try_read_source(const char * filename, size_t * len,
+        const char ** problem);
+char * cache_image_path(const char * source, const size_t len);
+bool cache_load(const char * path);
+void cache_store(const char * path);
+void cache_finish(void);
+
+#endif  /* PG_BBASIC_INTERNAL_CACHE_H */
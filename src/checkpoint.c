@@ -0,0 +1,569 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Checkpoints of a running program, for the --checkpoint and
+ * --restore options.
+ *
+ * A checkpoint is written by a child process forked between two
+ * statements, which writes out its copy of the interpreter's memory
+ * while the interpreter carries on, so a running program only stalls
+ * for as long as the fork takes. The file has a header naming the
+ * program and holding a hash of its source, followed by the state of
+ * the runtime, the statements and the symbol table, which each save
+ * and restore their own. Numbers are stored in native byte order,
+ * strings as a length and their bytes, and statements as a line
+ * number and the statement's position in a depth-first walk of that
+ * line, since their addresses differ from run to run.
+ *
+ * An FN keeps part of its state on the C stack while it runs, so
+ * checkpoints are only taken between statements outside any FN.
+ */
+
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#if HAVE_SYS_WAIT_H
+#include <sys/types.h>
+#include <sys/wait.h>
+#define USE_FORK 1
+#endif
+
+#include "checkpoint.h"
+#include "addr_set.h"
+#include "line_map.h"
+#include "runtime.h"
+#include "statements.h"
+#include "symbols.h"
+#include "util.h"
+
+#define CHECKPOINT_MAGIC "BBASICCP"
+#define CHECKPOINT_MAGIC_SIZE (8)
+#define CHECKPOINT_VERSION (1)
+#define CHECKPOINT_BYTE_ORDER (0x01020304)
+
+/* A checkpoint being written to a file, or read from memory */
+struct checkpoint {
+    FILE * fp;
+    const unsigned char * data;
+    size_t size;
+    size_t pos;
+    bool failed;
+};
+
+/* Checkpoint request flag */
+volatile sig_atomic_t checkpoint_requested;
+
+/* Path and source hash of the running program */
+static char * program_path;
+static uint64_t program_hash;
+
+#if USE_FORK
+/* Process writing the last checkpoint, or zero */
+static pid_t writer;
+#endif
+
+/* Static function declarations */
+static bool write_checkpoint(const char * filename,
+        struct statement * resume);
+static unsigned char * read_checkpoint(const char * filename,
+        struct checkpoint * cp);
+static const char * read_header(struct checkpoint * cp, char ** path);
+static void free_program_path(void);
+static struct statement * walk_line(struct statement * s, const int line,
+        const struct statement * target, const int64_t wanted,
+        int64_t * index, struct addr_set * seen);
+
+
+/*********************************************************************
+ *                                                                   *
+ * Public checkpoint functions                                       *
+ *                                                                   *
+ *********************************************************************/
+
+/* Identifies the program being run, so that a checkpoint can only be
+ * restored into the program it was taken from. path is empty for
+ * inline input.
+ */
+void
+checkpoint_set_program(const char * path, const char * source,
+        const size_t len) {
+    char resolved[PATH_MAX];
+    if ( !program_path ) {
+        x_atexit(free_program_path);
+    }
+    x_free(program_path);
+    program_path = x_strdup(*path && realpath(path, resolved) ?
+            resolved : path);
+
+    program_hash = UINT64_C(14695981039346656037);
+    for ( size_t i = 0; i < len; i++ ) {
+        program_hash = (program_hash ^ (unsigned char) source[i]) *
+            UINT64_C(1099511628211);
+    }
+}
+
+/* Returns the path of the program a checkpoint was taken from, which
+ * the caller should free, or exits if the checkpoint can't be read.
+ */
+char *
+checkpoint_program_path(const char * filename) {
+    struct checkpoint cp;
+    unsigned char * data = read_checkpoint(filename, &cp);
+    if ( !data ) {
+        exit(EXIT_FAILURE);
+    }
+
+    char * path = NULL;
+    const char * problem = read_header(&cp, &path);
+    if ( !problem && !*path ) {
+        problem = "taken from inline input, which must be given again";
+    }
+    x_free(data);
+
+    if ( problem ) {
+        fprintf(stderr, "%s: %s: %s\n", PACKAGE, filename, problem);
+        x_free(path);
+        exit(EXIT_FAILURE);
+    }
+
+    return path;
+}
+
+/* Writes a checkpoint of the running program to filename, to resume
+ * from the statement resume. The checkpoint is written by a child
+ * process, and is skipped if the last one is still being written.
+ */
+void
+checkpoint_take(const char * filename, struct statement * resume) {
+    checkpoint_requested = 0;
+
+#if USE_FORK
+    if ( writer > 0 ) {
+        int status;
+        if ( waitpid(writer, &status, WNOHANG) == 0 ) {
+            fprintf(stderr, "%s: still writing the last checkpoint, "
+                    "skipping this one\n", PACKAGE);
+            return;
+        }
+        writer = 0;
+    }
+
+    /* The child shares the open files' offsets, so they must be
+     * recorded before the parent moves them again
+     */
+    open_files_mark();
+
+    const pid_t pid = fork();
+    if ( pid == -1 ) {
+        fprintf(stderr, "%s: couldn't write checkpoint: %s\n",
+                PACKAGE, strerror(errno));
+        return;
+    } else if ( pid == 0 ) {
+        _exit(write_checkpoint(filename, resume) ?
+                EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    writer = pid;
+#else
+    open_files_mark();
+    write_checkpoint(filename, resume);
+#endif
+}
+
+/* Restores the state of the running program from a checkpoint, after
+ * the program has been loaded and the symbol table initialized. The
+ * program then resumes from where the checkpoint was taken when it is
+ * run. Returns STATUS_OK on success, or STATUS_ERROR on failure.
+ */
+int
+checkpoint_restore(const char * filename) {
+    struct checkpoint cp;
+    unsigned char * data = read_checkpoint(filename, &cp);
+    if ( !data ) {
+        return STATUS_ERROR;
+    }
+
+    char * path = NULL;
+    const char * problem = read_header(&cp, &path);
+    if ( !problem && (uint64_t) checkpoint_get_int(&cp) != program_hash ) {
+        problem = "taken from a different program";
+    }
+
+    if ( !problem ) {
+        program_build();
+        runtime_restore(&cp);
+        statements_restore(&cp);
+        symbol_table_restore(&cp);
+
+        if ( checkpoint_failed(&cp) || cp.pos != cp.size ) {
+            problem = "couldn't restore the checkpoint";
+        }
+    }
+
+    if ( problem ) {
+        fprintf(stderr, "%s: %s: %s\n", PACKAGE, filename, problem);
+    }
+
+    x_free(path);
+    x_free(data);
+
+    return problem ? STATUS_ERROR : STATUS_OK;
+}
+
+/* Waits for any checkpoint still being written */
+void
+checkpoint_finish(void) {
+#if USE_FORK
+    while ( writer > 0 ) {
+        int status;
+        if ( waitpid(writer, &status, 0) == -1 && errno == EINTR ) {
+            continue;
+        }
+        writer = 0;
+    }
+#endif
+}
+
+/* Writes an integer to a checkpoint */
+void
+checkpoint_put_int(struct checkpoint * cp, const int64_t n) {
+    if ( fwrite(&n, sizeof n, 1, cp->fp) != 1 ) {
+        cp->failed = true;
+    }
+}
+
+/* Writes a floating point number to a checkpoint */
+void
+checkpoint_put_float(struct checkpoint * cp, const double f) {
+    if ( fwrite(&f, sizeof f, 1, cp->fp) != 1 ) {
+        cp->failed = true;
+    }
+}
+
+/* Writes a string to a checkpoint */
+void
+checkpoint_put_string(struct checkpoint * cp, const char * s) {
+    checkpoint_put_bytes(cp, s, strlen(s));
+}
+
+/* Writes len characters, which may include null characters, to a
+ * checkpoint
+ */
+void
+checkpoint_put_bytes(struct checkpoint * cp, const char * s, const size_t len) {
+    checkpoint_put_int(cp, len);
+    if ( len > 0 && fwrite(s, len, 1, cp->fp) != 1 ) {
+        cp->failed = true;
+    }
+}
+
+/* Writes a reference to a statement, which may be NULL, to a
+ * checkpoint
+ */
+void
+checkpoint_put_stmt(struct checkpoint * cp, struct statement * s) {
+    if ( !s ) {
+        checkpoint_put_int(cp, -1);
+        checkpoint_put_int(cp, 0);
+        return;
+    }
+
+    struct addr_set * seen = addr_set_new();
+    int64_t index = 0;
+    if ( !walk_line(line_map_find(s->line_number), s->line_number,
+                s, -1, &index, seen) ) {
+        cp->failed = true;
+    }
+    addr_set_free(seen);
+
+    checkpoint_put_int(cp, s->line_number);
+    checkpoint_put_int(cp, index);
+}
+
+/* Reads an integer from a checkpoint */
+int64_t
+checkpoint_get_int(struct checkpoint * cp) {
+    int64_t n = 0;
+    if ( cp->size - cp->pos < sizeof n ) {
+        cp->failed = true;
+        return 0;
+    }
+
+    memcpy(&n, cp->data + cp->pos, sizeof n);
+    cp->pos += sizeof n;
+
+    return n;
+}
+
+/* Reads a floating point number from a checkpoint */
+double
+checkpoint_get_float(struct checkpoint * cp) {
+    double f = 0.0;
+    if ( cp->size - cp->pos < sizeof f ) {
+        cp->failed = true;
+        return 0.0;
+    }
+
+    memcpy(&f, cp->data + cp->pos, sizeof f);
+    cp->pos += sizeof f;
+
+    return f;
+}
+
+/* Reads a string from a checkpoint. The caller should free the
+ * returned string, which is empty if the checkpoint is damaged.
+ */
+char *
+checkpoint_get_string(struct checkpoint * cp) {
+    size_t len;
+    return checkpoint_get_bytes(cp, &len);
+}
+
+/* Reads characters written by checkpoint_put_bytes() from a checkpoint,
+ * sets len to their number, and returns them with a terminating null
+ * character. The caller is responsible for freeing the returned string.
+ */
+char *
+checkpoint_get_bytes(struct checkpoint * cp, size_t * len) {
+    const int64_t n = checkpoint_get_int(cp);
+    if ( n < 0 || (uint64_t) n > cp->size - cp->pos ) {
+        cp->failed = true;
+        *len = 0;
+        return x_strdup("");
+    }
+
+    char * s = x_malloc(n + 1);
+    memcpy(s, cp->data + cp->pos, n);
+    s[n] = '\0';
+    cp->pos += n;
+    *len = n;
+
+    return s;
+}
+
+/* Reads a reference to a statement from a checkpoint, and returns the
+ * statement, or NULL for a NULL reference or if the statement can't
+ * be found.
+ */
+struct statement *
+checkpoint_get_stmt(struct checkpoint * cp) {
+    const int64_t line = checkpoint_get_int(cp);
+    const int64_t wanted = checkpoint_get_int(cp);
+    if ( line == -1 || cp->failed ) {
+        return NULL;
+    } else if ( line < 0 || line > INT_MAX || wanted < 0 ) {
+        cp->failed = true;
+        return NULL;
+    }
+
+    struct addr_set * seen = addr_set_new();
+    int64_t index = 0;
+    struct statement * s = walk_line(line_map_find(line), line,
+            NULL, wanted, &index, seen);
+    addr_set_free(seen);
+
+    if ( !s ) {
+        cp->failed = true;
+    }
+
+    return s;
+}
+
+/* Marks a checkpoint as failed, when it holds something which can't
+ * be restored
+ */
+void
+checkpoint_fail(struct checkpoint * cp) {
+    cp->failed = true;
+}
+
+/* Returns true if writing or reading a checkpoint has failed */
+bool
+checkpoint_failed(struct checkpoint * cp) {
+    return cp->failed;
+}
+
+
+/*********************************************************************
+ *                                                                   *
+ * Static functions                                                  *
+ *                                                                   *
+ *********************************************************************/
+
+/* Writes a checkpoint to a temporary file, and renames it to filename,
+ * so that an earlier checkpoint is only replaced by a complete one.
+ * Returns true on success.
+ */
+static bool
+write_checkpoint(const char * filename, struct statement * resume) {
+    const size_t len = strlen(filename) + 32;
+    char * tmpname = x_malloc(len);
+    snprintf(tmpname, len, "%s.%ld.tmp", filename, (long) getpid());
+
+    struct checkpoint cp = { .fp = fopen(tmpname, "wb") };
+    if ( cp.fp == NULL ) {
+        perror(tmpname);
+        x_free(tmpname);
+        return false;
+    }
+
+    cp.failed = fwrite(CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_SIZE, 1,
+            cp.fp) != 1;
+    checkpoint_put_int(&cp, CHECKPOINT_VERSION);
+    checkpoint_put_int(&cp, CHECKPOINT_BYTE_ORDER);
+    checkpoint_put_string(&cp, PACKAGE_VERSION);
+    checkpoint_put_string(&cp, program_path ? program_path : "");
+    checkpoint_put_int(&cp, (int64_t) program_hash);
+
+    runtime_save(&cp, resume);
+    statements_save(&cp);
+    symbol_table_save(&cp);
+
+    bool ok = !cp.failed && fflush(cp.fp) == 0 && fsync(fileno(cp.fp)) == 0;
+    if ( fclose(cp.fp) != 0 ) {
+        ok = false;
+    }
+
+    if ( !ok || rename(tmpname, filename) != 0 ) {
+        fprintf(stderr, "%s: couldn't write checkpoint %s\n",
+                PACKAGE, filename);
+        remove(tmpname);
+        x_free(tmpname);
+        return false;
+    }
+
+    x_free(tmpname);
+    return true;
+}
+
+/* Reads a checkpoint file into memory, and sets up cp to read from it.
+ * Returns the contents, which the caller should free, or NULL after
+ * printing an error message.
+ */
+static unsigned char *
+read_checkpoint(const char * filename, struct checkpoint * cp) {
+    FILE * fp = fopen(filename, "rb");
+    if ( fp == NULL ) {
+        perror(filename);
+        return NULL;
+    }
+
+    size_t capacity = 4096;
+    unsigned char * data = x_malloc(capacity);
+    size_t n = 0;
+    size_t got;
+    while ( (got = fread(data + n, 1, capacity - n, fp)) > 0 ) {
+        n += got;
+        if ( n == capacity ) {
+            capacity *= 2;
+            data = x_realloc(data, capacity);
+        }
+    }
+
+    const bool ok = !ferror(fp);
+    fclose(fp);
+    if ( !ok ) {
+        perror(filename);
+        x_free(data);
+        return NULL;
+    }
+
+    *cp = (struct checkpoint) { .data = data, .size = n };
+
+    return data;
+}
+
+/* Reads and checks a checkpoint header, up to the source hash, and
+ * sets *path to the program path, which the caller should free.
+ * Returns NULL if the header is valid, or a description of the
+ * problem.
+ */
+static const char *
+read_header(struct checkpoint * cp, char ** path) {
+    if ( cp->size < CHECKPOINT_MAGIC_SIZE ||
+            memcmp(cp->data, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_SIZE) ) {
+        return "not a checkpoint";
+    }
+    cp->pos = CHECKPOINT_MAGIC_SIZE;
+
+    const int64_t version = checkpoint_get_int(cp);
+    const int64_t byte_order = checkpoint_get_int(cp);
+    char * package_version = checkpoint_get_string(cp);
+    const bool same = version == CHECKPOINT_VERSION &&
+        byte_order == CHECKPOINT_BYTE_ORDER &&
+        !strcmp(package_version, PACKAGE_VERSION);
+    x_free(package_version);
+
+    if ( cp->failed ) {
+        return "checkpoint is damaged";
+    } else if ( !same ) {
+        return "checkpoint taken by a different version of " PACKAGE;
+    }
+
+    *path = checkpoint_get_string(cp);
+
+    return cp->failed ? "checkpoint is damaged" : NULL;
+}
+
+/* Frees the program path at exit */
+static void
+free_program_path(void) {
+    x_free(program_path);
+    program_path = NULL;
+}
+
+/* Walks the statements on a line depth first, each statement's
+ * sub-statements before the statements which follow it, counting
+ * them in *index. Returns the statement which is target, or which is
+ * at position wanted, or NULL if there is none.
+ */
+static struct statement *
+walk_line(struct statement * s, const int line,
+        const struct statement * target, const int64_t wanted,
+        int64_t * index, struct addr_set * seen) {
+    while ( s && s->line_number == line && !addr_set_is_member(seen, s) ) {
+        if ( s == target || *index == wanted ) {
+            return s;
+        }
+
+        addr_set_add(seen, s);
+        (*index)++;
+
+        for ( size_t i = 0; i < STMT_NUM_STMTS; i++ ) {
+            struct statement * found = walk_line(s->stmt[i], line,
+                    target, wanted, index, seen);
+            if ( found ) {
+                return found;
+            }
+        }
+
+        s = s->next;
+    }
+
+    return NULL;
+}
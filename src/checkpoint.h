@@ -0,0 +1,58 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PG_BBASIC_INTERNAL_CHECKPOINT_H
+#define PG_BBASIC_INTERNAL_CHECKPOINT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <signal.h>
+
+/* Opaque and incomplete struct definitions */
+struct checkpoint;
+struct statement;
+
+/* Checkpoint request flag */
+extern volatile sig_atomic_t checkpoint_requested;
+
+/* Checkpoint functions */
+void checkpoint_set_program(const char * path, const char * source,
+        const size_t len);
+char * checkpoint_program_path(const char * filename);
+void checkpoint_take(const char * filename, struct statement * resume);
+int checkpoint_restore(const char * filename);
+void checkpoint_finish(void);
+
+/* Checkpoint serialization functions, for the runtime, statements and
+ * symbol table to save and restore their own state
+ */
+void checkpoint_put_int(struct checkpoint * cp, const int64_t n);
+void checkpoint_put_float(struct checkpoint * cp, const double f);
+void checkpoint_put_string(struct checkpoint * cp, const char * s);
+void checkpoint_put_bytes(struct checkpoint * cp, const char * s,
+        const size_t len);
+void checkpoint_put_stmt(struct checkpoint * cp, struct statement * s);
+int64_t checkpoint_get_int(struct checkpoint * cp);
+double checkpoint_get_float(struct checkpoint * cp);
+char * checkpoint_get_string(struct checkpoint * cp);
+char * checkpoint_get_bytes(struct checkpoint * cp, size_t * len);
+struct statement * checkpoint_get_stmt(struct checkpoint * cp);
+void checkpoint_fail(struct checkpoint * cp);
+bool checkpoint_failed(struct checkpoint * cp);
+
+#endif  /* PG_BBASIC_INTERNAL_CHECKPOINT_H */
@@ -25,6 +25,7 @@
 #include "data_map.h"
 #include "hash.h"
 #include "runtime.h"
+#include "stats.h"
 #include "util.h"
 
 #define NUM_BUCKETS (257)
@@ -37,7 +38,7 @@ struct entry {
 };
 
 /* The data map */
-static struct table {
+static THREAD_LOCAL struct table {
     struct entry * buckets[NUM_BUCKETS];
 } table;
 
@@ -64,7 +65,7 @@ data_map_add(const int line, struct value * data) {
             if ( current->line == ref->line ) {
                 /* There is a duplicate line number */
                 error_set(ERR_BAD_PROGRAM);
-                free(ref);
+                x_free(ref);
                 data_map_free();
                 return STATUS_ERROR;
             }
@@ -86,6 +87,10 @@ struct value *
 data_map_find(const int line) {
     struct value * data = NULL;
 
+    if ( stats_active ) {
+        stats_line_lookups++;
+    }
+
     const size_t hash = int_hash(line, NUM_BUCKETS);
     struct entry * current = table.buckets[hash];
     while ( current ) {
@@ -111,7 +116,7 @@ data_map_free(void) {
             struct entry * current = table.buckets[i];
             while ( current ) {
                 struct entry * tmp = current->next;
-                free(current);
+                x_free(current);
                 current = tmp;
             }
             table.buckets[i] = NULL; /* So we could reuse it */
@@ -0,0 +1,539 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Program editing, for interactive mode and --watch.
+ *
+ * The text of each program line is kept, for listing and saving the
+ * program and for finding which lines a new version of it changes.
+ * A line which is entered, replaced or deleted is parsed on its own,
+ * and linked into the built program between the lines either side of
+ * it, so that changing a few lines of a large program doesn't parse or
+ * build the rest of it again. The procedures are defined afresh from
+ * the built lines each time the program runs.
+ *
+ * DATA items are gathered into one list, in line order, as lines are
+ * built. When a line with DATA changes, the list is gathered again
+ * before the program next runs, by parsing just the lines with DATA.
+ */
+
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "edit.h"
+#include "runtime.h"
+#include "statements.h"
+#include "tokenised.h"
+#include "yydecls.h"
+#include "util.h"
+
+/* A program line as it was entered, including its line number */
+struct text_line {
+    int number;
+    char * text;
+};
+
+/* A list of program lines, sorted by line number */
+struct text_list {
+    struct text_line * lines;
+    size_t count;
+    size_t capacity;
+};
+
+/* The program being edited */
+static struct text_list program;
+
+/* Whether a line with DATA has changed since the program last ran */
+static bool data_changed;
+
+/* Static function declarations */
+static int compare_lines(const void * a, const void * b);
+static bool has_data(const char * text);
+static bool parse_line(const int number, const char * text);
+static char * read_file(const char * filename, size_t * len);
+static void remove_line(const int number, const char * old);
+static bool replace_line(const int number, const char * old,
+        const char * text);
+static void split_lines(const char * source, struct text_list * list);
+static void text_append(struct text_list * list, const int number,
+        char * text);
+static void text_free(struct text_list * list);
+static size_t text_index(const int number);
+
+
+/*********************************************************************
+ *                                                                   *
+ * Public program editing functions                                  *
+ *                                                                   *
+ *********************************************************************/
+
+/* Deletes the program lines from from to to */
+void
+edit_delete(const int from, const int to) {
+    const size_t first = text_index(from);
+    size_t last = first;
+    while ( last < program.count && program.lines[last].number <= to ) {
+        remove_line(program.lines[last].number, program.lines[last].text);
+        x_free(program.lines[last].text);
+        last++;
+    }
+
+    memmove(program.lines + first, program.lines + last,
+            (program.count - last) * sizeof *program.lines);
+    program.count -= last - first;
+}
+
+/* Checks whether the program has no lines */
+bool
+edit_empty(void) {
+    return program.count == 0;
+}
+
+/* Frees the program */
+void
+edit_free(void) {
+    runtime_free();
+    text_free(&program);
+    data_changed = false;
+}
+
+/* Enters a program line, replacing any line with the same number. The
+ * text starts with the line number. A line which doesn't parse is
+ * reported, leaves the program as it was, and returns false.
+ */
+bool
+edit_line(const int number, const char * text) {
+    const size_t i = text_index(number);
+    const bool replacing = i < program.count &&
+        program.lines[i].number == number;
+
+    if ( !replace_line(number, replacing ? program.lines[i].text : NULL,
+                text) ) {
+        return false;
+    }
+
+    if ( replacing ) {
+        x_free(program.lines[i].text);
+        program.lines[i].text = x_strdup(text);
+        return true;
+    }
+
+    /* Append the line to make room, then move it into place */
+    text_append(&program, number, x_strdup(text));
+    const struct text_line added = program.lines[program.count - 1];
+    memmove(program.lines + i + 1, program.lines + i,
+            (program.count - i - 1) * sizeof *program.lines);
+    program.lines[i] = added;
+
+    return true;
+}
+
+/* Writes the program lines from from to to */
+void
+edit_list(FILE * fp, const int from, const int to) {
+    for ( size_t i = text_index(from);
+            i < program.count && program.lines[i].number <= to; i++ ) {
+        fprintf(fp, "%s\n", program.lines[i].text);
+    }
+}
+
+/* Replaces the program with the one in a file, parsing only the lines
+ * which differ, and sets changed to the number of lines parsed.
+ * Returns false if the file can't be read.
+ */
+bool
+edit_load(const char * filename, size_t * changed) {
+    size_t len;
+    char * source = read_file(filename, &len);
+    if ( !source ) {
+        fprintf(program_err(), "%s: couldn't read %s: %s\n", PACKAGE,
+                filename, strerror(errno));
+        return false;
+    }
+
+    if ( tokenised_detect(source, len) ) {
+        char * text = tokenised_decode(source, len, &len);
+        x_free(source);
+        if ( !text ) {
+            fprintf(program_err(), "%s: %s: bad tokenised program\n",
+                    PACKAGE, filename);
+            return false;
+        }
+        source = text;
+    }
+
+    *changed = edit_replace(source);
+    x_free(source);
+
+    return true;
+}
+
+/* Makes the program ready to run, gathering its DATA items again if
+ * any line with DATA has changed
+ */
+void
+edit_prepare(void) {
+    if ( !data_changed ) {
+        return;
+    }
+    data_changed = false;
+
+    statements_free_data();
+    for ( size_t i = 0; i < program.count; i++ ) {
+        if ( has_data(program.lines[i].text) ) {
+            line_delete(program.lines[i].number);
+            parse_line(program.lines[i].number, program.lines[i].text);
+        }
+    }
+    reset_data_pointer();
+}
+
+/* Replaces the program with the one in source, parsing only the lines
+ * which differ, and returns the number of lines parsed. Lines which
+ * don't parse are reported, and leave any line they would replace.
+ */
+size_t
+edit_replace(const char * source) {
+    struct text_list next = { NULL, 0, 0 };
+    struct text_list merged = { NULL, 0, 0 };
+    split_lines(source, &next);
+
+    size_t i = 0;
+    size_t j = 0;
+    size_t parsed = 0;
+    while ( i < program.count || j < next.count ) {
+        struct text_line * old = i < program.count ?
+            &program.lines[i] : NULL;
+        struct text_line * new = j < next.count ? &next.lines[j] : NULL;
+
+        if ( old && (!new || old->number < new->number) ) {
+            /* The line has gone */
+            remove_line(old->number, old->text);
+            x_free(old->text);
+            i++;
+        } else if ( !old || new->number < old->number ) {
+            /* The line is new */
+            if ( replace_line(new->number, NULL, new->text) ) {
+                text_append(&merged, new->number, new->text);
+                parsed++;
+            } else {
+                x_free(new->text);
+            }
+            j++;
+        } else {
+            /* The line is the same, or has changed */
+            if ( strcmp(old->text, new->text) &&
+                    replace_line(new->number, old->text, new->text) ) {
+                text_append(&merged, new->number, new->text);
+                x_free(old->text);
+                parsed++;
+            } else {
+                text_append(&merged, old->number, old->text);
+                x_free(new->text);
+            }
+            i++;
+            j++;
+        }
+    }
+
+    x_free(program.lines);
+    x_free(next.lines);
+    program = merged;
+
+    return parsed;
+}
+
+/* Writes the program to a file */
+bool
+edit_save(const char * filename) {
+    FILE * fp = fopen(filename, "w");
+    if ( !fp ) {
+        fprintf(program_err(), "%s: couldn't open %s: %s\n", PACKAGE,
+                filename, strerror(errno));
+        return false;
+    }
+
+    edit_list(fp, 0, INT_MAX);
+
+    if ( fclose(fp) != 0 ) {
+        fprintf(program_err(), "%s: couldn't write %s: %s\n", PACKAGE,
+                filename, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/* Returns the text of the program */
+char *
+edit_source(void) {
+    size_t len = 0;
+    for ( size_t i = 0; i < program.count; i++ ) {
+        len += strlen(program.lines[i].text) + 1;
+    }
+
+    char * source = x_malloc(len + 1);
+    char * p = source;
+    for ( size_t i = 0; i < program.count; i++ ) {
+        const size_t n = strlen(program.lines[i].text);
+        memcpy(p, program.lines[i].text, n);
+        p[n] = '\n';
+        p += n + 1;
+    }
+    *p = '\0';
+
+    return source;
+}
+
+
+/*********************************************************************
+ *                                                                   *
+ * Static functions                                                  *
+ *                                                                   *
+ *********************************************************************/
+
+/* Compares two program lines by line number, for qsort() */
+static int
+compare_lines(const void * a, const void * b) {
+    const struct text_line * first = a;
+    const struct text_line * second = b;
+
+    return (first->number > second->number) -
+        (first->number < second->number);
+}
+
+/* Checks whether a line might contain DATA. A false positive, such as
+ * the word in a string, just means the line is parsed again.
+ */
+static bool
+has_data(const char * text) {
+    return strstr(text, "DATA") != NULL;
+}
+
+/* Parses a program line and adds it to the program, linking it in if
+ * the program has been built. Returns false on a syntax error.
+ */
+static bool
+parse_line(const int number, const char * text) {
+    /* lex expects a doubly null-terminated string. The line is ended
+     * with a newline, so that the lexer isn't left inside DATA.
+     */
+    const size_t len = strlen(text);
+    char * source = x_calloc(len + 3, 1);
+    memcpy(source, text, len);
+    source[len] = '\n';
+
+    yylineno = number;
+    YY_BUFFER_STATE buffer = yy_scan_buffer(source, len + 3);
+    const int status = yyparse();
+    yy_delete_buffer(buffer);
+    x_free(source);
+
+    if ( status != 0 ) {
+        return false;
+    }
+
+    line_link(number);
+    return true;
+}
+
+/* Reads a file into memory and sets len to its length, returning NULL
+ * and leaving errno set if it can't be read
+ */
+static char *
+read_file(const char * filename, size_t * len) {
+    FILE * fp = fopen(filename, "rb");
+    if ( !fp ) {
+        return NULL;
+    }
+
+    size_t capacity = 4096;
+    size_t n = 0;
+    char * source = x_malloc(capacity);
+    size_t got;
+    while ( (got = fread(source + n, 1, capacity - n - 1, fp)) > 0 ) {
+        n += got;
+        if ( capacity - n <= 1 ) {
+            capacity *= 2;
+            source = x_realloc(source, capacity);
+        }
+    }
+
+    const int error = ferror(fp) ? errno : 0;
+    fclose(fp);
+    if ( error ) {
+        x_free(source);
+        errno = error;
+        return NULL;
+    }
+
+    source[n] = '\0';
+    *len = n;
+
+    return source;
+}
+
+/* Removes a line, whose text was old, from the program */
+static void
+remove_line(const int number, const char * old) {
+    if ( has_data(old) ) {
+        data_changed = true;
+    }
+
+    line_delete(number);
+}
+
+/* Parses the text of a line, replacing the line whose text was old if
+ * it isn't NULL. Returns false if the text doesn't parse, leaving the
+ * old line in place.
+ */
+static bool
+replace_line(const int number, const char * old, const char * text) {
+    if ( has_data(text) || (old && has_data(old)) ) {
+        data_changed = true;
+    }
+
+    if ( old ) {
+        line_delete(number);
+    }
+
+    if ( parse_line(number, text) ) {
+        return true;
+    }
+
+    if ( old ) {
+        parse_line(number, old);
+    }
+
+    return false;
+}
+
+/* Splits the source of a program into a list of lines sorted by line
+ * number. Lines without a line number are reported and left out, as
+ * are all but one of any lines with the same number.
+ */
+static void
+split_lines(const char * source, struct text_list * list) {
+    bool sorted = true;
+    const char * s = source;
+    while ( *s ) {
+        const char * end = strchr(s, '\n');
+        const char * next = end ? end + 1 : s + strlen(s);
+        if ( !end ) {
+            end = next;
+        }
+        if ( end > s && end[-1] == '\r' ) {
+            end--;
+        }
+
+        while ( s < end && isspace((unsigned char) *s) ) {
+            s++;
+        }
+
+        char * text = x_malloc(end - s + 1);
+        memcpy(text, s, end - s);
+        text[end - s] = '\0';
+        s = next;
+
+        char * p;
+        errno = 0;
+        const long number = strtol(text, &p, 10);
+        if ( !isdigit((unsigned char) *text) || errno ||
+                number <= 0 || number > INT_MAX ) {
+            if ( *text ) {
+                fprintf(program_err(), "%s: no line number: %s\n",
+                        PACKAGE, text);
+            }
+            x_free(text);
+            continue;
+        }
+
+        if ( list->count > 0 &&
+                number <= list->lines[list->count - 1].number ) {
+            sorted = false;
+        }
+        text_append(list, number, text);
+    }
+
+    if ( sorted ) {
+        return;
+    }
+
+    qsort(list->lines, list->count, sizeof *list->lines, compare_lines);
+
+    size_t kept = 0;
+    for ( size_t i = 0; i < list->count; i++ ) {
+        if ( kept > 0 &&
+                list->lines[i].number == list->lines[kept - 1].number ) {
+            fprintf(program_err(), "%s: duplicate line %d\n", PACKAGE,
+                    list->lines[i].number);
+            x_free(list->lines[i].text);
+        } else {
+            list->lines[kept++] = list->lines[i];
+        }
+    }
+    list->count = kept;
+}
+
+/* Appends a line to a list of lines, taking ownership of its text */
+static void
+text_append(struct text_list * list, const int number, char * text) {
+    if ( list->count == list->capacity ) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->lines = x_realloc(list->lines,
+                list->capacity * sizeof *list->lines);
+    }
+
+    list->lines[list->count].number = number;
+    list->lines[list->count].text = text;
+    list->count++;
+}
+
+/* Frees a list of program lines */
+static void
+text_free(struct text_list * list) {
+    for ( size_t i = 0; i < list->count; i++ ) {
+        x_free(list->lines[i].text);
+    }
+    x_free(list->lines);
+    *list = (struct text_list) { NULL, 0, 0 };
+}
+
+/* Returns the index of the first program line numbered number or
+ * higher, or the number of lines if there isn't one
+ */
+static size_t
+text_index(const int number) {
+    size_t low = 0;
+    size_t high = program.count;
+    while ( low < high ) {
+        const size_t mid = low + (high - low) / 2;
+        if ( program.lines[mid].number < number ) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
@@ -0,0 +1,37 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PG_BBASIC_INTERNAL_EDIT_H
+#define PG_BBASIC_INTERNAL_EDIT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Program editing functions */
+void edit_delete(const int from, const int to);
+bool edit_empty(void);
+void edit_free(void);
+bool edit_line(const int number, const char * text);
+void edit_list(FILE * fp, const int from, const int to);
+bool edit_load(const char * filename, size_t * changed);
+void edit_prepare(void);
+size_t edit_replace(const char * source);
+bool edit_save(const char * filename);
+char * edit_source(void);
+
+#endif  /* PG_BBASIC_INTERNAL_EDIT_H */
@@ -26,8 +26,19 @@
 #include "expr_internal.h"
 #include "value.h"
 #include "runtime.h"
+#include "stats.h"
 #include "util.h"
 
+/* Evaluation function tables */
+static const expr_eval_function * const eval_tables[] = {
+    expr_value_evals, expr_fn_evals, expr_ops_evals, expr_builtin_evals
+};
+
+#define NUM_EVAL_TABLES (sizeof eval_tables / sizeof eval_tables[0])
+
+/* Static function declarations */
+static expr_eval_function type_eval(const int type);
+
 /* Appends tail to head, and returns head. If head is NULL,
  * tail is returned.
  */
@@ -54,6 +65,10 @@ expr_eval(struct expr * e) {
         ABORT("expression has no eval method");
     }
 
+    if ( stats_active ) {
+        stats_exprs[e->type]++;
+    }
+
     return e->eval(e);
 }
 
@@ -88,7 +103,31 @@ expr_free(struct expr * e) {
         expr_free(e->next);
     }
 
-    free(e);
+    x_free(e);
+}
+
+/* Constructs an expression of a given type with the evaluation
+ * function for that type, for loading compiled programs. Returns NULL
+ * if the type is out of range.
+ */
+struct expr *
+expr_compiled_new(const int type) {
+    const expr_eval_function eval = type_eval(type);
+    if ( !eval ) {
+        return NULL;
+    }
+
+    struct expr * e = expr_new(type);
+    e->eval = eval;
+    return e;
+}
+
+/* Returns true if an expression has the evaluation function for its
+ * type, so that expr_compiled_new() can recreate it.
+ */
+bool
+expr_is_compilable(const struct expr * e) {
+    return e->eval && e->eval == type_eval(e->type);
 }
 
 /* Base constructor for an empty expression */
@@ -106,3 +145,21 @@ expr_new(enum expr_type t) {
 
     return e;
 }
+
+/* Returns the evaluation function for an expression type, or NULL if
+ * the type is out of range.
+ */
+static expr_eval_function
+type_eval(const int type) {
+    if ( type < 1 || type >= EXPR_NUM_TYPES ) {
+        return NULL;
+    }
+
+    for ( size_t i = 0; i < NUM_EVAL_TABLES; i++ ) {
+        if ( eval_tables[i][type] ) {
+            return eval_tables[i][type];
+        }
+    }
+
+    return NULL;
+}
@@ -49,6 +49,8 @@
 
 #include "expr_internal.h"
 #include "value.h"
+#include "num_format.h"
+#include "num_parse.h"
 #include "runtime.h"
 #include "symbols.h"
 #include "rand.h"
@@ -82,6 +84,7 @@ static struct value * expr_eval_func_exp(struct expr * e);
 static struct value * expr_eval_func_ext(struct expr * e);
 static struct value * expr_eval_func_get(struct expr * e);
 static struct value * expr_eval_func_gets(struct expr * e);
+static struct value * expr_eval_func_getsf(struct expr * e);
 static struct value * expr_eval_func_inkey(struct expr * e);
 static struct value * expr_eval_func_inkeys(struct expr * e);
 static struct value * expr_eval_func_instr(struct expr * e);
@@ -107,6 +110,51 @@ static struct value * expr_eval_func_strs(struct expr * e);
 static struct value * expr_eval_func_tan(struct expr * e);
 static struct value * expr_eval_func_val(struct expr * e);
 
+/* Builtin function evaluators for compiled programs */
+const expr_eval_function expr_builtin_evals[EXPR_NUM_TYPES] = {
+    [EXPR_FUNC_ABS] = expr_eval_func_abs,
+    [EXPR_FUNC_ACS] = expr_eval_func_acs,
+    [EXPR_FUNC_ASC] = expr_eval_func_asc,
+    [EXPR_FUNC_ASN] = expr_eval_func_asn,
+    [EXPR_FUNC_ATN] = expr_eval_func_atn,
+    [EXPR_FUNC_BGET] = expr_eval_func_bget,
+    [EXPR_FUNC_CHRS] = expr_eval_func_chrs,
+    [EXPR_FUNC_COS] = expr_eval_func_cos,
+    [EXPR_FUNC_DEG] = expr_eval_func_deg,
+    [EXPR_FUNC_EOF] = expr_eval_func_eof,
+    [EXPR_FUNC_ERL] = expr_eval_func_erl,
+    [EXPR_FUNC_ERR] = expr_eval_func_err,
+    [EXPR_FUNC_EXP] = expr_eval_func_exp,
+    [EXPR_FUNC_EXT] = expr_eval_func_ext,
+    [EXPR_FUNC_GET] = expr_eval_func_get,
+    [EXPR_FUNC_GETS] = expr_eval_func_gets,
+    [EXPR_FUNC_GETSF] = expr_eval_func_getsf,
+    [EXPR_FUNC_INKEY] = expr_eval_func_inkey,
+    [EXPR_FUNC_INKEYS] = expr_eval_func_inkeys,
+    [EXPR_FUNC_INSTR] = expr_eval_func_instr,
+    [EXPR_FUNC_INT] = expr_eval_func_int,
+    [EXPR_FUNC_LEFTS] = expr_eval_func_lefts,
+    [EXPR_FUNC_LEN] = expr_eval_func_len,
+    [EXPR_FUNC_LN] = expr_eval_func_ln,
+    [EXPR_FUNC_LOG] = expr_eval_func_log,
+    [EXPR_FUNC_MIDS] = expr_eval_func_mids,
+    [EXPR_FUNC_OPENIN] = expr_eval_func_openin,
+    [EXPR_FUNC_OPENOUT] = expr_eval_func_openout,
+    [EXPR_FUNC_OPENUP] = expr_eval_func_openup,
+    [EXPR_FUNC_PTR] = expr_eval_func_ptr,
+    [EXPR_FUNC_RAD] = expr_eval_func_rad,
+    [EXPR_FUNC_RIGHTS] = expr_eval_func_rights,
+    [EXPR_FUNC_RND] = expr_eval_func_rnd,
+    [EXPR_FUNC_SGN] = expr_eval_func_sgn,
+    [EXPR_FUNC_SIN] = expr_eval_func_sin,
+    [EXPR_FUNC_SPC] = expr_eval_func_spc,
+    [EXPR_FUNC_SQR] = expr_eval_func_sqr,
+    [EXPR_FUNC_STRINGS] = expr_eval_func_strings,
+    [EXPR_FUNC_STRS] = expr_eval_func_strs,
+    [EXPR_FUNC_TAN] = expr_eval_func_tan,
+    [EXPR_FUNC_VAL] = expr_eval_func_val
+};
+
 
 /*********************************************************************
  *                                                                   *
@@ -242,6 +290,16 @@ expr_func_gets_new(void) {
     return expr;
 }
 
+/* Creates a new GET$# built-in function. If n is not NULL, the
+ * function reads up to n bytes rather than a line.
+ */
+struct expr *
+expr_func_getsf_new(struct expr * c, struct expr * n) {
+    struct expr * expr = expr_func_binary_new(c, n, EXPR_FUNC_GETSF);
+    expr->eval = expr_eval_func_getsf;
+    return expr;
+}
+
 /* Creates a new INKEY built-in function */
 struct expr *
 expr_func_inkey_new(struct expr * e) {
@@ -472,6 +530,7 @@ expr_is_builtin(struct expr * e) {
         case EXPR_FUNC_EXT:
         case EXPR_FUNC_GET:
         case EXPR_FUNC_GETS:
+        case EXPR_FUNC_GETSF:
         case EXPR_FUNC_INKEY:
         case EXPR_FUNC_INKEYS:
         case EXPR_FUNC_INSTR:
@@ -628,8 +687,8 @@ expr_eval_func_asc(struct expr * e) {
         return NULL;
     }
 
-    const char * s = value_string_peek(v);
-    struct value * result = value_int_new(s[0] ? s[0] : -1);
+    const unsigned char * s = (unsigned char *) value_string_peek(v);
+    struct value * result = value_int_new(value_string_len(v) ? s[0] : -1);
     value_free(v);
 
     return result;
@@ -709,9 +768,8 @@ expr_eval_func_bget(struct expr * e) {
     }
 
     unsigned char in;
-    int status = read(fd, &in, 1);
-    if ( status == -1 ) {
-        error_set(ERR_CHANNEL);
+    const ssize_t status = open_file_read(fd, &in, 1);
+    if ( status == STATUS_ERROR ) {
         return NULL;
     } else if ( status == 0 ) {
         error_set(ERR_EOF);
@@ -735,7 +793,7 @@ expr_eval_func_chrs(struct expr * e) {
         return NULL;
     }
 
-    struct value * result = value_string_new((char[]){value_int(v), 0});
+    struct value * result = value_string_new_len((char[]){value_int(v)}, 1);
     value_free(v);
 
     return result;
@@ -843,8 +901,11 @@ expr_eval_func_eof(struct expr * e) {
         return NULL;
     }
 
-    /* Compare offset to size and return appropriate boolean value */
-    return value_int_new(pos == statbuf.st_size ? -1 : 0);
+    /* Compare offset to size and return appropriate boolean value,
+     * allowing for any input we've read ahead but not yet consumed
+     */
+    const off_t consumed = pos - (off_t) open_file_buffered(fd);
+    return value_int_new(consumed == statbuf.st_size ? -1 : 0);
 }
 
 /* Evaluates an ERL built-in function */
@@ -958,6 +1019,60 @@ expr_eval_func_gets(struct expr * e) {
     return value_string_new((char[]){c, 0});
 }
 
+/* Evaluates a GET$# built-in function */
+static struct value *
+expr_eval_func_getsf(struct expr * e) {
+    struct value * c = expr_eval(e->subs[0]);
+    if ( !c ) {
+        return NULL;
+    } else if ( !value_is_int(c) ) {
+        value_free(c);
+        error_set(ERR_TYPE_MISMATCH);
+        return NULL;
+    }
+
+    const int fd = value_int(c);
+    value_free(c);
+
+    /* Disallow operations on stdin, stdout and stderr */
+    if ( fd < 3 ) {
+        error_set(ERR_CHANNEL);
+        return NULL;
+    }
+
+    char * str;
+    size_t len;
+    if ( e->subs[1] ) {
+        /* GET$# BY, so read a block of bytes */
+        struct value * n = expr_eval(e->subs[1]);
+        if ( !n ) {
+            return NULL;
+        } else if ( !value_is_numeric(n) ) {
+            value_free(n);
+            error_set(ERR_TYPE_MISMATCH);
+            return NULL;
+        }
+
+        /* Negative counts read nothing */
+        const int32_t nb = value_int(n);
+        value_free(n);
+
+        str = open_file_read_bytes(fd, nb > 0 ? nb : 0, &len);
+    } else {
+        str = open_file_read_line(fd);
+        len = str ? strlen(str) : 0;
+    }
+
+    if ( !str ) {
+        return NULL;
+    }
+
+    struct value * result = value_string_new_len(str, len);
+    x_free(str);
+
+    return result;
+}
+
 /* Evaluates an INKEY built-in function */
 static struct value *
 expr_eval_func_inkey(struct expr * e) {
@@ -1042,21 +1157,39 @@ expr_eval_func_instr(struct expr * e) {
     start = start ? start - 1 : 0;
     const char * h = value_string_peek(hval);
     const char * n = value_string_peek(nval);
+    const size_t hlen = value_string_len(hval);
+    const size_t nlen = value_string_len(nval);
 
     value_free(sval);
 
     struct value * result = NULL;
 
-    if ( strlen(n) == 0 ) {
+    if ( nlen == 0 ) {
         /* Always return 1 if the needle is the empty string */
         result = value_int_new(1);
-    } else if ( start >= strlen(h) ) {
+    } else if ( start >= hlen ) {
         /* Start index is past the end of the string */
         result = value_int_new(0);
     } else {
-        /* Defer the rest to strstr */
-        char * s = strstr(h + start, n);
-        result = value_int_new(s ? s - h + 1 : 0);
+        /* Strings may contain null characters, so look for each
+         * occurrence of the first character of the needle, and
+         * compare the rest from there.
+         */
+        size_t found = 0;
+        size_t i = start;
+        while ( !found && i + nlen <= hlen ) {
+            const char * p = memchr(h + i, n[0], hlen - nlen - i + 1);
+            if ( !p ) {
+                break;
+            }
+
+            i = p - h;
+            if ( !memcmp(p, n, nlen) ) {
+                found = i + 1;
+            }
+            i++;
+        }
+        result = value_int_new(found);
     }
 
     value_free(hval);
@@ -1106,20 +1239,16 @@ expr_eval_func_lefts(struct expr * e) {
         return NULL;
     }
 
-    char * s = value_string(sval);
+    const size_t l = value_string_len(sval);
     const size_t n = value_int(nval);
 
+    /* Shorten the string if necessary */
+    struct value * result = value_string_new_len(value_string_peek(sval),
+            n < l ? n : l);
+
     value_free(sval);
     value_free(nval);
 
-    if ( n < strlen(s) ) {
-        /* Shorten the string if necessary */
-        s[n] = '\0';
-    }
-
-    struct value * result = value_string_new(s);
-    free(s);
-
     return result;
 }
 
@@ -1137,7 +1266,7 @@ expr_eval_func_len(struct expr * e) {
         return NULL;
     }
 
-    struct value * result = value_int_new(strlen(value_string_peek(v)));
+    struct value * result = value_int_new(value_string_len(v));
     value_free(v);
 
     return result;
@@ -1239,8 +1368,8 @@ expr_eval_func_mids(struct expr * e) {
         return NULL;
     }
 
-    char * s = value_string_peek(sval);
-    const size_t l = strlen(s);
+    const char * s = value_string_peek(sval);
+    const size_t l = value_string_len(sval);
     size_t start = value_int(stval);
     const size_t len = value_int(lval);
 
@@ -1256,15 +1385,10 @@ expr_eval_func_mids(struct expr * e) {
         start -= 1;
     }
 
-    s = x_strdup(s + start);
-    if ( (start + len) < l ) {
-        /* Shorten the string if necessary */
-        s[len] = '\0';
-    }
-
-    struct value * result = value_string_new(s);
+    /* Shorten the string if necessary */
+    struct value * result = value_string_new_len(s + start,
+            len < l - start ? len : l - start);
 
-    free(s);
     value_free(sval);
     value_free(stval);
     value_free(lval);
@@ -1291,7 +1415,7 @@ expr_eval_func_openin(struct expr * e) {
         result = value_int_new(0);
     } else {
         result = value_int_new(fd);
-        open_file_add(fd);
+        open_file_add(fd, value_string_peek(v), O_RDONLY);
     }
 
     value_free(v);
@@ -1319,7 +1443,7 @@ expr_eval_func_openout(struct expr * e) {
         result = value_int_new(0);
     } else {
         result = value_int_new(fd);
-        open_file_add(fd);
+        open_file_add(fd, value_string_peek(v), O_WRONLY);
     }
 
     value_free(v);
@@ -1346,7 +1470,7 @@ expr_eval_func_openup(struct expr * e) {
         result = value_int_new(0);
     } else {
         result = value_int_new(fd);
-        open_file_add(fd);
+        open_file_add(fd, value_string_peek(v), O_RDWR);
     }
 
     value_free(v);
@@ -1426,20 +1550,16 @@ expr_eval_func_rights(struct expr * e) {
         return NULL;
     }
 
-    char * s = value_string_peek(sval);
+    const char * s = value_string_peek(sval);
     const size_t n = value_int(nval);
-    const size_t l = strlen(s);
-    if ( n < l ) {
-        /* Form a right substing */
-        s = x_strdup(s+l-n);
-    } else {
-        /* n is big enough to encompass the entire string */
-        s = x_strdup(s);
-    }
+    const size_t l = value_string_len(sval);
 
-    struct value * result = value_string_new(s);
+    /* Form a right substring, unless n is big enough to encompass
+     * the entire string
+     */
+    struct value * result = n < l ? value_string_new_len(s + l - n, n) :
+        value_string_new_len(s, l);
 
-    free(s);
     value_free(sval);
     value_free(nval);
 
@@ -1453,7 +1573,7 @@ expr_eval_func_rights(struct expr * e) {
  */
 static struct value *
 expr_eval_func_rnd(struct expr * e) {
-    static double last_rnd_1 = 0.255162656;
+    static THREAD_LOCAL double last_rnd_1 = 0.255162656;
 
     if ( !e->subs[0] ) {
         /* Without any arguments, RND is documented to return a
@@ -1645,17 +1765,17 @@ expr_eval_func_strings(struct expr * e) {
     /* Limit n to 256 */
     const size_t n = value_int(nval) % 256;
     const char * s = value_string_peek(sval);
-    const size_t l = strlen(s);
+    const size_t l = value_string_len(sval);
 
     /* calloc to get a terminating null even if l == 0 */
     char * cat = x_calloc(n * l + 1, 1);
     for ( size_t i = 0; i < n; i++ ) {
-        strcpy(cat + i * l, s);
+        memcpy(cat + i * l, s, l);
     }
 
-    struct value * result = value_string_new(cat);
+    struct value * result = value_string_new_len(cat, n * l);
 
-    free(cat);
+    x_free(cat);
     value_free(sval);
     value_free(nval);
 
@@ -1676,38 +1796,19 @@ expr_eval_func_strs(struct expr * e) {
         return NULL;
     }
 
-    char format[BUFFER_SIZE] = {0};
+    const enum number_format mode = format_number();
     const int places = format_places();
-    const int width = format_width();
 
-    switch ( format_number() ) {
-        case FORMAT_NORMAL:
-            sprintf(format, "%%%d.%dG", width, places);
-            break;
+    /* Note the scientific format probably won't match the format on
+     * the BBC Micro, where printing 2.345 with @%=&010209 would give
+     * 2.3E0, where 2.3E+00 is more normal here. We'll accept the
+     * difference for now.
+     */
+    const int precision = (mode == FORMAT_SCIENTIFIC && places > 0) ?
+        places - 1 : places;
 
-        case FORMAT_SCIENTIFIC:
-            /* Note this probably won't match the format on
-             * the BBC Micro, where printing 2.345 with
-             * @%=&010209 would give 2.3E0, where 2.3E+00
-             * is more normal here. We'll accept the difference
-             * for now.
-             */
-            sprintf(format, "%%%d.%dE", width, places == 0 ? 0 : places - 1);
-            break;
-
-        case FORMAT_FIXED:
-            sprintf(format, "%%%d.%dF", width, places);
-            break;
-
-        default:
-            ABORTF("unexpected format: %d\n", format_number());
-    }
-
-    char buffer[BUFFER_SIZE]; /* Should be big enough to hold any number */
-    const int n = snprintf(buffer, BUFFER_SIZE, format, value_float(v));
-    if ( n >= BUFFER_SIZE ) {
-        ABORTF("string too big (%d) for buffer (%d)", n, BUFFER_SIZE);
-    }
+    char buffer[NUM_FORMAT_BUFFER_SIZE];
+    num_format(buffer, v, mode, precision, format_width());
 
     struct value * result = value_string_new(buffer);
 
@@ -1762,17 +1863,15 @@ expr_eval_func_val(struct expr * e) {
         return NULL;
     }
 
-    const char * s = value_string_peek(v);
-    char * endptr;
-    errno = 0;
-    const double d = strtod(s,  &endptr);
-    if ( errno == ERANGE ) {
+    const char * end;
+    double d;
+    if ( num_parse_float(value_string_peek(v), &end, &d) == NUM_PARSE_RANGE ) {
         error_set(ERR_TOO_BIG);
         value_free(v);
         return NULL;
     }
 
-    struct value * result = value_float_new(endptr == s ? 0 : d);
+    struct value * result = value_float_new(d);
     value_free(v);
 
     return result;
@@ -40,6 +40,7 @@ struct expr * expr_func_exp_new(struct expr * e);
 struct expr * expr_func_ext_new(struct expr * e);
 struct expr * expr_func_get_new(void);
 struct expr * expr_func_gets_new(void);
+struct expr * expr_func_getsf_new(struct expr * c, struct expr * n);
 struct expr * expr_func_inkey_new(struct expr * e);
 struct expr * expr_func_inkeys_new(struct expr * e);
 struct expr * expr_func_instr_new(struct expr * haystack,
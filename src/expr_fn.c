@@ -22,10 +22,17 @@
 #include "runtime.h"
 #include "statements.h"
 #include "symbols.h"
+#include "introspect.h"
+#include "profile.h"
 
 /* Static function declarations */
 static struct value * expr_eval_fn(struct expr * e);
 
+/* FN evaluator for compiled programs */
+const expr_eval_function expr_fn_evals[EXPR_NUM_TYPES] = {
+    [EXPR_FN] = expr_eval_fn
+};
+
 
 /*********************************************************************
  *                                                                   *
@@ -72,7 +79,19 @@ expr_eval_fn(struct expr * e) {
     push_function();
 
     /* Run the function */
-    if ( run_statements(branch) != STATUS_EXIT ) {
+    introspect_call_enter(branch);
+    if ( profile_active ) {
+        profile_call_enter(branch);
+    }
+
+    const int status = run_statements(branch);
+
+    introspect_call_exit();
+    if ( profile_active ) {
+        profile_call_exit();
+    }
+
+    if ( status != STATUS_EXIT ) {
         return NULL;
     }
 
@@ -18,6 +18,9 @@
 #ifndef PG_BBASIC_INTERNAL_EXPR_INTERNAL_H
 #define PG_BBASIC_INTERNAL_EXPR_INTERNAL_H
 
+#include <stddef.h>
+#include <stdbool.h>
+
 #include "value.h"
 
 /* Expression types */
@@ -41,6 +44,7 @@ enum expr_type {
     EXPR_FUNC_EXT,
     EXPR_FUNC_GET,
     EXPR_FUNC_GETS,
+    EXPR_FUNC_GETSF,
     EXPR_FUNC_INKEY,
     EXPR_FUNC_INKEYS,
     EXPR_FUNC_INSTR,
@@ -101,6 +105,26 @@ struct expr {
 
 struct expr * expr_new(enum expr_type t);
 
+/* Expression evaluation function */
+typedef struct value * (*expr_eval_function)(struct expr *);
+
+/* Number of expression types, for tables indexed by type */
+#define EXPR_NUM_TYPES (EXPR_VARIABLE + 1)
+
+/* Tables of the evaluation functions in each source file, indexed by
+ * the type of expression each evaluates, so that compiled program
+ * images need only store the type. Each table has entries only for
+ * its own types.
+ */
+extern const expr_eval_function expr_value_evals[EXPR_NUM_TYPES];
+extern const expr_eval_function expr_fn_evals[EXPR_NUM_TYPES];
+extern const expr_eval_function expr_ops_evals[EXPR_NUM_TYPES];
+extern const expr_eval_function expr_builtin_evals[EXPR_NUM_TYPES];
+
+/* Functions for compiled programs */
+struct expr * expr_compiled_new(const int type);
+bool expr_is_compilable(const struct expr * e);
+
 #include "expr.h"
 
 #endif /* PG_BBASIC_INTERNAL_EXPR_INTERNAL_H */
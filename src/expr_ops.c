@@ -43,6 +43,28 @@ static struct value * expr_eval_op_binary_comp(struct expr * e);
 static struct value * expr_eval_op_unary_minus(struct expr * e);
 static struct value * expr_eval_op_unary_not(struct expr * e);
 
+/* Operator evaluators for compiled programs */
+const expr_eval_function expr_ops_evals[EXPR_NUM_TYPES] = {
+    [EXPR_OP_ADD] = expr_eval_op_binary_arith,
+    [EXPR_OP_AND] = expr_eval_op_binary_arith,
+    [EXPR_OP_DIV] = expr_eval_op_binary_arith,
+    [EXPR_OP_EOR] = expr_eval_op_binary_arith,
+    [EXPR_OP_EXP] = expr_eval_op_binary_arith,
+    [EXPR_OP_IDIV] = expr_eval_op_binary_arith,
+    [EXPR_OP_MOD] = expr_eval_op_binary_arith,
+    [EXPR_OP_MUL] = expr_eval_op_binary_arith,
+    [EXPR_OP_OR] = expr_eval_op_binary_arith,
+    [EXPR_OP_SUB] = expr_eval_op_binary_arith,
+    [EXPR_OP_EQ] = expr_eval_op_binary_comp,
+    [EXPR_OP_GT] = expr_eval_op_binary_comp,
+    [EXPR_OP_GTE] = expr_eval_op_binary_comp,
+    [EXPR_OP_LT] = expr_eval_op_binary_comp,
+    [EXPR_OP_LTE] = expr_eval_op_binary_comp,
+    [EXPR_OP_NEQ] = expr_eval_op_binary_comp,
+    [EXPR_OP_NOT] = expr_eval_op_unary_not,
+    [EXPR_OP_UMINUS] = expr_eval_op_unary_minus
+};
+
 
 /*********************************************************************
  *                                                                   *
@@ -241,14 +263,14 @@ expr_eval_op_binary_arith(struct expr * e) {
 
     if ( value_is_string(l) && value_is_string(r) && e->type == EXPR_OP_ADD ) {
         /* Perform string concatenation */
-        const char * left = value_string_peek(l);
-        const char * right = value_string_peek(r);
-
-        char * s = x_malloc(strlen(left) + strlen(right) + 1);
-        strcpy(s, left);
-        strcat(s, right);
-        result = value_string_new(s);
-        free(s);
+        const size_t left_len = value_string_len(l);
+        const size_t right_len = value_string_len(r);
+
+        char * s = x_malloc(left_len + right_len);
+        memcpy(s, value_string_peek(l), left_len);
+        memcpy(s + left_len, value_string_peek(r), right_len);
+        result = value_string_new_len(s, left_len + right_len);
+        x_free(s);
     } else if ( value_is_int(l) && value_is_int(r) ) {
         /* If both operands are integers, then make the result an
          * integer, unless:
@@ -449,7 +471,16 @@ expr_eval_op_binary_comp(struct expr * e) {
         equals = (value_float(l) == value_float(r));
         less = (value_float(l) < value_float(r));
     } else if ( value_is_string(l) && value_is_string(r) ) {
-        int c = strcmp(value_string_peek(l), value_string_peek(r));
+        /* Strings may contain null characters, so compare them up
+         * to the length of the shorter, then by length
+         */
+        const size_t left_len = value_string_len(l);
+        const size_t right_len = value_string_len(r);
+        int c = memcmp(value_string_peek(l), value_string_peek(r),
+                left_len < right_len ? left_len : right_len);
+        if ( c == 0 ) {
+            c = (left_len > right_len) - (left_len < right_len);
+        }
         equals = (c == 0);
         less = (c < 0);
     } else {
@@ -30,6 +30,13 @@ static struct value * expr_eval_array(struct expr * e);
 static struct value * expr_eval_constant(struct expr * e);
 static struct value * expr_eval_variable(struct expr * e);
 
+/* Constant, variable and array evaluators for compiled programs */
+const expr_eval_function expr_value_evals[EXPR_NUM_TYPES] = {
+    [EXPR_ARRAY] = expr_eval_array,
+    [EXPR_CONSTANT] = expr_eval_constant,
+    [EXPR_VARIABLE] = expr_eval_variable
+};
+
 
 /*********************************************************************
  *                                                                   *
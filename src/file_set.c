@@ -28,6 +28,13 @@ file_set_add(struct file_set * s, const int fd) {
     struct file_set_node * node = x_malloc(sizeof *node);
     node->fd = fd;
     node->ptr = 0;
+    node->buf = NULL;
+    node->buf_pos = 0;
+    node->buf_len = 0;
+    node->path = NULL;
+    node->mode = 0;
+    node->mark_pos = 0;
+    node->mark_size = 0;
     node->next = s->head;
     s->head = node;
 }
@@ -61,7 +68,9 @@ file_set_free(struct file_set * s) {
     struct file_set_node * current = s->head;
     while ( current ) {
         struct file_set_node * tmp = current->next;
-        free(current);
+        x_free(current->buf);
+        x_free(current->path);
+        x_free(current);
         current = tmp;
     }
 }
@@ -90,7 +99,9 @@ file_set_pop(struct file_set *s) {
     struct file_set_node * node = s->head;
     s->head = node->next;
     const int n = node->fd;
-    free(node);
+    x_free(node->buf);
+    x_free(node->path);
+    x_free(node);
 
     return n;
 }
@@ -107,9 +118,12 @@ file_set_remove(struct file_set * s, const int fd) {
             } else {
                 prev->next = current->next;
             }
-            free(current);
+            x_free(current->buf);
+            x_free(current->path);
+            x_free(current);
             break;
         }
+        prev = current;
         current = current->next;
     }
 }
@@ -18,15 +18,30 @@
 #ifndef PG_BBASIC_INTERNAL_FILE_SET_H
 #define PG_BBASIC_INTERNAL_FILE_SET_H
 
+#include <stddef.h>
 #include <stdbool.h>
+#include <sys/types.h>
 
 struct file_set {
     struct file_set_node * head;
 };
 
+/* buf holds input read ahead from the file, and is allocated the
+ * first time the file is read. Bytes from buf_pos to buf_len have
+ * been read from the file but not yet consumed. path and mode are
+ * what the file was opened with, and mark_pos and mark_size are the
+ * file's position and size when a checkpoint was last taken.
+ */
 struct file_set_node {
     int fd;
     int ptr;
+    unsigned char * buf;
+    size_t buf_pos;
+    size_t buf_len;
+    char * path;
+    int mode;
+    off_t mark_pos;
+    off_t mark_size;
     struct file_set_node * next;
 };
 
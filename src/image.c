@@ -0,0 +1,1323 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Compiled program images, for the --compile option.
+ *
+ * An image holds the program lines as parsed, before they are linked
+ * into a single statement list, so that loading one skips lexing and
+ * parsing altogether. Each statement, expression, print item and
+ * value is stored as a fixed-size record in a section for its kind,
+ * and refers to other records by index rather than by address: zero
+ * for NULL, and i + 1 for record i of the section. Strings are stored
+ * as offsets into a string table at the end. Execution and evaluation
+ * functions aren't stored at all, but looked up from the type of each
+ * statement and expression when it is loaded. Nothing in an image
+ * depends on where it is loaded, so the loader maps the file
+ * read-only and creates the parse tree directly from the records.
+ *
+ * An image is only accepted by the version which wrote it, and only
+ * if the checksum in its header matches its contents, so a damaged
+ * image is rejected and the program is parsed instead. The loader
+ * also checks every index and offset before creating anything,
+ * requires each record to be referenced exactly once from a tree
+ * rooted at the program lines, and checks that each statement and
+ * expression has the children its type needs, so that even an image
+ * with a valid checksum can't produce a tree which the interpreter
+ * couldn't have parsed.
+ */
+
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#if HAVE_SYS_MMAN_H && HAVE_MMAP
+#include <sys/mman.h>
+#define USE_MMAP 1
+#endif
+
+#include "image.h"
+#include "addr_set.h"
+#include "expr_internal.h"
+#include "runtime.h"
+#include "statements.h"
+#include "symbols.h"
+#include "value.h"
+#include "util.h"
+
+#define IMAGE_MAGIC "BBASICIM"
+#define IMAGE_MAGIC_SIZE (8)
+#define IMAGE_VERSION (2)
+#define IMAGE_BYTE_ORDER (0x01020304)
+#define IMAGE_PACKAGE_VERSION_SIZE (16)
+
+/* Initial value of the checksum, which is 64-bit FNV-1a */
+#define CHECKSUM_INIT UINT64_C(14695981039346656037)
+
+/* Returns the object an index refers to, or NULL for index zero */
+#define DEREF(array, ref) ((ref) ? (array)[(ref) - 1] : NULL)
+
+/* Image sections, in the order they appear in the file */
+enum image_section {
+    SECTION_LINES,
+    SECTION_STMTS,
+    SECTION_EXPRS,
+    SECTION_ITEMS,
+    SECTION_VALUES,
+    SECTION_STRINGS,
+    NUM_SECTIONS
+};
+
+/* Value record types */
+enum image_value_type {
+    IMAGE_VALUE_FLOAT = 1,
+    IMAGE_VALUE_INT,
+    IMAGE_VALUE_STRING
+};
+
+/* Image file header. The checksum covers the header, with the checksum
+ * itself zero, and the sections. The counts are of records in each
+ * section, or of bytes for the string table.
+ */
+struct image_header {
+    char magic[IMAGE_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t checksum;
+    char package_version[IMAGE_PACKAGE_VERSION_SIZE];
+    uint32_t counts[NUM_SECTIONS];
+};
+
+/* Records */
+struct image_line {
+    int32_t number;
+    uint32_t stmt;
+};
+
+struct image_stmt {
+    uint32_t type;
+    uint32_t v;
+    uint32_t e[STMT_NUM_EXPRS];
+    uint32_t pl;
+    uint32_t stmt[STMT_NUM_STMTS];
+    uint32_t next;
+};
+
+struct image_expr {
+    uint32_t type;
+    uint32_t val;
+    uint32_t subs[EXPR_NUM_SUBS];
+    uint32_t next;
+};
+
+struct image_item {
+    uint32_t spec;
+    uint32_t e;
+    uint32_t next;
+};
+
+struct image_value {
+    uint32_t type;
+    uint32_t next;
+    unsigned char payload[8];
+};
+
+/* Record sizes for each section */
+static const size_t record_sizes[NUM_SECTIONS] = {
+    sizeof(struct image_line),
+    sizeof(struct image_stmt),
+    sizeof(struct image_expr),
+    sizeof(struct image_item),
+    sizeof(struct image_value),
+    1
+};
+
+/* What a child of a statement, expression or print item must be. A
+ * kind is combined with REQUIRED for a child which can't be missing.
+ */
+enum child_kind {
+    CHILD_NONE,         /* No child */
+    CHILD_ANY,          /* Any child from the right section */
+    CHILD_INT,          /* An integer value */
+    CHILD_STRING,       /* A string value */
+    CHILD_NAME,         /* A constant holding a variable or FN name */
+    CHILD_VARS,         /* A list of variables and array elements */
+    CHILD_ARRAYS,       /* A list of array elements */
+    CHILD_TARGET,       /* A variable, array element or PTR# */
+    CHILD_PROMPTS,      /* A print list of variables and prompts */
+    CHILD_ASSIGN        /* An assignment to a variable or array element */
+};
+
+#define REQUIRED (0x80)
+#define REQ(kind) ((kind) | REQUIRED)
+
+/* The children of each type of statement, as the parser creates them.
+ * A type which the parser never creates isn't used.
+ */
+struct stmt_shape {
+    bool used;
+    unsigned char v;
+    unsigned char e[STMT_NUM_EXPRS];
+    unsigned char pl;
+    unsigned char stmt[STMT_NUM_STMTS];
+};
+
+static const struct stmt_shape stmt_shapes[] = {
+    [STATEMENT_ASSIGN] = { true, CHILD_NONE,
+        { REQ(CHILD_TARGET), REQ(CHILD_ANY) } },
+    [STATEMENT_BPUT] = { true, CHILD_INT,
+        { REQ(CHILD_ANY), REQ(CHILD_ANY) } },
+    [STATEMENT_CLEAR] = { true },
+    [STATEMENT_CLOSE] = { true, CHILD_NONE, { REQ(CHILD_ANY) } },
+    [STATEMENT_COLOUR] = { true, CHILD_NONE, { REQ(CHILD_ANY) } },
+    [STATEMENT_DATA] = { true, CHILD_ANY },
+    [STATEMENT_DEF_FN] = { true, REQ(CHILD_STRING), { CHILD_VARS } },
+    [STATEMENT_DEF_PROC] = { true, REQ(CHILD_STRING), { CHILD_VARS } },
+    [STATEMENT_DIM] = { true, CHILD_NONE, { REQ(CHILD_ARRAYS) } },
+    [STATEMENT_END] = { true },
+    [STATEMENT_ENDPROC] = { true },
+    [STATEMENT_FOR] = { true, CHILD_NONE,
+        { REQ(CHILD_ANY), REQ(CHILD_ANY) }, CHILD_NONE,
+        { REQ(CHILD_ASSIGN) } },
+    [STATEMENT_FN_RETURN] = { true, CHILD_NONE, { REQ(CHILD_ANY) } },
+    [STATEMENT_GOSUB] = { true, CHILD_NONE, { REQ(CHILD_ANY) } },
+    [STATEMENT_GOTO] = { true, CHILD_NONE, { REQ(CHILD_ANY) } },
+    [STATEMENT_IF] = { true, CHILD_NONE, { REQ(CHILD_ANY) }, CHILD_NONE,
+        { CHILD_ANY, CHILD_ANY } },
+    [STATEMENT_INPUT] = { true, CHILD_INT, { CHILD_NONE }, CHILD_PROMPTS },
+    [STATEMENT_INPUTF] = { true, CHILD_NONE,
+        { REQ(CHILD_ANY), CHILD_VARS } },
+    [STATEMENT_LOCAL] = { true, CHILD_NONE, { CHILD_VARS } },
+    [STATEMENT_NEXT] = { true, CHILD_NONE, { CHILD_VARS } },
+    [STATEMENT_NULL] = { true },
+    [STATEMENT_ON_ERROR] = { true, CHILD_NONE, { CHILD_NONE }, CHILD_NONE,
+        { CHILD_ANY } },
+    [STATEMENT_ON_GOTO] = { true, CHILD_NONE,
+        { REQ(CHILD_ANY), CHILD_ANY }, CHILD_NONE, { CHILD_ANY } },
+    [STATEMENT_ON_GOSUB] = { true, CHILD_NONE,
+        { REQ(CHILD_ANY), CHILD_ANY }, CHILD_NONE, { CHILD_ANY } },
+    [STATEMENT_PRINT] = { true, CHILD_NONE, { CHILD_NONE }, CHILD_ANY },
+    [STATEMENT_PRINTF] = { true, CHILD_NONE,
+        { REQ(CHILD_ANY), CHILD_ANY } },
+    [STATEMENT_PROC] = { true, REQ(CHILD_STRING), { CHILD_ANY } },
+    [STATEMENT_READ] = { true, CHILD_NONE, { CHILD_VARS } },
+    [STATEMENT_REM] = { true, CHILD_STRING },
+    [STATEMENT_REPEAT] = { true, CHILD_NONE, { CHILD_NONE }, CHILD_NONE,
+        { CHILD_ANY } },
+    [STATEMENT_REPORT] = { true },
+    [STATEMENT_RESTORE] = { true, CHILD_NONE, { CHILD_ANY } },
+    [STATEMENT_RETURN] = { true },
+    [STATEMENT_STOP] = { true },
+    [STATEMENT_TRACE] = { true, REQ(CHILD_INT), { REQ(CHILD_ANY) } },
+    [STATEMENT_UNTIL] = { true, CHILD_NONE, { REQ(CHILD_ANY) } }
+};
+
+#define NUM_STMT_SHAPES (sizeof stmt_shapes / sizeof stmt_shapes[0])
+
+/* The children of each type of expression */
+struct expr_shape {
+    bool used;
+    unsigned char val;
+    unsigned char subs[EXPR_NUM_SUBS];
+};
+
+#define NULLARY { true }
+#define UNARY { true, CHILD_NONE, { REQ(CHILD_ANY) } }
+#define BINARY { true, CHILD_NONE, { REQ(CHILD_ANY), REQ(CHILD_ANY) } }
+#define TERNARY { true, CHILD_NONE, \
+    { REQ(CHILD_ANY), REQ(CHILD_ANY), REQ(CHILD_ANY) } }
+
+static const struct expr_shape expr_shapes[EXPR_NUM_TYPES] = {
+    [EXPR_ARRAY] = { true, CHILD_NONE,
+        { REQ(CHILD_NAME), REQ(CHILD_ANY) } },
+    [EXPR_CONSTANT] = { true, REQ(CHILD_ANY) },
+    [EXPR_FN] = { true, CHILD_NONE, { CHILD_ANY, REQ(CHILD_NAME) } },
+    [EXPR_FUNC_ABS] = UNARY,
+    [EXPR_FUNC_ACS] = UNARY,
+    [EXPR_FUNC_ASC] = UNARY,
+    [EXPR_FUNC_ASN] = UNARY,
+    [EXPR_FUNC_ATN] = UNARY,
+    [EXPR_FUNC_BGET] = UNARY,
+    [EXPR_FUNC_CHRS] = UNARY,
+    [EXPR_FUNC_COS] = UNARY,
+    [EXPR_FUNC_DEG] = UNARY,
+    [EXPR_FUNC_EOF] = UNARY,
+    [EXPR_FUNC_ERL] = NULLARY,
+    [EXPR_FUNC_ERR] = NULLARY,
+    [EXPR_FUNC_EXP] = UNARY,
+    [EXPR_FUNC_EXT] = UNARY,
+    [EXPR_FUNC_GET] = NULLARY,
+    [EXPR_FUNC_GETS] = NULLARY,
+    [EXPR_FUNC_GETSF] = { true, CHILD_NONE,
+        { REQ(CHILD_ANY), CHILD_ANY } },
+    [EXPR_FUNC_INKEY] = UNARY,
+    [EXPR_FUNC_INKEYS] = UNARY,
+    [EXPR_FUNC_INSTR] = TERNARY,
+    [EXPR_FUNC_INT] = UNARY,
+    [EXPR_FUNC_LEFTS] = BINARY,
+    [EXPR_FUNC_LEN] = UNARY,
+    [EXPR_FUNC_LN] = UNARY,
+    [EXPR_FUNC_LOG] = UNARY,
+    [EXPR_FUNC_MIDS] = TERNARY,
+    [EXPR_FUNC_OPENIN] = UNARY,
+    [EXPR_FUNC_OPENOUT] = UNARY,
+    [EXPR_FUNC_OPENUP] = UNARY,
+    [EXPR_FUNC_PTR] = UNARY,
+    [EXPR_FUNC_RAD] = UNARY,
+    [EXPR_FUNC_RIGHTS] = BINARY,
+    [EXPR_FUNC_RND] = { true, CHILD_NONE, { CHILD_ANY } },
+    [EXPR_FUNC_SGN] = UNARY,
+    [EXPR_FUNC_SIN] = UNARY,
+    [EXPR_FUNC_SPC] = UNARY,
+    [EXPR_FUNC_SQR] = UNARY,
+    [EXPR_FUNC_STRINGS] = BINARY,
+    [EXPR_FUNC_STRS] = UNARY,
+    [EXPR_FUNC_TAN] = UNARY,
+    [EXPR_FUNC_VAL] = UNARY,
+    [EXPR_OP_ADD] = BINARY,
+    [EXPR_OP_AND] = BINARY,
+    [EXPR_OP_DIV] = BINARY,
+    [EXPR_OP_EOR] = BINARY,
+    [EXPR_OP_EQ] = BINARY,
+    [EXPR_OP_EXP] = BINARY,
+    [EXPR_OP_GT] = BINARY,
+    [EXPR_OP_GTE] = BINARY,
+    [EXPR_OP_IDIV] = BINARY,
+    [EXPR_OP_LT] = BINARY,
+    [EXPR_OP_LTE] = BINARY,
+    [EXPR_OP_MOD] = BINARY,
+    [EXPR_OP_MUL] = BINARY,
+    [EXPR_OP_NEQ] = BINARY,
+    [EXPR_OP_NOT] = UNARY,
+    [EXPR_OP_OR] = BINARY,
+    [EXPR_OP_SUB] = BINARY,
+    [EXPR_OP_UMINUS] = UNARY,
+    [EXPR_VARIABLE] = { true, CHILD_NONE, { REQ(CHILD_NAME) } }
+};
+
+/* A growable section of an image being written */
+struct section {
+    unsigned char * data;
+    uint32_t count;
+    size_t capacity;
+};
+
+/* An image being written */
+struct writer {
+    struct section sections[NUM_SECTIONS];
+    struct addr_set * seen;
+    bool failed;
+};
+
+/* An image being loaded, and the objects created from its records */
+struct loader {
+    struct image_header header;
+    const unsigned char * sections[NUM_SECTIONS];
+    unsigned char * refs[NUM_SECTIONS];
+    struct statement ** stmts;
+    struct expr ** exprs;
+    struct print_item ** items;
+    struct value ** values;
+};
+
+/* Static function declarations */
+static uint64_t checksum_add(uint64_t checksum, const void * data,
+        const size_t size);
+static uint32_t section_add(struct section * s, const enum image_section kind,
+        const size_t n);
+static void * record(struct section * s, const enum image_section kind,
+        const uint32_t ref);
+static bool claim_node(struct writer * w, void * node);
+static uint32_t write_stmts(struct writer * w, struct statement * s);
+static uint32_t write_exprs(struct writer * w, struct expr * e);
+static uint32_t write_items(struct writer * w, struct print_item * p);
+static uint32_t write_values(struct writer * w, struct value * v);
+static int write_file(const char * filename, struct writer * w,
+        const bool report);
+
+static void * map_file(const char * filename, size_t * size,
+        const bool report);
+static void unmap_file(void * map, const size_t size);
+static const char * check_image(struct loader * l, const void * map,
+        const size_t size);
+static bool check_records(struct loader * l);
+static bool check_tree(struct loader * l);
+static bool check_shapes(struct loader * l);
+static bool check_child(struct loader * l, const unsigned char want,
+        uint32_t ref);
+static uint32_t value_type(struct loader * l, const uint32_t ref);
+static bool is_name(struct loader * l, const uint32_t ref);
+static bool claim_ref(struct loader * l, const enum image_section kind,
+        const uint32_t ref);
+static void create_program(struct loader * l);
+
+
+/*********************************************************************
+ *                                                                   *
+ * Public image functions                                            *
+ *                                                                   *
+ *********************************************************************/
+
+/* Writes the parsed program to an image file. Returns STATUS_OK on
+ * success, or STATUS_ERROR on failure, after printing an error
+ * message if report is true.
+ */
+int
+image_write(const char * filename, const bool report) {
+    struct writer w;
+    memset(&w, 0, sizeof w);
+    w.seen = addr_set_new();
+
+    for ( struct line * line = program_lines(); line; line = line->next ) {
+        const uint32_t stmt = write_stmts(&w, line->stmt);
+        const uint32_t ref = section_add(&w.sections[SECTION_LINES],
+                SECTION_LINES, 1);
+        struct image_line * rec = record(&w.sections[SECTION_LINES],
+                SECTION_LINES, ref);
+        rec->number = line->number;
+        rec->stmt = stmt;
+    }
+
+    int status = STATUS_OK;
+    if ( w.failed ) {
+        if ( report ) {
+            fprintf(stderr, "%s: %s: program can't be compiled\n",
+                    PACKAGE, filename);
+        }
+        status = STATUS_ERROR;
+    } else {
+        status = write_file(filename, &w, report);
+    }
+
+    addr_set_free(w.seen);
+    for ( size_t i = 0; i < NUM_SECTIONS; i++ ) {
+        x_free(w.sections[i].data);
+    }
+
+    return status;
+}
+
+/* Returns true if a file is a compiled program image */
+bool
+image_detect(const char * filename) {
+    FILE * fp = fopen(filename, "rb");
+    if ( fp == NULL ) {
+        return false;
+    }
+
+    char magic[IMAGE_MAGIC_SIZE];
+    const bool found = fread(magic, 1, sizeof magic, fp) == sizeof magic &&
+        !memcmp(magic, IMAGE_MAGIC, IMAGE_MAGIC_SIZE);
+    fclose(fp);
+
+    return found;
+}
+
+/* Loads the program from an image file, in place of parsing it.
+ * Returns STATUS_OK on success, or STATUS_ERROR on failure, in which
+ * case nothing has been loaded, after printing an error message if
+ * report is true.
+ */
+int
+image_load(const char * filename, const bool report) {
+    size_t size;
+    void * map = map_file(filename, &size, report);
+    if ( map == NULL ) {
+        return STATUS_ERROR;
+    }
+
+    struct loader l;
+    memset(&l, 0, sizeof l);
+
+    const char * problem = check_image(&l, map, size);
+    if ( problem == NULL ) {
+        create_program(&l);
+    }
+
+    for ( size_t i = 0; i < NUM_SECTIONS; i++ ) {
+        x_free(l.refs[i]);
+    }
+    unmap_file(map, size);
+
+    if ( problem ) {
+        if ( report ) {
+            fprintf(stderr, "%s: %s: %s\n", PACKAGE, filename, problem);
+        }
+        return STATUS_ERROR;
+    }
+
+    return STATUS_OK;
+}
+
+
+/*********************************************************************
+ *                                                                   *
+ * Static functions for writing images                               *
+ *                                                                   *
+ *********************************************************************/
+
+/* Adds size bytes of data to a checksum, and returns the new checksum */
+static uint64_t
+checksum_add(uint64_t checksum, const void * data, const size_t size) {
+    const unsigned char * p = data;
+    for ( size_t i = 0; i < size; i++ ) {
+        checksum = (checksum ^ p[i]) * UINT64_C(1099511628211);
+    }
+
+    return checksum;
+}
+
+/* Adds n zeroed records to a section, and returns the index of the
+ * first.
+ */
+static uint32_t
+section_add(struct section * s, const enum image_section kind,
+        const size_t n) {
+    const size_t size = record_sizes[kind];
+    if ( s->count + n > s->capacity ) {
+        s->capacity = s->capacity ? s->capacity * 2 : 64;
+        while ( s->count + n > s->capacity ) {
+            s->capacity *= 2;
+        }
+        s->data = x_realloc(s->data, s->capacity * size);
+    }
+
+    memset(s->data + s->count * size, 0, n * size);
+    const uint32_t ref = s->count + 1;
+    s->count += n;
+
+    return ref;
+}
+
+/* Returns a pointer to a record in a section. This is invalidated
+ * when the section grows.
+ */
+static void *
+record(struct section * s, const enum image_section kind,
+        const uint32_t ref) {
+    return s->data + (ref - 1) * record_sizes[kind];
+}
+
+/* Notes that a node has been written, and returns false if it was
+ * already written, since the loader couldn't recreate a node which
+ * is shared.
+ */
+static bool
+claim_node(struct writer * w, void * node) {
+    if ( addr_set_is_member(w->seen, node) ) {
+        w->failed = true;
+        return false;
+    }
+
+    addr_set_add(w->seen, node);
+    return true;
+}
+
+/* Writes a list of statements, and returns the index of the first */
+static uint32_t
+write_stmts(struct writer * w, struct statement * s) {
+    struct section * sec = &w->sections[SECTION_STMTS];
+    uint32_t first = 0;
+    uint32_t previous = 0;
+
+    for ( ; s && !w->failed; s = s->next ) {
+        if ( !statement_is_compilable(s) || !claim_node(w, s) ) {
+            w->failed = true;
+            return 0;
+        }
+
+        /* Write the children first, since they may grow the section */
+        struct image_stmt rec = {
+            .type = s->type,
+            .v = write_values(w, s->v),
+            .pl = write_items(w, s->pl)
+        };
+        for ( size_t i = 0; i < STMT_NUM_EXPRS; i++ ) {
+            rec.e[i] = write_exprs(w, s->e[i]);
+        }
+        for ( size_t i = 0; i < STMT_NUM_STMTS; i++ ) {
+            rec.stmt[i] = write_stmts(w, s->stmt[i]);
+        }
+
+        const uint32_t ref = section_add(sec, SECTION_STMTS, 1);
+        memcpy(record(sec, SECTION_STMTS, ref), &rec, sizeof rec);
+
+        if ( previous ) {
+            ((struct image_stmt *) record(sec, SECTION_STMTS,
+                                          previous))->next = ref;
+        } else {
+            first = ref;
+        }
+        previous = ref;
+    }
+
+    return first;
+}
+
+/* Writes a list of expressions, and returns the index of the first */
+static uint32_t
+write_exprs(struct writer * w, struct expr * e) {
+    struct section * sec = &w->sections[SECTION_EXPRS];
+    uint32_t first = 0;
+    uint32_t previous = 0;
+
+    for ( ; e && !w->failed; e = e->next ) {
+        if ( !expr_is_compilable(e) || !claim_node(w, e) ) {
+            w->failed = true;
+            return 0;
+        }
+
+        struct image_expr rec = {
+            .type = e->type,
+            .val = write_values(w, e->val)
+        };
+        for ( size_t i = 0; i < EXPR_NUM_SUBS; i++ ) {
+            rec.subs[i] = write_exprs(w, e->subs[i]);
+        }
+
+        const uint32_t ref = section_add(sec, SECTION_EXPRS, 1);
+        memcpy(record(sec, SECTION_EXPRS, ref), &rec, sizeof rec);
+
+        if ( previous ) {
+            ((struct image_expr *) record(sec, SECTION_EXPRS,
+                                          previous))->next = ref;
+        } else {
+            first = ref;
+        }
+        previous = ref;
+    }
+
+    return first;
+}
+
+/* Writes a print list, and returns the index of the first item */
+static uint32_t
+write_items(struct writer * w, struct print_item * p) {
+    struct section * sec = &w->sections[SECTION_ITEMS];
+    uint32_t first = 0;
+    uint32_t previous = 0;
+
+    for ( ; p && !w->failed; p = p->next ) {
+        if ( !claim_node(w, p) ) {
+            return 0;
+        }
+
+        const struct image_item rec = {
+            .spec = p->spec,
+            .e = write_exprs(w, p->e)
+        };
+
+        const uint32_t ref = section_add(sec, SECTION_ITEMS, 1);
+        memcpy(record(sec, SECTION_ITEMS, ref), &rec, sizeof rec);
+
+        if ( previous ) {
+            ((struct image_item *) record(sec, SECTION_ITEMS,
+                                          previous))->next = ref;
+        } else {
+            first = ref;
+        }
+        previous = ref;
+    }
+
+    return first;
+}
+
+/* Writes a list of values, and returns the index of the first */
+static uint32_t
+write_values(struct writer * w, struct value * v) {
+    struct section * sec = &w->sections[SECTION_VALUES];
+    struct section * strings = &w->sections[SECTION_STRINGS];
+    uint32_t first = 0;
+    uint32_t previous = 0;
+
+    for ( ; v && !w->failed; v = value_next(v) ) {
+        if ( !claim_node(w, v) ) {
+            return 0;
+        }
+
+        struct image_value rec = { .type = 0 };
+        if ( value_is_string(v) ) {
+            const char * s = value_string_peek(v);
+            const size_t len = strlen(s) + 1;
+            const uint32_t offset = section_add(strings,
+                    SECTION_STRINGS, len) - 1;
+            memcpy(record(strings, SECTION_STRINGS, offset + 1), s, len);
+
+            rec.type = IMAGE_VALUE_STRING;
+            memcpy(rec.payload, &offset, sizeof offset);
+        } else if ( value_is_int(v) ) {
+            const int32_t n = value_int(v);
+            rec.type = IMAGE_VALUE_INT;
+            memcpy(rec.payload, &n, sizeof n);
+        } else {
+            const double f = value_float(v);
+            rec.type = IMAGE_VALUE_FLOAT;
+            memcpy(rec.payload, &f, sizeof f);
+        }
+
+        const uint32_t ref = section_add(sec, SECTION_VALUES, 1);
+        memcpy(record(sec, SECTION_VALUES, ref), &rec, sizeof rec);
+
+        if ( previous ) {
+            ((struct image_value *) record(sec, SECTION_VALUES,
+                                           previous))->next = ref;
+        } else {
+            first = ref;
+        }
+        previous = ref;
+    }
+
+    return first;
+}
+
+/* Writes the header and sections to a temporary file, and renames it
+ * to filename, so that a reader never sees a partial image.
+ */
+static int
+write_file(const char * filename, struct writer * w, const bool report) {
+    struct image_header header;
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, IMAGE_MAGIC, IMAGE_MAGIC_SIZE);
+    header.version = IMAGE_VERSION;
+    header.byte_order = IMAGE_BYTE_ORDER;
+    strncpy(header.package_version, PACKAGE_VERSION,
+            IMAGE_PACKAGE_VERSION_SIZE - 1);
+    for ( size_t i = 0; i < NUM_SECTIONS; i++ ) {
+        header.counts[i] = w->sections[i].count;
+    }
+
+    uint64_t checksum = checksum_add(CHECKSUM_INIT, &header, sizeof header);
+    for ( size_t i = 0; i < NUM_SECTIONS; i++ ) {
+        checksum = checksum_add(checksum, w->sections[i].data,
+                w->sections[i].count * record_sizes[i]);
+    }
+    header.checksum = checksum;
+
+    const size_t len = strlen(filename) + 32;
+    char * tmpname = x_malloc(len);
+    snprintf(tmpname, len, "%s.%ld.tmp", filename, (long) getpid());
+
+    FILE * fp = fopen(tmpname, "wb");
+    if ( fp == NULL ) {
+        if ( report ) {
+            perror(tmpname);
+        }
+        x_free(tmpname);
+        return STATUS_ERROR;
+    }
+
+    bool ok = fwrite(&header, sizeof header, 1, fp) == 1;
+    for ( size_t i = 0; ok && i < NUM_SECTIONS; i++ ) {
+        const size_t n = w->sections[i].count;
+        ok = fwrite(w->sections[i].data, record_sizes[i], n, fp) == n;
+    }
+
+    if ( fclose(fp) != 0 ) {
+        ok = false;
+    }
+
+    if ( !ok || rename(tmpname, filename) != 0 ) {
+        if ( report ) {
+            perror(filename);
+        }
+        remove(tmpname);
+        x_free(tmpname);
+        return STATUS_ERROR;
+    }
+
+    x_free(tmpname);
+    return STATUS_OK;
+}
+
+
+/*********************************************************************
+ *                                                                   *
+ * Static functions for loading images                               *
+ *                                                                   *
+ *********************************************************************/
+
+/* Maps a file into memory read-only, or reads it where mmap isn't
+ * available. Returns NULL on failure, after printing an error message
+ * if report is true.
+ */
+static void *
+map_file(const char * filename, size_t * size, const bool report) {
+    const int fd = open(filename, O_RDONLY);
+    if ( fd == -1 ) {
+        if ( report ) {
+            perror(filename);
+        }
+        return NULL;
+    }
+
+    struct stat st;
+    if ( fstat(fd, &st) == -1 ||
+            st.st_size < (off_t) sizeof(struct image_header) ) {
+        if ( report ) {
+            fprintf(stderr, "%s: %s: not a compiled program\n",
+                    PACKAGE, filename);
+        }
+        close(fd);
+        return NULL;
+    }
+
+    *size = st.st_size;
+
+#if USE_MMAP
+    void * map = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if ( map == MAP_FAILED ) {
+        if ( report ) {
+            perror(filename);
+        }
+        map = NULL;
+    }
+#else
+    unsigned char * map = x_malloc(*size);
+    size_t done = 0;
+    while ( done < *size ) {
+        const ssize_t n = read(fd, map + done, *size - done);
+        if ( n <= 0 ) {
+            if ( report ) {
+                perror(filename);
+            }
+            x_free(map);
+            map = NULL;
+            break;
+        }
+        done += n;
+    }
+#endif
+
+    close(fd);
+    return map;
+}
+
+/* Releases a file mapped by map_file() */
+static void
+unmap_file(void * map, const size_t size) {
+#if USE_MMAP
+    munmap(map, size);
+#else
+    (void) size;
+    x_free(map);
+#endif
+}
+
+/* Checks an image's header and records, and sets up the loader to
+ * create the program from it. Returns NULL if the image is valid, or
+ * a description of the problem.
+ */
+static const char *
+check_image(struct loader * l, const void * map, const size_t size) {
+    struct image_header * h = &l->header;
+    memcpy(h, map, sizeof *h);
+
+    if ( memcmp(h->magic, IMAGE_MAGIC, IMAGE_MAGIC_SIZE) ) {
+        return "not a compiled program";
+    }
+
+    if ( h->version != IMAGE_VERSION || h->byte_order != IMAGE_BYTE_ORDER ||
+            strncmp(h->package_version, PACKAGE_VERSION,
+                IMAGE_PACKAGE_VERSION_SIZE) ) {
+        return "compiled by a different version of " PACKAGE;
+    }
+
+    /* The sections must exactly fill the rest of the file */
+    uint64_t expected = sizeof *h;
+    const unsigned char * p = (const unsigned char *) map + sizeof *h;
+    for ( size_t i = 0; i < NUM_SECTIONS; i++ ) {
+        const uint64_t len = (uint64_t) h->counts[i] * record_sizes[i];
+        expected += len;
+        if ( expected > size ) {
+            return "compiled program is damaged";
+        }
+
+        l->sections[i] = p;
+        l->refs[i] = x_calloc(h->counts[i] + 1, 1);
+        p += len;
+    }
+
+    if ( expected != size ) {
+        return "compiled program is damaged";
+    }
+
+    /* The checksum is calculated with the checksum field zero */
+    struct image_header zeroed = *h;
+    zeroed.checksum = 0;
+    const uint64_t checksum = checksum_add(checksum_add(CHECKSUM_INIT,
+                &zeroed, sizeof zeroed),
+            (const unsigned char *) map + sizeof *h, size - sizeof *h);
+    if ( checksum != h->checksum ) {
+        return "compiled program is damaged";
+    }
+
+    if ( !check_records(l) || !check_tree(l) || !check_shapes(l) ) {
+        return "compiled program is damaged";
+    }
+
+    return NULL;
+}
+
+/* Checks the value types, string offsets and references in every
+ * record, and that no record is referenced more than once.
+ */
+static bool
+check_records(struct loader * l) {
+    const uint32_t * counts = l->header.counts;
+    const char * strings = (const char *) l->sections[SECTION_STRINGS];
+    const uint32_t strings_size = counts[SECTION_STRINGS];
+
+    if ( strings_size && strings[strings_size - 1] != '\0' ) {
+        return false;
+    }
+
+    const struct image_value * values = (const void *) l->sections[SECTION_VALUES];
+    for ( uint32_t i = 0; i < counts[SECTION_VALUES]; i++ ) {
+        if ( values[i].type == IMAGE_VALUE_STRING ) {
+            uint32_t offset;
+            memcpy(&offset, values[i].payload, sizeof offset);
+            if ( offset >= strings_size ) {
+                return false;
+            }
+        } else if ( values[i].type != IMAGE_VALUE_INT &&
+                values[i].type != IMAGE_VALUE_FLOAT ) {
+            return false;
+        }
+
+        if ( !claim_ref(l, SECTION_VALUES, values[i].next) ) {
+            return false;
+        }
+    }
+
+    const struct image_expr * exprs = (const void *) l->sections[SECTION_EXPRS];
+    for ( uint32_t i = 0; i < counts[SECTION_EXPRS]; i++ ) {
+        const struct image_expr * e = &exprs[i];
+        if ( !claim_ref(l, SECTION_VALUES, e->val) ||
+                !claim_ref(l, SECTION_EXPRS, e->next) ) {
+            return false;
+        }
+
+        for ( size_t j = 0; j < EXPR_NUM_SUBS; j++ ) {
+            if ( !claim_ref(l, SECTION_EXPRS, e->subs[j]) ) {
+                return false;
+            }
+        }
+    }
+
+    const struct image_item * items = (const void *) l->sections[SECTION_ITEMS];
+    for ( uint32_t i = 0; i < counts[SECTION_ITEMS]; i++ ) {
+        if ( items[i].spec > PRINT_EXPR ||
+                !claim_ref(l, SECTION_EXPRS, items[i].e) ||
+                !claim_ref(l, SECTION_ITEMS, items[i].next) ) {
+            return false;
+        }
+    }
+
+    const struct image_stmt * stmts = (const void *) l->sections[SECTION_STMTS];
+    for ( uint32_t i = 0; i < counts[SECTION_STMTS]; i++ ) {
+        const struct image_stmt * s = &stmts[i];
+        if ( !claim_ref(l, SECTION_VALUES, s->v) ||
+                !claim_ref(l, SECTION_ITEMS, s->pl) ||
+                !claim_ref(l, SECTION_STMTS, s->next) ) {
+            return false;
+        }
+
+        for ( size_t j = 0; j < STMT_NUM_EXPRS; j++ ) {
+            if ( !claim_ref(l, SECTION_EXPRS, s->e[j]) ) {
+                return false;
+            }
+        }
+
+        for ( size_t j = 0; j < STMT_NUM_STMTS; j++ ) {
+            if ( !claim_ref(l, SECTION_STMTS, s->stmt[j]) ) {
+                return false;
+            }
+        }
+    }
+
+    /* Lines must be in order, as line_add() would sort them */
+    const struct image_line * lines = (const void *) l->sections[SECTION_LINES];
+    for ( uint32_t i = 0; i < counts[SECTION_LINES]; i++ ) {
+        if ( lines[i].stmt == 0 ||
+                (i > 0 && lines[i].number <= lines[i - 1].number) ||
+                !claim_ref(l, SECTION_STMTS, lines[i].stmt) ) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Checks that every record can be reached from the program lines. Each
+ * record is referenced at most once by now, so following the
+ * references from the lines visits each reachable record once, and
+ * any record left unvisited is unreferenced or part of a cycle.
+ */
+static bool
+check_tree(struct loader * l) {
+    const uint32_t * counts = l->header.counts;
+    const struct image_line * lines = (const void *) l->sections[SECTION_LINES];
+    const struct image_stmt * stmts = (const void *) l->sections[SECTION_STMTS];
+    const struct image_expr * exprs = (const void *) l->sections[SECTION_EXPRS];
+    const struct image_item * items = (const void *) l->sections[SECTION_ITEMS];
+    const struct image_value * values = (const void *) l->sections[SECTION_VALUES];
+
+    size_t total = 0;
+    for ( size_t i = SECTION_STMTS; i < SECTION_STRINGS; i++ ) {
+        total += counts[i];
+    }
+
+    struct pending {
+        enum image_section kind;
+        uint32_t ref;
+    } * stack = x_malloc((total + 1) * sizeof *stack);
+    size_t top = 0;
+    size_t visited = 0;
+
+#define PUSH(k, r) do { if ( r ) { stack[top].kind = (k); \
+    stack[top++].ref = (r); } } while ( 0 )
+
+    for ( uint32_t i = 0; i < counts[SECTION_LINES]; i++ ) {
+        PUSH(SECTION_STMTS, lines[i].stmt);
+    }
+
+    while ( top > 0 ) {
+        const struct pending p = stack[--top];
+        const uint32_t i = p.ref - 1;
+        visited++;
+
+        switch ( p.kind ) {
+            case SECTION_STMTS:
+                PUSH(SECTION_VALUES, stmts[i].v);
+                PUSH(SECTION_ITEMS, stmts[i].pl);
+                PUSH(SECTION_STMTS, stmts[i].next);
+                for ( size_t j = 0; j < STMT_NUM_EXPRS; j++ ) {
+                    PUSH(SECTION_EXPRS, stmts[i].e[j]);
+                }
+                for ( size_t j = 0; j < STMT_NUM_STMTS; j++ ) {
+                    PUSH(SECTION_STMTS, stmts[i].stmt[j]);
+                }
+                break;
+
+            case SECTION_EXPRS:
+                PUSH(SECTION_VALUES, exprs[i].val);
+                PUSH(SECTION_EXPRS, exprs[i].next);
+                for ( size_t j = 0; j < EXPR_NUM_SUBS; j++ ) {
+                    PUSH(SECTION_EXPRS, exprs[i].subs[j]);
+                }
+                break;
+
+            case SECTION_ITEMS:
+                PUSH(SECTION_EXPRS, items[i].e);
+                PUSH(SECTION_ITEMS, items[i].next);
+                break;
+
+            default:
+                PUSH(SECTION_VALUES, values[i].next);
+                break;
+        }
+    }
+
+#undef PUSH
+
+    x_free(stack);
+    return visited == total;
+}
+
+/* Checks that every statement, expression and print item has the
+ * children its type needs, so that the functions which execute and
+ * evaluate them find what the parser would have given them. The tree
+ * has been checked by now, so lists can be followed safely.
+ */
+static bool
+check_shapes(struct loader * l) {
+    const uint32_t * counts = l->header.counts;
+
+    const struct image_stmt * stmts = (const void *) l->sections[SECTION_STMTS];
+    for ( uint32_t i = 0; i < counts[SECTION_STMTS]; i++ ) {
+        const struct image_stmt * s = &stmts[i];
+        if ( s->type >= NUM_STMT_SHAPES || !stmt_shapes[s->type].used ) {
+            return false;
+        }
+
+        const struct stmt_shape * shape = &stmt_shapes[s->type];
+        if ( !check_child(l, shape->v, s->v) ||
+                !check_child(l, shape->pl, s->pl) ) {
+            return false;
+        }
+
+        for ( size_t j = 0; j < STMT_NUM_EXPRS; j++ ) {
+            if ( !check_child(l, shape->e[j], s->e[j]) ) {
+                return false;
+            }
+        }
+
+        for ( size_t j = 0; j < STMT_NUM_STMTS; j++ ) {
+            if ( !check_child(l, shape->stmt[j], s->stmt[j]) ) {
+                return false;
+            }
+        }
+    }
+
+    const struct image_expr * exprs = (const void *) l->sections[SECTION_EXPRS];
+    for ( uint32_t i = 0; i < counts[SECTION_EXPRS]; i++ ) {
+        const struct image_expr * e = &exprs[i];
+        if ( e->type >= EXPR_NUM_TYPES || !expr_shapes[e->type].used ||
+                !check_child(l, expr_shapes[e->type].val, e->val) ) {
+            return false;
+        }
+
+        for ( size_t j = 0; j < EXPR_NUM_SUBS; j++ ) {
+            if ( !check_child(l, expr_shapes[e->type].subs[j],
+                        e->subs[j]) ) {
+                return false;
+            }
+        }
+    }
+
+    /* Only an expression item has an expression */
+    const struct image_item * items = (const void *) l->sections[SECTION_ITEMS];
+    for ( uint32_t i = 0; i < counts[SECTION_ITEMS]; i++ ) {
+        if ( (items[i].spec == PRINT_EXPR) != (items[i].e != 0) ) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Checks that a child is of the kind wanted, which also determines the
+ * section it refers to.
+ */
+static bool
+check_child(struct loader * l, const unsigned char want, uint32_t ref) {
+    if ( ref == 0 ) {
+        return !(want & REQUIRED);
+    }
+
+    const int kind = want & ~REQUIRED;
+
+    const struct image_stmt * stmts = (const void *) l->sections[SECTION_STMTS];
+    const struct image_expr * exprs = (const void *) l->sections[SECTION_EXPRS];
+    const struct image_item * items = (const void *) l->sections[SECTION_ITEMS];
+
+    switch ( kind ) {
+        case CHILD_ANY:
+            return true;
+
+        case CHILD_INT:
+            return value_type(l, ref) == IMAGE_VALUE_INT;
+
+        case CHILD_STRING:
+            return value_type(l, ref) == IMAGE_VALUE_STRING;
+
+        case CHILD_NAME:
+            return exprs[ref - 1].type == EXPR_CONSTANT &&
+                is_name(l, exprs[ref - 1].val);
+
+        case CHILD_VARS:
+        case CHILD_ARRAYS:
+            for ( ; ref; ref = exprs[ref - 1].next ) {
+                const uint32_t type = exprs[ref - 1].type;
+                if ( type != EXPR_ARRAY &&
+                        (type != EXPR_VARIABLE || kind == CHILD_ARRAYS) ) {
+                    return false;
+                }
+            }
+            return true;
+
+        case CHILD_TARGET:
+            return exprs[ref - 1].type == EXPR_VARIABLE ||
+                exprs[ref - 1].type == EXPR_ARRAY ||
+                exprs[ref - 1].type == EXPR_FUNC_PTR;
+
+        case CHILD_PROMPTS:
+            /* INPUT reads into variables and prints anything else,
+             * which must be a string
+             */
+            for ( ; ref; ref = items[ref - 1].next ) {
+                const uint32_t e = items[ref - 1].e;
+                if ( e == 0 ) {
+                    continue;
+                }
+
+                const uint32_t type = exprs[e - 1].type;
+                if ( type != EXPR_VARIABLE && type != EXPR_ARRAY &&
+                        type != EXPR_FUNC_SPC &&
+                        (type != EXPR_CONSTANT ||
+                         value_type(l, exprs[e - 1].val) !=
+                         IMAGE_VALUE_STRING) ) {
+                    return false;
+                }
+            }
+            return true;
+
+        case CHILD_ASSIGN:
+            return stmts[ref - 1].type == STATEMENT_ASSIGN &&
+                stmts[ref - 1].e[0] &&
+                (exprs[stmts[ref - 1].e[0] - 1].type == EXPR_VARIABLE ||
+                 exprs[stmts[ref - 1].e[0] - 1].type == EXPR_ARRAY);
+
+        default:
+            return false;
+    }
+}
+
+/* Returns the type of a value record, or zero for no value */
+static uint32_t
+value_type(struct loader * l, const uint32_t ref) {
+    const struct image_value * values = (const void *) l->sections[SECTION_VALUES];
+    return ref ? values[ref - 1].type : 0;
+}
+
+/* Returns true if a value record is a string which could name a
+ * variable, array or FN
+ */
+static bool
+is_name(struct loader * l, const uint32_t ref) {
+    if ( value_type(l, ref) != IMAGE_VALUE_STRING ) {
+        return false;
+    }
+
+    const struct image_value * values = (const void *) l->sections[SECTION_VALUES];
+    uint32_t offset;
+    memcpy(&offset, values[ref - 1].payload, sizeof offset);
+
+    const char * name = (const char *) l->sections[SECTION_STRINGS] + offset;
+    return variable_name_is_real(name) || variable_name_is_integer(name) ||
+        variable_name_is_resident(name) || variable_name_is_string(name);
+}
+
+/* Records a reference to a record, and returns false if the index is
+ * out of range or the record has already been referenced.
+ */
+static bool
+claim_ref(struct loader * l, const enum image_section kind,
+        const uint32_t ref) {
+    if ( ref == 0 ) {
+        return true;
+    }
+
+    if ( ref > l->header.counts[kind] || l->refs[kind][ref - 1] ) {
+        return false;
+    }
+
+    l->refs[kind][ref - 1] = 1;
+    return true;
+}
+
+/* Creates the program from a checked image. Every object is created
+ * first, and then linked to its children.
+ */
+static void
+create_program(struct loader * l) {
+    const uint32_t * counts = l->header.counts;
+    const char * strings = (const char *) l->sections[SECTION_STRINGS];
+    const struct image_value * values = (const void *) l->sections[SECTION_VALUES];
+    const struct image_expr * exprs = (const void *) l->sections[SECTION_EXPRS];
+    const struct image_item * items = (const void *) l->sections[SECTION_ITEMS];
+    const struct image_stmt * stmts = (const void *) l->sections[SECTION_STMTS];
+    const struct image_line * lines = (const void *) l->sections[SECTION_LINES];
+
+    l->values = x_malloc((counts[SECTION_VALUES] + 1) * sizeof *l->values);
+    for ( uint32_t i = 0; i < counts[SECTION_VALUES]; i++ ) {
+        if ( values[i].type == IMAGE_VALUE_STRING ) {
+            uint32_t offset;
+            memcpy(&offset, values[i].payload, sizeof offset);
+            l->values[i] = value_string_new(strings + offset);
+        } else if ( values[i].type == IMAGE_VALUE_INT ) {
+            int32_t n;
+            memcpy(&n, values[i].payload, sizeof n);
+            l->values[i] = value_int_new(n);
+        } else {
+            double f;
+            memcpy(&f, values[i].payload, sizeof f);
+            l->values[i] = value_float_new(f);
+        }
+    }
+
+    /* Link values from the end, so each append is to a single value */
+    for ( uint32_t i = counts[SECTION_VALUES]; i > 0; i-- ) {
+        if ( values[i - 1].next ) {
+            value_append(l->values[i - 1], l->values[values[i - 1].next - 1]);
+        }
+    }
+
+    l->exprs = x_malloc((counts[SECTION_EXPRS] + 1) * sizeof *l->exprs);
+    for ( uint32_t i = 0; i < counts[SECTION_EXPRS]; i++ ) {
+        l->exprs[i] = expr_compiled_new(exprs[i].type);
+        l->exprs[i]->val = DEREF(l->values, exprs[i].val);
+    }
+
+    for ( uint32_t i = 0; i < counts[SECTION_EXPRS]; i++ ) {
+        for ( size_t j = 0; j < EXPR_NUM_SUBS; j++ ) {
+            l->exprs[i]->subs[j] = DEREF(l->exprs, exprs[i].subs[j]);
+        }
+        l->exprs[i]->next = DEREF(l->exprs, exprs[i].next);
+    }
+
+    l->items = x_malloc((counts[SECTION_ITEMS] + 1) * sizeof *l->items);
+    for ( uint32_t i = 0; i < counts[SECTION_ITEMS]; i++ ) {
+        l->items[i] = x_malloc(sizeof *l->items[i]);
+        l->items[i]->spec = items[i].spec;
+        l->items[i]->e = DEREF(l->exprs, items[i].e);
+    }
+
+    for ( uint32_t i = 0; i < counts[SECTION_ITEMS]; i++ ) {
+        l->items[i]->next = DEREF(l->items, items[i].next);
+    }
+
+    l->stmts = x_malloc((counts[SECTION_STMTS] + 1) * sizeof *l->stmts);
+    for ( uint32_t i = 0; i < counts[SECTION_STMTS]; i++ ) {
+        struct statement * s = statement_compiled_new(stmts[i].type);
+        s->v = DEREF(l->values, stmts[i].v);
+        s->pl = DEREF(l->items, stmts[i].pl);
+        for ( size_t j = 0; j < STMT_NUM_EXPRS; j++ ) {
+            s->e[j] = DEREF(l->exprs, stmts[i].e[j]);
+        }
+        l->stmts[i] = s;
+    }
+
+    for ( uint32_t i = 0; i < counts[SECTION_STMTS]; i++ ) {
+        for ( size_t j = 0; j < STMT_NUM_STMTS; j++ ) {
+            l->stmts[i]->stmt[j] = DEREF(l->stmts, stmts[i].stmt[j]);
+        }
+        l->stmts[i]->next = DEREF(l->stmts, stmts[i].next);
+    }
+
+    for ( uint32_t i = 0; i < counts[SECTION_LINES]; i++ ) {
+        line_add(lines[i].number, l->stmts[lines[i].stmt - 1]);
+    }
+
+    x_free(l->values);
+    x_free(l->exprs);
+    x_free(l->items);
+    x_free(l->stmts);
+}
@@ -0,0 +1,28 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PG_BBASIC_INTERNAL_IMAGE_H
+#define PG_BBASIC_INTERNAL_IMAGE_H
+
+#include <stdbool.h>
+
+/* Compiled program image functions */
+int image_write(const char * filename, const bool report);
+bool image_detect(const char * filename);
+int image_load(const char * filename, const bool report);
+
+#endif  /* PG_BBASIC_INTERNAL_IMAGE_H */
@@ -0,0 +1,238 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Live introspection of a running program.
+ *
+ * The SIGUSR1 handler sets introspect_requested, and the statement
+ * loop notices it before the next statement and writes a status
+ * report: the current line, the PROC, FN and GOSUB calls in progress,
+ * the open files and their pointers, heap use, and the lines which
+ * have executed the most statements so far. The program then carries
+ * on running.
+ *
+ * To have this information to hand, the statement loop counts the
+ * statements executed on each line, and the call statements keep a
+ * stack of their targets. Both are cheap enough to do all the time.
+ */
+
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <signal.h>
+
+#include "introspect.h"
+#include "runtime.h"
+#include "statements.h"
+#include "value.h"
+#include "util.h"
+
+/* Number of hot lines to report */
+#define NUM_HOT_LINES (10)
+
+/* A line and its statement count, for the hot lines list */
+struct hot_line {
+    int line;
+    unsigned long count;
+};
+
+/* Introspection request flag */
+volatile sig_atomic_t introspect_requested;
+
+/* Statements executed on each line, indexed by line index. These and
+ * the call stack belong to the program running on this thread.
+ */
+THREAD_LOCAL unsigned long * introspect_line_counts;
+static THREAD_LOCAL size_t num_lines;
+
+/* Targets of the PROC, FN and GOSUB calls in progress */
+static THREAD_LOCAL const struct statement ** calls;
+static THREAD_LOCAL size_t num_calls;
+static THREAD_LOCAL size_t calls_capacity;
+
+/* Report file, or NULL to report to standard error */
+static THREAD_LOCAL FILE * report_file;
+
+/* Static function declarations */
+static void write_calls(FILE * fp);
+static void write_hot_lines(FILE * fp, const struct statement * program);
+static void write_heap(FILE * fp);
+
+
+/*********************************************************************
+ *                                                                   *
+ * Public introspection functions                                    *
+ *                                                                   *
+ *********************************************************************/
+
+/* Prepares for introspection of a program with nlines lines. Reports
+ * are appended to filename, or written to standard error if filename
+ * is NULL.
+ */
+void
+introspect_start(const char * filename, const size_t nlines) {
+    if ( filename ) {
+        report_file = x_fopen(filename, "a");
+    }
+
+    num_lines = nlines;
+    introspect_line_counts = x_calloc(nlines ? nlines : 1,
+            sizeof *introspect_line_counts);
+    num_calls = 0;
+}
+
+/* Records a PROC, FN or GOSUB call. target is the DEF statement for a
+ * PROC or FN, or the first statement branched to for a GOSUB.
+ */
+void
+introspect_call_enter(const struct statement * target) {
+    if ( num_calls == calls_capacity ) {
+        calls_capacity = calls_capacity ? calls_capacity * 2 : 64;
+        calls = x_realloc(calls, calls_capacity * sizeof *calls);
+    }
+
+    calls[num_calls++] = target;
+}
+
+/* Records a return from the most recent call */
+void
+introspect_call_exit(void) {
+    if ( num_calls > 0 ) {
+        num_calls--;
+    }
+}
+
+/* Writes a status report. program is the first statement of the
+ * program, and current is the statement about to be executed.
+ */
+void
+introspect_report(const struct statement * program,
+        const struct statement * current) {
+    FILE * fp = report_file ? report_file : stderr;
+
+    fprintf(fp, "%s: status at line %d\n", PACKAGE, current->line_number);
+    write_calls(fp);
+    fprintf(fp, "  Open files:\n");
+    open_files_report(fp);
+    write_heap(fp);
+    write_hot_lines(fp, program);
+    fflush(fp);
+}
+
+/* Frees the resources used for introspection */
+void
+introspect_finish(void) {
+    if ( report_file ) {
+        x_fclose(report_file);
+        report_file = NULL;
+    }
+
+    x_free(introspect_line_counts);
+    introspect_line_counts = NULL;
+    x_free(calls);
+    calls = NULL;
+    num_calls = 0;
+    calls_capacity = 0;
+}
+
+
+/*********************************************************************
+ *                                                                   *
+ * Static functions                                                  *
+ *                                                                   *
+ *********************************************************************/
+
+/* Writes the calls in progress, outermost first */
+static void
+write_calls(FILE * fp) {
+    fprintf(fp, "  Call stack (depth %zu):\n", num_calls);
+    for ( size_t i = 0; i < num_calls; i++ ) {
+        const struct statement * target = calls[i];
+        if ( target->type == STATEMENT_DEF_PROC ||
+                target->type == STATEMENT_DEF_FN ) {
+            fprintf(fp, "    %s (line %d)\n",
+                    value_string_peek(target->v), target->line_number);
+        } else {
+            fprintf(fp, "    GOSUB %d\n", target->line_number);
+        }
+    }
+}
+
+/* Writes the current and peak heap use */
+static void
+write_heap(FILE * fp) {
+#if HAVE_MALLOC_USABLE_SIZE
+    fprintf(fp, "  Heap: %zu bytes, peak %zu bytes, "
+            "%lu allocations, %lu frees\n",
+            x_heap_size, x_heap_peak, x_alloc_count, x_free_count);
+#else
+    fprintf(fp, "  Heap: %lu allocations, %lu frees\n",
+            x_alloc_count, x_free_count);
+#endif
+}
+
+/* Writes the lines which have executed the most statements */
+static void
+write_hot_lines(FILE * fp, const struct statement * program) {
+    struct hot_line hot[NUM_HOT_LINES];
+    size_t num_hot = 0;
+    unsigned long total = 0;
+
+    /* Every line has at least one statement in the top-level list,
+     * which gives the line number for each line index.
+     */
+    int last_index = -1;
+    for ( const struct statement * s = program; s; s = s->next ) {
+        if ( s->line_index == last_index ) {
+            continue;
+        }
+        last_index = s->line_index;
+
+        if ( s->line_index < 0 || (size_t) s->line_index >= num_lines ) {
+            continue;
+        }
+
+        const unsigned long count = introspect_line_counts[s->line_index];
+        total += count;
+        if ( count == 0 ) {
+            continue;
+        }
+
+        /* Insert into the list, which is kept in descending order */
+        size_t i = num_hot < NUM_HOT_LINES ? num_hot++ : NUM_HOT_LINES;
+        while ( i > 0 && hot[i - 1].count < count ) {
+            if ( i < NUM_HOT_LINES ) {
+                hot[i] = hot[i - 1];
+            }
+            i--;
+        }
+        if ( i < NUM_HOT_LINES ) {
+            hot[i].line = s->line_number;
+            hot[i].count = count;
+        }
+    }
+
+    fprintf(fp, "  Statements executed: %lu\n", total);
+    fprintf(fp, "  Hot lines:\n");
+    fprintf(fp, "    %8s %12s %7s\n", "Line", "Statements", "%");
+    for ( size_t i = 0; i < num_hot; i++ ) {
+        fprintf(fp, "    %8d %12lu %7.2f\n", hot[i].line, hot[i].count,
+                100.0 * hot[i].count / total);
+    }
+}
@@ -0,0 +1,45 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PG_BBASIC_INTERNAL_INTROSPECT_H
+#define PG_BBASIC_INTERNAL_INTROSPECT_H
+
+#include "internal.h"
+
+#include <stddef.h>
+#include <signal.h>
+
+/* Opaque and incomplete struct definitions */
+struct statement;
+
+/* Set by the SIGUSR1 handler to request a status report */
+extern volatile sig_atomic_t introspect_requested;
+
+/* Statements executed on each line, indexed by line index, which
+ * the statement loop increments directly.
+ */
+extern THREAD_LOCAL unsigned long * introspect_line_counts;
+
+/* Introspection functions */
+void introspect_start(const char * filename, const size_t nlines);
+void introspect_call_enter(const struct statement * target);
+void introspect_call_exit(void);
+void introspect_report(const struct statement * program,
+        const struct statement * current);
+void introspect_finish(void);
+
+#endif  /* PG_BBASIC_INTERNAL_INTROSPECT_H */
@@ -0,0 +1,462 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Lazy loading of PROC and FN bodies, for the --lazy option.
+ *
+ * Before a program is parsed, its source is scanned for line numbers
+ * and for lines starting with DEF PROC or DEF FN. The lines after
+ * each DEF line, up to the next one, are taken to be its body, and
+ * are cut out of the source, leaving their newlines so that syntax
+ * errors are reported at the right lines. The DEF lines themselves
+ * are parsed with the rest of the program, so every PROC and FN is
+ * defined as usual, but a DEF whose body was cut out loads it the
+ * first time it is executed, which happens on the first call. A
+ * branch to a line in a body which hasn't been loaded loads it too.
+ *
+ * A body is left in place if its DEF line holds anything after the
+ * DEF, or if it contains DATA, which must all be known before the
+ * program runs, or a DEF later in a line. If the scan finds anything
+ * the parser might not see the same way, such as lines out of order
+ * or a string which might run on to the next line, it leaves every
+ * body in place and the program is parsed as usual.
+ *
+ * Line indices, which the profiler and introspection count by, are
+ * numbered over the whole program, including bodies not yet loaded,
+ * so that loading a body doesn't change them.
+ */
+
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "lazy.h"
+#include "runtime.h"
+#include "statements.h"
+#include "util.h"
+#include "yydecls.h"
+
+/* Most digits in a line number the lexer will accept */
+#define MAX_LINE_DIGITS (9)
+
+/* A PROC or FN body cut out of the source */
+struct body {
+    int def_line;
+    int first_line;
+    int last_line;
+    int source_line;
+    char * text;
+    size_t size;
+    struct statement * def;
+};
+
+/* A line of source, as scanned */
+struct scan_line {
+    size_t start;
+    size_t end;
+    int number;
+    int source_line;
+    bool def;
+    bool plain;
+    bool cut;
+};
+
+/* The bodies cut out of the source, in line order */
+static THREAD_LOCAL struct body * bodies;
+static THREAD_LOCAL size_t num_bodies;
+
+/* The numbers of all the lines in the program, in order */
+static THREAD_LOCAL int * line_numbers;
+static THREAD_LOCAL size_t num_line_numbers;
+
+/* Static function declarations */
+static bool scan_line(const char * p, const char * end,
+        struct scan_line * line);
+static bool contains(const char * p, const char * end, const char * word);
+static void cut_bodies(const char * source, struct scan_line * scan,
+        const size_t n);
+static struct body * find_body(const int def_line);
+static int load_body(struct body * body);
+static int exec_def(struct statement * s);
+
+
+/*********************************************************************
+ *                                                                   *
+ * Public lazy loading functions                                     *
+ *                                                                   *
+ *********************************************************************/
+
+/* Scans the len bytes of source, which are followed by two NULs, and
+ * cuts out the PROC and FN bodies which can be loaded lazily, updating
+ * len. Returns true if any were cut out.
+ */
+bool
+lazy_scan(char * source, size_t * len) {
+    lazy_free();
+
+    struct scan_line * scan = NULL;
+    size_t n = 0;
+    size_t capacity = 0;
+    int last_number = -1;
+    bool ok = true;
+
+    size_t pos = 0;
+    while ( ok && pos < *len ) {
+        const char * eol = memchr(source + pos, '\n', *len - pos);
+        const size_t end = eol ? (size_t) (eol - source) + 1 : *len;
+
+        if ( n == capacity ) {
+            capacity = capacity ? capacity * 2 : 256;
+            scan = x_realloc(scan, capacity * sizeof *scan);
+        }
+
+        struct scan_line * line = &scan[n];
+        line->start = pos;
+        line->end = end;
+        line->source_line = n + 1;
+        ok = scan_line(source + pos, source + end, line);
+        if ( line->number >= 0 ) {
+            ok = ok && line->number > last_number;
+            last_number = line->number;
+        }
+
+        n++;
+        pos = end;
+    }
+
+    if ( ok ) {
+        cut_bodies(source, scan, n);
+    }
+
+    if ( num_bodies > 0 ) {
+        /* Record every line number, for the line indices */
+        line_numbers = x_malloc(n * sizeof *line_numbers);
+        for ( size_t i = 0; i < n; i++ ) {
+            if ( scan[i].number >= 0 ) {
+                line_numbers[num_line_numbers++] = scan[i].number;
+            }
+        }
+
+        /* Close up the source, leaving the newlines of the bodies */
+        size_t w = 0;
+        for ( size_t i = 0; i < n; i++ ) {
+            if ( scan[i].cut ) {
+                if ( source[scan[i].end - 1] == '\n' ) {
+                    source[w++] = '\n';
+                }
+            } else {
+                memmove(source + w, source + scan[i].start,
+                        scan[i].end - scan[i].start);
+                w += scan[i].end - scan[i].start;
+            }
+        }
+        source[w] = '\0';
+        source[w + 1] = '\0';
+        *len = w;
+    }
+
+    x_free(scan);
+
+    return num_bodies > 0;
+}
+
+/* Returns true if any bodies were cut out of the program */
+bool
+lazy_active(void) {
+    return num_bodies > 0;
+}
+
+/* Returns the index of a line in the whole program, or -1 if there's
+ * no such line.
+ */
+int
+lazy_line_index(const int line) {
+    size_t low = 0;
+    size_t high = num_line_numbers;
+    while ( low < high ) {
+        const size_t mid = low + (high - low) / 2;
+        if ( line_numbers[mid] < line ) {
+            low = mid + 1;
+        } else if ( line_numbers[mid] > line ) {
+            high = mid;
+        } else {
+            return mid;
+        }
+    }
+
+    return -1;
+}
+
+/* Returns the number of lines in the whole program */
+size_t
+lazy_num_lines(void) {
+    return num_line_numbers;
+}
+
+/* Arranges for a DEF statement being built into the program to load
+ * its body when it is executed, if its body was cut out.
+ */
+void
+lazy_attach(struct statement * def) {
+    struct body * body = find_body(def->line_number);
+    if ( body && body->def_line == def->line_number && body->text ) {
+        body->def = def;
+        def->exec = exec_def;
+    }
+}
+
+/* Loads the body containing a line, if it hasn't been loaded, and
+ * returns true if it was loaded.
+ */
+bool
+lazy_load_line(const int line) {
+    struct body * body = find_body(line);
+    if ( !body || !body->text || !body->def ||
+            line < body->first_line || line > body->last_line ) {
+        return false;
+    }
+
+    return load_body(body) == STATUS_OK;
+}
+
+/* Frees the bodies and line numbers */
+void
+lazy_free(void) {
+    for ( size_t i = 0; i < num_bodies; i++ ) {
+        x_free(bodies[i].text);
+    }
+    x_free(bodies);
+    bodies = NULL;
+    num_bodies = 0;
+
+    x_free(line_numbers);
+    line_numbers = NULL;
+    num_line_numbers = 0;
+}
+
+
+/*********************************************************************
+ *                                                                   *
+ * Static functions                                                  *
+ *                                                                   *
+ *********************************************************************/
+
+/* Scans a line of source, ending at end. Sets its number, or -1 for
+ * a blank line, whether it's a DEF line, and whether it's plain: for
+ * a DEF line, holding nothing else, and for other lines, holding no
+ * DATA or DEF. Returns false if the line might not be parsed as a
+ * single line, or might not have the number found here.
+ */
+static bool
+scan_line(const char * p, const char * end, struct scan_line * line) {
+    line->number = -1;
+    line->def = false;
+    line->plain = true;
+    line->cut = false;
+
+    size_t quotes = 0;
+    for ( const char * q = p; q < end; q++ ) {
+        if ( *q == '"' ) {
+            quotes++;
+        }
+    }
+    if ( quotes % 2 ) {
+        return false;
+    }
+
+    while ( p < end && (*p == ' ' || *p == '\t') ) {
+        p++;
+    }
+    if ( p == end || *p == '\n' ) {
+        return true;
+    }
+
+    /* The lexer reads a leading zero on its own, and reads a number
+     * followed by a point or an exponent as a float
+     */
+    if ( !isdigit((unsigned char) *p) ||
+            (*p == '0' && p + 1 < end && isdigit((unsigned char) p[1])) ) {
+        return false;
+    }
+
+    int number = 0;
+    int digits = 0;
+    while ( p < end && isdigit((unsigned char) *p) ) {
+        if ( ++digits > MAX_LINE_DIGITS ) {
+            return false;
+        }
+        number = number * 10 + (*p++ - '0');
+    }
+    if ( p < end && (*p == '.' || *p == 'E' || *p == 'e') ) {
+        return false;
+    }
+    line->number = number;
+
+    while ( p < end && (*p == ' ' || *p == '\t') ) {
+        p++;
+    }
+
+    if ( end - p > 3 && !strncmp(p, "DEF", 3) ) {
+        const char * q = p + 3;
+        while ( q < end && (*q == ' ' || *q == '\t') ) {
+            q++;
+        }
+
+        if ( (end - q > 4 && !strncmp(q, "PROC", 4)) ||
+                (end - q > 2 && !strncmp(q, "FN", 2)) ) {
+            line->def = true;
+            line->plain = !memchr(q, ':', end - q);
+            return true;
+        }
+    }
+
+    line->plain = !contains(p, end, "DATA") && !contains(p, end, "DEF");
+    return true;
+}
+
+/* Returns true if a word appears anywhere between p and end */
+static bool
+contains(const char * p, const char * end, const char * word) {
+    const size_t len = strlen(word);
+    for ( ; (size_t) (end - p) >= len; p++ ) {
+        if ( *p == *word && !strncmp(p, word, len) ) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Copies out the bodies following plain DEF lines, and marks their
+ * lines as cut.
+ */
+static void
+cut_bodies(const char * source, struct scan_line * scan, const size_t n) {
+    size_t capacity = 0;
+
+    for ( size_t i = 0; i < n; i++ ) {
+        if ( !scan[i].def ) {
+            continue;
+        }
+
+        /* The body runs up to the next DEF line */
+        size_t j = i + 1;
+        bool plain = scan[i].plain;
+        int first_line = -1;
+        int last_line = -1;
+        while ( j < n && !scan[j].def ) {
+            plain = plain && scan[j].plain;
+            if ( scan[j].number >= 0 ) {
+                if ( first_line < 0 ) {
+                    first_line = scan[j].number;
+                }
+                last_line = scan[j].number;
+            }
+            j++;
+        }
+
+        if ( plain && first_line >= 0 ) {
+            if ( num_bodies == capacity ) {
+                capacity = capacity ? capacity * 2 : 64;
+                bodies = x_realloc(bodies, capacity * sizeof *bodies);
+            }
+
+            struct body * body = &bodies[num_bodies++];
+            const size_t start = scan[i + 1].start;
+            const size_t len = scan[j - 1].end - start;
+            body->def_line = scan[i].number;
+            body->first_line = first_line;
+            body->last_line = last_line;
+            body->source_line = scan[i + 1].source_line;
+            body->size = len + 2;
+            body->text = x_malloc(body->size);
+            memcpy(body->text, source + start, len);
+            body->text[len] = '\0';
+            body->text[len + 1] = '\0';
+            body->def = NULL;
+
+            for ( size_t k = i + 1; k < j; k++ ) {
+                scan[k].cut = true;
+            }
+        }
+
+        i = j - 1;
+    }
+}
+
+/* Returns the last body whose DEF line is no later than line, or NULL
+ * if there is none.
+ */
+static struct body *
+find_body(const int line) {
+    size_t low = 0;
+    size_t high = num_bodies;
+    while ( low < high ) {
+        const size_t mid = low + (high - low) / 2;
+        if ( bodies[mid].def_line <= line ) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low > 0 ? &bodies[low - 1] : NULL;
+}
+
+/* Parses a body and links it into the program after its DEF */
+static int
+load_body(struct body * body) {
+    body->def->exec = NULL;
+
+    yylineno = body->source_line;
+    YY_BUFFER_STATE buffer = yy_scan_buffer(body->text, body->size);
+    const int status = yyparse();
+    yy_delete_buffer(buffer);
+
+    x_free(body->text);
+    body->text = NULL;
+
+    /* Link in whatever was parsed, even after a syntax error, so that
+     * it's freed along with the rest of the program
+     */
+    program_link(body->def);
+
+    if ( status != 0 ) {
+        error_set(ERR_SYNTAX_ERROR);
+        return ERR_SYNTAX_ERROR;
+    }
+
+    return STATUS_OK;
+}
+
+/* Executes a DEF statement whose body hasn't been loaded, by loading
+ * it and carrying on into it.
+ */
+static int
+exec_def(struct statement * s) {
+    const int status = load_body(find_body(s->line_number));
+    if ( status != STATUS_OK ) {
+        return status;
+    }
+
+    set_pc(s->next);
+
+    return STATUS_OK;
+}
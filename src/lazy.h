@@ -0,0 +1,36 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PG_BBASIC_INTERNAL_LAZY_H
+#define PG_BBASIC_INTERNAL_LAZY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Opaque and incomplete struct definition */
+struct statement;
+
+/* Lazy PROC and FN body functions */
+bool lazy_scan(char * source, size_t * len);
+bool lazy_active(void);
+int lazy_line_index(const int line);
+size_t lazy_num_lines(void);
+void lazy_attach(struct statement * def);
+bool lazy_load_line(const int line);
+void lazy_free(void);
+
+#endif  /* PG_BBASIC_INTERNAL_LAZY_H */
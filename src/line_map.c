@@ -25,7 +25,9 @@
 
 #include "line_map.h"
 #include "hash.h"
+#include "lazy.h"
 #include "runtime.h"
+#include "stats.h"
 #include "util.h"
 
 #define NUM_BUCKETS (257)
@@ -38,12 +40,13 @@ struct entry {
 };
 
 /* The line map */
-static struct table {
+static THREAD_LOCAL struct table {
     struct entry * buckets[NUM_BUCKETS];
 } table;
 
 /* Static function declarations */
 static void entry_free(struct entry * ref);
+static struct statement * find(const int line);
 static void table_free(void);
 
 /* Adds a line to the branch table */
@@ -65,7 +68,7 @@ line_map_add(const int line, struct statement * stmt) {
             if ( current->line == ref->line ) {
                 /* There is a duplicate line number */
                 error_set(ERR_BAD_PROGRAM);
-                free(ref);
+                x_free(ref);
                 line_map_free();
                 return STATUS_ERROR;
             }
@@ -85,16 +88,15 @@ line_map_add(const int line, struct statement * stmt) {
 /* Looks for a statement in the line map */
 struct statement *
 line_map_find(const int line) {
-    struct statement * stmt = NULL;
+    if ( stats_active ) {
+        stats_line_lookups++;
+    }
 
-    const size_t hash = int_hash(line, NUM_BUCKETS);
-    struct entry * current = table.buckets[hash];
-    while ( current ) {
-        if ( current->line == line ) {
-            stmt = current->stmt;
-            break;
-        }
-        current = current->next;
+    struct statement * stmt = find(line);
+
+    /* The line may be in a PROC or FN body not loaded yet */
+    if ( stmt == NULL && lazy_load_line(line) ) {
+        stmt = find(line);
     }
 
     if ( stmt == NULL ) {
@@ -112,10 +114,40 @@ line_map_free(void) {
             struct entry * current = table.buckets[i];
             while ( current ) {
                 struct entry * tmp = current->next;
-                free(current);
+                x_free(current);
                 current = tmp;
             }
             table.buckets[i] = NULL; /* So we could reuse it */
         }
     }
 }
+
+/* Removes a line from the line map, if it's there */
+void
+line_map_remove(const int line) {
+    struct entry ** link = &table.buckets[int_hash(line, NUM_BUCKETS)];
+    while ( *link ) {
+        if ( (*link)->line == line ) {
+            struct entry * tmp = *link;
+            *link = tmp->next;
+            x_free(tmp);
+            return;
+        }
+        link = &(*link)->next;
+    }
+}
+
+/* Looks for a statement in the line map, without reporting an error */
+static struct statement *
+find(const int line) {
+    const size_t hash = int_hash(line, NUM_BUCKETS);
+    struct entry * current = table.buckets[hash];
+    while ( current ) {
+        if ( current->line == line ) {
+            return current->stmt;
+        }
+        current = current->next;
+    }
+
+    return NULL;
+}
@@ -24,5 +24,6 @@ struct statement;
 int line_map_add(const int line, struct statement * stmt);
 struct statement * line_map_find(const int line);
 void line_map_free(void);
+void line_map_remove(const int line);
 
 #endif  /* PG_BBASIC_INTERNAL_LINE_MAP_H */
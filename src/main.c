@@ -22,6 +22,10 @@
 #include <string.h>
 #include <signal.h>
 
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
 #include "parser.h"
 #include "util.h"
 #include "options.h"
@@ -29,6 +33,16 @@
 #include "symbols.h"
 #include "yydecls.h"
 #include "terminal.h"
+#include "stats.h"
+#include "introspect.h"
+#include "image.h"
+#include "cache.h"
+#include "server.h"
+#include "batch.h"
+#include "lazy.h"
+#include "checkpoint.h"
+#include "repl.h"
+#include "watch.h"
 
 /* Signal handler */
 void
@@ -42,41 +56,262 @@ handler(int signum) {
     interrupt = 1;
 }
 
+/* SIGUSR1 handler, which asks for a status report before the next
+ * statement is executed.
+ */
+void
+introspect_handler(int signum) {
+    (void) signum;
+
+    introspect_requested = 1;
+}
+
+/* SIGUSR2 handler, which asks for a checkpoint before the next
+ * statement is executed. It also handles SIGALRM for periodic
+ * checkpoints, and sets the next alarm.
+ */
+void
+checkpoint_handler(int signum) {
+    if ( signum == SIGALRM ) {
+        alarm(checkpoint_interval);
+    }
+
+    checkpoint_requested = 1;
+}
+
+/* Identifies the program for checkpoints, by its path and source */
+static void
+identify_program(void) {
+    if ( input_inline ) {
+        checkpoint_set_program("", input_inline, strlen(input_inline));
+        return;
+    }
+
+    size_t len;
+    char * source = cache_read_source(input_filename, &len);
+    checkpoint_set_program(input_filename, source, len);
+    x_free(source);
+}
+
+/* Writes the parsed program to a compiled image, named by the -o
+ * option or else after the input file.
+ */
+static int
+compile(void) {
+    if ( output_filename ) {
+        return image_write(output_filename, true);
+    }
+
+    if ( !input_filename ) {
+        fprintf(stderr, "%s: no output file for inline input\n", PACKAGE);
+        return STATUS_ERROR;
+    }
+
+    /* Replace a .basic or .bas extension, or else append one */
+    const size_t len = strlen(input_filename);
+    char * filename = x_malloc(len + 5);
+    strcpy(filename, input_filename);
+
+    char * dot = strrchr(filename, '.');
+    if ( dot && strchr(dot, '/') == NULL &&
+            (!strcmp(dot, ".basic") || !strcmp(dot, ".bas")) ) {
+        *dot = '\0';
+    }
+    strcat(filename, ".bbi");
+
+    const int status = image_write(filename, true);
+    x_free(filename);
+
+    return status;
+}
+
+/* Runs the program, reports any statistics, and returns the exit
+ * status.
+ */
+static int
+run(void) {
+    int status = program_run();
+
+    if ( counts_flag ) {
+        stats_report_counts();
+    }
+
+    if ( stats_flag || stats_json_flag ) {
+        stats_report(stats_json_flag);
+    }
+
+    if ( status != STATUS_OK ) {
+        if ( status >= 0 ) {
+            return status;
+        }
+
+        if ( error_is_set() ) {
+            status = error_code();
+            if ( status > 0 ) {
+                return status;
+            }
+        }
+
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
 /* Main function */
 int main(int argc, char ** argv) {
     YY_BUFFER_STATE buffer = NULL;
-    FILE * infile = NULL;
+    char * source = NULL;
+    char * cache_path = NULL;
+    bool interactive = false;
 
     process_options(argc, argv);
+
+    /* Have a server run the program instead, if requested */
+    if ( connect_socket ) {
+        return server_connect(connect_socket);
+    }
+
+    /* Run a batch of programs instead, if requested. The profilers,
+     * the flight recorder and checkpoints keep their state for the
+     * whole process, so can't follow jobs on several threads.
+     */
+    if ( batch_filename && (profile_filename || profile_stacks_filename ||
+                profile_samples_filename || recorder_filename ||
+                checkpoint_filename || restore_filename) ) {
+        fprintf(stderr, "%s: --batch can't be used with --profile, "
+                "--profile-stacks, --profile-samples, --recorder, "
+                "--checkpoint or --restore\n", PACKAGE);
+        return EXIT_FAILURE;
+    }
+
+    if ( batch_filename ) {
+        return batch_run(batch_filename, jobs_count);
+    }
+
+    if ( watch_flag && (!input_filename || input_inline) ) {
+        fprintf(stderr, "%s: --watch needs a program file\n", PACKAGE);
+        return EXIT_FAILURE;
+    }
+
+    if ( watch_flag && (compile_flag || server_socket || restore_filename) ) {
+        fprintf(stderr, "%s: --watch can't be used with --compile, "
+                "--server or --restore\n", PACKAGE);
+        return EXIT_FAILURE;
+    }
+
+    if ( checkpoint_interval && !checkpoint_filename ) {
+        fprintf(stderr, "%s: --checkpoint-interval needs --checkpoint\n",
+                PACKAGE);
+        return EXIT_FAILURE;
+    }
+
+    /* Resume the program a checkpoint was taken from, unless told
+     * which program to resume
+     */
+    if ( restore_filename && !input_filename && !input_inline ) {
+        input_filename = checkpoint_program_path(restore_filename);
+    }
+
+    if ( (checkpoint_filename || restore_filename) &&
+            (input_filename || input_inline) ) {
+        identify_program();
+    }
+
     defer_lex_finalize();
+    stats_active = stats_flag || stats_json_flag || counts_flag;
 
     /* Get input depending on command line */
-    if ( input_inline ) {
+    if ( watch_flag ) {
+        /* watch_run() loads the program itself */
+    } else if ( input_filename && !input_inline &&
+            image_detect(input_filename) ) {
+        /* Load a compiled program instead of parsing */
+        stats_phase_begin(STATS_PHASE_PARSE);
+        const int loaded = image_load(input_filename, true);
+        stats_phase_end(STATS_PHASE_PARSE);
+
+        if ( loaded != STATUS_OK ) {
+            return EXIT_FAILURE;
+        }
+    } else if ( input_inline ) {
         /* Process inline input if provided */
         buffer = yy_scan_buffer(input_inline, strlen(input_inline)+2);
+    } else if ( input_filename && lazy_flag && !compile_flag ) {
+        /* Parse only the main program and the DEF lines now, leaving
+         * the PROC and FN bodies until they are called
+         */
+        size_t len;
+        source = cache_read_source(input_filename, &len);
+
+        stats_phase_begin(STATS_PHASE_PARSE);
+        lazy_scan(source, &len);
+        stats_phase_end(STATS_PHASE_PARSE);
+
+        buffer = yy_scan_buffer(source, len + 2);
+    } else if ( input_filename && !no_cache_flag && !compile_flag &&
+            cache_start(cache_dir, cache_size) ) {
+        /* Load the program from the cache if it has been run before,
+         * or else parse it from memory and cache it afterwards.
+         */
+        size_t len;
+        source = cache_read_source(input_filename, &len);
+        cache_path = cache_image_path(source, len);
+
+        stats_phase_begin(STATS_PHASE_PARSE);
+        const bool cached = cache_load(cache_path);
+        stats_phase_end(STATS_PHASE_PARSE);
+
+        if ( cached ) {
+            x_free(cache_path);
+            cache_path = NULL;
+        } else {
+            buffer = yy_scan_buffer(source, len + 2);
+        }
     } else if ( input_filename ) {
-        /* Otherwise process input file */
-        infile = x_fopen(input_filename, "r");
-        yyrestart(infile);
+        /* Otherwise process input file, from memory so that a
+         * tokenised program can be decoded first
+         */
+        size_t len;
+        source = cache_read_source(input_filename, &len);
+        buffer = yy_scan_buffer(source, len + 2);
+    } else if ( !compile_flag && !server_socket && !checkpoint_filename ) {
+        /* With no program given, enter one interactively */
+        interactive = true;
     } else {
         fprintf(stderr, "%s: no input provided\n", PACKAGE);
         return EXIT_FAILURE;
     }
 
-    /* Save status to exit after freeing resources on error */
-    int status = yyparse();
-
-    /* Free input depending on input method */
+    int status = 0;
     if ( buffer ) {
+        /* Save status to exit after freeing resources on error */
+        stats_phase_begin(STATS_PHASE_PARSE);
+        status = yyparse();
+        stats_phase_end(STATS_PHASE_PARSE);
+
         yy_delete_buffer(buffer);
-    } else if ( infile ) {
-        x_fclose(infile);
+
+        if ( status == 0 && cache_path ) {
+            cache_store(cache_path);
+        }
     }
 
+    x_free(source);
+    x_free(cache_path);
+    cache_finish();
+
     if ( status != 0 ) {
         return EXIT_FAILURE;
     }
 
+    /* Write a compiled image instead of running, if requested */
+    if ( compile_flag ) {
+        status = compile();
+        runtime_free();
+        return status == STATUS_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     /* Catch SIGINT, to print an Escape error message, and to
      * clean up the terminal, if necessary.
      */
@@ -90,26 +325,61 @@ int main(int argc, char ** argv) {
         exit(EXIT_FAILURE);
     }
 
-    /* Run program */
+    /* Catch SIGUSR1, to write a status report and carry on. Restart
+     * interrupted system calls, so reads aren't cut short.
+     */
+    act.sa_handler = introspect_handler;
+    act.sa_flags = SA_RESTART;
+    if ( sigaction(SIGUSR1, &act, NULL) == -1 ) {
+        perror("sigaction failed");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Run program, or serve it to clients */
     symbol_table_init();
     x_atexit(tty_atexit);
+#if ENABLE_ANSI_COLOURS
+    x_atexit(reset_colours);
+#endif
 
-    status = program_run();
+    if ( interactive ) {
+        return repl_run();
+    }
 
-    if ( status != STATUS_OK ) {
-        if ( status >= 0 ) {
-            return status;
-        }
+    if ( watch_flag ) {
+        return watch_run(input_filename);
+    }
 
-        if ( error_is_set() ) {
-            status = error_code();
-            if ( status > 0 ) {
-                return status;
-            }
-        }
+    if ( server_socket ) {
+        program_build();
+        return server_run(server_socket, run);
+    }
 
+    if ( restore_filename &&
+            checkpoint_restore(restore_filename) != STATUS_OK ) {
+        runtime_free();
         return EXIT_FAILURE;
     }
 
-    return EXIT_SUCCESS;
+    /* Catch SIGUSR2, and SIGALRM if checkpoints are periodic, to write
+     * a checkpoint and carry on
+     */
+    if ( checkpoint_filename ) {
+        act.sa_handler = checkpoint_handler;
+        if ( sigaction(SIGUSR2, &act, NULL) == -1 ||
+                (checkpoint_interval &&
+                 sigaction(SIGALRM, &act, NULL) == -1) ) {
+            perror("sigaction failed");
+            exit(EXIT_FAILURE);
+        }
+
+        if ( checkpoint_interval ) {
+            alarm(checkpoint_interval);
+        }
+    }
+
+    status = run();
+    checkpoint_finish();
+
+    return status;
 }
@@ -0,0 +1,444 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Functions for formatting numbers directly into a caller-supplied
+ * buffer. The output is identical to that of the printf %G, %E and
+ * %F conversions, but integers are converted directly, and doubles
+ * are rounded exactly using double arithmetic rather than going
+ * through the C library. Values which can't be converted exactly
+ * this way (very large or very small magnitudes, infinities and
+ * NaNs) fall back to snprintf.
+ */
+
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "num_format.h"
+#include "util.h"
+
+/* Returned by the static formatting functions when a value can't
+ * be formatted without the C library
+ */
+#define NOT_EXACT ((size_t) -1)
+
+/* Maximum number of significant digits we'll produce ourselves */
+#define MAX_DIGITS (15)
+
+/* Doubles below 2^52 have a resolution of at least one half, so
+ * we can exactly separate their integer and fractional parts
+ */
+#define EXACT_LIMIT (4503599627370496.0)
+
+/* Powers of ten exactly representable as doubles */
+static const double double_powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* Integer powers of ten up to 10^MAX_DIGITS */
+static const uint64_t int_powers[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL
+};
+
+/* Static function declarations */
+static size_t format_double(char * buffer, const double d,
+        const enum number_format mode, const int precision);
+static size_t format_fallback(char * buffer, const double d,
+        const enum number_format mode, const int precision, const int width);
+static size_t format_int(char * buffer, const int32_t n,
+        const enum number_format mode, const int precision);
+static size_t pad_field(char * buffer, const size_t len, const int width);
+static bool scale_round(const double d, const int k, uint64_t * out);
+static bool significant_digits(const double d, const int p,
+        uint64_t * digits, int * exponent);
+static size_t write_exponent(char * buffer, const int exponent);
+static size_t write_uint(char * buffer, uint64_t n, const size_t min_digits);
+
+
+/*********************************************************************
+ *                                                                   *
+ * Public formatting function                                        *
+ *                                                                   *
+ *********************************************************************/
+
+/* Writes a numeric value into buffer, which must be at least
+ * NUM_FORMAT_BUFFER_SIZE bytes, and returns the number of characters
+ * written, not including the terminating null. mode selects the
+ * equivalent of the printf %G, %E or %F conversions, precision has
+ * the same meaning as the printf precision for those conversions,
+ * and the result is right-justified in a field of the specified
+ * width.
+ */
+size_t
+num_format(char * buffer, struct value * v, const enum number_format mode,
+        const int precision, const int width) {
+    size_t len = NOT_EXACT;
+
+    if ( value_is_int(v) ) {
+        len = format_int(buffer, value_int(v), mode, precision);
+    }
+
+    if ( len == NOT_EXACT ) {
+        len = format_double(buffer, value_float(v), mode, precision);
+    }
+
+    if ( len == NOT_EXACT ) {
+        return format_fallback(buffer, value_float(v), mode, precision, width);
+    }
+
+    return pad_field(buffer, len, width);
+}
+
+
+/*********************************************************************
+ *                                                                   *
+ * Static formatting functions                                       *
+ *                                                                   *
+ *********************************************************************/
+
+/* Formats a double, returning NOT_EXACT if it can't be exactly
+ * converted with double arithmetic
+ */
+static size_t
+format_double(char * buffer, const double d,
+        const enum number_format mode, const int precision) {
+    if ( !isfinite(d) ) {
+        return NOT_EXACT;
+    }
+
+    const double m = fabs(d);
+    size_t len = 0;
+
+    if ( signbit(d) ) {
+        buffer[len++] = '-';
+    }
+
+    uint64_t n;
+    int exponent;
+    char digits[MAX_DIGITS + 1];
+
+    switch ( mode ) {
+        case FORMAT_FIXED:
+            if ( !scale_round(m, precision, &n) ) {
+                return NOT_EXACT;
+            }
+
+            /* Ensure there is at least one digit before the point */
+            const size_t nd = write_uint(digits, n, precision + 1);
+            if ( nd > MAX_DIGITS ) {
+                return NOT_EXACT;
+            }
+
+            memcpy(buffer + len, digits, nd - precision);
+            len += nd - precision;
+            if ( precision > 0 ) {
+                buffer[len++] = '.';
+                memcpy(buffer + len, digits + nd - precision, precision);
+                len += precision;
+            }
+
+            break;
+
+        case FORMAT_SCIENTIFIC:
+            if ( !significant_digits(m, precision + 1, &n, &exponent) ) {
+                return NOT_EXACT;
+            }
+
+            write_uint(digits, n, precision + 1);
+            buffer[len++] = digits[0];
+            if ( precision > 0 ) {
+                buffer[len++] = '.';
+                memcpy(buffer + len, digits + 1, precision);
+                len += precision;
+            }
+            len += write_exponent(buffer + len, exponent);
+
+            break;
+
+        case FORMAT_NORMAL: {
+            /* As with printf, a precision of zero is taken as one */
+            const int p = precision == 0 ? 1 : precision;
+            if ( !significant_digits(m, p, &n, &exponent) ) {
+                return NOT_EXACT;
+            }
+
+            /* Trailing zeros are not shown in the general format */
+            write_uint(digits, n, p);
+            int sig = p;
+            while ( sig > 1 && digits[sig-1] == '0' ) {
+                sig--;
+            }
+
+            if ( exponent >= -4 && exponent < p ) {
+                /* Fixed style */
+                if ( exponent >= 0 ) {
+                    memcpy(buffer + len, digits, exponent + 1);
+                    len += exponent + 1;
+                    if ( sig > exponent + 1 ) {
+                        buffer[len++] = '.';
+                        memcpy(buffer + len, digits + exponent + 1,
+                                sig - exponent - 1);
+                        len += sig - exponent - 1;
+                    }
+                } else {
+                    buffer[len++] = '0';
+                    buffer[len++] = '.';
+                    for ( int i = -1; i > exponent; i-- ) {
+                        buffer[len++] = '0';
+                    }
+                    memcpy(buffer + len, digits, sig);
+                    len += sig;
+                }
+            } else {
+                /* Scientific style */
+                buffer[len++] = digits[0];
+                if ( sig > 1 ) {
+                    buffer[len++] = '.';
+                    memcpy(buffer + len, digits + 1, sig - 1);
+                    len += sig - 1;
+                }
+                len += write_exponent(buffer + len, exponent);
+            }
+
+            break;
+        }
+
+        default:
+            ABORTF("unexpected number format: %d", mode);
+    }
+
+    return len;
+}
+
+/* Formats a double with snprintf, for values we can't convert
+ * exactly ourselves
+ */
+static size_t
+format_fallback(char * buffer, const double d,
+        const enum number_format mode, const int precision, const int width) {
+    int n;
+
+    switch ( mode ) {
+        case FORMAT_NORMAL:
+            n = snprintf(buffer, NUM_FORMAT_BUFFER_SIZE, "%*.*G",
+                    width, precision, d);
+            break;
+
+        case FORMAT_SCIENTIFIC:
+            n = snprintf(buffer, NUM_FORMAT_BUFFER_SIZE, "%*.*E",
+                    width, precision, d);
+            break;
+
+        case FORMAT_FIXED:
+            n = snprintf(buffer, NUM_FORMAT_BUFFER_SIZE, "%*.*F",
+                    width, precision, d);
+            break;
+
+        default:
+            ABORTF("unexpected number format: %d", mode);
+    }
+
+    if ( n < 0 || n >= NUM_FORMAT_BUFFER_SIZE ) {
+        ABORTF("string too big (%d) for buffer (%d)", n, NUM_FORMAT_BUFFER_SIZE);
+    }
+
+    return n;
+}
+
+/* Formats an integer, returning NOT_EXACT if it needs rounding,
+ * in which case it should be formatted as a double.
+ */
+static size_t
+format_int(char * buffer, const int32_t n,
+        const enum number_format mode, const int precision) {
+    const uint32_t m = n < 0 ? -(uint32_t) n : (uint32_t) n;
+    size_t len = 0;
+
+    if ( n < 0 ) {
+        buffer[len++] = '-';
+    }
+
+    switch ( mode ) {
+        case FORMAT_FIXED:
+            len += write_uint(buffer + len, m, 1);
+            if ( precision > 0 ) {
+                buffer[len++] = '.';
+                memset(buffer + len, '0', precision);
+                len += precision;
+            }
+
+            return len;
+
+        case FORMAT_NORMAL: {
+            /* Integers with no more digits than the precision are
+             * shown exactly as they are
+             */
+            const int p = precision == 0 ? 1 : precision;
+            if ( p > MAX_DIGITS || m >= int_powers[p] ) {
+                return NOT_EXACT;
+            }
+
+            return len + write_uint(buffer + len, m, 1);
+        }
+
+        default:
+            return NOT_EXACT;
+    }
+}
+
+/* Right-justifies a formatted number in a field of the specified
+ * width, and null-terminates it
+ */
+static size_t
+pad_field(char * buffer, const size_t len, const int width) {
+    if ( width > 0 && len < (size_t) width ) {
+        const size_t pad = width - len;
+        memmove(buffer + pad, buffer, len);
+        memset(buffer, ' ', pad);
+        buffer[width] = '\0';
+        return width;
+    }
+
+    buffer[len] = '\0';
+    return len;
+}
+
+/* Calculates d * 10^k rounded to the nearest integer, with ties
+ * going to the even integer. The rounding is exact because fma
+ * gives us the error in the scaled value, which tells us which
+ * side of a halfway point the true product or quotient falls.
+ * d should be non-negative. Returns false if the scaled value is
+ * too large for this to work.
+ */
+static bool
+scale_round(const double d, const int k, uint64_t * out) {
+    if ( k > 22 || k < -22 ) {
+        return false;
+    }
+
+    double y;
+    double err;
+    if ( k >= 0 ) {
+        y = d * double_powers[k];
+        err = fma(d, double_powers[k], -y);
+    } else {
+        y = d / double_powers[-k];
+        err = -fma(y, double_powers[-k], -d);
+    }
+
+    if ( !(y < EXACT_LIMIT) ) {
+        return false;
+    }
+
+    const double whole = floor(y);
+    const double frac = y - whole;
+    uint64_t n = (uint64_t) whole;
+
+    if ( frac > 0.5 || (frac == 0.5 && (err > 0 || (err == 0 && (n & 1)))) ) {
+        n++;
+    }
+
+    *out = n;
+    return true;
+}
+
+/* Calculates the p most significant decimal digits of d, correctly
+ * rounded, and the decimal exponent of the first of them. d should
+ * be non-negative. Returns false if they can't be calculated exactly.
+ */
+static bool
+significant_digits(const double d, const int p,
+        uint64_t * digits, int * exponent) {
+    if ( p < 1 || p > MAX_DIGITS ) {
+        return false;
+    }
+
+    if ( d == 0 ) {
+        *digits = 0;
+        *exponent = 0;
+        return true;
+    }
+
+    /* log10 may be out by one near powers of ten, and rounding
+     * may carry into an extra digit, so adjust and retry until we
+     * get exactly p digits.
+     */
+    int e = (int) floor(log10(d));
+    for ( int tries = 0; tries < 3; tries++ ) {
+        uint64_t n;
+        if ( !scale_round(d, p - 1 - e, &n) ) {
+            return false;
+        }
+
+        if ( n >= int_powers[p] ) {
+            e++;
+        } else if ( n < int_powers[p-1] ) {
+            e--;
+        } else {
+            *digits = n;
+            *exponent = e;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Writes an exponent in the same style as printf, with a sign and
+ * at least two digits
+ */
+static size_t
+write_exponent(char * buffer, const int exponent) {
+    size_t len = 0;
+    buffer[len++] = 'E';
+    buffer[len++] = exponent < 0 ? '-' : '+';
+    len += write_uint(buffer + len, exponent < 0 ? -exponent : exponent, 2);
+    return len;
+}
+
+/* Writes the decimal digits of n, padded with leading zeros to at
+ * least min_digits, and returns the number of digits written. The
+ * output is not null-terminated.
+ */
+static size_t
+write_uint(char * buffer, uint64_t n, const size_t min_digits) {
+    char tmp[24];
+    size_t nd = 0;
+
+    do {
+        tmp[nd++] = '0' + (n % 10);
+        n /= 10;
+    } while ( n );
+
+    while ( nd < min_digits ) {
+        tmp[nd++] = '0';
+    }
+
+    for ( size_t i = 0; i < nd; i++ ) {
+        buffer[i] = tmp[nd-i-1];
+    }
+
+    return nd;
+}
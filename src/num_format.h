@@ -0,0 +1,35 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PG_BBASIC_INTERNAL_NUM_FORMAT_H
+#define PG_BBASIC_INTERNAL_NUM_FORMAT_H
+
+#include <stddef.h>
+#include "symbols.h"
+#include "value.h"
+
+/* Size of a buffer large enough to hold any formatted number,
+ * including the largest double in fixed format, and the widest
+ * field width which can be specified in @%
+ */
+#define NUM_FORMAT_BUFFER_SIZE (512)
+
+/* Number formatting function */
+size_t num_format(char * buffer, struct value * v,
+        const enum number_format mode, const int precision, const int width);
+
+#endif  /* PG_BBASIC_INTERNAL_NUM_FORMAT_H */
@@ -0,0 +1,374 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Functions for parsing numbers from strings, used for numeric
+ * literals in the lexer, for VAL, and for INPUT. Unlike strtod and
+ * strtol these don't depend on the current locale, and only accept
+ * the decimal and hexadecimal forms that BBC BASIC itself accepts.
+ *
+ * Decimal numbers with no more than 19 significant digits and small
+ * exponents are converted exactly with a single correctly-rounded
+ * multiplication or division. Anything else is passed to strtod,
+ * which is always exact, but much slower. strtod reads the decimal
+ * point of the current locale, which a program linking libbbasic may
+ * have set, so it is called with the C locale where the system
+ * allows it.
+ */
+
+#include "internal.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <float.h>
+#include <errno.h>
+
+#if HAVE_LOCALE_H
+#include <locale.h>
+#endif
+
+#if HAVE_XLOCALE_H
+#include <xlocale.h>
+#endif
+
+#include "num_parse.h"
+#include "util.h"
+
+/* Maximum number of significant digits which fit in a uint64_t */
+#define MAX_DIGITS (19)
+
+/* Integers up to 2^53 are exactly representable as doubles */
+#define EXACT_LIMIT (UINT64_C(1) << 53)
+
+/* Size of the buffer used to pass numbers to strtod. Longer
+ * numbers are copied to dynamically allocated memory.
+ */
+#define FALLBACK_BUFFER_SIZE (64)
+
+/* Maximum absolute exponent we keep track of. Anything larger
+ * always overflows or underflows, so we just need to stop it
+ * overflowing an int.
+ */
+#define MAX_EXPONENT (100000)
+
+/* Powers of ten exactly representable as doubles */
+static const double powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* Static function declarations */
+static bool fast_path(uint64_t w, const int exponent, double * d);
+static enum num_parse_status slow_path(const char * s,
+        const size_t len, double * d);
+static int digit_value(const int c, const int base);
+static bool is_space(const int c);
+
+
+/*********************************************************************
+ *                                                                   *
+ * Public parsing functions                                          *
+ *                                                                   *
+ *********************************************************************/
+
+/* Parses a decimal floating point number from the start of s, in the
+ * same way as strtod, skipping any leading white space. On return,
+ * *end points to the first character after the number, or to s if
+ * there was no number. Returns NUM_PARSE_EMPTY if there was no
+ * number, and NUM_PARSE_RANGE if the number overflowed or underflowed.
+ */
+enum num_parse_status
+num_parse_float(const char * s, const char ** end, double * d) {
+    const char * p = s;
+    while ( is_space(*p) ) {
+        p++;
+    }
+
+    const char * start = p;
+    bool negative = false;
+    if ( *p == '-' || *p == '+' ) {
+        negative = *p == '-';
+        p++;
+    }
+
+    /* Accumulate up to MAX_DIGITS significant digits, ignoring
+     * leading zeros, and keep track of the decimal exponent.
+     */
+    uint64_t w = 0;
+    int ndigits = 0;
+    int exponent = 0;
+    bool any = false;
+    bool truncated = false;
+
+    while ( *p >= '0' && *p <= '9' ) {
+        any = true;
+        if ( w == 0 && *p == '0' ) {
+            /* Leading zero */
+        } else if ( ndigits < MAX_DIGITS ) {
+            w = w * 10 + (*p - '0');
+            ndigits++;
+        } else {
+            truncated = truncated || *p != '0';
+            exponent++;
+        }
+        p++;
+    }
+
+    if ( *p == '.' ) {
+        p++;
+        while ( *p >= '0' && *p <= '9' ) {
+            any = true;
+            if ( w == 0 && *p == '0' ) {
+                exponent--;
+            } else if ( ndigits < MAX_DIGITS ) {
+                w = w * 10 + (*p - '0');
+                ndigits++;
+                exponent--;
+            } else {
+                truncated = truncated || *p != '0';
+            }
+            p++;
+        }
+    }
+
+    if ( !any ) {
+        *end = s;
+        *d = 0;
+        return NUM_PARSE_EMPTY;
+    }
+
+    /* The exponent is only part of the number if at least one
+     * digit follows the E and optional sign.
+     */
+    if ( *p == 'E' || *p == 'e' ) {
+        const char * q = p + 1;
+        bool exp_negative = false;
+        if ( *q == '-' || *q == '+' ) {
+            exp_negative = *q == '-';
+            q++;
+        }
+
+        if ( *q >= '0' && *q <= '9' ) {
+            int e = 0;
+            while ( *q >= '0' && *q <= '9' ) {
+                if ( e < MAX_EXPONENT ) {
+                    e = e * 10 + (*q - '0');
+                }
+                q++;
+            }
+
+            exponent += exp_negative ? -e : e;
+            p = q;
+        }
+    }
+
+    *end = p;
+
+    if ( !truncated && fast_path(w, exponent, d) ) {
+        if ( negative ) {
+            *d = -*d;
+        }
+        return NUM_PARSE_OK;
+    }
+
+    return slow_path(start, p - start, d);
+}
+
+/* Parses an integer in the specified base, which must be 10 or 16,
+ * from the start of s, in the same way as strtol, skipping any
+ * leading white space. Unlike strtol, a leading 0x is not accepted
+ * for hexadecimal numbers. On return, *end points to the first
+ * character after the number, or to s if there was no number.
+ * Returns NUM_PARSE_EMPTY if there was no number, and NUM_PARSE_RANGE
+ * if the number does not fit in an int32_t.
+ */
+enum num_parse_status
+num_parse_int(const char * s, const char ** end, const int base, int32_t * n) {
+    const char * p = s;
+    while ( is_space(*p) ) {
+        p++;
+    }
+
+    bool negative = false;
+    if ( *p == '-' || *p == '+' ) {
+        negative = *p == '-';
+        p++;
+    }
+
+    /* Accumulate the magnitude in a wider type, which allows us
+     * to represent the magnitude of INT32_MIN.
+     */
+    const int64_t limit = negative ? -(int64_t) INT32_MIN : INT32_MAX;
+    int64_t m = 0;
+    bool any = false;
+    bool overflow = false;
+
+    int v;
+    while ( (v = digit_value(*p, base)) != -1 ) {
+        any = true;
+        if ( !overflow ) {
+            m = m * base + v;
+            overflow = m > limit;
+        }
+        p++;
+    }
+
+    if ( !any ) {
+        *end = s;
+        *n = 0;
+        return NUM_PARSE_EMPTY;
+    }
+
+    *end = p;
+
+    if ( overflow ) {
+        *n = 0;
+        return NUM_PARSE_RANGE;
+    }
+
+    *n = (int32_t) (negative ? -m : m);
+    return NUM_PARSE_OK;
+}
+
+
+/*********************************************************************
+ *                                                                   *
+ * Static functions                                                  *
+ *                                                                   *
+ *********************************************************************/
+
+/* Converts w * 10^exponent to a double if it can be done exactly
+ * with a single floating point operation, and returns false if it
+ * can't.
+ */
+static bool
+fast_path(uint64_t w, const int exponent, double * d) {
+#if !defined(FLT_EVAL_METHOD) || FLT_EVAL_METHOD != 0
+    /* With extended precision intermediate values, the result may
+     * be rounded twice, so always take the slow path.
+     */
+    (void) w;
+    (void) exponent;
+    (void) d;
+    return false;
+#else
+    if ( w == 0 ) {
+        *d = 0;
+        return true;
+    } else if ( w > EXACT_LIMIT ) {
+        return false;
+    }
+
+    if ( exponent < 0 ) {
+        if ( exponent < -22 ) {
+            return false;
+        }
+
+        *d = (double) w / powers[-exponent];
+        return true;
+    }
+
+    int e = exponent;
+    if ( e > 22 ) {
+        /* Move any excess exponent into the mantissa, if it
+         * remains exactly representable.
+         */
+        while ( e > 22 && w <= EXACT_LIMIT / 10 ) {
+            w *= 10;
+            e--;
+        }
+
+        if ( e > 22 ) {
+            return false;
+        }
+    }
+
+    *d = (double) w * powers[e];
+    return true;
+#endif
+}
+
+/* Converts a number with strtod in the C locale. The caller has
+ * already established that the len characters starting at s are a
+ * valid decimal number, so they are copied to a null-terminated buffer
+ * to ensure strtod sees exactly the same number, and not a hexadecimal
+ * or other form we don't accept.
+ */
+static enum num_parse_status
+slow_path(const char * s, const size_t len, double * d) {
+    char buffer[FALLBACK_BUFFER_SIZE];
+    char * b = len < FALLBACK_BUFFER_SIZE ? buffer : x_malloc(len + 1);
+    memcpy(b, s, len);
+    b[len] = '\0';
+
+    /* The C locale is created for each call, since this path is rare,
+     * and the C library normally returns a shared object for it.
+     */
+#if HAVE_NEWLOCALE && (HAVE_STRTOD_L || HAVE_USELOCALE)
+    const locale_t c_locale = newlocale(LC_NUMERIC_MASK, "C", (locale_t) 0);
+#endif
+
+    errno = 0;
+#if HAVE_NEWLOCALE && HAVE_STRTOD_L
+    *d = c_locale ? strtod_l(b, NULL, c_locale) : strtod(b, NULL);
+#elif HAVE_NEWLOCALE && HAVE_USELOCALE
+    const locale_t old_locale = c_locale ? uselocale(c_locale) : 0;
+    *d = strtod(b, NULL);
+    if ( old_locale ) {
+        uselocale(old_locale);
+    }
+#else
+    *d = strtod(b, NULL);
+#endif
+    const int saved_errno = errno;
+
+#if HAVE_NEWLOCALE && (HAVE_STRTOD_L || HAVE_USELOCALE)
+    if ( c_locale ) {
+        freelocale(c_locale);
+    }
+#endif
+
+    if ( b != buffer ) {
+        x_free(b);
+    }
+
+    return saved_errno == ERANGE ? NUM_PARSE_RANGE : NUM_PARSE_OK;
+}
+
+/* Returns the value of a digit in the specified base, or -1 if
+ * the character is not a digit in that base
+ */
+static int
+digit_value(const int c, const int base) {
+    if ( c >= '0' && c <= '9' ) {
+        return c - '0';
+    } else if ( base == 16 && c >= 'A' && c <= 'F' ) {
+        return c - 'A' + 10;
+    } else if ( base == 16 && c >= 'a' && c <= 'f' ) {
+        return c - 'a' + 10;
+    }
+
+    return -1;
+}
+
+/* Returns true if a character is white space in the C locale */
+static bool
+is_space(const int c) {
+    return c == ' ' || c == '\t' || c == '\n' ||
+        c == '\v' || c == '\f' || c == '\r';
+}
@@ -0,0 +1,36 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PG_BBASIC_INTERNAL_NUM_PARSE_H
+#define PG_BBASIC_INTERNAL_NUM_PARSE_H
+
+#include <stdint.h>
+
+/* Number parsing status values */
+enum num_parse_status {
+    NUM_PARSE_OK = 0,
+    NUM_PARSE_EMPTY,
+    NUM_PARSE_RANGE
+};
+
+/* Number parsing functions */
+enum num_parse_status num_parse_float(const char * s,
+        const char ** end, double * d);
+enum num_parse_status num_parse_int(const char * s,
+        const char ** end, const int base, int32_t * n);
+
+#endif  /* PG_BBASIC_INTERNAL_NUM_PARSE_H */
@@ -32,11 +32,36 @@
 #include "util.h"
 
 /* Options global variables */
+char * batch_filename;
+char * cache_dir;
+long cache_size;
+char * checkpoint_filename;
+long checkpoint_interval;
+int compile_flag;
+char * connect_socket;
 int debug_flag;
 char * input_inline;
 char * input_filename;
+char * introspect_filename;
+long jobs_count;
+int lazy_flag;
+int no_cache_flag;
+char * output_filename;
+char * profile_filename;
+char * profile_stacks_filename;
+char * profile_samples_filename;
+char * recorder_filename;
+long recorder_size;
+char * restore_filename;
+char * server_socket;
+int recorder_times_flag;
+int counts_flag;
+int stats_flag;
+int stats_json_flag;
+int watch_flag;
 
 /* Static function declarations */
+static long parse_size(const char * s);
 static void process_cmdline(int, char **);
 static void output_help(int, char **);
 
@@ -65,7 +90,7 @@ process_options(int argc, char ** argv) {
 /* Frees stored inline input */
 static void
 free_input_inline(void) {
-    free(input_inline);
+    x_free(input_inline);
     input_inline = NULL; /* In case of multiple calls */
 }
 
@@ -76,7 +101,7 @@ set_input_inline(const char * s) {
      * to preserve only the last
      */
     if ( input_inline ) {
-        free(input_inline);
+        x_free(input_inline);
     }
 
     /* lex expects a doubly null-terminated string */
@@ -86,6 +111,19 @@ set_input_inline(const char * s) {
     x_atexit(free_input_inline);
 }
 
+/* Parses a positive size given as an option argument */
+static long
+parse_size(const char * s) {
+    char * end;
+    const long n = strtol(s, &end, 10);
+    if ( end == s || *end || n <= 0 ) {
+        fprintf(stderr, "Invalid size: %s\n", s);
+        exit(EXIT_FAILURE);
+    }
+
+    return n;
+}
+
 #ifdef HAVE_GETOPT_H
 #ifdef HAVE_GETOPT_LONG
 
@@ -94,16 +132,40 @@ static void
 process_cmdline(int argc, char ** argv) {
     while ( 1 ) {
         struct option long_options[] = {
+            {"batch", required_argument, NULL, 0},
+            {"cache-dir", required_argument, NULL, 0},
+            {"cache-size", required_argument, NULL, 0},
+            {"checkpoint", required_argument, NULL, 0},
+            {"checkpoint-interval", required_argument, NULL, 0},
+            {"compile", no_argument, &compile_flag, 1},
+            {"connect", required_argument, NULL, 0},
+            {"counts", no_argument, &counts_flag, 1},
             {"debug", no_argument, &debug_flag, 1},
             {"help", no_argument, &help_flag, 1},
             {"inline", required_argument, NULL, 0},
+            {"introspect", required_argument, NULL, 0},
+            {"jobs", required_argument, NULL, 0},
+            {"lazy", no_argument, &lazy_flag, 1},
+            {"no-cache", no_argument, &no_cache_flag, 1},
+            {"output", required_argument, NULL, 0},
+            {"profile", required_argument, NULL, 0},
+            {"profile-samples", required_argument, NULL, 0},
+            {"profile-stacks", required_argument, NULL, 0},
+            {"recorder", required_argument, NULL, 0},
+            {"recorder-size", required_argument, NULL, 0},
+            {"recorder-times", no_argument, &recorder_times_flag, 1},
+            {"restore", required_argument, NULL, 0},
+            {"server", required_argument, NULL, 0},
+            {"stats", no_argument, &stats_flag, 1},
+            {"stats-json", no_argument, &stats_json_flag, 1},
             {"version", no_argument, &version_flag, 1},
+            {"watch", no_argument, &watch_flag, 1},
             {0, 0, 0, 0}
         };
 
         int option_index = 0;
 
-        int c = getopt_long(argc, argv, "dhi:V", long_options, &option_index);
+        int c = getopt_long(argc, argv, "dhi:o:V", long_options, &option_index);
         if ( c == -1 ) {
             break;
         }
@@ -117,9 +179,73 @@ process_cmdline(int argc, char ** argv) {
 
                 /* Process long option arguments */
                 switch ( option_index ) {
+                    case 0:
+                        batch_filename = optarg;
+                        break;
+
+                    case 1:
+                        cache_dir = optarg;
+                        break;
+
                     case 2:
+                        cache_size = parse_size(optarg);
+                        break;
+
+                    case 3:
+                        checkpoint_filename = optarg;
+                        break;
+
+                    case 4:
+                        checkpoint_interval = parse_size(optarg);
+                        break;
+
+                    case 6:
+                        connect_socket = optarg;
+                        break;
+
+                    case 10:
                         set_input_inline(optarg);
                         break;
+
+                    case 11:
+                        introspect_filename = optarg;
+                        break;
+
+                    case 12:
+                        jobs_count = parse_size(optarg);
+                        break;
+
+                    case 15:
+                        output_filename = optarg;
+                        break;
+
+                    case 16:
+                        profile_filename = optarg;
+                        break;
+
+                    case 17:
+                        profile_samples_filename = optarg;
+                        break;
+
+                    case 18:
+                        profile_stacks_filename = optarg;
+                        break;
+
+                    case 19:
+                        recorder_filename = optarg;
+                        break;
+
+                    case 20:
+                        recorder_size = parse_size(optarg);
+                        break;
+
+                    case 22:
+                        restore_filename = optarg;
+                        break;
+
+                    case 23:
+                        server_socket = optarg;
+                        break;
                 }
 
                 break;
@@ -136,6 +262,10 @@ process_cmdline(int argc, char ** argv) {
                 set_input_inline(optarg);
                 break;
 
+            case 'o':
+                output_filename = optarg;
+                break;
+
             case 'V':
                 version_flag = 1;
                 break;
@@ -174,7 +304,53 @@ output_help(int argc, char ** argv) {
     printf("  -d, --debug             enable debug output\n");
     printf("  -h, --help              produce this help message\n");
     printf("  -i, --inline=STRING     provide inline BASIC input\n");
+    printf("      --introspect=FILE   append SIGUSR1 status reports to FILE\n");
     printf("  -V, --version           report version\n");
+    printf("      --watch             run the program again whenever its file\n");
+    printf("                          changes\n");
+
+    printf("\nCompiling:\n");
+    printf("      --compile           write a compiled program image and exit\n");
+    printf("  -o, --output=FILE       write the image to FILE (default: the input\n");
+    printf("                          file name with a .bbi extension)\n");
+    printf("      --no-cache          don't use the compiled program cache\n");
+    printf("      --cache-dir=DIR     cache compiled programs in DIR\n");
+    printf("      --cache-size=N      limit the cache to N megabytes (default 64)\n");
+    printf("      --lazy              parse PROC and FN bodies when first called,\n");
+    printf("                          without using the cache\n");
+
+    printf("\nServer:\n");
+    printf("      --server=SOCKET     load the program once, and run it for each\n");
+    printf("                          client connecting to SOCKET\n");
+    printf("      --connect=SOCKET    run the program loaded by a server at SOCKET\n");
+    printf("                          with this process's standard streams\n");
+
+    printf("\nBatch:\n");
+    printf("      --batch=MANIFEST    run the program, input and output files on\n");
+    printf("                          each line of MANIFEST concurrently\n");
+    printf("      --jobs=N            run N jobs at once (default: one per CPU)\n");
+
+    printf("\nProfiling:\n");
+    printf("      --profile=FILE      write a line profile to FILE\n");
+    printf("      --profile-samples=FILE\n");
+    printf("                          write a sampled line profile to FILE\n");
+    printf("      --profile-stacks=FILE\n");
+    printf("                          write PROC, FN and GOSUB call stacks to FILE\n");
+    printf("      --counts            report deterministic operation counts at exit\n");
+    printf("      --stats             report runtime statistics at exit\n");
+    printf("      --stats-json        report runtime statistics at exit as JSON\n");
+
+    printf("\nFlight recorder:\n");
+    printf("      --recorder=FILE     record recent lines, and write them to FILE\n");
+    printf("                          on an untrapped error or a fatal signal\n");
+    printf("      --recorder-size=N   record the last N statements (default 1024)\n");
+    printf("      --recorder-times    record the time of each statement\n");
+
+    printf("\nCheckpoints:\n");
+    printf("      --checkpoint=FILE   write the program's state to FILE on SIGUSR2\n");
+    printf("      --checkpoint-interval=N\n");
+    printf("                          also write it every N seconds\n");
+    printf("      --restore=FILE      resume the program from the state in FILE\n");
 }
 
 #else
@@ -19,9 +19,33 @@
 #define PG_BBASIC_OPTIONS_H
 
 /* Global options variables */
+extern char * batch_filename;
+extern char * cache_dir;
+extern long cache_size;
+extern char * checkpoint_filename;
+extern long checkpoint_interval;
+extern int compile_flag;
+extern char * connect_socket;
 extern int debug_flag;
 extern char * input_inline;
 extern char * input_filename;
+extern char * introspect_filename;
+extern long jobs_count;
+extern int lazy_flag;
+extern int no_cache_flag;
+extern char * output_filename;
+extern char * profile_filename;
+extern char * profile_stacks_filename;
+extern char * profile_samples_filename;
+extern char * recorder_filename;
+extern long recorder_size;
+extern char * restore_filename;
+extern char * server_socket;
+extern int recorder_times_flag;
+extern int counts_flag;
+extern int stats_flag;
+extern int stats_json_flag;
+extern int watch_flag;
 
 void process_options(int argc, char ** argv);
 
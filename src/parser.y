@@ -29,6 +29,7 @@
 #include "runtime.h"
 #include "statements.h"
 #include "expr_internal.h"
+#include "util.h"
 
 int yyerror(char * s, ...);
 int yylex(void);
@@ -48,9 +49,9 @@ extern int yylineno;
 }
 
 /* Most keywords */
-%token ABS ACS AND ASC ASN ATN AUTO BGET BPUT CHAIN CHRS CLEAR
+%token ABS ACS AND ASC ASN ATN AUTO BGET BPUT BY CHAIN CHRS CLEAR
 %token CLOSE COLOUR COS DATA DEF DEG DELETE DIM DIV ELSE END
-%token ENDPROC EOF_ EOR ERL ERR ERROR EVAL EXP EXT FOR GET GETS
+%token ENDPROC EOF_ EOR ERL ERR ERROR EVAL EXP EXT FOR GET GETS GETS_
 %token GOSUB GOTO IF INKEY INKEYS INPUT INPUT_ INSTR INT LEFTS
 %token LEN LET LINE LIST LISTO LN LOAD LOCAL LOG MIDS MOD NEW
 %token NEXT NOT OFF OLD ON OPENIN OPENOUT OPENUP OR PI PRINT
@@ -120,6 +121,7 @@ line:                               /* ignore empty lines */
  | INT_LITERAL line_stmts           {
                                         if ( line_add($1, $2) != STATUS_OK ) {
                                             yyerror("duplicate line %d", $1);
+                                            statement_free($2);
                                             YYABORT;
                                         }
                                     }
@@ -162,14 +164,15 @@ opt_stmt:                           { $$ = NULL; }
 
 /* Statements */
 stmt:
-   BPUT var ',' expr                { $$ = statement_bput_new($2, $4); }
+   BPUT var ',' expr                { $$ = statement_bput_new($2, $4, true); }
+ | BPUT var ',' expr ';'            { $$ = statement_bput_new($2, $4, false); }
  | CLEAR                            { $$ = statement_clear_new(); }
  | CLOSE INT_LITERAL                { $$ = statement_close_new(expr_int_new($2)); }
  | CLOSE var                        { $$ = statement_close_new($2); }
  | COLOUR expr                      { $$ = statement_colour_new($2); }
  | DATA data_items                  { $$ = statement_data_new($2); }
- | DEF FN opt_vars                  { $$ = statement_def_fn_new($2, $3); free($2); }
- | DEF PROC opt_vars                { $$ = statement_def_proc_new($2, $3); free($2); }
+ | DEF FN opt_vars                  { $$ = statement_def_fn_new($2, $3); x_free($2); }
+ | DEF PROC opt_vars                { $$ = statement_def_proc_new($2, $3); x_free($2); }
  | DIM array                        { $$ = statement_dim_new($2); }
  | END                              { $$ = statement_end_new(); }
  | ENDPROC                          { $$ = statement_endproc_new(); }
@@ -188,9 +191,9 @@ stmt:
  | ON ERROR OFF                     { $$ = statement_on_error_new(NULL); }
  | PRINT opt_plist                  { $$ = statement_print_new($2); }
  | PRINT_ var ',' exprs             { $$ = statement_printf_new($2, $4); }
- | PROC opt_exprs                   { $$ = statement_proc_new($1, $2); free($1); }
+ | PROC opt_exprs                   { $$ = statement_proc_new($1, $2); x_free($1); }
  | READ vars                        { $$ = statement_read_new($2); }
- | REM                              { $$ = statement_rem_new($1); free($1); }
+ | REM                              { $$ = statement_rem_new($1); x_free($1); }
  | REPEAT opt_stmt                  { $$ = statement_repeat_new($2); }
  | REPORT                           { $$ = statement_report_new(); }
  | RESTORE opt_expr                 { $$ = statement_restore_new($2); }
@@ -311,7 +314,7 @@ prompt_prefix:
  ;
 
 prompt_value:
-   STRING_LITERAL                   { $$ = print_list_expr_append(NULL, expr_string_new($1)); free($1);}
+   STRING_LITERAL                   { $$ = print_list_expr_append(NULL, expr_string_new($1)); x_free($1);}
  | SPC '(' expr ')'                 { $$ = print_list_expr_append(NULL, expr_func_spc_new($3)); }
  ;
 
@@ -377,7 +380,7 @@ expr:
  | '-' expr %prec UMINUS            { $$ = expr_op_uminus_new($2); }
  | '+' expr %prec UPLUS             { $$ = $2; }
  | NOT expr %prec UNOT              { $$ = expr_op_not_new($2); }
- | FN opt_exprs                     { $$ = expr_fn_new($1, $2); free($1); }
+ | FN opt_exprs                     { $$ = expr_fn_new($1, $2); x_free($1); }
  | '(' expr ')'                     { $$ = $2; }
  | builtin_function                 { $$ = $1; }
  | literal                          { $$ = $1; }
@@ -401,6 +404,8 @@ builtin_function:
  | EXT '(' var ')'                  { $$ = expr_func_ext_new($3); }
  | GET                              { $$ = expr_func_get_new(); }
  | GETS                             { $$ = expr_func_gets_new(); }
+ | GETS_ var                        { $$ = expr_func_getsf_new($2, NULL); }
+ | GETS_ var BY expr %prec UMINUS   { $$ = expr_func_getsf_new($2, $4); }
  | INKEY '(' expr ')'               { $$ = expr_func_inkey_new($3); }
  | INKEYS '(' expr ')'              { $$ = expr_func_inkeys_new($3); }
  | INSTR '(' expr ',' expr ')'      { $$ = expr_func_instr_new($3, $5, NULL); }
@@ -439,7 +444,7 @@ data_item:
    FLOAT_LITERAL                    { $$ = value_float_new($1); }
  | HEX_LITERAL                      { $$ = value_int_new($1); }
  | INT_LITERAL                      { $$ = value_int_new($1); }
- | STRING_LITERAL                   { $$ = value_string_new($1); free($1); }
+ | STRING_LITERAL                   { $$ = value_string_new($1); x_free($1); }
  ;
 
 literal:
@@ -448,7 +453,7 @@ literal:
  | HEX_LITERAL                      { $$ = expr_int_new($1); }
  | INT_LITERAL                      { $$ = expr_int_new($1); }
  | PI                               { $$ = expr_float_new(3.14159265359); }
- | STRING_LITERAL                   { $$ = expr_string_new($1); free($1); }
+ | STRING_LITERAL                   { $$ = expr_string_new($1); x_free($1); }
  | TRUE                             { $$ = expr_int_new($1); }
  ;
 
@@ -458,32 +463,33 @@ var:
  ;
 
 scalar:
-   ID %prec EMPTY                   { $$ = expr_variable_new($1); free($1); }
- | ID_INTEGER %prec EMPTY           { $$ = expr_variable_new($1); free($1); }
- | ID_RESIDENT %prec EMPTY          { $$ = expr_variable_new($1); free($1); }
- | ID_STRING %prec EMPTY            { $$ = expr_variable_new($1); free($1); }
+   ID %prec EMPTY                   { $$ = expr_variable_new($1); x_free($1); }
+ | ID_INTEGER %prec EMPTY           { $$ = expr_variable_new($1); x_free($1); }
+ | ID_RESIDENT %prec EMPTY          { $$ = expr_variable_new($1); x_free($1); }
+ | ID_STRING %prec EMPTY            { $$ = expr_variable_new($1); x_free($1); }
  ;
 
 array:
-   ID '(' exprs ')'                 { $$ = expr_array_new($1, $3); free($1); }
- | ID_INTEGER '(' exprs ')'         { $$ = expr_array_new($1, $3); free($1); }
- | ID_RESIDENT '(' exprs ')'        { $$ = expr_array_new($1, $3); free($1); }
- | ID_STRING '(' exprs ')'          { $$ = expr_array_new($1, $3); free($1); }
+   ID '(' exprs ')'                 { $$ = expr_array_new($1, $3); x_free($1); }
+ | ID_INTEGER '(' exprs ')'         { $$ = expr_array_new($1, $3); x_free($1); }
+ | ID_RESIDENT '(' exprs ')'        { $$ = expr_array_new($1, $3); x_free($1); }
+ | ID_STRING '(' exprs ')'          { $$ = expr_array_new($1, $3); x_free($1); }
  ;
 
 %%
 
 int yyerror(char * fmt, ...) {
+    FILE * err = program_err();
 #if HAVE_CONFIG_H
-    fprintf(stderr, "%s: ", PACKAGE);
+    fprintf(err, "%s: ", PACKAGE);
 #endif
 
     va_list ap;
     va_start(ap, fmt);
-    vfprintf(stderr, fmt, ap);
+    vfprintf(err, fmt, ap);
     va_end(ap);
 
-    fputc('\n', stderr);
+    fputc('\n', err);
 
     return 0;
 }
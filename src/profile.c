@@ -0,0 +1,470 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Line and call stack profiler for the --profile and --profile-stacks
+ * options.
+ *
+ * Each program line has a slot in an array of counters, indexed by
+ * the line_index field of its statements, so recording a statement
+ * is just an array update. Time is measured by reading a cheap
+ * clock - the processor's time stamp counter where available, and
+ * CLOCK_MONOTONIC otherwise - once per statement, and charging the
+ * time since the previous reading to the line which was active.
+ * Allocations are charged in the same way, using the count kept by
+ * the x_malloc family of functions.
+ *
+ * Time spent in a PROC, FN or GOSUB is also charged to the line which
+ * called it as inclusive time. Recursive calls are only counted once,
+ * when the outermost call from a line returns.
+ *
+ * For the call stack report, calls are recorded in a tree with a
+ * frame for each distinct call path, and time is charged to the
+ * current frame in the same way as to the active line. The report is
+ * written in the "folded" format read by flame graph tools, with one
+ * line for each call path giving the frames separated by semi-colons,
+ * followed by the time spent in the last frame in nanoseconds.
+ */
+
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "profile.h"
+#include "statements.h"
+#include "util.h"
+#include "value.h"
+
+/* The time stamp counter is much cheaper to read than the system
+ * clock, and is converted to seconds using the system clock at the
+ * end of the run.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PROFILE_USE_TSC (1)
+#else
+#define PROFILE_USE_TSC (0)
+#endif
+
+/* Counters for a single program line */
+struct profile_line {
+    int number;
+    unsigned long count;
+    unsigned long allocs;
+
+    /* Ticks spent executing the line itself, and in calls made from
+     * it, excluding time spent back on the line by recursive calls.
+     */
+    uint64_t self;
+    uint64_t callee;
+
+    /* Number of calls from this line not yet returned, and the value
+     * of self when the outermost one was made.
+     */
+    int depth;
+    uint64_t self_mark;
+};
+
+/* A frame in the call tree, identified by the statement called */
+struct profile_frame {
+    const struct statement * target;
+    char * name;
+    uint64_t self;
+
+    struct profile_frame * parent;
+    struct profile_frame * child;
+    struct profile_frame * sibling;
+};
+
+/* An active PROC, FN or GOSUB call, with the calling line and frame */
+struct profile_call {
+    size_t slot;
+    struct profile_frame * frame;
+    uint64_t start;
+};
+
+/* Profiling active flag */
+bool profile_active;
+
+/* Report files */
+static FILE * lines_file;
+static FILE * stacks_file;
+
+/* Line counters, with one extra slot to absorb time before the
+ * first statement is executed.
+ */
+static struct profile_line * slots;
+static size_t num_slots;
+
+/* Call tree, with the root for time spent outside any call */
+static struct profile_frame root = { .name = "(main)" };
+static struct profile_frame * current_frame;
+
+/* Stack of active calls */
+static struct profile_call * calls;
+static size_t num_calls;
+static size_t calls_capacity;
+
+/* Currently active slot, and the tick and allocation counts
+ * when it was last charged.
+ */
+static size_t active;
+static uint64_t last_ticks;
+static unsigned long last_allocs;
+
+/* Tick count and system clock time at the start of the run */
+static uint64_t start_ticks;
+static uint64_t start_ns;
+
+/* Static function declarations */
+static void charge(const uint64_t now);
+static int compare_lines(const void * a, const void * b);
+static struct profile_frame * frame_child(struct profile_frame * parent,
+        const struct statement * target);
+static void frames_free(void);
+static uint64_t monotonic_ns(void);
+static uint64_t ticks(void);
+static void write_lines(const uint64_t total_ticks, const double scale);
+static void write_stacks(const double scale);
+
+
+/*********************************************************************
+ *                                                                   *
+ * Public profiling functions                                        *
+ *                                                                   *
+ *********************************************************************/
+
+/* Starts profiling a program with the specified number of lines.
+ * When profile_finish is called, the line report is written to
+ * lines_filename and the call stack report to stacks_filename,
+ * either of which may be NULL.
+ */
+void
+profile_start(const char * lines_filename,
+        const char * stacks_filename, const size_t nlines) {
+    lines_file = lines_filename ? x_fopen(lines_filename, "w") : NULL;
+    stacks_file = stacks_filename ? x_fopen(stacks_filename, "w") : NULL;
+    current_frame = &root;
+    slots = x_calloc(nlines + 1, sizeof *slots);
+    num_slots = nlines;
+    active = nlines;
+
+    start_ns = monotonic_ns();
+    start_ticks = ticks();
+    last_ticks = start_ticks;
+    last_allocs = x_alloc_count;
+
+    profile_active = true;
+}
+
+/* Records the execution of a statement, making its line active */
+void
+profile_statement(const struct statement * s) {
+    charge(ticks());
+
+    active = s->line_index;
+    slots[active].number = s->line_number;
+    slots[active].count++;
+}
+
+/* Records a PROC, FN or GOSUB call from the active line. target is
+ * the DEF statement for a PROC or FN, or the first statement executed
+ * for a GOSUB.
+ */
+void
+profile_call_enter(const struct statement * target) {
+    const uint64_t now = ticks();
+    charge(now);
+
+    if ( num_calls == calls_capacity ) {
+        calls_capacity = calls_capacity ? calls_capacity * 2 : 64;
+        calls = x_realloc(calls, calls_capacity * sizeof *calls);
+    }
+
+    struct profile_line * line = &slots[active];
+    if ( line->depth++ == 0 ) {
+        line->self_mark = line->self;
+    }
+
+    calls[num_calls].slot = active;
+    calls[num_calls].frame = current_frame;
+    calls[num_calls].start = now;
+    num_calls++;
+
+    current_frame = frame_child(current_frame, target);
+
+    /* Don't charge our own allocations to the program */
+    last_allocs = x_alloc_count;
+}
+
+/* Records a return from the most recent call, making the calling
+ * line active again.
+ */
+void
+profile_call_exit(void) {
+    if ( num_calls == 0 ) {
+        return;
+    }
+
+    const uint64_t now = ticks();
+    charge(now);
+
+    struct profile_call * call = &calls[--num_calls];
+    struct profile_line * line = &slots[call->slot];
+    if ( --line->depth == 0 ) {
+        line->callee += (now - call->start) - (line->self - line->self_mark);
+    }
+
+    active = call->slot;
+    current_frame = call->frame;
+}
+
+/* Stops profiling, and writes and closes the reports */
+void
+profile_finish(void) {
+    if ( !profile_active ) {
+        return;
+    }
+
+    /* Calls still active when the program ended, for instance
+     * because of an END inside a PROC, last until the end.
+     */
+    while ( num_calls > 0 ) {
+        profile_call_exit();
+    }
+    charge(ticks());
+
+    const uint64_t total_ticks = last_ticks - start_ticks;
+    const uint64_t total_ns = monotonic_ns() - start_ns;
+    const double scale = total_ticks ?
+        (double) total_ns / total_ticks / 1e9 : 0;
+
+    if ( lines_file ) {
+        write_lines(total_ticks, scale);
+        x_fclose(lines_file);
+        lines_file = NULL;
+    }
+
+    if ( stacks_file ) {
+        write_stacks(scale);
+        x_fclose(stacks_file);
+        stacks_file = NULL;
+    }
+
+    frames_free();
+    x_free(slots);
+    slots = NULL;
+    x_free(calls);
+    calls = NULL;
+    calls_capacity = 0;
+    profile_active = false;
+}
+
+
+/*********************************************************************
+ *                                                                   *
+ * Static functions                                                  *
+ *                                                                   *
+ *********************************************************************/
+
+/* Charges the time and allocations since the last call to the
+ * active line.
+ */
+static void
+charge(const uint64_t now) {
+    slots[active].self += now - last_ticks;
+    slots[active].allocs += x_alloc_count - last_allocs;
+    current_frame->self += now - last_ticks;
+    last_ticks = now;
+    last_allocs = x_alloc_count;
+}
+
+/* Orders lines by descending exclusive time, then by line number */
+static int
+compare_lines(const void * a, const void * b) {
+    const struct profile_line * la = *(const struct profile_line * const *) a;
+    const struct profile_line * lb = *(const struct profile_line * const *) b;
+
+    if ( la->self != lb->self ) {
+        return la->self > lb->self ? -1 : 1;
+    }
+
+    return (la->number > lb->number) - (la->number < lb->number);
+}
+
+/* Returns the child of a frame for a call to target, creating
+ * it if necessary.
+ */
+static struct profile_frame *
+frame_child(struct profile_frame * parent,
+        const struct statement * target) {
+    struct profile_frame * frame = parent->child;
+    while ( frame ) {
+        if ( frame->target == target ) {
+            return frame;
+        }
+        frame = frame->sibling;
+    }
+
+    frame = x_malloc(sizeof *frame);
+    frame->target = target;
+    if ( target->type == STATEMENT_DEF_PROC ||
+            target->type == STATEMENT_DEF_FN ) {
+        frame->name = x_strdup(value_string_peek(target->v));
+    } else {
+        frame->name = x_msprintf("GOSUB%d", target->line_number);
+    }
+    frame->self = 0;
+    frame->parent = parent;
+    frame->child = NULL;
+    frame->sibling = parent->child;
+    parent->child = frame;
+
+    return frame;
+}
+
+/* Frees the call tree, other than the root */
+static void
+frames_free(void) {
+    struct profile_frame * frame = root.child;
+    while ( frame && frame != &root ) {
+        if ( frame->child ) {
+            frame = frame->child;
+            continue;
+        }
+
+        struct profile_frame * next = frame->sibling ?
+            frame->sibling : frame->parent;
+        frame->parent->child = frame->sibling;
+        x_free(frame->name);
+        x_free(frame);
+        frame = next;
+    }
+
+    root.self = 0;
+    current_frame = &root;
+}
+
+/* Returns the system monotonic clock in nanoseconds */
+static uint64_t
+monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Returns the current tick count */
+static uint64_t
+ticks(void) {
+#if PROFILE_USE_TSC
+    return __builtin_ia32_rdtsc();
+#else
+    return monotonic_ns();
+#endif
+}
+
+/* Writes the line report, with one row for each line executed */
+static void
+write_lines(const uint64_t total_ticks, const double scale) {
+    struct profile_line ** sorted = x_malloc((num_slots + 1) * sizeof *sorted);
+    size_t n = 0;
+    unsigned long count = 0;
+    unsigned long allocs = 0;
+
+    for ( size_t i = 0; i < num_slots; i++ ) {
+        if ( slots[i].count > 0 ) {
+            sorted[n++] = &slots[i];
+            count += slots[i].count;
+            allocs += slots[i].allocs;
+        }
+    }
+
+    qsort(sorted, n, sizeof *sorted, compare_lines);
+
+    fprintf(lines_file, "# %s line profile\n", PACKAGE);
+    fprintf(lines_file, "# Total time %.6f s, %lu statements, "
+            "%lu allocations\n", total_ticks * scale, count, allocs);
+    fprintf(lines_file, "#\n");
+    fprintf(lines_file, "# %8s %12s %12s %12s %7s %12s\n",
+            "Line", "Count", "Incl (s)", "Excl (s)", "Excl %", "Allocs");
+
+    for ( size_t i = 0; i < n; i++ ) {
+        const struct profile_line * line = sorted[i];
+        const double percent = total_ticks ?
+            100.0 * line->self / total_ticks : 0;
+
+        fprintf(lines_file, "  %8d %12lu %12.6f %12.6f %7.2f %12lu\n",
+                line->number, line->count,
+                (line->self + line->callee) * scale,
+                line->self * scale, percent, line->allocs);
+    }
+
+    x_free(sorted);
+}
+
+/* Writes the call stack report, with one row for each call path */
+static void
+write_stacks(const double scale) {
+    struct profile_frame ** path = NULL;
+    size_t capacity = 0;
+
+    /* Walk the tree depth first, without recursion, since the tree
+     * is as deep as the deepest recursive PROC or FN call.
+     */
+    struct profile_frame * frame = &root;
+    while ( frame ) {
+        const unsigned long long ns = frame->self * scale * 1e9 + 0.5;
+        if ( ns > 0 ) {
+            /* Collect the path from the root, and write it out */
+            size_t depth = 0;
+            for ( struct profile_frame * f = frame; f != &root; f = f->parent ) {
+                if ( depth == capacity ) {
+                    capacity = capacity ? capacity * 2 : 64;
+                    path = x_realloc(path, capacity * sizeof *path);
+                }
+                path[depth++] = f;
+            }
+
+            if ( depth == 0 ) {
+                fputs(root.name, stacks_file);
+            }
+
+            while ( depth > 0 ) {
+                fputs(path[--depth]->name, stacks_file);
+                if ( depth > 0 ) {
+                    fputc(';', stacks_file);
+                }
+            }
+
+            fprintf(stacks_file, " %llu\n", ns);
+        }
+
+        /* Move to the next frame */
+        if ( frame->child ) {
+            frame = frame->child;
+        } else {
+            while ( frame && frame != &root && !frame->sibling ) {
+                frame = frame->parent;
+            }
+            frame = (frame && frame != &root) ? frame->sibling : NULL;
+        }
+    }
+
+    x_free(path);
+}
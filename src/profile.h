@@ -0,0 +1,38 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PG_BBASIC_INTERNAL_PROFILE_H
+#define PG_BBASIC_INTERNAL_PROFILE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Opaque and incomplete struct definitions */
+struct statement;
+
+/* Profiling active flag, checked before calling the hooks below */
+extern bool profile_active;
+
+/* Profiling functions */
+void profile_start(const char * lines_filename,
+        const char * stacks_filename, const size_t nlines);
+void profile_statement(const struct statement * s);
+void profile_call_enter(const struct statement * target);
+void profile_call_exit(void);
+void profile_finish(void);
+
+#endif  /* PG_BBASIC_INTERNAL_PROFILE_H */
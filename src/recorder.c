@@ -0,0 +1,371 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Flight recorder for the --recorder option.
+ *
+ * Each statement executed stores its line number and type, and
+ * optionally a timestamp, in the next slot of a fixed-size ring
+ * buffer, overwriting the oldest entry once the buffer is full.
+ * Nothing is written out while the program runs. If the program
+ * stops with an untrapped error, including Escape, or is killed by
+ * a signal, the entries still in the buffer are written to the
+ * recorder file, oldest first.
+ *
+ * The dump may be made from a signal handler, so it uses only
+ * open() and write(), and formats numbers itself.
+ */
+
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#if HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "recorder.h"
+#include "runtime.h"
+#include "statements.h"
+#include "stats.h"
+#include "util.h"
+
+/* Default number of entries in the ring buffer */
+#define DEFAULT_SIZE (1024)
+
+/* Size of the buffer used to format a line of the dump */
+#define LINE_BUFFER_SIZE (128)
+
+/* An entry in the ring buffer */
+struct recorder_entry {
+    int32_t line;
+    int32_t type;
+    uint64_t time;
+};
+
+/* Flight recorder active flag */
+bool recorder_active;
+
+/* Ring buffer, its size less one (the size is a power of two), and
+ * the number of statements recorded so far.
+ */
+static struct recorder_entry * ring;
+static size_t ring_mask;
+static unsigned long recorded;
+
+/* Record timestamps as well as lines */
+static bool record_times;
+static struct timespec start_time;
+
+/* Dump file name, and whether the buffer has already been dumped */
+static const char * dump_filename;
+static volatile sig_atomic_t dumped;
+
+/* Signals which cause a dump before the program dies, and their
+ * previous dispositions.
+ */
+static const int fatal_signals[] = {
+    SIGABRT, SIGBUS, SIGFPE, SIGHUP, SIGQUIT, SIGSEGV, SIGTERM
+};
+
+#define NUM_FATAL_SIGNALS (sizeof fatal_signals / sizeof fatal_signals[0])
+
+static struct sigaction old_actions[NUM_FATAL_SIGNALS];
+
+/* Static function declarations */
+static void dump(const char * reason);
+static void handler(int signum);
+static size_t put_number(char * buffer, unsigned long n, int width, char pad);
+static size_t put_string(char * buffer, const char * s, int width);
+static const char * signal_name(int signum);
+static void write_all(int fd, const char * buffer, size_t len);
+
+
+/*********************************************************************
+ *                                                                   *
+ * Public flight recorder functions                                  *
+ *                                                                   *
+ *********************************************************************/
+
+/* Starts recording into a ring buffer of at least size entries, or
+ * a default size if size is zero. The buffer will be dumped to
+ * filename on an untrapped error or a fatal signal.
+ */
+void
+recorder_start(const char * filename, size_t size, const bool times) {
+    if ( size == 0 ) {
+        size = DEFAULT_SIZE;
+    }
+
+    /* Round up to a power of two, so a mask selects the slot */
+    size_t n = 1;
+    while ( n < size ) {
+        n <<= 1;
+    }
+
+    ring = x_calloc(n, sizeof *ring);
+    ring_mask = n - 1;
+    recorded = 0;
+    dumped = 0;
+    dump_filename = filename;
+    record_times = times;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = handler;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = SA_RESETHAND;
+    for ( size_t i = 0; i < NUM_FATAL_SIGNALS; i++ ) {
+        if ( sigaction(fatal_signals[i], &act, &old_actions[i]) == -1 ) {
+            perror("sigaction failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    recorder_active = true;
+}
+
+/* Records the execution of a statement */
+void
+recorder_record(const struct statement * s) {
+    struct recorder_entry * entry = &ring[recorded & ring_mask];
+    entry->line = s->line_number;
+    entry->type = s->type;
+
+    if ( record_times ) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        entry->time = (uint64_t)(ts.tv_sec - start_time.tv_sec) * 1000000000
+            + ts.tv_nsec - start_time.tv_nsec;
+    }
+
+    recorded++;
+}
+
+/* Dumps the buffer for the current untrapped error */
+void
+recorder_dump_error(void) {
+    if ( !recorder_active ) {
+        return;
+    }
+
+    char reason[LINE_BUFFER_SIZE];
+    const char * msg = error_string(error_code());
+    if ( error_line() == 0 ) {
+        snprintf(reason, sizeof reason, "%s", msg ? msg : "error");
+    } else {
+        snprintf(reason, sizeof reason, "%s at line %d",
+                msg ? msg : "error", error_line());
+    }
+
+    dump(reason);
+}
+
+/* Stops recording, and frees the buffer */
+void
+recorder_finish(void) {
+    if ( !recorder_active ) {
+        return;
+    }
+
+    recorder_active = false;
+    for ( size_t i = 0; i < NUM_FATAL_SIGNALS; i++ ) {
+        if ( sigaction(fatal_signals[i], &old_actions[i], NULL) == -1 ) {
+            perror("sigaction failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    x_free(ring);
+    ring = NULL;
+}
+
+
+/*********************************************************************
+ *                                                                   *
+ * Static functions                                                  *
+ *                                                                   *
+ *********************************************************************/
+
+/* Writes the entries in the buffer to the dump file, oldest first.
+ * This is async-signal-safe.
+ */
+static void
+dump(const char * reason) {
+    if ( dumped ) {
+        return;
+    }
+    dumped = 1;
+
+    const int fd = open(dump_filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if ( fd == -1 ) {
+        static const char msg[] = PACKAGE ": couldn't open recorder file\n";
+        write_all(STDERR_FILENO, msg, sizeof msg - 1);
+        return;
+    }
+
+    const unsigned long total = recorded;
+    const unsigned long kept = total > ring_mask + 1 ? ring_mask + 1 : total;
+
+    char buffer[LINE_BUFFER_SIZE];
+    size_t len = 0;
+
+    len += put_string(buffer + len, "# " PACKAGE " flight recorder\n# ", 0);
+    len += put_string(buffer + len, reason, 0);
+    buffer[len++] = '\n';
+    write_all(fd, buffer, len);
+
+    len = put_string(buffer, "# Last ", 0);
+    len += put_number(buffer + len, kept, 0, ' ');
+    len += put_string(buffer + len, " of ", 0);
+    len += put_number(buffer + len, total, 0, ' ');
+    len += put_string(buffer + len, " statements\n#\n#     Line Statement", 0);
+    if ( record_times ) {
+        len += put_string(buffer + len, "         Time (s)", 0);
+    }
+    buffer[len++] = '\n';
+    write_all(fd, buffer, len);
+
+    for ( unsigned long i = total - kept; i < total; i++ ) {
+        const struct recorder_entry * entry = &ring[i & ring_mask];
+        const char * name = stats_statement_name(entry->type);
+
+        len = put_number(buffer, entry->line, 10, ' ');
+        buffer[len++] = ' ';
+        len += put_string(buffer + len, name ? name : "?",
+                record_times ? 12 : 0);
+        if ( record_times ) {
+            len += put_number(buffer + len, entry->time / 1000000000, 6, ' ');
+            buffer[len++] = '.';
+            len += put_number(buffer + len, entry->time % 1000000000, 9, '0');
+        }
+        buffer[len++] = '\n';
+        write_all(fd, buffer, len);
+    }
+
+    close(fd);
+}
+
+/* Fatal signal handler. The handler is reset on entry, so raising
+ * the signal again after the dump gives the default action.
+ */
+static void
+handler(int signum) {
+    char reason[LINE_BUFFER_SIZE];
+    size_t len = put_string(reason, "Killed by ", 0);
+    len += put_string(reason + len, signal_name(signum), 0);
+    len += put_string(reason + len, " at line ", 0);
+    len += put_number(reason + len, current_line, 0, ' ');
+    reason[len] = '\0';
+
+    dump(reason);
+    raise(signum);
+}
+
+/* Formats an unsigned number right-aligned in a field of at least
+ * width characters, and returns the number of characters written.
+ */
+static size_t
+put_number(char * buffer, unsigned long n, int width, char pad) {
+    char digits[24];
+    int ndigits = 0;
+
+    do {
+        digits[ndigits++] = '0' + n % 10;
+        n /= 10;
+    } while ( n );
+
+    size_t len = 0;
+    for ( int i = ndigits; i < width; i++ ) {
+        buffer[len++] = pad;
+    }
+    while ( ndigits ) {
+        buffer[len++] = digits[--ndigits];
+    }
+
+    return len;
+}
+
+/* Copies a string left-aligned in a field of at least width
+ * characters, and returns the number of characters written.
+ */
+static size_t
+put_string(char * buffer, const char * s, int width) {
+    size_t len = 0;
+    while ( s[len] && len < LINE_BUFFER_SIZE / 2 ) {
+        buffer[len] = s[len];
+        len++;
+    }
+    while ( (int) len < width ) {
+        buffer[len++] = ' ';
+    }
+
+    return len;
+}
+
+/* Returns the name of one of the fatal signals */
+static const char *
+signal_name(int signum) {
+    switch ( signum ) {
+        case SIGABRT:
+            return "SIGABRT";
+
+        case SIGBUS:
+            return "SIGBUS";
+
+        case SIGFPE:
+            return "SIGFPE";
+
+        case SIGHUP:
+            return "SIGHUP";
+
+        case SIGQUIT:
+            return "SIGQUIT";
+
+        case SIGSEGV:
+            return "SIGSEGV";
+
+        case SIGTERM:
+            return "SIGTERM";
+
+        default:
+            return "signal";
+    }
+}
+
+/* Writes a buffer in full, retrying short writes */
+static void
+write_all(int fd, const char * buffer, size_t len) {
+    while ( len > 0 ) {
+        const ssize_t n = write(fd, buffer, len);
+        if ( n <= 0 ) {
+            return;
+        }
+        buffer += n;
+        len -= n;
+    }
+}
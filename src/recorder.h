@@ -0,0 +1,37 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PG_BBASIC_INTERNAL_RECORDER_H
+#define PG_BBASIC_INTERNAL_RECORDER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct statement;
+
+/* Flight recorder active flag, checked before recording each
+ * statement.
+ */
+extern bool recorder_active;
+
+/* Flight recorder functions */
+void recorder_start(const char * filename, size_t size, const bool times);
+void recorder_record(const struct statement * s);
+void recorder_dump_error(void);
+void recorder_finish(void);
+
+#endif  /* PG_BBASIC_INTERNAL_RECORDER_H */
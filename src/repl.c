@@ -0,0 +1,349 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Interactive mode, for entering, editing and running a program.
+ *
+ * The program stays loaded between runs, and is edited a line at a
+ * time as edit.c describes, so that RUN runs it as it stands without
+ * parsing it again.
+ */
+
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "repl.h"
+#include "edit.h"
+#include "runtime.h"
+#include "util.h"
+
+/* The program NEW replaced, for OLD */
+static char * old_source;
+
+/* Static function declarations */
+static bool command(char * input);
+static char * filename_arg(char * s);
+static bool parse_number(char ** s, int * n);
+static bool parse_range(char * s, int * from, int * to);
+static char * read_line(FILE * fp);
+static void report(const enum basic_error code);
+
+
+/*********************************************************************
+ *                                                                   *
+ * Public interactive mode functions                                 *
+ *                                                                   *
+ *********************************************************************/
+
+/* Reads and carries out program lines and commands from standard input
+ * until it ends, and returns the exit status
+ */
+int
+repl_run(void) {
+    const bool prompt = isatty(STDIN_FILENO);
+    program_set_resident(true);
+
+    while ( true ) {
+        if ( prompt ) {
+            fputs(">", stdout);
+            fflush(stdout);
+        }
+
+        errno = 0;
+        char * input = read_line(stdin);
+        if ( !input ) {
+            if ( errno != EINTR ) {
+                break;
+            }
+
+            /* Escape at the prompt */
+            clearerr(stdin);
+            interrupt = 0;
+            fputc('\n', stdout);
+            report(ERR_ESCAPE);
+            continue;
+        }
+
+        if ( !command(input) ) {
+            report(ERR_MISTAKE);
+        }
+        x_free(input);
+        fflush(stdout);
+    }
+
+    if ( prompt ) {
+        fputc('\n', stdout);
+    }
+
+    edit_free();
+    x_free(old_source);
+    old_source = NULL;
+
+    return EXIT_SUCCESS;
+}
+
+
+/*********************************************************************
+ *                                                                   *
+ * Static functions                                                  *
+ *                                                                   *
+ *********************************************************************/
+
+/* Carries out a line of input, which is either a program line or a
+ * command. Returns false if it's neither.
+ */
+static bool
+command(char * input) {
+    char * s = input;
+    while ( isspace((unsigned char) *s) ) {
+        s++;
+    }
+
+    /* A line number, with a line to enter or nothing to delete */
+    int number;
+    if ( isdigit((unsigned char) *s) ) {
+        char * p = s;
+        if ( !parse_number(&p, &number) ) {
+            return false;
+        }
+
+        while ( isspace((unsigned char) *p) ) {
+            p++;
+        }
+
+        if ( *p ) {
+            edit_line(number, s);
+        } else {
+            edit_delete(number, number);
+        }
+
+        return true;
+    }
+
+    /* Split the command from its arguments */
+    char * args = s;
+    while ( isupper((unsigned char) *args) ) {
+        args++;
+    }
+    const size_t len = args - s;
+
+    int from = 0;
+    int to = INT_MAX;
+    if ( len == 0 ) {
+        return *s == '\0';
+    } else if ( len == 3 && !strncmp(s, "RUN", len) && !*args ) {
+        edit_prepare();
+        program_run();
+        interrupt = 0;
+    } else if ( len == 4 && !strncmp(s, "LIST", len) ) {
+        if ( !parse_range(args, &from, &to) ) {
+            return false;
+        }
+        edit_list(stdout, from, to);
+    } else if ( len == 6 && !strncmp(s, "DELETE", len) ) {
+        if ( !parse_range(args, &from, &to) || from == 0 ) {
+            return false;
+        }
+        edit_delete(from, to);
+    } else if ( len == 3 && !strncmp(s, "NEW", len) && !*args ) {
+        x_free(old_source);
+        old_source = edit_source();
+        edit_free();
+    } else if ( len == 3 && !strncmp(s, "OLD", len) && !*args ) {
+        if ( edit_empty() && old_source ) {
+            edit_replace(old_source);
+            x_free(old_source);
+            old_source = NULL;
+        }
+    } else if ( len == 4 && !strncmp(s, "SAVE", len) ) {
+        const char * filename = filename_arg(args);
+        if ( !filename ) {
+            return false;
+        }
+        edit_save(filename);
+    } else if ( len == 4 && !strncmp(s, "LOAD", len) ) {
+        const char * filename = filename_arg(args);
+        if ( !filename ) {
+            return false;
+        }
+        size_t changed;
+        edit_load(filename, &changed);
+    } else if ( len == 4 && !strncmp(s, "AUTO", len) ) {
+        int step = 10;
+        if ( !parse_range(args, &from, &step) ) {
+            return false;
+        }
+        if ( from == 0 ) {
+            from = 10;
+        }
+        if ( !strchr(args, ',') ) {
+            step = 10;
+        }
+
+        /* Number lines until a blank line or Escape */
+        for ( int number = from; true; number += step ) {
+            printf("%5d ", number);
+            fflush(stdout);
+
+            char * line = read_line(stdin);
+            if ( !line || !*line ) {
+                x_free(line);
+                clearerr(stdin);
+                interrupt = 0;
+                break;
+            }
+
+            char * text = x_msprintf("%d %s", number, line);
+            edit_line(number, text);
+            x_free(text);
+            x_free(line);
+
+            if ( number > INT_MAX - step ) {
+                break;
+            }
+        }
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+/* Returns the file name given to SAVE or LOAD, with any quotes removed,
+ * or NULL if there isn't one
+ */
+static char *
+filename_arg(char * s) {
+    while ( isspace((unsigned char) *s) ) {
+        s++;
+    }
+
+    char * end = s + strlen(s);
+    while ( end > s && isspace((unsigned char) end[-1]) ) {
+        end--;
+    }
+    *end = '\0';
+
+    if ( *s == '"' ) {
+        if ( end - s < 2 || end[-1] != '"' ) {
+            return NULL;
+        }
+        s++;
+        end[-1] = '\0';
+    }
+
+    return *s ? s : NULL;
+}
+
+/* Reads a positive line number, and advances past it */
+static bool
+parse_number(char ** s, int * n) {
+    char * end;
+    errno = 0;
+    const long number = strtol(*s, &end, 10);
+    if ( end == *s || !isdigit((unsigned char) **s) || errno ||
+            number <= 0 || number > INT_MAX ) {
+        return false;
+    }
+
+    *n = number;
+    *s = end;
+    return true;
+}
+
+/* Reads an optional line number range, as "from", "from,to", ",to" or
+ * "from,", leaving from and to as they were for missing numbers
+ */
+static bool
+parse_range(char * s, int * from, int * to) {
+    while ( isspace((unsigned char) *s) ) {
+        s++;
+    }
+
+    if ( isdigit((unsigned char) *s) ) {
+        if ( !parse_number(&s, from) ) {
+            return false;
+        }
+
+        if ( *s != ',' ) {
+            *to = *from;
+        }
+    }
+
+    if ( *s == ',' ) {
+        s++;
+        if ( isdigit((unsigned char) *s) && !parse_number(&s, to) ) {
+            return false;
+        }
+    }
+
+    while ( isspace((unsigned char) *s) ) {
+        s++;
+    }
+
+    return *s == '\0';
+}
+
+/* Reads a line of any length, without its newline. Returns NULL at the
+ * end of input, or if reading is interrupted.
+ */
+static char *
+read_line(FILE * fp) {
+    size_t size = 128;
+    size_t len = 0;
+    char * line = x_malloc(size);
+
+    while ( fgets(line + len, size - len, fp) ) {
+        len += strlen(line + len);
+        if ( len > 0 && line[len - 1] == '\n' ) {
+            line[--len] = '\0';
+            if ( len > 0 && line[len - 1] == '\r' ) {
+                line[--len] = '\0';
+            }
+            return line;
+        }
+
+        if ( len + 1 == size ) {
+            size *= 2;
+            line = x_realloc(line, size);
+        }
+    }
+
+    /* A last line without a newline */
+    if ( len > 0 && !ferror(fp) ) {
+        return line;
+    }
+
+    x_free(line);
+    return NULL;
+}
+
+/* Reports an error in a command */
+static void
+report(const enum basic_error code) {
+    fprintf(program_err(), "%s\n", error_string(code));
+}
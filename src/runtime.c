@@ -24,43 +24,89 @@
 #include <stdbool.h>
 #include <string.h>
 #include <signal.h>
+#include <limits.h>
 #include <errno.h>
 
 #if HAVE_UNISTD_H
 #include <unistd.h>
 #endif
 
+#if HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#if HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+
+#if HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#if HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
 #include "runtime.h"
+#include "addr_set.h"
 #include "statements.h"
 #include "stack_addr.h"
 #include "symbols.h"
 #include "line_map.h"
+#include "lazy.h"
 #include "util.h"
 #include "options.h"
 #include "file_set.h"
 #include "colours.h"
+#include "profile.h"
+#include "sampler.h"
+#include "recorder.h"
+#include "introspect.h"
+#include "stats.h"
+#include "checkpoint.h"
+
+/* The state of a running program is kept per thread, so that
+ * separate threads can each run a program through libbbasic.
+ */
 
-/* List of program lines */
-static struct line {
-    int number;
-    struct statement * stmt;
-    struct line * next;
-} * lines;
+/* List of program lines, and the last line in the list */
+static THREAD_LOCAL struct line * lines;
+static THREAD_LOCAL struct line * lines_tail;
 
-/* List of program statements */
-static struct statement * stmts;
+/* The line most recently added, which the next is likely to follow */
+static THREAD_LOCAL struct line * lines_last_added;
 
-/* Currently executing line */
-static int current_line;
+/* List of program statements, and the number of lines it was built
+ * from, which is zero until it has been built.
+ */
+static THREAD_LOCAL struct statement * stmts;
+static THREAD_LOCAL size_t num_lines;
+
+/* Currently executing line, and its index, which is also read by the
+ * sampling profiler's signal handler. The index is -1 when no line is
+ * executing.
+ */
+THREAD_LOCAL volatile sig_atomic_t current_line;
+THREAD_LOCAL volatile sig_atomic_t current_line_index = -1;
 
 /* Pointer to next statement to execute */
-static struct statement * program_counter;
+static THREAD_LOCAL struct statement * program_counter;
+
+/* Statement to resume from when the program is run, if it was
+ * restored from a checkpoint
+ */
+static THREAD_LOCAL struct statement * resume_stmt;
+
+/* Number of calls to run_statements() in progress, which is one
+ * unless an FN is being evaluated
+ */
+static THREAD_LOCAL int run_depth;
 
 /* Pointer to ON ERROR handling statment, if any */
-static struct statement * error_stmt;
+static THREAD_LOCAL struct statement * error_stmt;
 
 /* Lines and codes of current and last-reported errors */
-static struct error_register {
+static THREAD_LOCAL struct error_register {
     int line;
     enum basic_error code;
     int last_line;
@@ -73,40 +119,92 @@ static struct error_register {
 };
 
 /* Function return value stack */
-static struct stack_addr return_stack;
+static THREAD_LOCAL struct stack_addr return_stack;
 
 /* Open files list */
-static struct file_set files_list;
+static THREAD_LOCAL struct file_set files_list;
+
+/* Size of the input buffer for each open file */
+#define OPEN_FILE_BUFFER_SIZE (8192)
 
 #ifdef ENABLE_ANSI_COLOURS
 /* "Colours used" flag */
-static bool colours_used;
-
-/* Reset colours exit handler */
-static void reset_colours(void);
+static THREAD_LOCAL bool colours_used;
 #endif
 
+/* Streams for program input, output and error messages, or NULL for
+ * the standard streams
+ */
+static THREAD_LOCAL FILE * input_stream;
+static THREAD_LOCAL FILE * output_stream;
+static THREAD_LOCAL FILE * error_stream;
+
+/* A program detached from the runtime. The line map is rebuilt from
+ * the lines when it is attached again.
+ */
+struct program {
+    struct line * lines;
+    struct line * lines_tail;
+};
+
 /* Static function declarations */
+static struct statement * build_lines(struct line * line,
+        const struct line * stop, struct statement * tail, size_t * count);
+static void define_procedures(void);
+static struct line * find_line(const int number, struct line ** previous);
+static struct statement * line_last(struct line * line);
+static void line_retarget(struct line * line, const struct statement * from,
+        struct statement * to);
+static void retarget(struct statement * s, const int number,
+        const struct statement * from, struct statement * to,
+        struct addr_set * seen);
+static void runtime_reset(void);
+static ssize_t open_file_fill(struct file_set_node * node);
+static bool open_file_reopen(const int fd, const char * path,
+        const int mode, const off_t pos, const off_t size);
 static bool status_error(const int status);
 
 /* Interrupt flag */
 volatile sig_atomic_t interrupt;
 
-/* Builds a list of program statements from a list of program lines */
-static void
+/* Whether the program stays loaded after it has run */
+static THREAD_LOCAL bool resident;
+
+/* Builds a list of program statements from a list of program lines,
+ * and returns the number of lines.
+ */
+static size_t
 build_statements(void) {
-    struct line * line = lines;
-    struct statement * tail = NULL;
+    size_t count = 0;
+    build_lines(lines, NULL, NULL, &count);
 
-    while ( line ) {
+    return lazy_active() ? lazy_num_lines() : count;
+}
+
+/* Builds the lines from line up to stop into the list of program
+ * statements, after tail, or at the head of the list if tail is NULL.
+ * Adds the number of lines built to count, and returns the last
+ * statement built.
+ */
+static struct statement *
+build_lines(struct line * line, const struct line * stop,
+        struct statement * tail, size_t * count) {
+    while ( line != stop ) {
         struct statement * stmt = line->stmt;
         struct statement * next = stmt->next;
 
+        /* Lines which haven't been loaded leave gaps in a lazily
+         * loaded program, so they can't just be counted
+         */
+        const int index = lazy_active() ?
+            lazy_line_index(line->number) : (int) *count;
+
         while ( stmt ) {
             /* Update the line number for each statement, so it's
              * available to the statement execution routines
              * */
             stmt->line_number = line->number;
+            stmt->line_index = index;
 
             /* Add or append the statement */
             if ( !tail ) {
@@ -122,6 +220,7 @@ build_statements(void) {
                 case STATEMENT_DEF_FN:
                 case STATEMENT_DEF_PROC:
                     symbol_proc_define(value_string_peek(stmt->v), stmt);
+                    lazy_attach(stmt);
                     break;
 
                 default:
@@ -144,19 +243,15 @@ build_statements(void) {
 
         }
         line = line->next;
+        (*count)++;
     }
-}
 
-#if ENABLE_ANSI_COLOURS
-/* Reset colours exit handler */
-static void
-reset_colours(void) {
-    if ( colours_used ) {
-        printf(ANSI_COLOUR_RESET);
-        fflush(stdout);
+    if ( tail ) {
+        tail->next = stop ? stop->stmt : NULL;
     }
+
+    return tail;
 }
-#endif
 
 /* Pops an expression from the runtime stack */
 struct value *
@@ -178,11 +273,18 @@ runtime_stack_push(struct value * v) {
 /* Runs a sequence of statements */
 int
 run_statements(struct statement * s) {
-    int status;
+    const int calling_line = current_line;
+    const int calling_index = current_line_index;
+    int status = STATUS_OK;
 
     set_pc(s);
+    run_depth++;
     struct statement * current = program_counter;
     while ( (current = pc()) ) {
+        if ( checkpoint_requested && run_depth == 1 ) {
+            checkpoint_take(checkpoint_filename, current);
+        }
+
         /* The statement may alter the program counter, so
          * set the default before we execute it, not after
          */
@@ -190,6 +292,21 @@ run_statements(struct statement * s) {
         
         /* Store current line number for error reporting */
         current_line = current->line_number;
+        current_line_index = current->line_index;
+
+        introspect_line_counts[current->line_index]++;
+        if ( introspect_requested ) {
+            introspect_requested = 0;
+            introspect_report(stmts, current);
+        }
+
+        if ( profile_active ) {
+            profile_statement(current);
+        }
+
+        if ( recorder_active ) {
+            recorder_record(current);
+        }
 
         status = statement_execute(current);
         if ( error_stmt && ((status == STATUS_ERROR) || (status > 0)
@@ -211,6 +328,11 @@ run_statements(struct statement * s) {
         }
     }
 
+    /* When running an FN, the calling statement is still executing */
+    current_line = calling_line;
+    current_line_index = calling_index;
+    run_depth--;
+
     return status;
 }
 
@@ -218,19 +340,55 @@ run_statements(struct statement * s) {
 int
 program_run(void) {
 
-    /* Set up */
+    /* Set up, forgetting any error left by an earlier run unless
+     * resuming from a checkpoint
+     */
     error_clear();
-    build_statements();
-    reset_data_pointer();
+    if ( !resume_stmt ) {
+        error_register.last_line = 0;
+        error_register.last_code = ERR_NO_ERROR;
+    }
+    program_build();
+    if ( resident ) {
+        /* The procedures went with the variables after the last run */
+        define_procedures();
+    }
+    const size_t nlines = num_lines;
 
-#if ENABLE_ANSI_COLOURS
-    x_atexit(reset_colours);
-#endif
+    introspect_start(introspect_filename, nlines);
 
-    int status = run_statements(stmts);
+    if ( profile_filename || profile_stacks_filename ) {
+        profile_start(profile_filename, profile_stacks_filename, nlines);
+    }
 
-    /* Cleanup */
-    runtime_free();
+    if ( profile_samples_filename ) {
+        sampler_start(profile_samples_filename, nlines);
+    }
+
+    if ( recorder_filename ) {
+        recorder_start(recorder_filename, recorder_size, recorder_times_flag);
+    }
+
+    stats_phase_begin(STATS_PHASE_RUN);
+    int status = run_statements(resume_stmt ? resume_stmt : stmts);
+    resume_stmt = NULL;
+    stats_phase_end(STATS_PHASE_RUN);
+    sampler_finish(stmts);
+    profile_finish();
+
+    /* Dump the flight recorder if the program stopped on an error */
+    if ( status_error(status) || error_is_set() ) {
+        recorder_dump_error();
+    }
+    recorder_finish();
+    introspect_finish();
+
+    /* Cleanup, keeping a resident program for the next run */
+    if ( resident ) {
+        runtime_reset();
+    } else {
+        runtime_free();
+    }
 
     // Return the status code on error.
     if ( status_error(status) || error_is_set() ) {
@@ -244,22 +402,47 @@ program_run(void) {
     return STATUS_OK;
 }
 
+/* Builds the program from its lines, if that hasn't been done yet.
+ * program_run() does this itself, but --server does it beforehand so
+ * that each forked run starts with the program built.
+ */
+void
+program_build(void) {
+    if ( num_lines > 0 ) {
+        return;
+    }
+
+    stats_phase_begin(STATS_PHASE_BUILD);
+    num_lines = build_statements();
+    reset_data_pointer();
+    stats_phase_end(STATS_PHASE_BUILD);
+}
+
 /* Frees resources used by the runtime */
 void
 runtime_free(void) {
     /* Free program statements */
+    const bool built = num_lines > 0;
     error_stmt_clear();
     statement_free(stmts);
     stmts = NULL;
+    num_lines = 0;
 
-    /* Free program lines */
+    /* Free program lines, and their statements if the program was
+     * never built from them
+     */
     struct line * line = lines;
     while ( line ) {
         struct line * tmp = line->next;
-        free(line);
+        if ( !built ) {
+            statement_free(line->stmt);
+        }
+        x_free(line);
         line = tmp;
     }
     lines = NULL;
+    lines_tail = NULL;
+    lines_last_added = NULL;
 
     /* Free other resources */
     stack_addr_free(&return_stack);
@@ -267,7 +450,97 @@ runtime_free(void) {
     file_set_free(&files_list);
     symbol_table_free();
     line_map_free();
+    lazy_free();
     statements_cleanup();
+    resume_stmt = NULL;
+}
+
+/* Resets the runtime for another run of the same program, keeping
+ * the built program and its DATA items
+ */
+static void
+runtime_reset(void) {
+    error_stmt_clear();
+    stack_addr_free(&return_stack);
+    open_files_close_all();
+    symbol_table_free();
+    statements_reset();
+}
+
+/* Sets whether the program stays loaded after it has run, so that it
+ * can be edited and run again
+ */
+void
+program_set_resident(const bool keep) {
+    resident = keep;
+}
+
+/* Restores the program counter, error handling state and open files
+ * from a checkpoint
+ */
+void
+runtime_restore(struct checkpoint * cp) {
+    resume_stmt = checkpoint_get_stmt(cp);
+    struct statement * handler = checkpoint_get_stmt(cp);
+    struct statement * next = checkpoint_get_stmt(cp);
+    if ( handler ) {
+        error_stmt_set(handler, next);
+    }
+    error_register.last_line = checkpoint_get_int(cp);
+    error_register.last_code = checkpoint_get_int(cp);
+
+    const int64_t num_files = checkpoint_get_int(cp);
+    for ( int64_t i = 0; i < num_files && !checkpoint_failed(cp); i++ ) {
+        const int64_t fd = checkpoint_get_int(cp);
+        char * path = checkpoint_get_string(cp);
+        const int mode = checkpoint_get_int(cp);
+        const off_t pos = checkpoint_get_int(cp);
+        const off_t size = checkpoint_get_int(cp);
+        const int ptr = checkpoint_get_int(cp);
+
+        if ( checkpoint_failed(cp) || fd < 0 || fd > INT_MAX ||
+                !open_file_reopen(fd, path, mode, pos, size) ) {
+            checkpoint_fail(cp);
+        } else {
+            open_file_add(fd, path, mode);
+            open_file_set_ptr(fd, ptr);
+        }
+        x_free(path);
+    }
+
+    if ( !resume_stmt ) {
+        checkpoint_fail(cp);
+    }
+}
+
+/* Saves the program counter, error handling state and open files to
+ * a checkpoint, to resume from the statement resume. The positions
+ * and sizes of the files are those recorded by open_files_mark().
+ */
+void
+runtime_save(struct checkpoint * cp, struct statement * resume) {
+    checkpoint_put_stmt(cp, resume);
+    checkpoint_put_stmt(cp, error_stmt);
+    checkpoint_put_stmt(cp, error_stmt ? error_stmt->next : NULL);
+    checkpoint_put_int(cp, error_register.last_line);
+    checkpoint_put_int(cp, error_register.last_code);
+
+    int64_t num_files = 0;
+    for ( struct file_set_node * node = files_list.head; node;
+            node = node->next ) {
+        num_files++;
+    }
+
+    checkpoint_put_int(cp, num_files);
+    for ( struct file_set_node * node = files_list.head; node;
+            node = node->next ) {
+        checkpoint_put_int(cp, node->fd);
+        checkpoint_put_string(cp, node->path);
+        checkpoint_put_int(cp, node->mode);
+        checkpoint_put_int(cp, node->mark_pos);
+        checkpoint_put_int(cp, node->mark_size);
+        checkpoint_put_int(cp, node->ptr);
+    }
 }
 
 
@@ -291,13 +564,34 @@ line_add(const int number, struct statement * stmt) {
     int status;
     if ( (status = line_map_add(number, stmt)) != STATUS_OK ) {
         runtime_free();
-        free(new_line);
+        x_free(new_line);
         return status;
     }
 
     /* If the program is empty, just add this one line and return */
     if ( lines == NULL ) {
         lines = new_line;
+        lines_tail = new_line;
+        lines_last_added = new_line;
+        return STATUS_OK;
+    }
+
+    /* Lines usually come in order, so check the end first */
+    if ( number > lines_tail->number ) {
+        lines_tail->next = new_line;
+        lines_tail = new_line;
+        lines_last_added = new_line;
+        return STATUS_OK;
+    }
+
+    /* Lines inserted into the middle of a program, such as a lazily
+     * loaded PROC body, also usually come in order
+     */
+    struct line * last = lines_last_added;
+    lines_last_added = new_line;
+    if ( last && number > last->number && number < last->next->number ) {
+        new_line->next = last->next;
+        last->next = new_line;
         return STATUS_OK;
     }
 
@@ -325,10 +619,256 @@ line_add(const int number, struct statement * stmt) {
      * append the new line.
      */
     previous->next = new_line;
+    lines_tail = new_line;
 
     return STATUS_OK;
 }
 
+/* Returns the list of program lines */
+struct line *
+program_lines(void) {
+    return lines;
+}
+
+/* Links lines added to a built program into it, as when a PROC or FN
+ * body is loaded lazily. The new lines must directly follow the line
+ * ending with statement s.
+ */
+void
+program_link(struct statement * s) {
+    struct line * line = lines;
+    while ( line && line->number != s->line_number ) {
+        line = line->next;
+    }
+    if ( !line ) {
+        return;
+    }
+
+    /* The new lines end at the line s used to lead to */
+    struct line * stop = line->next;
+    while ( stop && stop->stmt != s->next ) {
+        stop = stop->next;
+    }
+
+    size_t count = 0;
+    build_lines(line->next, stop, s, &count);
+}
+
+/* Links a line added to a built program into it, between the lines
+ * either side of it, without building the rest of the program again.
+ * A program which hasn't been built yet is left alone, since building
+ * it links every line.
+ */
+void
+line_link(const int number) {
+    if ( num_lines == 0 ) {
+        return;
+    }
+
+    struct line * previous;
+    struct line * line = find_line(number, &previous);
+    if ( !line ) {
+        return;
+    }
+
+    /* Statements on the previous line which led to the next line now
+     * lead to this one
+     */
+    if ( previous ) {
+        line_retarget(previous, line->next ? line->next->stmt : NULL,
+                line->stmt);
+    }
+
+    build_lines(line, line->next, previous ? line_last(previous) : NULL,
+            &num_lines);
+}
+
+/* Deletes a line from the program. If the program has been built, the
+ * lines either side of it are linked together in its place.
+ */
+int
+line_delete(const int number) {
+    struct line * previous;
+    struct line * line = find_line(number, &previous);
+    if ( !line ) {
+        return STATUS_ERROR;
+    }
+
+    if ( num_lines > 0 ) {
+        struct statement * next = line->next ? line->next->stmt : NULL;
+        line_retarget(line, next, NULL);
+        if ( previous ) {
+            line_retarget(previous, line->stmt, next);
+        } else {
+            stmts = next;
+        }
+    }
+
+    if ( previous ) {
+        previous->next = line->next;
+    } else {
+        lines = line->next;
+    }
+    if ( lines_tail == line ) {
+        lines_tail = previous;
+    }
+    lines_last_added = NULL;
+
+    line_map_remove(number);
+    statement_free(line->stmt);
+    x_free(line);
+
+    return STATUS_OK;
+}
+
+/* Detaches the program lines from the runtime and returns them, so
+ * that another program can be loaded or run on this thread. Returns
+ * NULL if there is no program.
+ */
+struct program *
+program_detach(void) {
+    if ( !lines ) {
+        return NULL;
+    }
+
+    struct program * program = x_malloc(sizeof *program);
+    program->lines = lines;
+    program->lines_tail = lines_tail;
+
+    lines = NULL;
+    lines_tail = NULL;
+    lines_last_added = NULL;
+    line_map_free();
+
+    return program;
+}
+
+/* Attaches program lines previously returned by program_detach(),
+ * replacing any program already loaded, and frees program.
+ */
+int
+program_attach(struct program * program) {
+    runtime_free();
+
+    if ( !program ) {
+        return STATUS_OK;
+    }
+
+    lines = program->lines;
+    lines_tail = program->lines_tail;
+    x_free(program);
+
+    for ( struct line * line = lines; line; line = line->next ) {
+        if ( line_map_add(line->number, line->stmt) != STATUS_OK ) {
+            return STATUS_ERROR;
+        }
+    }
+
+    return STATUS_OK;
+}
+
+/* Defines the procedures and functions in a built program */
+static void
+define_procedures(void) {
+    for ( struct line * line = lines; line; line = line->next ) {
+        for ( struct statement * s = line->stmt;
+                s && s->line_number == line->number; s = s->next ) {
+            if ( s->type == STATEMENT_DEF_FN ||
+                    s->type == STATEMENT_DEF_PROC ) {
+                symbol_proc_define(value_string_peek(s->v), s);
+            }
+        }
+    }
+}
+
+/* Finds a program line, and the line before it */
+static struct line *
+find_line(const int number, struct line ** previous) {
+    *previous = NULL;
+    struct line * line = lines;
+    while ( line && line->number < number ) {
+        *previous = line;
+        line = line->next;
+    }
+
+    return line && line->number == number ? line : NULL;
+}
+
+/* Returns the last statement of a line in a built program */
+static struct statement *
+line_last(struct line * line) {
+    struct statement * s = line->stmt;
+    while ( s->next && s->next->line_number == line->number ) {
+        s = s->next;
+    }
+
+    return s;
+}
+
+/* Makes the statements in a line of a built program which lead to the
+ * statement from, outside the line, lead to the statement to instead
+ */
+static void
+line_retarget(struct line * line, const struct statement * from,
+        struct statement * to) {
+    if ( from == to ) {
+        return;
+    }
+
+    struct addr_set * seen = addr_set_new();
+    retarget(line->stmt, line->number, from, to, seen);
+    addr_set_free(seen);
+}
+
+/* Does the work of line_retarget() for a list of statements, and the
+ * lists they contain
+ */
+static void
+retarget(struct statement * s, const int number,
+        const struct statement * from, struct statement * to,
+        struct addr_set * seen) {
+    while ( s && s->line_number == number && !addr_set_is_member(seen, s) ) {
+        addr_set_add(seen, s);
+        for ( size_t i = 0; i < STMT_NUM_STMTS && s->stmt[i]; i++ ) {
+            retarget(s->stmt[i], number, from, to, seen);
+        }
+
+        if ( s->next == from ) {
+            s->next = to;
+            return;
+        }
+        s = s->next;
+    }
+}
+
+/* Returns the stream from which INPUT reads */
+FILE *
+program_in(void) {
+    return input_stream ? input_stream : stdin;
+}
+
+/* Returns the stream to which PRINT and other statements write */
+FILE *
+program_out(void) {
+    return output_stream ? output_stream : stdout;
+}
+
+/* Returns the stream to which error messages are written */
+FILE *
+program_err(void) {
+    return error_stream ? error_stream : stderr;
+}
+
+/* Sets the streams for programs run on this thread. NULL selects the
+ * corresponding standard stream.
+ */
+void
+program_set_streams(FILE * in, FILE * out, FILE * err) {
+    input_stream = in;
+    output_stream = out;
+    error_stream = err;
+}
+
 /*********************************************************************
  *                                                                   *
  * Program counter functions                                         *
@@ -354,10 +894,31 @@ set_pc(struct statement * stmt) {
  *                                                                   *
  *********************************************************************/
 
-/* Adds a file to the open files list */
+/* Adds a file to the open files list. path and mode are the path and
+ * access mode it was opened with, which a checkpoint needs to open it
+ * again.
+ */
 void
-open_file_add(const int fd) {
+open_file_add(const int fd, const char * path, const int mode) {
+    char resolved[PATH_MAX];
     file_set_add(&files_list, fd);
+
+    struct file_set_node * node = file_set_find(&files_list, fd);
+    node->path = x_strdup(realpath(path, resolved) ? resolved : path);
+    node->mode = mode;
+}
+
+/* Returns the number of bytes which have been read ahead from a file
+ * into its input buffer, but not yet consumed
+ */
+size_t
+open_file_buffered(const int fd) {
+    struct file_set_node * node = file_set_find(&files_list, fd);
+    if ( !node ) {
+        return 0;
+    }
+
+    return node->buf_len - node->buf_pos;
 }
 
 /* Closes all open files */
@@ -370,6 +931,31 @@ open_files_close_all(void) {
     }
 }
 
+/* Records the position of each open file, not counting input read
+ * ahead but not yet consumed, and its size, for a checkpoint
+ */
+void
+open_files_mark(void) {
+    for ( struct file_set_node * node = files_list.head; node;
+            node = node->next ) {
+        const off_t offset = lseek(node->fd, 0, SEEK_CUR);
+        node->mark_pos = offset == -1 ? 0 :
+            offset - (off_t) (node->buf_len - node->buf_pos);
+
+        struct stat st;
+        node->mark_size = fstat(node->fd, &st) == -1 ? 0 : st.st_size;
+    }
+}
+
+/* Writes the channel and file pointer of each open file */
+void
+open_files_report(FILE * fp) {
+    for ( struct file_set_node * node = files_list.head; node;
+            node = node->next ) {
+        fprintf(fp, "    channel %d, PTR %d\n", node->fd, node->ptr);
+    }
+}
+
 /* Gets the file pointer for an open file */
 int
 open_file_get_ptr(const int fd) {
@@ -382,15 +968,207 @@ open_file_get_ptr(const int fd) {
     return node->ptr;
 }
 
-/* Increments the file pointer for an open file */
+/* Increments the file pointer for an open file by n items */
 void
-open_file_increment_ptr(const int fd) {
+open_file_increment_ptr(const int fd, const int n) {
     struct file_set_node * node = file_set_find(&files_list, fd);
     if ( !node ) {
         ABORT("failed to find open file");
     }
 
-    node->ptr++;
+    node->ptr += n;
+}
+
+/* Reads up to n bytes from an open file into buffer, through the
+ * file's input buffer. Returns the number of bytes read, which is
+ * less than n only at end-of-file, or STATUS_ERROR on error.
+ */
+ssize_t
+open_file_read(const int fd, void * buffer, const size_t n) {
+    struct file_set_node * node = file_set_find(&files_list, fd);
+    if ( !node ) {
+        error_set(ERR_CHANNEL);
+        return STATUS_ERROR;
+    }
+
+    unsigned char * out = buffer;
+    size_t got = 0;
+    while ( got < n ) {
+        if ( node->buf_pos < node->buf_len ) {
+            /* Consume any buffered input first */
+            size_t nb = node->buf_len - node->buf_pos;
+            if ( nb > n - got ) {
+                nb = n - got;
+            }
+
+            memcpy(out + got, node->buf + node->buf_pos, nb);
+            node->buf_pos += nb;
+            got += nb;
+            continue;
+        }
+
+        ssize_t status;
+        if ( n - got >= OPEN_FILE_BUFFER_SIZE ) {
+            /* Read large transfers directly */
+            status = read(fd, out + got, n - got);
+            if ( status > 0 ) {
+                got += status;
+            }
+        } else {
+            status = open_file_fill(node);
+        }
+
+        if ( status == -1 ) {
+            error_set(ERR_CHANNEL);
+            return STATUS_ERROR;
+        } else if ( status == 0 ) {
+            break;
+        }
+    }
+
+    return got;
+}
+
+/* Reads up to n bytes from an open file, sets len to the number read,
+ * and returns them with a terminating null character. The bytes may
+ * include null characters. Large reads go straight from the file into
+ * the string rather than through the file's input buffer, and the
+ * string grows as bytes arrive, so asking for more bytes than the file
+ * holds doesn't allocate memory for all of them. Returns NULL on error,
+ * including at end-of-file. The caller is responsible for freeing the
+ * returned string.
+ */
+char *
+open_file_read_bytes(const int fd, const size_t n, size_t * len) {
+    struct file_set_node * node = file_set_find(&files_list, fd);
+    if ( !node ) {
+        error_set(ERR_CHANNEL);
+        return NULL;
+    }
+
+    size_t capacity = n < OPEN_FILE_BUFFER_SIZE ? n : OPEN_FILE_BUFFER_SIZE;
+    char * s = x_malloc(capacity + 1);
+    size_t got = 0;
+
+    while ( got < n ) {
+        if ( got == capacity ) {
+            capacity = capacity < n - capacity ? capacity * 2 : n;
+            s = x_realloc(s, capacity + 1);
+        }
+
+        if ( node->buf_pos < node->buf_len ) {
+            /* Consume any buffered input first */
+            size_t nb = node->buf_len - node->buf_pos;
+            if ( nb > capacity - got ) {
+                nb = capacity - got;
+            }
+
+            memcpy(s + got, node->buf + node->buf_pos, nb);
+            node->buf_pos += nb;
+            got += nb;
+            continue;
+        }
+
+        ssize_t status;
+        if ( capacity - got >= OPEN_FILE_BUFFER_SIZE ) {
+            /* Read large transfers directly */
+            status = read(fd, s + got, capacity - got);
+            if ( status > 0 ) {
+                got += status;
+            }
+        } else {
+            status = open_file_fill(node);
+        }
+
+        if ( status == -1 ) {
+            x_free(s);
+            error_set(ERR_CHANNEL);
+            return NULL;
+        } else if ( status == 0 ) {
+            break;
+        }
+    }
+
+    if ( got == 0 && n > 0 ) {
+        x_free(s);
+        error_set(ERR_EOF);
+        return NULL;
+    }
+
+    s[got] = '\0';
+    *len = got;
+
+    return s;
+}
+
+/* Reads a line from an open file, and returns it without the line
+ * terminator, which may be LF or CR LF. A final line without a
+ * terminator is also returned. Returns NULL on error, including if
+ * there are no more lines. The caller is responsible for freeing the
+ * returned string.
+ */
+char *
+open_file_read_line(const int fd) {
+    struct file_set_node * node = file_set_find(&files_list, fd);
+    if ( !node ) {
+        error_set(ERR_CHANNEL);
+        return NULL;
+    }
+
+    char * line = NULL;
+    size_t len = 0;
+    size_t cap = 0;
+    bool any = false;
+
+    while ( true ) {
+        if ( node->buf_pos == node->buf_len ) {
+            const ssize_t status = open_file_fill(node);
+            if ( status == -1 ) {
+                x_free(line);
+                error_set(ERR_CHANNEL);
+                return NULL;
+            } else if ( status == 0 ) {
+                break;
+            }
+        }
+
+        any = true;
+
+        /* Find the end of the line, if it's in the buffer */
+        const unsigned char * start = node->buf + node->buf_pos;
+        const size_t avail = node->buf_len - node->buf_pos;
+        const unsigned char * nl = memchr(start, '\n', avail);
+        const size_t nb = nl ? (size_t) (nl - start) : avail;
+
+        /* Append this part of the line, leaving room for
+         * the terminating null
+         */
+        if ( len + nb + 1 > cap ) {
+            cap = len + nb + 1 > cap * 2 ? len + nb + 1 : cap * 2;
+            line = x_realloc(line, cap);
+        }
+        memcpy(line + len, start, nb);
+        len += nb;
+
+        if ( nl ) {
+            node->buf_pos += nb + 1;
+            break;
+        }
+
+        node->buf_pos += nb;
+    }
+
+    if ( !any ) {
+        error_set(ERR_EOF);
+        return NULL;
+    }
+
+    if ( len > 0 && line[len-1] == '\r' ) {
+        len--;
+    }
+    line[len] = '\0';
+
+    return line;
 }
 
 /* Removes a file from the open files list */
@@ -413,10 +1191,121 @@ open_file_set_ptr(const int fd, const int ptr) {
     return STATUS_OK;
 }
 
+/* Writes the contents of iovcnt buffers to an open file with as few
+ * system calls as possible, discarding any buffered input first.
+ * Returns STATUS_OK on success, or STATUS_ERROR on error.
+ */
+int
+open_file_writev(const int fd, struct iovec * iov, int iovcnt) {
+    if ( open_file_sync(fd) != STATUS_OK ) {
+        return STATUS_ERROR;
+    }
+
+    while ( iovcnt > 0 ) {
+        ssize_t status = writev(fd, iov, iovcnt);
+        if ( status == -1 ) {
+            error_set(ERR_CHANNEL);
+            return STATUS_ERROR;
+        }
+
+        /* Skip past whatever was written, in case of a short write */
+        while ( iovcnt > 0 && (size_t) status >= iov->iov_len ) {
+            status -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+
+        if ( iovcnt > 0 ) {
+            iov->iov_base = (char *) iov->iov_base + status;
+            iov->iov_len -= status;
+        }
+    }
+
+    return STATUS_OK;
+}
+
+/* Discards any input read ahead from a file, moving the file offset
+ * back to the first unconsumed byte. This must be called before
+ * writing to or seeking within a file.
+ */
+int
+open_file_sync(const int fd) {
+    struct file_set_node * node = file_set_find(&files_list, fd);
+    if ( !node ) {
+        error_set(ERR_CHANNEL);
+        return STATUS_ERROR;
+    }
+
+    const size_t unread = node->buf_len - node->buf_pos;
+    node->buf_pos = 0;
+    node->buf_len = 0;
+
+    if ( unread > 0 && lseek(fd, -(off_t) unread, SEEK_CUR) == -1 ) {
+        error_set(ERR_CHANNEL);
+        return STATUS_ERROR;
+    }
+
+    return STATUS_OK;
+}
+
+/* Refills the input buffer for an open file, which must be empty.
+ * Returns the number of bytes read, zero at end-of-file, or -1 on
+ * error.
+ */
+static ssize_t
+open_file_fill(struct file_set_node * node) {
+    if ( !node->buf ) {
+        node->buf = x_malloc(OPEN_FILE_BUFFER_SIZE);
+    }
+
+    const ssize_t status = read(node->fd, node->buf, OPEN_FILE_BUFFER_SIZE);
+    node->buf_pos = 0;
+    node->buf_len = status > 0 ? status : 0;
+
+    return status;
+}
+
+
+/* Opens a file from a checkpoint again on the channel it had before,
+ * truncating it to its size at the time if it's writable, and moves
+ * to the position it had. Returns true on success.
+ */
+static bool
+open_file_reopen(const int fd, const char * path, const int mode,
+        const off_t pos, const off_t size) {
+    if ( fcntl(fd, F_GETFD) != -1 ) {
+        fprintf(stderr, "%s: channel %d for %s is already in use\n",
+                PACKAGE, fd, path);
+        return false;
+    }
+
+    const int flags = mode == O_RDONLY ? mode : mode | O_CREAT;
+    const int newfd = open(path, flags,
+            S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if ( newfd == -1 ) {
+        perror(path);
+        return false;
+    }
+
+    if ( (mode != O_RDONLY && ftruncate(newfd, size) == -1) ||
+            lseek(newfd, pos, SEEK_SET) == -1 ||
+            (newfd != fd && dup2(newfd, fd) == -1) ) {
+        perror(path);
+        close(newfd);
+        return false;
+    }
+
+    if ( newfd != fd ) {
+        close(newfd);
+    }
+
+    return true;
+}
+
 
 /*********************************************************************
  *                                                                   *
- * Colour function                                                   *
+ * Colour functions                                                  *
  *                                                                   *
  *********************************************************************/
 
@@ -426,6 +1315,16 @@ void
 set_colour_used(void) {
     colours_used = true;
 }
+
+/* Resets the colours, if the program changed them */
+void
+reset_colours(void) {
+    if ( colours_used ) {
+        fputs(ANSI_COLOUR_RESET, program_out());
+        fflush(program_out());
+        colours_used = false;
+    }
+}
 #endif
 
 
@@ -685,13 +1584,14 @@ error_output(void) {
         ABORTF("unrecognized error code: %d", error_register.code);
     }
 
-    fprintf(stderr, "%s", msg);
+    FILE * err = program_err();
+    fprintf(err, "%s", msg);
 
     /* Output line number if one is set */
     if ( error_register.line == 0 ) {
-        fputc('\n', stderr);
+        fputc('\n', err);
     } else {
-        fprintf(stderr, " at line %d\n", error_register.line);
+        fprintf(err, " at line %d\n", error_register.line);
     }
 }
 
@@ -18,12 +18,19 @@
 #ifndef PG_BBASIC_INTERNAL_RUNTIME_H
 #define PG_BBASIC_INTERNAL_RUNTIME_H
 
+#include "internal.h"
+
+#include <stdio.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <signal.h>
+#include <sys/types.h>
 #include "value.h"
 
-/* Opaque and incomplete struct definition */
+/* Opaque and incomplete struct definitions */
 struct statement;
+struct iovec;
+struct checkpoint;
 
 /* Error codes */
 enum basic_error {
@@ -104,11 +111,37 @@ enum branch_status {
     END_OF_PROGRAM = -2 
 };
 
+/* A program line, in the list of lines sorted by line number */
+struct line {
+    int number;
+    struct statement * stmt;
+    struct line * next;
+};
+
+/* A program detached from the runtime */
+struct program;
+
 /* Runtime functions */
 int line_add(const int number, struct statement * stmt);
+int line_delete(const int number);
+void line_link(const int number);
+struct line * program_lines(void);
+void program_link(struct statement * s);
+int program_attach(struct program * program);
+void program_build(void);
+struct program * program_detach(void);
 int program_run(void);
+void program_set_resident(const bool keep);
 int run_statements(struct statement * s);
 void runtime_free(void);
+void runtime_restore(struct checkpoint * cp);
+void runtime_save(struct checkpoint * cp, struct statement * resume);
+
+/* Program stream functions */
+FILE * program_err(void);
+FILE * program_in(void);
+FILE * program_out(void);
+void program_set_streams(FILE * in, FILE * out, FILE * err);
 
 /* Runtime stack functions */
 struct value * runtime_stack_pop(void);
@@ -119,15 +152,24 @@ struct statement * pc(void);
 void set_pc(struct statement * stmt);
 
 /* Open file functions */
-void open_file_add(const int fd);
+void open_file_add(const int fd, const char * path, const int mode);
+size_t open_file_buffered(const int fd);
 void open_files_close_all(void);
+void open_files_mark(void);
+void open_files_report(FILE * fp);
 int open_file_get_ptr(const int fd);
-void open_file_increment_ptr(const int fd);
+void open_file_increment_ptr(const int fd, const int n);
+ssize_t open_file_read(const int fd, void * buffer, const size_t n);
+char * open_file_read_bytes(const int fd, const size_t n, size_t * len);
+char * open_file_read_line(const int fd);
 void open_file_remove(const int fd);
 int open_file_set_ptr(const int fd, const int ptr);
+int open_file_sync(const int fd);
+int open_file_writev(const int fd, struct iovec * iov, int iovcnt);
 
 #ifdef ENABLE_ANSI_COLOURS
-/* Colour function */
+/* Colour functions */
+void reset_colours(void);
 void set_colour_used(void);
 #endif
 
@@ -147,4 +189,8 @@ void error_stmt_clear(void);
 /* Interrupt flag */
 extern volatile sig_atomic_t interrupt;
 
+/* Currently executing line and line index */
+extern THREAD_LOCAL volatile sig_atomic_t current_line;
+extern THREAD_LOCAL volatile sig_atomic_t current_line_index;
+
 #endif  /* PG_BBASIC_INTERNAL_RUNTIME_H */
@@ -0,0 +1,253 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Sampling profiler for the --profile-samples option.
+ *
+ * A SIGPROF timer interrupts the program at regular intervals of
+ * CPU time, and the signal handler increments a counter for the index
+ * of the line being executed. The counters are allocated before the
+ * timer starts, one for each line and one for samples taken when no
+ * line is executing, so every sample is counted however long the
+ * program runs. No locking is needed, since the handler is the only
+ * writer, and the counters are only read once the timer has been
+ * stopped. Nothing else is done while the program runs, so the only
+ * cost to the interpreter is keeping current_line_index up to date
+ * alongside current_line. At the end of the run the counters are
+ * written out as a histogram.
+ */
+
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+
+#if HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#include "sampler.h"
+#include "runtime.h"
+#include "statements.h"
+#include "util.h"
+
+/* Sampling interval in microseconds */
+#define SAMPLE_INTERVAL (1000)
+
+/* Number of samples for a single line */
+struct sample_count {
+    int line;
+    unsigned long count;
+};
+
+/* Sample counters, indexed by line index, with the last one for
+ * samples taken when no line is executing
+ */
+static volatile sig_atomic_t * samples;
+static size_t sample_lines;
+
+/* Report file */
+static FILE * sample_file;
+
+/* Histogram built from the counters, and the total number of samples */
+static struct sample_count * histogram;
+static size_t histogram_size;
+static unsigned long num_samples;
+
+/* Previous SIGPROF disposition */
+static struct sigaction old_action;
+
+/* Static function declarations */
+static int compare_counts(const void * a, const void * b);
+static void count_samples(const struct statement * program);
+static void handler(int signum);
+static void set_timer(const long usec);
+
+
+/*********************************************************************
+ *                                                                   *
+ * Public sampling functions                                         *
+ *                                                                   *
+ *********************************************************************/
+
+/* Starts sampling a program with nlines lines, writing the report to
+ * filename when sampler_finish is called.
+ */
+void
+sampler_start(const char * filename, const size_t nlines) {
+    sample_file = x_fopen(filename, "w");
+    samples = x_calloc(nlines + 1, sizeof *samples);
+    sample_lines = nlines;
+
+    /* Restart interrupted system calls, so sampling doesn't cause
+     * reads from the keyboard or from files to fail.
+     */
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = handler;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = SA_RESTART;
+    if ( sigaction(SIGPROF, &act, &old_action) == -1 ) {
+        perror("sigaction failed");
+        exit(EXIT_FAILURE);
+    }
+
+    set_timer(SAMPLE_INTERVAL);
+}
+
+/* Stops sampling, and writes and closes the report. program is the
+ * list of program statements, which gives the line number for each
+ * line index.
+ */
+void
+sampler_finish(const struct statement * program) {
+    if ( !sample_file ) {
+        return;
+    }
+
+    set_timer(0);
+    if ( sigaction(SIGPROF, &old_action, NULL) == -1 ) {
+        perror("sigaction failed");
+        exit(EXIT_FAILURE);
+    }
+
+    count_samples(program);
+    qsort(histogram, histogram_size, sizeof *histogram, compare_counts);
+
+    fprintf(sample_file, "# %s sampling profile\n", PACKAGE);
+    fprintf(sample_file, "# %lu samples (requested interval %d us "
+            "of CPU time)\n", num_samples, SAMPLE_INTERVAL);
+    fprintf(sample_file, "#\n");
+    fprintf(sample_file, "# %8s %12s %7s\n", "Line", "Samples", "%");
+
+    for ( size_t i = 0; i < histogram_size; i++ ) {
+        fprintf(sample_file, "  %8d %12lu %7.2f\n",
+                histogram[i].line, histogram[i].count,
+                100.0 * histogram[i].count / num_samples);
+    }
+
+    x_fclose(sample_file);
+    sample_file = NULL;
+    x_free((void *) samples);
+    samples = NULL;
+    sample_lines = 0;
+    x_free(histogram);
+    histogram = NULL;
+    histogram_size = 0;
+}
+
+
+/*********************************************************************
+ *                                                                   *
+ * Static functions                                                  *
+ *                                                                   *
+ *********************************************************************/
+
+/* Orders histogram entries by descending count, then by line number */
+static int
+compare_counts(const void * a, const void * b) {
+    const struct sample_count * ca = a;
+    const struct sample_count * cb = b;
+
+    if ( ca->count != cb->count ) {
+        return ca->count > cb->count ? -1 : 1;
+    }
+
+    return (ca->line > cb->line) - (ca->line < cb->line);
+}
+
+/* Builds the histogram from the counters. Every line has at least one
+ * statement in the top-level list, which gives the line number for
+ * each line index. Samples taken when no line was executing, or for a
+ * line which is no longer in the program, are shown against line 0.
+ */
+static void
+count_samples(const struct statement * program) {
+    int * numbers = x_calloc(sample_lines + 1, sizeof *numbers);
+    bool * found = x_calloc(sample_lines + 1, sizeof *found);
+    for ( const struct statement * s = program; s; s = s->next ) {
+        if ( s->line_index >= 0 && (size_t) s->line_index < sample_lines ) {
+            numbers[s->line_index] = s->line_number;
+            found[s->line_index] = true;
+        }
+    }
+
+    unsigned long other = samples[sample_lines];
+    histogram = x_malloc((sample_lines + 1) * sizeof *histogram);
+    num_samples = 0;
+    for ( size_t i = 0; i < sample_lines; i++ ) {
+        const unsigned long count = samples[i];
+        if ( count == 0 ) {
+            continue;
+        } else if ( !found[i] ) {
+            other += count;
+            continue;
+        }
+
+        histogram[histogram_size].line = numbers[i];
+        histogram[histogram_size].count = count;
+        histogram_size++;
+        num_samples += count;
+    }
+
+    if ( other > 0 ) {
+        histogram[histogram_size].line = 0;
+        histogram[histogram_size].count = other;
+        histogram_size++;
+        num_samples += other;
+    }
+
+    x_free(numbers);
+    x_free(found);
+}
+
+/* SIGPROF handler, which counts a sample for the current line */
+static void
+handler(int signum) {
+    (void) signum;
+
+    const sig_atomic_t index = current_line_index;
+    if ( index >= 0 && (size_t) index < sample_lines ) {
+        samples[index]++;
+    } else {
+        samples[sample_lines]++;
+    }
+}
+
+/* Sets the profiling timer to the specified interval, or stops
+ * it if the interval is zero.
+ */
+static void
+set_timer(const long usec) {
+#if !HAVE_SETITIMER
+    (void) usec;
+    fprintf(stderr, "%s: sampling profiler not supported\n", PACKAGE);
+    exit(EXIT_FAILURE);
+#else
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = usec;
+    timer.it_value = timer.it_interval;
+
+    if ( setitimer(ITIMER_PROF, &timer, NULL) == -1 ) {
+        perror("setitimer failed");
+        exit(EXIT_FAILURE);
+    }
+#endif
+}
@@ -0,0 +1,502 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Fork server for the --server and --connect options.
+ *
+ * The server parses and builds the program once, and then listens on
+ * a Unix domain socket. A client connects and sends its standard
+ * input, output and error as SCM_RIGHTS file descriptors with a
+ * single byte of data. For each client the server forks a child, which
+ * inherits the built program, receives the client's descriptors and
+ * makes them its own standard streams, and runs the program. A child
+ * whose client doesn't send its descriptors in time exits with a
+ * failure status. When the child exits, the
+ * server writes its exit status to the client as a decimal number and
+ * a newline, using 128 plus the signal number if it was killed, and
+ * closes the connection.
+ *
+ * bbasic --connect=SOCKET is such a client. It exits with the status
+ * reported by the server.
+ */
+
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#if HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#if HAVE_SYS_SOCKET_H && HAVE_SYS_UN_H && HAVE_SYS_WAIT_H
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#define HAVE_SERVER 1
+#endif
+
+#include "server.h"
+#include "runtime.h"
+#include "util.h"
+
+#if HAVE_SERVER
+
+/* Number of descriptors passed by a client */
+#define NUM_FDS (3)
+
+/* Seconds to wait for a client to send its descriptors */
+#define RECEIVE_TIMEOUT (5)
+
+/* A running child, and the connection to report its status to */
+struct child {
+    pid_t pid;
+    int conn;
+};
+
+/* Children still running */
+static struct child * children;
+static size_t num_children;
+static size_t children_capacity;
+
+/* Set by SIGTERM to stop the server */
+static volatile sig_atomic_t stop_requested;
+
+/* Static function declarations */
+static int listen_on(const char * path);
+static void serve(const int conn, int (*run)(void), const int listener,
+        const sigset_t * mask);
+static bool receive_fds(const int conn, int * fds);
+static bool send_fds(const int conn, const int * fds);
+static void reap_children(const bool wait);
+static void write_status(const int conn, const int status);
+static void set_handler(const int signum, void (*handler)(int));
+static void stop_handler(int signum);
+static void child_handler(int signum);
+
+#endif
+
+
+/*********************************************************************
+ *                                                                   *
+ * Public fork server functions                                      *
+ *                                                                   *
+ *********************************************************************/
+
+/* Listens on a socket at path, and calls run in a forked child for
+ * each client until SIGINT or SIGTERM is received. The program must
+ * already have been built. Returns the exit status for the server.
+ */
+int
+server_run(const char * path, int (*run)(void)) {
+#if HAVE_SERVER
+    const int listener = listen_on(path);
+    if ( listener == -1 ) {
+        return EXIT_FAILURE;
+    }
+
+    /* The signals which stop the server or end a run are blocked
+     * except while waiting in pselect(), so none can be missed between
+     * checking for them and waiting. A client which disconnects early
+     * mustn't kill the server when its status is written.
+     */
+    set_handler(SIGTERM, stop_handler);
+    set_handler(SIGCHLD, child_handler);
+    signal(SIGPIPE, SIG_IGN);
+
+    sigset_t blocked;
+    sigset_t original;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGCHLD);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGTERM);
+    sigprocmask(SIG_BLOCK, &blocked, &original);
+
+    while ( !stop_requested && !interrupt ) {
+        reap_children(false);
+
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(listener, &readable);
+        if ( pselect(listener + 1, &readable, NULL, NULL, NULL,
+                    &original) == -1 ) {
+            if ( errno != EINTR ) {
+                perror("pselect failed");
+                break;
+            }
+            continue;
+        }
+
+        /* The listener doesn't block, in case the client has gone */
+        const int conn = accept(listener, NULL, NULL);
+        if ( conn == -1 ) {
+            continue;
+        }
+        fcntl(conn, F_SETFL, fcntl(conn, F_GETFL) & ~O_NONBLOCK);
+
+        serve(conn, run, listener, &original);
+    }
+
+    close(listener);
+    unlink(path);
+
+    /* Let any runs in progress finish and report */
+    reap_children(true);
+    x_free(children);
+
+    return EXIT_SUCCESS;
+#else
+    (void) run;
+    fprintf(stderr, "%s: %s: servers are not supported on this system\n",
+            PACKAGE, path);
+    return EXIT_FAILURE;
+#endif
+}
+
+/* Connects to a server at path, passes it the standard streams, and
+ * returns the exit status of the run.
+ */
+int
+server_connect(const char * path) {
+#if HAVE_SERVER
+    const int conn = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ( conn == -1 ) {
+        perror("socket failed");
+        return EXIT_FAILURE;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof addr.sun_path - 1);
+
+    if ( connect(conn, (struct sockaddr *) &addr, sizeof addr) == -1 ) {
+        perror(path);
+        close(conn);
+        return EXIT_FAILURE;
+    }
+
+    const int fds[NUM_FDS] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    if ( !send_fds(conn, fds) ) {
+        perror(path);
+        close(conn);
+        return EXIT_FAILURE;
+    }
+
+    /* Read the status line, which arrives when the run finishes */
+    char buffer[32];
+    size_t len = 0;
+    while ( len < sizeof buffer - 1 && !memchr(buffer, '\n', len) ) {
+        const ssize_t n = read(conn, buffer + len, sizeof buffer - 1 - len);
+        if ( n == -1 && errno == EINTR ) {
+            continue;
+        } else if ( n <= 0 ) {
+            break;
+        }
+        len += n;
+    }
+    buffer[len] = '\0';
+    close(conn);
+
+    char * end;
+    const long status = strtol(buffer, &end, 10);
+    if ( end == buffer || *end != '\n' ) {
+        fprintf(stderr, "%s: %s: no status from server\n", PACKAGE, path);
+        return EXIT_FAILURE;
+    }
+
+    return status;
+#else
+    fprintf(stderr, "%s: %s: servers are not supported on this system\n",
+            PACKAGE, path);
+    return EXIT_FAILURE;
+#endif
+}
+
+
+#if HAVE_SERVER
+
+/*********************************************************************
+ *                                                                   *
+ * Static functions                                                  *
+ *                                                                   *
+ *********************************************************************/
+
+/* Creates a listening socket at path, replacing any socket left
+ * there by a previous server. Returns -1 on failure.
+ */
+static int
+listen_on(const char * path) {
+    struct sockaddr_un addr;
+    if ( strlen(path) >= sizeof addr.sun_path ) {
+        fprintf(stderr, "%s: %s: socket path too long\n", PACKAGE, path);
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    struct stat st;
+    if ( stat(path, &st) == 0 && S_ISSOCK(st.st_mode) ) {
+        unlink(path);
+    }
+
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ( listener == -1 ) {
+        perror("socket failed");
+        return -1;
+    }
+    fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+
+    if ( bind(listener, (struct sockaddr *) &addr, sizeof addr) == -1 ||
+            listen(listener, SOMAXCONN) == -1 ) {
+        perror(path);
+        close(listener);
+        return -1;
+    }
+
+    return listener;
+}
+
+/* Forks a child which receives a client's descriptors and runs the
+ * program with them. The descriptors are received in the child, so
+ * that a client which is slow to send them doesn't hold up the
+ * others. The child runs with the signal mask mask.
+ */
+static void
+serve(const int conn, int (*run)(void), const int listener,
+        const sigset_t * mask) {
+    fflush(NULL);
+    const pid_t pid = fork();
+
+    if ( pid == 0 ) {
+        /* In the child, restore default signal handling, and take
+         * over the client's streams.
+         */
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
+        sigprocmask(SIG_SETMASK, mask, NULL);
+        close(listener);
+
+        /* Close the connections to other clients, which would
+         * otherwise stay open until this child exits, and keep
+         * those clients waiting for their status.
+         */
+        for ( size_t i = 0; i < num_children; i++ ) {
+            close(children[i].conn);
+        }
+
+        int fds[NUM_FDS];
+        if ( !receive_fds(conn, fds) ) {
+            _exit(EXIT_FAILURE);
+        }
+        close(conn);
+
+        for ( int i = 0; i < NUM_FDS; i++ ) {
+            if ( dup2(fds[i], i) == -1 ) {
+                _exit(EXIT_FAILURE);
+            }
+        }
+        for ( int i = 0; i < NUM_FDS; i++ ) {
+            if ( fds[i] >= NUM_FDS ) {
+                close(fds[i]);
+            }
+        }
+
+        exit(run());
+    }
+
+    if ( pid == -1 ) {
+        perror("fork failed");
+        write_status(conn, EXIT_FAILURE);
+        close(conn);
+        return;
+    }
+
+    if ( num_children == children_capacity ) {
+        children_capacity = children_capacity ? children_capacity * 2 : 16;
+        children = x_realloc(children, children_capacity * sizeof *children);
+    }
+    children[num_children++] = (struct child){ pid, conn };
+}
+
+/* Receives a client's descriptors into fds, and returns false if the
+ * client didn't send exactly NUM_FDS of them within the timeout.
+ */
+static bool
+receive_fds(const int conn, int * fds) {
+    const struct timeval timeout = { RECEIVE_TIMEOUT, 0 };
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+
+    char byte;
+    struct iovec iov = { &byte, 1 };
+    union {
+        struct cmsghdr hdr;
+        char buffer[CMSG_SPACE(sizeof(int) * NUM_FDS)];
+    } control;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof control.buffer;
+
+    ssize_t n;
+    do {
+        n = recvmsg(conn, &msg, 0);
+    } while ( n == -1 && errno == EINTR );
+
+    struct cmsghdr * cmsg = n == 1 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if ( cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+            cmsg->cmsg_type != SCM_RIGHTS ) {
+        return false;
+    }
+
+    /* Close whatever was sent if it was the wrong number */
+    const size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    int received[NUM_FDS];
+    memcpy(received, CMSG_DATA(cmsg),
+            (count < NUM_FDS ? count : NUM_FDS) * sizeof(int));
+    if ( count != NUM_FDS || (msg.msg_flags & MSG_CTRUNC) ) {
+        for ( size_t i = 0; i < count && i < NUM_FDS; i++ ) {
+            close(received[i]);
+        }
+        return false;
+    }
+
+    memcpy(fds, received, sizeof received);
+    return true;
+}
+
+/* Sends descriptors to a server, and returns false on failure */
+static bool
+send_fds(const int conn, const int * fds) {
+    char byte = 0;
+    struct iovec iov = { &byte, 1 };
+    union {
+        struct cmsghdr hdr;
+        char buffer[CMSG_SPACE(sizeof(int) * NUM_FDS)];
+    } control;
+    memset(&control, 0, sizeof control);
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof control.buffer;
+
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * NUM_FDS);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * NUM_FDS);
+
+    ssize_t n;
+    do {
+        n = sendmsg(conn, &msg, 0);
+    } while ( n == -1 && errno == EINTR );
+
+    return n == 1;
+}
+
+/* Reports the status of children which have exited, waiting for all
+ * of them if wait is true.
+ */
+static void
+reap_children(const bool wait) {
+    while ( num_children > 0 ) {
+        int status;
+        const pid_t pid = waitpid(-1, &status, wait ? 0 : WNOHANG);
+        if ( pid == -1 && errno == EINTR ) {
+            continue;
+        } else if ( pid <= 0 ) {
+            return;
+        }
+
+        for ( size_t i = 0; i < num_children; i++ ) {
+            if ( children[i].pid == pid ) {
+                if ( WIFSIGNALED(status) ) {
+                    write_status(children[i].conn, 128 + WTERMSIG(status));
+                } else {
+                    write_status(children[i].conn, WEXITSTATUS(status));
+                }
+                close(children[i].conn);
+                children[i] = children[--num_children];
+                break;
+            }
+        }
+    }
+}
+
+/* Writes an exit status to a client. Errors are ignored, since the
+ * client may have gone.
+ */
+static void
+write_status(const int conn, const int status) {
+    char buffer[32];
+    const int len = snprintf(buffer, sizeof buffer, "%d\n", status);
+    if ( write(conn, buffer, len) != len ) {
+        return;
+    }
+}
+
+/* Installs a signal handler */
+static void
+set_handler(const int signum, void (*handler)(int)) {
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = handler;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = 0;
+    if ( sigaction(signum, &act, NULL) == -1 ) {
+        perror("sigaction failed");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* SIGTERM handler, which stops the server */
+static void
+stop_handler(int signum) {
+    (void) signum;
+
+    stop_requested = 1;
+}
+
+/* SIGCHLD handler. This only needs to interrupt pselect(), so that
+ * children are reaped promptly.
+ */
+static void
+child_handler(int signum) {
+    (void) signum;
+}
+
+#endif  /* HAVE_SERVER */
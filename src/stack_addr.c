@@ -33,7 +33,7 @@ stack_addr_empty(struct stack_addr * stack) {
 /* Frees resources associated with a stack */
 void
 stack_addr_free(struct stack_addr * stack) {
-    free(stack->data);
+    x_free(stack->data);
     stack->data = NULL;
     stack->top = 0;
     stack->size = 0;
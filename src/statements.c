@@ -36,41 +36,52 @@
 #include <sys/types.h>
 #endif
 
+#if HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
 #include "statements.h"
 #include "expr.h"
 #include "value.h"
+#include "num_format.h"
+#include "num_parse.h"
 #include "util.h"
 #include "runtime.h"
 #include "symbols.h"
+#include "introspect.h"
+#include "profile.h"
+#include "stats.h"
 #include "line_map.h"
 #include "data_map.h"
 #include "addr_set.h"
 #include "stack_addr.h"
 #include "options.h"
 #include "colours.h"
+#include "checkpoint.h"
 
 #define BUFFER_SIZE (257)
 #define MAX_LINE_LEN (256)
+#define PRINTF_BUFFER_SIZE (4096)
 
 /* Return address stacks */
-static struct stack_addr fn_stack;
-static struct stack_addr for_stack;
-static struct stack_addr gosub_stack;
-static struct stack_addr proc_stack;
-static struct stack_addr repeat_stack;
-static struct stack_addr return_stack;
+static THREAD_LOCAL struct stack_addr fn_stack;
+static THREAD_LOCAL struct stack_addr for_stack;
+static THREAD_LOCAL struct stack_addr gosub_stack;
+static THREAD_LOCAL struct stack_addr proc_stack;
+static THREAD_LOCAL struct stack_addr repeat_stack;
+static THREAD_LOCAL struct stack_addr return_stack;
 
 /* TRACE statement state */
-static bool trace_on;       /* TRACE on/off */
-static int32_t trace_last_line; /* Last line we traced, to avoid repeition */
-static int32_t trace_threshold; /* Line threshold above which we won't trace */
+static THREAD_LOCAL bool trace_on;       /* TRACE on/off */
+static THREAD_LOCAL int32_t trace_last_line; /* Last line we traced, to avoid repeition */
+static THREAD_LOCAL int32_t trace_threshold; /* Line threshold above which we won't trace */
 
 /* Value of COUNT pseudo-variable */
-static int32_t pcount;
+static THREAD_LOCAL int32_t pcount;
 
 /* List of DATA items and current pointer */
-static struct value * data_items;
-static struct value * data_ptr;
+static THREAD_LOCAL struct value * data_items;
+static THREAD_LOCAL struct value * data_ptr;
 
 /* Static function declarations */
 static int stmt_exec_assign(struct statement * s);
@@ -110,16 +121,61 @@ static int stmt_exec_until(struct statement * s);
 static int advance_file_ptr(struct expr * c, struct expr * e);
 static int assign_expr(struct expr * var, struct expr * e);
 static int assign_value(struct expr * var, struct value * v);
+static size_t encode_record(unsigned char * out, struct value * v);
 static struct value * eval_array_indices(struct expr * var);
 static struct print_item * print_item_new(enum print_specifier spec,
         struct expr * e);
 static struct statement * create(enum statement_type type);
 static struct statement * for_stack_peek(struct expr * e);
+static void stack_restore(struct checkpoint * cp, struct stack_addr * stack);
+static void stack_save(struct checkpoint * cp, struct stack_addr * stack);
 static void free_internal(struct statement * stmt,
         struct addr_set * set);
 static int increment_var(struct statement * parent,
         struct expr * var, struct value * inc);
-static void update_line_numbers(struct statement *s, const int line_number);
+static void update_line_numbers(struct statement *s,
+        const struct statement * parent);
+
+/* Statement execution functions for each statement type, so that
+ * compiled program images need only store the type. DATA, DEF and REM
+ * statements have no execution function.
+ */
+static int (* const exec_functions[])(struct statement *) = {
+    [STATEMENT_ASSIGN] = stmt_exec_assign,
+    [STATEMENT_BPUT] = stmt_exec_bput,
+    [STATEMENT_CLEAR] = stmt_exec_clear,
+    [STATEMENT_CLOSE] = stmt_exec_close,
+    [STATEMENT_COLOUR] = stmt_exec_colour,
+    [STATEMENT_DIM] = stmt_exec_dim,
+    [STATEMENT_END] = stmt_exec_end,
+    [STATEMENT_ENDPROC] = stmt_exec_endproc,
+    [STATEMENT_FN_RETURN] = stmt_exec_fn_return,
+    [STATEMENT_FOR] = stmt_exec_for,
+    [STATEMENT_GOSUB] = stmt_exec_gosub,
+    [STATEMENT_GOTO] = stmt_exec_goto,
+    [STATEMENT_IF] = stmt_exec_if,
+    [STATEMENT_INPUT] = stmt_exec_input,
+    [STATEMENT_INPUTF] = stmt_exec_inputf,
+    [STATEMENT_LOCAL] = stmt_exec_local,
+    [STATEMENT_NEXT] = stmt_exec_next,
+    [STATEMENT_NULL] = stmt_exec_null,
+    [STATEMENT_ON_ERROR] = stmt_exec_on_error,
+    [STATEMENT_ON_GOSUB] = stmt_exec_on_gosub,
+    [STATEMENT_ON_GOTO] = stmt_exec_on_goto,
+    [STATEMENT_PRINT] = stmt_exec_print,
+    [STATEMENT_PRINTF] = stmt_exec_printf,
+    [STATEMENT_PROC] = stmt_exec_proc,
+    [STATEMENT_READ] = stmt_exec_read,
+    [STATEMENT_REPEAT] = stmt_exec_repeat,
+    [STATEMENT_REPORT] = stmt_exec_report,
+    [STATEMENT_RESTORE] = stmt_exec_restore,
+    [STATEMENT_RETURN] = stmt_exec_return,
+    [STATEMENT_STOP] = stmt_exec_stop,
+    [STATEMENT_TRACE] = stmt_exec_trace,
+    [STATEMENT_UNTIL] = stmt_exec_until
+};
+
+#define NUM_EXEC_FUNCTIONS (sizeof exec_functions / sizeof exec_functions[0])
 
 
 /*********************************************************************
@@ -146,14 +202,89 @@ reset_data_pointer(void) {
  */
 void
 statements_cleanup(void) {
+    statements_reset();
+    statements_free_data();
+}
+
+/* Frees the DATA items, so that they can be gathered again as the
+ * lines with DATA are built
+ */
+void
+statements_free_data(void) {
+    value_free(data_items);
+    data_items = NULL;
+    data_ptr = NULL;
+    data_map_free();
+}
+
+/* Resets the statements runtime environment for another run of the
+ * same program, keeping its DATA items.
+ */
+void
+statements_reset(void) {
     stack_addr_free(&fn_stack);
     stack_addr_free(&for_stack);
     stack_addr_free(&gosub_stack);
     stack_addr_free(&proc_stack);
     stack_addr_free(&repeat_stack);
     stack_addr_free(&return_stack);
-    value_free(data_items);
-    data_map_free();
+    data_ptr = data_items;
+
+    trace_on = false;
+    trace_last_line = 0;
+    trace_threshold = 0;
+    pcount = 0;
+}
+
+/* Restores the return address stacks, TRACE state, COUNT and DATA
+ * pointer from a checkpoint
+ */
+void
+statements_restore(struct checkpoint * cp) {
+    stack_restore(cp, &fn_stack);
+    stack_restore(cp, &for_stack);
+    stack_restore(cp, &gosub_stack);
+    stack_restore(cp, &proc_stack);
+    stack_restore(cp, &repeat_stack);
+
+    trace_on = checkpoint_get_int(cp);
+    trace_last_line = checkpoint_get_int(cp);
+    trace_threshold = checkpoint_get_int(cp);
+    pcount = checkpoint_get_int(cp);
+
+    /* The DATA pointer is saved as the number of items read */
+    data_ptr = data_items;
+    for ( int64_t n = checkpoint_get_int(cp); n > 0; n-- ) {
+        if ( !data_ptr ) {
+            checkpoint_fail(cp);
+            break;
+        }
+        data_ptr = value_next(data_ptr);
+    }
+}
+
+/* Saves the return address stacks, TRACE state, COUNT and DATA
+ * pointer to a checkpoint
+ */
+void
+statements_save(struct checkpoint * cp) {
+    stack_save(cp, &fn_stack);
+    stack_save(cp, &for_stack);
+    stack_save(cp, &gosub_stack);
+    stack_save(cp, &proc_stack);
+    stack_save(cp, &repeat_stack);
+
+    checkpoint_put_int(cp, trace_on);
+    checkpoint_put_int(cp, trace_last_line);
+    checkpoint_put_int(cp, trace_threshold);
+    checkpoint_put_int(cp, pcount);
+
+    int64_t n = 0;
+    for ( struct value * v = data_items; v && v != data_ptr;
+            v = value_next(v) ) {
+        n++;
+    }
+    checkpoint_put_int(cp, n);
 }
 
 /* Appends tail to head, and returns head. If head is NULL,
@@ -185,7 +316,11 @@ statement_execute(struct statement * s) {
          * one statement, we only TRACE it once per line execution.
          */
         trace_last_line = s->line_number;
-        fprintf(stderr, "[%d] ", s->line_number);
+        fprintf(program_err(), "[%d] ", s->line_number);
+    }
+
+    if ( stats_active ) {
+        stats_statements[s->type]++;
     }
 
     /* Execute statement */
@@ -202,7 +337,7 @@ statement_fixup(struct statement * s, struct statement * next) {
             break;
         }
 
-        update_line_numbers(s->stmt[i], s->line_number);
+        update_line_numbers(s->stmt[i], s);
         s->stmt[i] = statement_append(s->stmt[i], next);
     }
 
@@ -235,6 +370,30 @@ statement_free(struct statement * s) {
  *                                                                   *
  *********************************************************************/
 
+/* Constructs a statement of a given type with the execution function
+ * for that type, for loading compiled programs. Returns NULL if the
+ * type is out of range.
+ */
+struct statement *
+statement_compiled_new(const int type) {
+    if ( type < 1 || (size_t) type >= NUM_EXEC_FUNCTIONS ) {
+        return NULL;
+    }
+
+    struct statement * stmt = create(type);
+    stmt->exec = exec_functions[type];
+    return stmt;
+}
+
+/* Returns true if a statement has the execution function for its
+ * type, so that statement_compiled_new() can recreate it.
+ */
+bool
+statement_is_compilable(const struct statement * s) {
+    return s->type >= 1 && (size_t) s->type < NUM_EXEC_FUNCTIONS &&
+        s->exec == exec_functions[s->type];
+}
+
 /* Constructs a new assignment statement */
 struct statement *
 statement_assign_new(struct expr * var, struct expr * e) {
@@ -245,10 +404,15 @@ statement_assign_new(struct expr * var, struct expr * e) {
     return stmt;
 }
 
-/* Constructs a new BPUT# statement */
+/* Constructs a new BPUT# statement. newline specifies whether a
+ * newline should be written after a string.
+ */
 struct statement *
-statement_bput_new(struct expr * c, struct expr * b) {
+statement_bput_new(struct expr * c, struct expr * b, const bool newline) {
     struct statement * stmt = create(STATEMENT_BPUT);
+    if ( newline ) {
+        stmt->v = value_int_new(1);
+    }
     stmt->e[0] = c;
     stmt->e[1] = b;
     stmt->exec = stmt_exec_bput;
@@ -494,7 +658,7 @@ statement_proc_new(char * id, struct expr * e) {
 /* Constructs a new READ statement */
 struct statement *
 statement_read_new(struct expr * vars) {
-    struct statement * stmt = create(STATEMENT_REM);
+    struct statement * stmt = create(STATEMENT_READ);
     stmt->e[0] = vars;
     stmt->exec = stmt_exec_read;
     return stmt;
@@ -648,7 +812,7 @@ print_list_free(struct print_item * list) {
     while ( list ) {
         struct print_item * tmp = list->next;
         expr_free(list->e);
-        free(list);
+        x_free(list);
         list = tmp;
     }
 }
@@ -686,7 +850,10 @@ stmt_exec_assign(struct statement * s) {
     return assign_expr(s->e[0], s->e[1]);
 }
 
-/* Executes a BPUT# statement */
+/* Executes a BPUT# statement. A number is written as a single
+ * byte, and a string is written in a single operation, followed by
+ * a newline unless the statement ended with a semi-colon.
+ */
 static int
 stmt_exec_bput(struct statement * s) {
     struct value * c = expr_eval(s->e[0]);
@@ -695,7 +862,7 @@ stmt_exec_bput(struct statement * s) {
         value_free(c);
         value_free(b);
         return STATUS_ERROR;
-    } else if ( !value_is_int(c) || !value_is_int(b) ) {
+    } else if ( !value_is_int(c) || (!value_is_int(b) && !value_is_string(b)) ) {
         value_free(c);
         value_free(b);
         error_set(ERR_TYPE_MISMATCH);
@@ -703,23 +870,37 @@ stmt_exec_bput(struct statement * s) {
     }
 
     const int fd = value_int(c);
-    const unsigned char out = value_int(b) % 256;
     value_free(c);
-    value_free(b);
 
     /* Disallow operations on stdin, stdout and stderr */
     if ( fd < 3 ) {
+        value_free(b);
         error_set(ERR_CHANNEL);
         return ERR_CHANNEL;
     }
 
-    int status = write(fd, &out, 1);
-    if ( status == -1 ) {
-        error_set(ERR_CHANNEL);
+    unsigned char out;
+    struct iovec iov[2];
+    int iovcnt;
+
+    if ( value_is_string(b) ) {
+        iov[0].iov_base = value_string_peek(b);
+        iov[0].iov_len = value_string_len(b);
+        iov[1].iov_base = "\n";
+        iov[1].iov_len = 1;
+        iovcnt = s->v ? 2 : 1;
+    } else {
+        out = value_int(b) % 256;
+        iov[0].iov_base = &out;
+        iov[0].iov_len = 1;
+        iovcnt = 1;
+    }
+
+    const int status = open_file_writev(fd, iov, iovcnt);
+    value_free(b);
+
+    if ( status != STATUS_OK ) {
         return ERR_CHANNEL;
-    } else if ( status == 0 ) {
-        error_set(ERR_EOF);
-        return ERR_EOF;
     }
 
     return STATUS_OK;
@@ -790,67 +971,67 @@ stmt_exec_colour(struct statement * s) {
 
     switch ( colour ) {
         case COLOUR_BLACK:
-            printf(ANSI_COLOUR_BLACK);
+            fputs(ANSI_COLOUR_BLACK, program_out());
             break;
 
         case COLOUR_RED:
-            printf(ANSI_COLOUR_RED);
+            fputs(ANSI_COLOUR_RED, program_out());
             break;
 
         case COLOUR_GREEN:
-            printf(ANSI_COLOUR_GREEN);
+            fputs(ANSI_COLOUR_GREEN, program_out());
             break;
 
         case COLOUR_YELLOW:
-            printf(ANSI_COLOUR_YELLOW);
+            fputs(ANSI_COLOUR_YELLOW, program_out());
             break;
 
         case COLOUR_BLUE:
-            printf(ANSI_COLOUR_BLUE);
+            fputs(ANSI_COLOUR_BLUE, program_out());
             break;
 
         case COLOUR_MAGENTA:
-            printf(ANSI_COLOUR_MAGENTA);
+            fputs(ANSI_COLOUR_MAGENTA, program_out());
             break;
 
         case COLOUR_CYAN:
-            printf(ANSI_COLOUR_CYAN);
+            fputs(ANSI_COLOUR_CYAN, program_out());
             break;
 
         case COLOUR_WHITE:
-            printf(ANSI_COLOUR_WHITE);
+            fputs(ANSI_COLOUR_WHITE, program_out());
             break;
 
         case BACKGROUND_COLOUR_BLACK:
-            printf(ANSI_BACKGROUND_COLOUR_BLACK);
+            fputs(ANSI_BACKGROUND_COLOUR_BLACK, program_out());
             break;
 
         case BACKGROUND_COLOUR_RED:
-            printf(ANSI_BACKGROUND_COLOUR_RED);
+            fputs(ANSI_BACKGROUND_COLOUR_RED, program_out());
             break;
 
         case BACKGROUND_COLOUR_GREEN:
-            printf(ANSI_BACKGROUND_COLOUR_GREEN);
+            fputs(ANSI_BACKGROUND_COLOUR_GREEN, program_out());
             break;
 
         case BACKGROUND_COLOUR_YELLOW:
-            printf(ANSI_BACKGROUND_COLOUR_YELLOW);
+            fputs(ANSI_BACKGROUND_COLOUR_YELLOW, program_out());
             break;
 
         case BACKGROUND_COLOUR_BLUE:
-            printf(ANSI_BACKGROUND_COLOUR_BLUE);
+            fputs(ANSI_BACKGROUND_COLOUR_BLUE, program_out());
             break;
 
         case BACKGROUND_COLOUR_MAGENTA:
-            printf(ANSI_BACKGROUND_COLOUR_MAGENTA);
+            fputs(ANSI_BACKGROUND_COLOUR_MAGENTA, program_out());
             break;
 
         case BACKGROUND_COLOUR_CYAN:
-            printf(ANSI_BACKGROUND_COLOUR_CYAN);
+            fputs(ANSI_BACKGROUND_COLOUR_CYAN, program_out());
             break;
 
         case BACKGROUND_COLOUR_WHITE:
-            printf(ANSI_BACKGROUND_COLOUR_WHITE);
+            fputs(ANSI_BACKGROUND_COLOUR_WHITE, program_out());
             break;
 
         default:
@@ -903,6 +1084,11 @@ stmt_exec_endproc(struct statement * s) {
     symbol_table_pop_frame();
     set_pc(stack_addr_pop(&proc_stack));
 
+    introspect_call_exit();
+    if ( profile_active ) {
+        profile_call_exit();
+    }
+
     return STATUS_OK;
 }
 
@@ -990,6 +1176,11 @@ stmt_exec_gosub(struct statement * s) {
     stack_addr_push(&gosub_stack, s->next);
     set_pc(branch);
 
+    introspect_call_enter(branch);
+    if ( profile_active ) {
+        profile_call_enter(branch);
+    }
+
     value_free(line);
 
     return STATUS_OK;
@@ -1071,8 +1262,8 @@ stmt_exec_input(struct statement * s) {
 
                     /* Output a prompt if necessary */
                     if ( output_prompt ) {
-                        putchar('?');
-                        fflush(stdout);
+                        fputc('?', program_out());
+                        fflush(program_out());
                         output_prompt = false;
                     }
 
@@ -1080,7 +1271,7 @@ stmt_exec_input(struct statement * s) {
                      * line from standard input.
                      */
                     char buffer[MAX_LINE_LEN];
-                    if ( !fgets(buffer, MAX_LINE_LEN, stdin) ) {
+                    if ( !fgets(buffer, MAX_LINE_LEN, program_in()) ) {
                         if ( errno == EINTR ) {
                             error_set(ERR_ESCAPE);
                             return ERR_ESCAPE;
@@ -1127,10 +1318,9 @@ stmt_exec_input(struct statement * s) {
                         /* Resident integer variable, so read an integer,
                          * discarding any trailing input
                          */
-                        char * endptr;
-                        errno = 0;
-                        const long n = strtol(buffer, &endptr, 10);
-                        if ( errno == ERANGE || endptr == buffer || n > INT_MAX ) {
+                        const char * end;
+                        int32_t n;
+                        if ( num_parse_int(buffer, &end, 10, &n) != NUM_PARSE_OK ) {
                             /* Any errors result in a value of zero */
                             input = expr_int_new(0);
                         } else {
@@ -1140,10 +1330,9 @@ stmt_exec_input(struct statement * s) {
                         /* Numeric variable, so read a double,
                          * discarding any trailing input
                          */
-                        char * endptr;
-                        errno = 0;
-                        const double d = strtod(buffer, &endptr);
-                        if ( errno == ERANGE || endptr == buffer ) {
+                        const char * end;
+                        double d;
+                        if ( num_parse_float(buffer, &end, &d) != NUM_PARSE_OK ) {
                             /* Any errors result in a value of zero */
                             input = expr_int_new(0);
                         } else {
@@ -1164,9 +1353,9 @@ stmt_exec_input(struct statement * s) {
                         return STATUS_ERROR;
                     }
 
-                    printf("%s", value_string_peek(v));
+                    fputs(value_string_peek(v), program_out());
                     value_free(v);
-                    fflush(stdout);
+                    fflush(program_out());
 
                     output_prompt = false;
                 }
@@ -1212,9 +1401,12 @@ stmt_exec_inputf(struct statement * s) {
     while ( var ) {
         /* Read the leading byte */
         unsigned char t;
-        if ( read(fd, &t, 1) == -1 ) {
-            error_set(ERR_CHANNEL);
+        const ssize_t nread = open_file_read(fd, &t, 1);
+        if ( nread == STATUS_ERROR ) {
             return ERR_CHANNEL;
+        } else if ( nread == 0 ) {
+            error_set(ERR_EOF);
+            return ERR_EOF;
         }
 
         struct value * v;
@@ -1222,7 +1414,7 @@ stmt_exec_inputf(struct statement * s) {
         switch ( t ) {
             case 0x40:
                 /* Integer */
-                if ( read(fd, buffer, sizeof(int32_t)) != sizeof(int32_t) ) {
+                if ( open_file_read(fd, buffer, sizeof(int32_t)) != sizeof(int32_t) ) {
                     error_set(ERR_CHANNEL);
                     return ERR_CHANNEL;
                 }
@@ -1238,7 +1430,7 @@ stmt_exec_inputf(struct statement * s) {
 
             case 0xff:
                 /* Float */
-                if ( read(fd, buffer, sizeof(double)) != sizeof(double) ) {
+                if ( open_file_read(fd, buffer, sizeof(double)) != sizeof(double) ) {
                     error_set(ERR_CHANNEL);
                     return ERR_CHANNEL;
                 }
@@ -1254,7 +1446,7 @@ stmt_exec_inputf(struct statement * s) {
                  * We won't use the original t again, so it's safe to
                  * reuse it.
                  */
-                if ( read(fd, &t, 1) != 1 ) {
+                if ( open_file_read(fd, &t, 1) != 1 ) {
                     error_set(ERR_CHANNEL);
                     return ERR_CHANNEL;
                 }
@@ -1262,13 +1454,13 @@ stmt_exec_inputf(struct statement * s) {
                 t = (uint8_t) t; /* In case CHAR_BIT > 8 */
 
                 /* Read the string itself, and null-terminate it */
-                if ( read(fd, &buffer, t) != t ) {
+                if ( open_file_read(fd, &buffer, t) != t ) {
                     error_set(ERR_CHANNEL);
                     return ERR_CHANNEL;
                 }
                 buffer[t] = '\0';
 
-                v = value_string_new(buffer);
+                v = value_string_new_len(buffer, t);
                 break;
 
             default:
@@ -1277,7 +1469,7 @@ stmt_exec_inputf(struct statement * s) {
         }
 
         /* Increment the file pointer */
-        open_file_increment_ptr(fd);
+        open_file_increment_ptr(fd, 1);
 
         /* Assign the value to the variable */
         int status = assign_value(var, v);
@@ -1343,7 +1535,7 @@ stmt_exec_next(struct statement * s) {
     }
 
     struct value * step = expr_eval(branch->e[1]);
-    if ( !term ) {
+    if ( !step ) {
         value_free(term);
         return STATUS_ERROR;
     }
@@ -1425,6 +1617,7 @@ stmt_exec_on_error(struct statement * s) {
     } else {
         /* ON ERROR <statement> was called, so set the error statement */
         s->stmt[0]->line_number = s->line_number;
+        s->stmt[0]->line_index = s->line_index;
         error_stmt_set(s->stmt[0], s->next);
     }
 
@@ -1452,6 +1645,11 @@ stmt_exec_on(struct statement * s, bool gosub) {
         if ( s->stmt[0] ) {
             if ( gosub ) {
                 stack_addr_push(&gosub_stack, s->next);
+
+                introspect_call_enter(s->stmt[0]);
+                if ( profile_active ) {
+                    profile_call_enter(s->stmt[0]);
+                }
             }
             set_pc(s->stmt[0]);
 
@@ -1495,6 +1693,11 @@ stmt_exec_on(struct statement * s, bool gosub) {
         }
         if ( gosub ) {
             stack_addr_push(&gosub_stack, s->next);
+
+            introspect_call_enter(branch_stmt);
+            if ( profile_active ) {
+                profile_call_enter(branch_stmt);
+            }
         }
         set_pc(branch_stmt);
 
@@ -1507,6 +1710,11 @@ stmt_exec_on(struct statement * s, bool gosub) {
     if ( s->stmt[0] ) {
         if ( gosub ) {
             stack_addr_push(&gosub_stack, s->next);
+
+            introspect_call_enter(s->stmt[0]);
+            if ( profile_active ) {
+                profile_call_enter(s->stmt[0]);
+            }
         }
         set_pc(s->stmt[0]);
 
@@ -1535,10 +1743,11 @@ stmt_exec_on_goto(struct statement * s) {
  */
 static int
 stmt_exec_print(struct statement * s) {
+    FILE * fp = program_out();
     struct print_item * item = s->pl;
     if ( !item ) {
         /* Print a blank line if no print list was specified */
-        putchar('\n');
+        fputc('\n', fp);
         pcount = 0;
         return STATUS_OK;
     }
@@ -1552,7 +1761,7 @@ stmt_exec_print(struct statement * s) {
                 /* A new line can be forced at any stage in the print
                  * list by inserting an apostrophe.
                  */
-                putchar('\n');
+                fputc('\n', fp);
                 pcount = 0;
                 spec = PRINT_APOSTROPHE;
                 break;
@@ -1572,7 +1781,7 @@ stmt_exec_print(struct statement * s) {
                          * item will be printed in the field after
                          * the previous item
                          */
-                        putchar(' ');
+                        fputc(' ', fp);
                         pcount++;
                     }
                 }
@@ -1582,21 +1791,23 @@ stmt_exec_print(struct statement * s) {
                     return STATUS_ERROR;
                 }
 
-                char * out;
-                if ( spec == PRINT_SEMICOLON ) {
+                if ( value_is_numeric(v) ) {
                     /* A semi-colon after an item in the print list
                      * will cause the next item to be printed on the
                      * same line and immediately following the previous
                      * item, so turn off field width in the case.
                      */
-                    out = value_to_string(v, false);
+                    char out[NUM_FORMAT_BUFFER_SIZE];
+                    const size_t len = value_format(out, v,
+                            spec != PRINT_SEMICOLON);
+                    fwrite(out, 1, len, fp);
+                    pcount += len;
                 } else {
-                    out = value_to_string(v, true);
+                    const char * out = value_string_peek(v);
+                    const size_t len = value_string_len(v);
+                    fwrite(out, 1, len, fp);
+                    pcount += len;
                 }
-
-                printf("%s", out);
-                pcount += strlen(out);
-                free(out);
                 value_free(v);
 
                 /* Reset the previous specifier value */
@@ -1611,10 +1822,10 @@ stmt_exec_print(struct statement * s) {
     }
 
     if ( spec != PRINT_SEMICOLON ) {
-        putchar('\n');
+        fputc('\n', fp);
         pcount = 0;
     } else {
-        fflush(stdout);
+        fflush(fp);
     }
 
     return STATUS_OK;
@@ -1643,86 +1854,61 @@ stmt_exec_printf(struct statement * s) {
         return ERR_CHANNEL;
     }
 
-    char buffer[BUFFER_SIZE];
+    /* Encode all the items into one buffer and write them together,
+     * writing the buffer and the current item with writev if the
+     * buffer would overflow.
+     */
+    unsigned char buffer[PRINTF_BUFFER_SIZE];
+    unsigned char record[BUFFER_SIZE];
+    size_t len = 0;
+    int items = 0;
+    int status = STATUS_OK;
 
     /* Loop through the expressions */
     struct expr * e = s->e[1];
     while ( e ) {
         struct value * v = expr_eval(e);
         if ( !v ) {
-            return STATUS_ERROR;
+            /* Still write any items preceding the error */
+            status = STATUS_ERROR;
+            break;
         }
 
-        /* Write according to type */
-        if ( value_is_int(v) ) {
-            const int32_t n = value_int(v);
-            value_free(v);
-
-            /* Integers are represented by 0x40 followed by the four
-             * value bytes, with most significant byte first. Note that
-             * BBC Basic II specifically requires integers to be stored
-             * in two's complement, and while C in general does not, it
-             * does require the signed intN_t integer types to have a
-             * two's complement representation (see C17 7.2.0.1.1.3),
-             * so the behavior will be correct on a conforming
-             * implementation.
-             */
-            buffer[0] = 0x40;
-            buffer[1] = (((uint32_t) n) & 0xFF000000) >> 24;
-            buffer[2] = (((uint32_t) n) & 0xFF0000) >> 16;
-            buffer[3] = (((uint32_t) n) & 0xFF00) >> 8;
-            buffer[4] = ((uint32_t) n) & 0xFF;
-
-            if ( write(fd, buffer, 5) == -1 ) {
-                error_set(ERR_CHANNEL);
-                return ERR_CHANNEL;
-            }
-        } else if ( value_is_float(v) ) {
-            const double d = value_float(v);
-            value_free(v);
+        const bool fits = PRINTF_BUFFER_SIZE - len >= BUFFER_SIZE;
+        const size_t nb = encode_record(fits ? buffer + len : record, v);
+        value_free(v);
+        items++;
 
-            /* Real numbers are represented by 0xff, followed by the
-             * double value. Note that this is inconsistent with BBC
-             * BASIC II on the BBC Micro, where it is stored as 0xff
-             * followed by four bytes of mantissa and one byte of
-             * exponent.
-             */
-            buffer[0] = 0xff;
-            memcpy(&buffer[1], &d, sizeof(d));
+        if ( fits ) {
+            len += nb;
+        } else {
+            struct iovec iov[2] = {
+                { .iov_base = buffer, .iov_len = len },
+                { .iov_base = record, .iov_len = nb }
+            };
 
-            if ( write(fd, buffer, 1 + sizeof(d)) == -1 ) {
-                error_set(ERR_CHANNEL);
+            if ( open_file_writev(fd, iov, 2) != STATUS_OK ) {
                 return ERR_CHANNEL;
             }
-        } else if ( value_is_string(v) ) {
-            const size_t sl = strlen(value_string_peek(v));
-            const size_t nb = sl > 255 ? 255 : sl;
-
-            /* Strings are represented by 0x00, followed by a single
-             * octet containing the string length, followed by the
-             * string bytes themselves. The maximum length of a string
-             * is 255.
-             */
-            buffer[0] = 0x00;
-            buffer[1] = nb;
-            strncpy(&buffer[2], value_string_peek(v), nb);
-            value_free(v);
 
-            if ( write(fd, buffer, 2 + nb) == -1 ) {
-                error_set(ERR_CHANNEL);
-                return ERR_CHANNEL;
-            }
-        } else {
-            ABORT("unexpected value type");
+            open_file_increment_ptr(fd, items);
+            len = 0;
+            items = 0;
         }
 
-        /* Increment the file pointer */
-        open_file_increment_ptr(fd);
-
         e = expr_next(e);
     }
 
-    return STATUS_OK;
+    if ( len > 0 ) {
+        struct iovec iov = { .iov_base = buffer, .iov_len = len };
+        if ( open_file_writev(fd, &iov, 1) != STATUS_OK ) {
+            return ERR_CHANNEL;
+        }
+
+        open_file_increment_ptr(fd, items);
+    }
+
+    return status;
 }
 
 /* Executes a PROC statement */
@@ -1744,6 +1930,11 @@ stmt_exec_proc(struct statement * s) {
     stack_addr_push(&proc_stack, s->next);
     set_pc(branch);
 
+    introspect_call_enter(branch);
+    if ( profile_active ) {
+        profile_call_enter(branch);
+    }
+
     return STATUS_OK;
 }
 
@@ -1800,11 +1991,11 @@ static int
 stmt_exec_report(struct statement * s) {
     const char * msg = error_string(error_last_code());
     if ( !msg ) {
-        printf("\n(C)1982 Acorn\n");
+        fputs("\n(C)1982 Acorn\n", program_out());
         pcount = 0;
     } else {
-        printf("\n%s", msg);
-        fflush(stdout);
+        fprintf(program_out(), "\n%s", msg);
+        fflush(program_out());
         pcount = strlen(msg);
     }
 
@@ -1861,13 +2052,18 @@ stmt_exec_return(struct statement * s) {
     }
     set_pc(stack_addr_pop(&gosub_stack));
 
+    introspect_call_exit();
+    if ( profile_active ) {
+        profile_call_exit();
+    }
+
     return STATUS_OK;
 }
 
 /* Executes a STOP statement */
 static int
 stmt_exec_stop(struct statement * s) {
-    fprintf(stderr, "STOP at line %d\n", s->line_number);
+    fprintf(program_err(), "STOP at line %d\n", s->line_number);
     return STATUS_EXIT;
 }
 
@@ -1969,7 +2165,11 @@ advance_file_ptr(struct expr * c, struct expr * e) {
         return ERR_CHANNEL;
     }
 
-    /* Set file position to beginning */
+    /* Set file position to beginning, discarding any buffered input */
+    if ( open_file_sync(fd) != STATUS_OK ) {
+        return ERR_CHANNEL;
+    }
+
     if ( lseek(fd, 0, SEEK_SET) == -1 ) {
         error_set(ERR_CHANNEL);
         return ERR_CHANNEL;
@@ -1980,15 +2180,18 @@ advance_file_ptr(struct expr * c, struct expr * e) {
     char buffer[BUFFER_SIZE];
     while ( open_file_get_ptr(fd) < want ) {
         unsigned char b;
-        if ( read(fd, &b, 1) == -1 ) {
-            error_set(ERR_CHANNEL);
+        const ssize_t nread = open_file_read(fd, &b, 1);
+        if ( nread == STATUS_ERROR ) {
             return ERR_CHANNEL;
+        } else if ( nread == 0 ) {
+            error_set(ERR_EOF);
+            return ERR_EOF;
         }
 
         switch ( b ) {
             case 0x40:
                 /* Integer */
-                if ( read(fd, buffer, 4) != 4 ) {
+                if ( open_file_read(fd, buffer, 4) != 4 ) {
                     error_set(ERR_CHANNEL);
                     return ERR_CHANNEL;
                 }
@@ -1997,7 +2200,7 @@ advance_file_ptr(struct expr * c, struct expr * e) {
 
             case 0xff:
                 /* Float */
-                if ( read(fd, buffer, sizeof(double)) != sizeof(double) ) {
+                if ( open_file_read(fd, buffer, sizeof(double)) != sizeof(double) ) {
                     error_set(ERR_CHANNEL);
                     return ERR_CHANNEL;
                 }
@@ -2006,12 +2209,12 @@ advance_file_ptr(struct expr * c, struct expr * e) {
 
             case 0x00:
                 /* String */
-                if ( read(fd, &b, 1) != 1 ) {
+                if ( open_file_read(fd, &b, 1) != 1 ) {
                     error_set(ERR_CHANNEL);
                     return ERR_CHANNEL;
                 }
 
-                if ( read(fd, buffer, (uint8_t) b) != (uint8_t) b ) {
+                if ( open_file_read(fd, buffer, (uint8_t) b) != (uint8_t) b ) {
                     error_set(ERR_CHANNEL);
                     return ERR_CHANNEL;
                 }
@@ -2023,12 +2226,69 @@ advance_file_ptr(struct expr * c, struct expr * e) {
                 return ERR_CHANNEL;
         }
 
-        open_file_increment_ptr(fd);
+        open_file_increment_ptr(fd, 1);
     }
 
     return STATUS_OK;
 }
 
+/* Encodes a value in the format used by PRINT# and INPUT# into out,
+ * which must be at least BUFFER_SIZE bytes, and returns the number
+ * of bytes used
+ */
+static size_t
+encode_record(unsigned char * out, struct value * v) {
+    if ( value_is_int(v) ) {
+        const int32_t n = value_int(v);
+
+        /* Integers are represented by 0x40 followed by the four
+         * value bytes, with most significant byte first. Note that
+         * BBC Basic II specifically requires integers to be stored
+         * in two's complement, and while C in general does not, it
+         * does require the signed intN_t integer types to have a
+         * two's complement representation (see C17 7.2.0.1.1.3),
+         * so the behavior will be correct on a conforming
+         * implementation.
+         */
+        out[0] = 0x40;
+        out[1] = (((uint32_t) n) & 0xFF000000) >> 24;
+        out[2] = (((uint32_t) n) & 0xFF0000) >> 16;
+        out[3] = (((uint32_t) n) & 0xFF00) >> 8;
+        out[4] = ((uint32_t) n) & 0xFF;
+
+        return 5;
+    } else if ( value_is_float(v) ) {
+        const double d = value_float(v);
+
+        /* Real numbers are represented by 0xff, followed by the
+         * double value. Note that this is inconsistent with BBC
+         * BASIC II on the BBC Micro, where it is stored as 0xff
+         * followed by four bytes of mantissa and one byte of
+         * exponent.
+         */
+        out[0] = 0xff;
+        memcpy(&out[1], &d, sizeof(d));
+
+        return 1 + sizeof(d);
+    } else if ( value_is_string(v) ) {
+        const size_t sl = value_string_len(v);
+        const size_t nb = sl > 255 ? 255 : sl;
+
+        /* Strings are represented by 0x00, followed by a single
+         * octet containing the string length, followed by the
+         * string bytes themselves. The maximum length of a string
+         * is 255.
+         */
+        out[0] = 0x00;
+        out[1] = nb;
+        memcpy(&out[2], value_string_peek(v), nb);
+
+        return 2 + nb;
+    }
+
+    ABORT("unexpected value type");
+}
+
 /* Assigns e to var */
 static int
 assign_expr(struct expr * var, struct expr * e) {
@@ -2068,6 +2328,8 @@ assign_value(struct expr * var, struct value * v) {
 static struct statement *
 create(enum statement_type type) {
     struct statement * stmt = x_malloc(sizeof *stmt);
+    stmt->line_number = 0;
+    stmt->line_index = 0;
     stmt->type = type;
     stmt->v = NULL;
     stmt->pl = NULL;
@@ -2146,6 +2408,24 @@ for_stack_peek(struct expr * e) {
     return match;
 }
 
+/* Restores a return address stack from a checkpoint */
+static void
+stack_restore(struct checkpoint * cp, struct stack_addr * stack) {
+    const int64_t n = checkpoint_get_int(cp);
+    for ( int64_t i = 0; i < n && !checkpoint_failed(cp); i++ ) {
+        stack_addr_push(stack, checkpoint_get_stmt(cp));
+    }
+}
+
+/* Saves a return address stack to a checkpoint, bottom first */
+static void
+stack_save(struct checkpoint * cp, struct stack_addr * stack) {
+    checkpoint_put_int(cp, stack->top);
+    for ( size_t i = 0; i < stack->top; i++ ) {
+        checkpoint_put_stmt(cp, stack->data[i]);
+    }
+}
+
 /* Internal recursive implementation of statement_free */
 static void
 free_internal(struct statement * stmt, struct addr_set * set) {
@@ -2178,7 +2458,7 @@ free_internal(struct statement * stmt, struct addr_set * set) {
             print_list_free(stmt->pl);
         }
 
-        free(stmt);
+        x_free(stmt);
         stmt = tmp;
     }
 }
@@ -2209,19 +2489,21 @@ print_item_new(enum print_specifier spec, struct expr * e) {
     return item;
 }
 
-/* Recursively add a parent line number to a statement and
- * any sub-statements it has.
+/* Recursively add a parent line number and index to a statement
+ * and any sub-statements it has.
  */
 static void
-update_line_numbers(struct statement *s, const int line_number) {
+update_line_numbers(struct statement *s,
+        const struct statement * parent) {
     while ( s ) {
-        s->line_number = line_number;
+        s->line_number = parent->line_number;
+        s->line_index = parent->line_index;
         for ( size_t i = 0; i < STMT_NUM_STMTS; i++ ) {
             if ( !s->stmt[i] ) {
                 break;
             }
 
-            update_line_numbers(s->stmt[i], line_number);
+            update_line_numbers(s->stmt[i], parent);
         }
         s = s->next;
     }
@@ -18,10 +18,14 @@
 #ifndef PG_BBASIC_INTERNAL_STATEMENTS_H
 #define PG_BBASIC_INTERNAL_STATEMENTS_H
 
+#include <stddef.h>
 #include <stdbool.h>
 #include "expr.h"
 #include "addr_set.h"
 
+/* Opaque and incomplete struct definition */
+struct checkpoint;
+
 /* Statement types */
 enum statement_type {
     STATEMENT_ASSIGN = 1,
@@ -83,6 +87,7 @@ enum trace_type {
 /* Tagged union statement object */
 struct statement {
     int line_number;
+    int line_index;
     enum statement_type type;
 
     struct value * v;
@@ -105,17 +110,26 @@ struct print_item {
 void push_function(void);
 void reset_data_pointer(void);
 void statements_cleanup(void);
+void statements_free_data(void);
+void statements_reset(void);
+void statements_restore(struct checkpoint * cp);
+void statements_save(struct checkpoint * cp);
 int statement_execute(struct statement * stmt);
 void statement_fixup(struct statement * stmt, struct statement * next);
 void statement_free(struct statement * stmt);
 
+/* Functions for compiled programs */
+struct statement * statement_compiled_new(const int type);
+bool statement_is_compilable(const struct statement * s);
+
 /* Functions for working with lists of statements */
 struct statement * statement_append(struct statement * head,
         struct statement * tail);
 
 /* Individual statement constructors */
 struct statement * statement_assign_new(struct expr * var, struct expr * e);
-struct statement * statement_bput_new(struct expr * c, struct expr * e);
+struct statement * statement_bput_new(struct expr * c, struct expr * e,
+        const bool newline);
 struct statement * statement_clear_new(void);
 struct statement * statement_close_new(struct expr * c);
 struct statement * statement_colour_new(struct expr * e);
@@ -0,0 +1,381 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Runtime statistics for the --stats, --stats-json and --counts
+ * options. When statistics are active, the statement and expression
+ * dispatchers count each statement and expression by type, and the
+ * symbol table and line maps count lookups. Allocation counts and
+ * heap sizes are kept by the x_malloc family of functions.
+ *
+ * Apart from the timings and heap sizes, these statistics depend only
+ * on the program and its input, so --counts reports just those, for
+ * comparing against a baseline.
+ */
+
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#if HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+
+#include "stats.h"
+#include "statements.h"
+#include "expr_internal.h"
+#include "util.h"
+
+/* Number of statement and expression types, including the unused
+ * zero value.
+ */
+#define NUM_STATEMENT_TYPES (STATEMENT_UNTIL + 1)
+#define NUM_EXPR_TYPES (EXPR_VARIABLE + 1)
+
+/* Statistics active flag */
+bool stats_active;
+
+/* Statement and expression counts */
+unsigned long stats_statements[NUM_STATEMENT_TYPES];
+unsigned long stats_exprs[NUM_EXPR_TYPES];
+unsigned long stats_symbol_lookups;
+unsigned long stats_line_lookups;
+
+/* Statement type names */
+static const char * statement_names[NUM_STATEMENT_TYPES] = {
+    [STATEMENT_ASSIGN] = "ASSIGN",
+    [STATEMENT_BPUT] = "BPUT",
+    [STATEMENT_CLEAR] = "CLEAR",
+    [STATEMENT_CLOSE] = "CLOSE",
+    [STATEMENT_COLOUR] = "COLOUR",
+    [STATEMENT_DATA] = "DATA",
+    [STATEMENT_DEF_FN] = "DEF_FN",
+    [STATEMENT_DEF_PROC] = "DEF_PROC",
+    [STATEMENT_DIM] = "DIM",
+    [STATEMENT_END] = "END",
+    [STATEMENT_ENDPROC] = "ENDPROC",
+    [STATEMENT_FOR] = "FOR",
+    [STATEMENT_FN] = "FN",
+    [STATEMENT_FN_RETURN] = "FN_RETURN",
+    [STATEMENT_GOSUB] = "GOSUB",
+    [STATEMENT_GOTO] = "GOTO",
+    [STATEMENT_IF] = "IF",
+    [STATEMENT_INPUT] = "INPUT",
+    [STATEMENT_INPUTF] = "INPUTF",
+    [STATEMENT_LOCAL] = "LOCAL",
+    [STATEMENT_NEXT] = "NEXT",
+    [STATEMENT_NULL] = "NULL",
+    [STATEMENT_ON_ERROR] = "ON_ERROR",
+    [STATEMENT_ON_GOTO] = "ON_GOTO",
+    [STATEMENT_ON_GOSUB] = "ON_GOSUB",
+    [STATEMENT_PRINT] = "PRINT",
+    [STATEMENT_PRINTF] = "PRINTF",
+    [STATEMENT_PROC] = "PROC",
+    [STATEMENT_READ] = "READ",
+    [STATEMENT_REM] = "REM",
+    [STATEMENT_REPEAT] = "REPEAT",
+    [STATEMENT_REPORT] = "REPORT",
+    [STATEMENT_RESTORE] = "RESTORE",
+    [STATEMENT_RETURN] = "RETURN",
+    [STATEMENT_STOP] = "STOP",
+    [STATEMENT_TRACE] = "TRACE",
+    [STATEMENT_UNTIL] = "UNTIL",
+};
+
+/* Expression type names */
+static const char * expr_names[NUM_EXPR_TYPES] = {
+    [EXPR_ARRAY] = "ARRAY",
+    [EXPR_CONSTANT] = "CONSTANT",
+    [EXPR_FN] = "FN",
+    [EXPR_FUNC_ABS] = "FUNC_ABS",
+    [EXPR_FUNC_ACS] = "FUNC_ACS",
+    [EXPR_FUNC_ASC] = "FUNC_ASC",
+    [EXPR_FUNC_ASN] = "FUNC_ASN",
+    [EXPR_FUNC_ATN] = "FUNC_ATN",
+    [EXPR_FUNC_BGET] = "FUNC_BGET",
+    [EXPR_FUNC_CHRS] = "FUNC_CHRS",
+    [EXPR_FUNC_COS] = "FUNC_COS",
+    [EXPR_FUNC_DEG] = "FUNC_DEG",
+    [EXPR_FUNC_EOF] = "FUNC_EOF",
+    [EXPR_FUNC_ERL] = "FUNC_ERL",
+    [EXPR_FUNC_ERR] = "FUNC_ERR",
+    [EXPR_FUNC_EXP] = "FUNC_EXP",
+    [EXPR_FUNC_EXT] = "FUNC_EXT",
+    [EXPR_FUNC_GET] = "FUNC_GET",
+    [EXPR_FUNC_GETS] = "FUNC_GETS",
+    [EXPR_FUNC_GETSF] = "FUNC_GETSF",
+    [EXPR_FUNC_INKEY] = "FUNC_INKEY",
+    [EXPR_FUNC_INKEYS] = "FUNC_INKEYS",
+    [EXPR_FUNC_INSTR] = "FUNC_INSTR",
+    [EXPR_FUNC_INT] = "FUNC_INT",
+    [EXPR_FUNC_LEFTS] = "FUNC_LEFTS",
+    [EXPR_FUNC_LEN] = "FUNC_LEN",
+    [EXPR_FUNC_LN] = "FUNC_LN",
+    [EXPR_FUNC_LOG] = "FUNC_LOG",
+    [EXPR_FUNC_MIDS] = "FUNC_MIDS",
+    [EXPR_FUNC_OPENIN] = "FUNC_OPENIN",
+    [EXPR_FUNC_OPENOUT] = "FUNC_OPENOUT",
+    [EXPR_FUNC_OPENUP] = "FUNC_OPENUP",
+    [EXPR_FUNC_PTR] = "FUNC_PTR",
+    [EXPR_FUNC_RAD] = "FUNC_RAD",
+    [EXPR_FUNC_RIGHTS] = "FUNC_RIGHTS",
+    [EXPR_FUNC_RND] = "FUNC_RND",
+    [EXPR_FUNC_SGN] = "FUNC_SGN",
+    [EXPR_FUNC_SIN] = "FUNC_SIN",
+    [EXPR_FUNC_SPC] = "FUNC_SPC",
+    [EXPR_FUNC_SQR] = "FUNC_SQR",
+    [EXPR_FUNC_STRINGS] = "FUNC_STRINGS",
+    [EXPR_FUNC_STRS] = "FUNC_STRS",
+    [EXPR_FUNC_TAN] = "FUNC_TAN",
+    [EXPR_FUNC_VAL] = "FUNC_VAL",
+    [EXPR_OP_ADD] = "OP_ADD",
+    [EXPR_OP_AND] = "OP_AND",
+    [EXPR_OP_DIV] = "OP_DIV",
+    [EXPR_OP_EOR] = "OP_EOR",
+    [EXPR_OP_EQ] = "OP_EQ",
+    [EXPR_OP_EXP] = "OP_EXP",
+    [EXPR_OP_GT] = "OP_GT",
+    [EXPR_OP_GTE] = "OP_GTE",
+    [EXPR_OP_IDIV] = "OP_IDIV",
+    [EXPR_OP_LT] = "OP_LT",
+    [EXPR_OP_LTE] = "OP_LTE",
+    [EXPR_OP_MOD] = "OP_MOD",
+    [EXPR_OP_MUL] = "OP_MUL",
+    [EXPR_OP_NEQ] = "OP_NEQ",
+    [EXPR_OP_NOT] = "OP_NOT",
+    [EXPR_OP_OR] = "OP_OR",
+    [EXPR_OP_SUB] = "OP_SUB",
+    [EXPR_OP_UMINUS] = "OP_UMINUS",
+    [EXPR_VARIABLE] = "VARIABLE",
+};
+
+/* Phase names */
+static const char * phase_names[STATS_NUM_PHASES] = {
+    [STATS_PHASE_PARSE] = "parse",
+    [STATS_PHASE_BUILD] = "build",
+    [STATS_PHASE_RUN] = "run"
+};
+
+/* Phase start times and durations, in nanoseconds, which are timed
+ * for whichever program is running on this thread
+ */
+static THREAD_LOCAL uint64_t phase_start[STATS_NUM_PHASES];
+static THREAD_LOCAL uint64_t phase_time[STATS_NUM_PHASES];
+
+/* Static function declarations */
+static uint64_t monotonic_ns(void);
+static long peak_rss(void);
+static unsigned long sum(const unsigned long * counts, const size_t n);
+static void write_counts(FILE * fp, const bool json, const char * title,
+        const char ** names, const unsigned long * counts, const size_t n);
+
+
+/*********************************************************************
+ *                                                                   *
+ * Public statistics functions                                       *
+ *                                                                   *
+ *********************************************************************/
+
+/* Records the start of a program phase */
+void
+stats_phase_begin(const enum stats_phase phase) {
+    phase_start[phase] = monotonic_ns();
+}
+
+/* Records the end of a program phase */
+void
+stats_phase_end(const enum stats_phase phase) {
+    phase_time[phase] += monotonic_ns() - phase_start[phase];
+}
+
+/* Writes the statistics to standard error, as text or JSON */
+void
+stats_report(const bool json) {
+    FILE * fp = stderr;
+    const unsigned long statements = sum(stats_statements, NUM_STATEMENT_TYPES);
+    const unsigned long exprs = sum(stats_exprs, NUM_EXPR_TYPES);
+
+#if HAVE_MALLOC_USABLE_SIZE
+    const bool have_heap = true;
+#else
+    const bool have_heap = false;
+#endif
+
+    const long rss = peak_rss();
+
+    if ( json ) {
+        fprintf(fp, "{\n");
+        for ( size_t i = 0; i < STATS_NUM_PHASES; i++ ) {
+            fprintf(fp, "  \"%s_time\": %.6f,\n",
+                    phase_names[i], phase_time[i] / 1e9);
+        }
+        fprintf(fp, "  \"statements\": %lu,\n", statements);
+        write_counts(fp, json, "statements_by_type",
+                statement_names, stats_statements, NUM_STATEMENT_TYPES);
+        fprintf(fp, "  \"expressions\": %lu,\n", exprs);
+        write_counts(fp, json, "expressions_by_type",
+                expr_names, stats_exprs, NUM_EXPR_TYPES);
+        fprintf(fp, "  \"symbol_lookups\": %lu,\n", stats_symbol_lookups);
+        fprintf(fp, "  \"line_lookups\": %lu,\n", stats_line_lookups);
+        fprintf(fp, "  \"allocations\": %lu,\n", x_alloc_count);
+        fprintf(fp, "  \"frees\": %lu,\n", x_free_count);
+        if ( have_heap ) {
+            fprintf(fp, "  \"peak_heap\": %zu,\n", x_heap_peak);
+        } else {
+            fprintf(fp, "  \"peak_heap\": null,\n");
+        }
+        if ( rss >= 0 ) {
+            fprintf(fp, "  \"peak_rss\": %ld\n", rss);
+        } else {
+            fprintf(fp, "  \"peak_rss\": null\n");
+        }
+        fprintf(fp, "}\n");
+        return;
+    }
+
+    fprintf(fp, "%s statistics:\n", PACKAGE);
+    for ( size_t i = 0; i < STATS_NUM_PHASES; i++ ) {
+        char label[32];
+        snprintf(label, sizeof label, "%s time", phase_names[i]);
+        fprintf(fp, "  %-22s %.6f s\n", label, phase_time[i] / 1e9);
+    }
+    fprintf(fp, "  %-22s %lu\n", "statements", statements);
+    fprintf(fp, "  %-22s %lu\n", "expressions", exprs);
+    fprintf(fp, "  %-22s %lu\n", "symbol lookups", stats_symbol_lookups);
+    fprintf(fp, "  %-22s %lu\n", "line lookups", stats_line_lookups);
+    fprintf(fp, "  %-22s %lu\n", "allocations", x_alloc_count);
+    fprintf(fp, "  %-22s %lu\n", "frees", x_free_count);
+    if ( have_heap ) {
+        fprintf(fp, "  %-22s %zu bytes\n", "peak heap", x_heap_peak);
+    } else {
+        fprintf(fp, "  %-22s unknown\n", "peak heap");
+    }
+    if ( rss >= 0 ) {
+        fprintf(fp, "  %-22s %ld bytes\n", "peak RSS", rss);
+    } else {
+        fprintf(fp, "  %-22s unknown\n", "peak RSS");
+    }
+
+    write_counts(fp, json, "Statements by type",
+            statement_names, stats_statements, NUM_STATEMENT_TYPES);
+    write_counts(fp, json, "Expressions by type",
+            expr_names, stats_exprs, NUM_EXPR_TYPES);
+}
+
+/* Returns the name of a statement type, or NULL if it is not valid */
+const char *
+stats_statement_name(const int type) {
+    if ( type < 0 || type >= NUM_STATEMENT_TYPES ) {
+        return NULL;
+    }
+
+    return statement_names[type];
+}
+
+/* Writes the deterministic counts to standard error, one per line */
+void
+stats_report_counts(void) {
+    FILE * fp = stderr;
+    fprintf(fp, "statements %lu\n", sum(stats_statements, NUM_STATEMENT_TYPES));
+    fprintf(fp, "expressions %lu\n", sum(stats_exprs, NUM_EXPR_TYPES));
+    fprintf(fp, "symbol_lookups %lu\n", stats_symbol_lookups);
+    fprintf(fp, "line_lookups %lu\n", stats_line_lookups);
+    fprintf(fp, "allocations %lu\n", x_alloc_count);
+    fprintf(fp, "frees %lu\n", x_free_count);
+}
+
+
+/*********************************************************************
+ *                                                                   *
+ * Static functions                                                  *
+ *                                                                   *
+ *********************************************************************/
+
+/* Returns the system monotonic clock in nanoseconds */
+static uint64_t
+monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Returns the peak resident set size of the process in bytes,
+ * or -1 if it isn't available.
+ */
+static long
+peak_rss(void) {
+#if HAVE_GETRUSAGE
+    struct rusage usage;
+    if ( getrusage(RUSAGE_SELF, &usage) == -1 ) {
+        return -1;
+    }
+
+#if defined(__APPLE__)
+    /* macOS reports bytes, rather than kilobytes */
+    return usage.ru_maxrss;
+#else
+    return usage.ru_maxrss * 1024L;
+#endif
+#else
+    return -1;
+#endif
+}
+
+/* Returns the sum of an array of counts */
+static unsigned long
+sum(const unsigned long * counts, const size_t n) {
+    unsigned long total = 0;
+    for ( size_t i = 0; i < n; i++ ) {
+        total += counts[i];
+    }
+
+    return total;
+}
+
+/* Writes the non-zero counts in an array, with their names */
+static void
+write_counts(FILE * fp, const bool json, const char * title,
+        const char ** names, const unsigned long * counts, const size_t n) {
+    bool first = true;
+
+    if ( json ) {
+        fprintf(fp, "  \"%s\": {", title);
+    } else {
+        fprintf(fp, "\n%s:\n", title);
+    }
+
+    for ( size_t i = 0; i < n; i++ ) {
+        if ( counts[i] == 0 ) {
+            continue;
+        }
+
+        if ( json ) {
+            fprintf(fp, "%s\n    \"%s\": %lu", first ? "" : ",",
+                    names[i], counts[i]);
+        } else {
+            fprintf(fp, "  %-22s %lu\n", names[i], counts[i]);
+        }
+        first = false;
+    }
+
+    if ( json ) {
+        fprintf(fp, "%s},\n", first ? "" : "\n  ");
+    }
+}
@@ -0,0 +1,55 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PG_BBASIC_INTERNAL_STATS_H
+#define PG_BBASIC_INTERNAL_STATS_H
+
+#include <stdbool.h>
+
+/* Program phases which are timed */
+enum stats_phase {
+    STATS_PHASE_PARSE,
+    STATS_PHASE_BUILD,
+    STATS_PHASE_RUN,
+    STATS_NUM_PHASES
+};
+
+/* Statistics active flag, checked before counting statements
+ * and expressions.
+ */
+extern bool stats_active;
+
+/* Counts of statements executed and expressions evaluated, indexed
+ * by statement and expression type.
+ */
+extern unsigned long stats_statements[];
+extern unsigned long stats_exprs[];
+
+/* Counts of symbol table lookups, and of line number lookups for
+ * branches and RESTORE.
+ */
+extern unsigned long stats_symbol_lookups;
+extern unsigned long stats_line_lookups;
+
+/* Statistics functions */
+void stats_phase_begin(const enum stats_phase phase);
+void stats_phase_end(const enum stats_phase phase);
+void stats_report(const bool json);
+void stats_report_counts(void);
+const char * stats_statement_name(const int type);
+
+#endif  /* PG_BBASIC_INTERNAL_STATS_H */
@@ -31,6 +31,8 @@
 #include "runtime.h"
 #include "util.h"
 #include "hash.h"
+#include "stats.h"
+#include "checkpoint.h"
 
 #define VAR_NAME_COUNT "COUNT"
 #define VAR_NAME_TIME "TIME"
@@ -65,6 +67,7 @@ struct symbol {
         struct statement * stmt;
         struct array * array;
     } u;
+    size_t len;     /* Length of a string, which may contain nulls */
     struct symbol * next;
 };
 
@@ -78,14 +81,17 @@ struct symbol {
  * frame. Non-variable symbols such as functions and procedures
  * are always stored in the base table.
  */
-static struct symtable {
+static THREAD_LOCAL struct symtable {
     struct symbol * buckets[NUM_BUCKETS];
     struct symtable * prev;
-} table, * top_frame = &table;
+} table, * top_frame;
 
 /* Static function declarations */
 static void clear_buckets(struct symtable * t);
 static void free_buckets(struct symtable * t);
+static void frame_restore(struct checkpoint * cp, struct symtable * t);
+static void frame_save(struct checkpoint * cp, struct symtable * t);
+static void frames_save(struct checkpoint * cp, struct symtable * t);
 static bool have_frames(void);
 static struct symbol * symbol_copy(struct symbol * id);
 static struct symbol * symbol_find(const char * id);
@@ -97,11 +103,15 @@ static void symbol_move(struct symbol * dst, struct symbol * src);
 
 static int procedure_add(const char * id, struct statement * stmt);
 
+static void format_decode(void);
+
 static int resident_assign(const int c, struct value * v);
 static struct value * resident_eval(const int c);
 static int resident_index(const int c);
 
 static int array_index(struct value * dims, struct value * indices);
+static struct array * array_restore(struct checkpoint * cp);
+static void array_save(struct checkpoint * cp, struct array * array);
 static size_t array_size(struct value * v);
 
 static int variable_add(const char * id, struct value * v);
@@ -114,7 +124,17 @@ static void variable_set(struct symbol * s, struct value * v);
  * @% has an initial value of 0x90a, and the others have
  * initial values of zero.
  */
-static int32_t residents[27] = { 0x90a };
+static THREAD_LOCAL int32_t residents[27] = { 0x90a };
+
+/* Decoded copy of @%, so that printing a number doesn't need to
+ * decode it each time. The initial values correspond to the
+ * initial value of @%.
+ */
+static THREAD_LOCAL struct {
+    enum number_format number;
+    int places;
+    int width;
+} format_cache = { FORMAT_NORMAL, 9, 10 };
 
 /* Datum holds a clock value that is used to calculate a difference
  * for the TIME pseudo-variable. set_time_value can be set by assigning
@@ -122,8 +142,8 @@ static int32_t residents[27] = { 0x90a };
  * the TIME pseudo-variable will return the number of 1/100ths of
  * seconds since TIME was last set.
  */
-static struct timespec datum;
-static long set_time_value;
+static THREAD_LOCAL struct timespec datum;
+static THREAD_LOCAL long set_time_value;
 
 
 /*********************************************************************
@@ -246,9 +266,21 @@ symbol_table_free(void) {
     free_buckets(&table);
 }
 
-/* Performs symbol table initialization */
+/* Performs symbol table initialization. Each thread has its own
+ * table, and its top frame can only be set once the thread is
+ * running, so this must be called before the table is used. The
+ * resident integer variables are reset, in case a program has
+ * already run on this thread.
+ */
 void
 symbol_table_init(void) {
+    top_frame = &table;
+
+    memset(residents, 0, sizeof residents);
+    residents[resident_index('@')] = 0x90a;
+    format_decode();
+    set_time_value = 0;
+
     errno = 0;
     if ( clock_gettime(CLOCK_REALTIME, &datum) == -1 ) {
         ABORTF("clock_gettime failed: %s\n", strerror(errno));
@@ -264,7 +296,7 @@ symbol_table_pop_frame(void) {
 
     struct symtable * tmp = top_frame->prev;
     free_buckets(top_frame);
-    free(top_frame);
+    x_free(top_frame);
     top_frame = tmp;
 }
 
@@ -276,6 +308,50 @@ symbol_table_push_frame(void) {
     top_frame = frame;
 }
 
+/* Restores the variables, resident integer variables and TIME from a
+ * checkpoint, into a freshly initialized symbol table
+ */
+void
+symbol_table_restore(struct checkpoint * cp) {
+    for ( size_t i = 0; i < sizeof residents / sizeof residents[0]; i++ ) {
+        residents[i] = checkpoint_get_int(cp);
+    }
+    format_decode();
+
+    struct value * time = value_int_new(checkpoint_get_int(cp));
+    symbol_variable_assign(VAR_NAME_TIME, time);
+    value_free(time);
+
+    const int64_t num_frames = checkpoint_get_int(cp);
+    frame_restore(cp, &table);
+    for ( int64_t i = 0; i < num_frames && !checkpoint_failed(cp); i++ ) {
+        symbol_table_push_frame();
+        frame_restore(cp, top_frame);
+    }
+}
+
+/* Saves the variables, resident integer variables and TIME to a
+ * checkpoint. Procedures are defined again when the program is
+ * loaded, so they aren't saved.
+ */
+void
+symbol_table_save(struct checkpoint * cp) {
+    for ( size_t i = 0; i < sizeof residents / sizeof residents[0]; i++ ) {
+        checkpoint_put_int(cp, residents[i]);
+    }
+
+    struct value * time = symbol_variable_eval(VAR_NAME_TIME);
+    checkpoint_put_int(cp, value_int(time));
+    value_free(time);
+
+    int64_t num_frames = 0;
+    for ( struct symtable * t = top_frame; t != &table; t = t->prev ) {
+        num_frames++;
+    }
+    checkpoint_put_int(cp, num_frames);
+    frames_save(cp, top_frame);
+}
+
 /* Assigns a value to an array element */
 int
 symbol_array_assign(const char * id, struct value * indices, struct value * v) {
@@ -318,8 +394,9 @@ symbol_array_assign(const char * id, struct value * indices, struct value * v) {
                 error_set(ERR_TYPE_MISMATCH);
                 return STATUS_ERROR;
             }
-            free(e->u.s);
+            x_free(e->u.s);
             e->u.s = value_string(v);
+            e->len = value_string_len(v);
             break;
 
         default:
@@ -379,6 +456,7 @@ symbol_array_dimension(const char * id, struct value * v) {
 
             case SYMBOL_STRING:
                 s->u.s = x_strdup("");
+                s->len = 0;
                 break;
 
             default:
@@ -433,7 +511,7 @@ symbol_array_eval(const char * id, struct value * indices) {
             break;
 
         case SYMBOL_STRING:
-            result = value_string_new(e->u.s);
+            result = value_string_new_len(e->u.s, e->len);
             break;
 
         default:
@@ -479,7 +557,15 @@ symbol_variable_assign_local(const char * id, struct value * v) {
         /* Resident integer variables are non-local by nature,
          * so treat them the same as always
          */
-        return resident_assign(id[0], v);
+        if ( v ) {
+            return resident_assign(id[0], v);
+        }
+
+        v = value_int_new(0);
+        int status = resident_assign(id[0], v);
+        value_free(v);
+
+        return status;
     }
 
     if ( v ) {
@@ -544,7 +630,7 @@ variable_name_is_integer(const char * s) {
         return false;
     }
 
-    return l > 2 || islower(s[1]);
+    return l > 2 || islower(s[0]);
 }
 
 /* Returns true if a variable name refers to a real variable */
@@ -580,16 +666,7 @@ variable_name_is_string(const char * s) {
 /* Returns the current number format from the @% variable */
 enum number_format
 format_number(void) {
-    switch ( (residents[resident_index('@')] & 0xFF0000) >> 16 ) {
-        case 1:
-            return FORMAT_SCIENTIFIC;
-
-        case 2:
-            return FORMAT_FIXED;
-    }
-
-    /* Normal is the default */
-    return FORMAT_NORMAL;
+    return format_cache.number;
 }
 
 /* Returns the current number of significant figures/decimal
@@ -598,20 +675,54 @@ format_number(void) {
  */
 int
 format_places(void) {
-    int p = ((residents[resident_index('@')] & 0xFF00) >> 8);
-    return (p < 1 || p > 10) ? 10 : p;
+    return format_cache.places;
 }
 
 /* Resets the @% variable to its default value */
 void
 format_reset(void) {
     residents[resident_index('@')] = 0x90a;
+    format_decode();
 }
 
 /* Returns the current field width from the @% variable */
 int
 format_width(void) {
-    return residents[resident_index('@')] & 0xFF;
+    return format_cache.width;
+}
+
+
+/*********************************************************************
+ *                                                                   *
+ * Static number format functions                                    *
+ *                                                                   *
+ *********************************************************************/
+
+/* Decodes the @% variable into the format cache. This must be
+ * called whenever @% changes.
+ */
+static void
+format_decode(void) {
+    const int32_t f = residents[resident_index('@')];
+
+    switch ( (f & 0xFF0000) >> 16 ) {
+        case 1:
+            format_cache.number = FORMAT_SCIENTIFIC;
+            break;
+
+        case 2:
+            format_cache.number = FORMAT_FIXED;
+            break;
+
+        default:
+            /* Normal is the default */
+            format_cache.number = FORMAT_NORMAL;
+            break;
+    }
+
+    const int p = (f & 0xFF00) >> 8;
+    format_cache.places = (p < 1 || p > 10) ? 10 : p;
+    format_cache.width = f & 0xFF;
 }
 
 
@@ -676,12 +787,114 @@ free_buckets(struct symtable * t) {
     }
 }
 
+/* Restores the variables in a specific symbol table frame from a
+ * checkpoint
+ */
+static void
+frame_restore(struct checkpoint * cp, struct symtable * t) {
+    const int64_t num_symbols = checkpoint_get_int(cp);
+    for ( int64_t i = 0; i < num_symbols && !checkpoint_failed(cp); i++ ) {
+        struct symbol s = { .next = NULL };
+        s.type = checkpoint_get_int(cp);
+        s.id = checkpoint_get_string(cp);
+
+        switch ( s.type ) {
+            case SYMBOL_ARRAY:
+                s.u.array = array_restore(cp);
+                break;
+
+            case SYMBOL_FLOAT:
+                s.u.f = checkpoint_get_float(cp);
+                break;
+
+            case SYMBOL_INTEGER:
+                s.u.n = checkpoint_get_int(cp);
+                break;
+
+            case SYMBOL_STRING:
+                s.u.s = checkpoint_get_bytes(cp, &s.len);
+                break;
+
+            default:
+                checkpoint_fail(cp);
+                break;
+        }
+
+        /* symbol_insert_frame() copies the ID, but takes the value */
+        if ( !checkpoint_failed(cp) ) {
+            symbol_insert_frame(&s, t);
+        } else if ( s.type == SYMBOL_STRING ||
+                (s.type == SYMBOL_ARRAY && s.u.array) ) {
+            symbol_free(symbol_copy(&s));
+        }
+        x_free(s.id);
+    }
+}
+
+/* Saves the variables in a specific symbol table frame to a
+ * checkpoint
+ */
+static void
+frame_save(struct checkpoint * cp, struct symtable * t) {
+    int64_t num_symbols = 0;
+    for ( int i = 0; i < NUM_BUCKETS; i++ ) {
+        for ( struct symbol * s = t->buckets[i]; s; s = s->next ) {
+            if ( s->type != SYMBOL_PROCEDURE ) {
+                num_symbols++;
+            }
+        }
+    }
+    checkpoint_put_int(cp, num_symbols);
+
+    for ( int i = 0; i < NUM_BUCKETS; i++ ) {
+        for ( struct symbol * s = t->buckets[i]; s; s = s->next ) {
+            if ( s->type == SYMBOL_PROCEDURE ) {
+                continue;
+            }
+
+            checkpoint_put_int(cp, s->type);
+            checkpoint_put_string(cp, s->id);
+            switch ( s->type ) {
+                case SYMBOL_ARRAY:
+                    array_save(cp, s->u.array);
+                    break;
+
+                case SYMBOL_FLOAT:
+                    checkpoint_put_float(cp, s->u.f);
+                    break;
+
+                case SYMBOL_INTEGER:
+                    checkpoint_put_int(cp, s->u.n);
+                    break;
+
+                case SYMBOL_STRING:
+                    checkpoint_put_bytes(cp, s->u.s, s->len);
+                    break;
+
+                default:
+                    ABORTF("unexpected symbol type: %d", s->type);
+            }
+        }
+    }
+}
+
+/* Saves a frame and the frames below it to a checkpoint, bottom
+ * first
+ */
+static void
+frames_save(struct checkpoint * cp, struct symtable * t) {
+    if ( t != &table ) {
+        frames_save(cp, t->prev);
+    }
+    frame_save(cp, t);
+}
+
 /* Returns true if there are currently stack frames on top
  * of the base symbol table.
  */
 static bool
 have_frames(void) {
-    return top_frame != &table;
+    return top_frame && top_frame != &table;
 }
 
 /* Copies a symbol into a newly-allocated one */
@@ -691,6 +904,7 @@ symbol_copy(struct symbol * s) {
     new_sym->id = x_strdup(s->id);
     new_sym->type = s->type;
     new_sym->u = s->u;
+    new_sym->len = s->len;
     new_sym->next = NULL;
     return new_sym;
 }
@@ -717,6 +931,10 @@ symbol_find(const char * id) {
  */
 static struct symbol *
 symbol_find_frame(const char * id, struct symtable * t) {
+    if ( stats_active ) {
+        stats_symbol_lookups++;
+    }
+
     struct symbol * current = t->buckets[djb2hash(id, NUM_BUCKETS)];
     while ( current ) {
         if ( !strcmp(current->id, id) ) {
@@ -733,7 +951,7 @@ static void
 symbol_free(struct symbol * s) {
     size_t size;
 
-    free(s->id);
+    x_free(s->id);
 
     switch ( s->type ) {
         case SYMBOL_ARRAY:
@@ -742,12 +960,12 @@ symbol_free(struct symbol * s) {
                 symbol_free(s->u.array->data[i]);
             }
             value_free(s->u.array->dims);
-            free(s->u.array->data);
-            free(s->u.array);
+            x_free(s->u.array->data);
+            x_free(s->u.array);
             break;
 
         case SYMBOL_STRING:
-            free(s->u.s);
+            x_free(s->u.s);
             break;
 
         default:
@@ -755,7 +973,7 @@ symbol_free(struct symbol * s) {
             break;
     }
 
-    free(s);
+    x_free(s);
 }
 
 /* Inserts a global symbol into the symbol table, or replaces an
@@ -771,6 +989,10 @@ symbol_insert(struct symbol * s) {
  */
 static void
 symbol_insert_frame(struct symbol * s, struct symtable * t) {
+    if ( stats_active ) {
+        stats_symbol_lookups++;
+    }
+
     const size_t hash = djb2hash(s->id, NUM_BUCKETS);
     struct symbol * current = t->buckets[hash];
     if ( current == NULL ) {
@@ -808,10 +1030,11 @@ symbol_insert_frame(struct symbol * s, struct symtable * t) {
 static void
 symbol_move(struct symbol * dst, struct symbol * src) {
     if ( dst->type == SYMBOL_STRING ) {
-        free(dst->u.s);
+        x_free(dst->u.s);
     }
     dst->type = src->type;
     dst->u = src->u;
+    dst->len = src->len;
 }
 
 
@@ -850,6 +1073,9 @@ resident_assign(const int c, struct value * v) {
     }
 
     residents[resident_index(c)] = value_int(v);
+    if ( c == '@' ) {
+        format_decode();
+    }
 
     return STATUS_OK;
 }
@@ -1038,6 +1264,97 @@ array_index(struct value * dims, struct value * indices) {
     return index;
 }
 
+/* Restores an array from a checkpoint, or returns NULL if the
+ * checkpoint is damaged
+ */
+static struct array *
+array_restore(struct checkpoint * cp) {
+    const enum symbol_type type = checkpoint_get_int(cp);
+    const int64_t num_dims = checkpoint_get_int(cp);
+    if ( (type != SYMBOL_FLOAT && type != SYMBOL_INTEGER &&
+                type != SYMBOL_STRING) || num_dims < 1 ) {
+        checkpoint_fail(cp);
+        return NULL;
+    }
+
+    struct value * dims = NULL;
+    for ( int64_t i = 0; i < num_dims; i++ ) {
+        const int64_t dim = checkpoint_get_int(cp);
+        if ( dim < 0 || dim > INT32_MAX ) {
+            checkpoint_fail(cp);
+        }
+        dims = value_append(dims, value_int_new(dim));
+    }
+
+    if ( checkpoint_failed(cp) ) {
+        value_free(dims);
+        return NULL;
+    }
+
+    struct array * array = x_malloc(sizeof *array);
+    array->size = array_size(dims);
+    array->type = type;
+    array->dims = dims;
+    array->data = x_malloc(sizeof *array->data * array->size);
+
+    for ( size_t i = 0; i < array->size; i++ ) {
+        struct symbol * s = x_malloc(sizeof *s);
+        s->id = NULL;
+        s->next = NULL;
+        s->type = type;
+
+        switch ( type ) {
+            case SYMBOL_FLOAT:
+                s->u.f = checkpoint_get_float(cp);
+                break;
+
+            case SYMBOL_INTEGER:
+                s->u.n = checkpoint_get_int(cp);
+                break;
+
+            default:
+                s->u.s = checkpoint_get_bytes(cp, &s->len);
+                break;
+        }
+
+        array->data[i] = s;
+    }
+
+    return array;
+}
+
+/* Saves an array's type, dimensions and elements to a checkpoint */
+static void
+array_save(struct checkpoint * cp, struct array * array) {
+    int64_t num_dims = 0;
+    for ( struct value * d = array->dims; d; d = value_next(d) ) {
+        num_dims++;
+    }
+
+    checkpoint_put_int(cp, array->type);
+    checkpoint_put_int(cp, num_dims);
+    for ( struct value * d = array->dims; d; d = value_next(d) ) {
+        checkpoint_put_int(cp, value_int(d));
+    }
+
+    for ( size_t i = 0; i < array->size; i++ ) {
+        struct symbol * s = array->data[i];
+        switch ( array->type ) {
+            case SYMBOL_FLOAT:
+                checkpoint_put_float(cp, s->u.f);
+                break;
+
+            case SYMBOL_INTEGER:
+                checkpoint_put_int(cp, s->u.n);
+                break;
+
+            default:
+                checkpoint_put_bytes(cp, s->u.s, s->len);
+                break;
+        }
+    }
+}
+
 /* Calculates the size of an array from its dimensions.
  * Note that in BBC BASIC II arrays are zero-indexed, but
  * n is a valid index for DIM var(n), so we actually need
@@ -1140,7 +1457,7 @@ variable_get(const char * id) {
             break;
 
         case SYMBOL_STRING:
-            result = value_string_new(current->u.s);
+            result = value_string_new_len(current->u.s, current->len);
             break;
 
         case SYMBOL_PROCEDURE:
@@ -1167,6 +1484,7 @@ variable_set(struct symbol * s, struct value * v) {
     } else if ( value_is_string(v) ) {
         s->type = SYMBOL_STRING;
         s->u.s = value_string(v);
+        s->len = value_string_len(v);
     } else {
         ABORT("unexpected expression type");
     }
@@ -23,8 +23,9 @@
 #include "value.h"
 #include "runtime.h"
 
-/* Opaque and incomplete struct definition */
+/* Opaque and incomplete struct definitions */
 struct statement;
+struct checkpoint;
 
 /* Number formats in @% resident integer variable */
 enum number_format {
@@ -39,6 +40,8 @@ void symbol_table_free(void);
 void symbol_table_init(void);
 void symbol_table_pop_frame(void);
 void symbol_table_push_frame(void);
+void symbol_table_restore(struct checkpoint * cp);
+void symbol_table_save(struct checkpoint * cp);
 
 /* Procedure functions */
 int pass_arguments(struct expr * params, struct expr * args);
@@ -0,0 +1,259 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Programs saved in the BBC Micro's tokenised format.
+ *
+ * Each line is a carriage return, the line number high byte first, the
+ * length of the whole line including these four bytes, and the text of
+ * the line with each keyword replaced by a byte of 0x80 or more. Line
+ * numbers after GOTO, GOSUB, RESTORE, THEN and ELSE are stored as 0x8D
+ * and three bytes which keep them clear of the control characters. The
+ * program ends with a carriage return and 0xFF.
+ *
+ * A tokenised program is decoded in memory into the text the parser
+ * reads, with a space between a keyword and a name or number which
+ * would otherwise run into it, since BBC BASIC doesn't need one but
+ * bbasic's lexer does. Strings and the rest of a line after REM or DATA
+ * are copied as they are.
+ */
+
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "tokenised.h"
+#include "util.h"
+
+/* Special token values */
+#define TOKEN_FN (0xA4)
+#define TOKEN_LINE_NUMBER (0x8D)
+#define TOKEN_PROC (0xF2)
+#define TOKEN_DATA (0xDC)
+#define TOKEN_REM (0xF4)
+
+/* The end of program marker, after a carriage return */
+#define END_OF_PROGRAM (0xFF)
+
+/* The keywords for tokens 0x80 to 0xFF. The two forms of PTR, PAGE,
+ * TIME, LOMEM and HIMEM, as functions and as the targets of
+ * assignments, have separate tokens.
+ */
+static const char * const keywords[] = {
+    "AND", "DIV", "EOR", "MOD", "OR", "ERROR", "LINE", "OFF",
+    "STEP", "SPC", "TAB(", "ELSE", "THEN", NULL, "OPENIN", "PTR",
+    "PAGE", "TIME", "LOMEM", "HIMEM", "ABS", "ACS", "ADVAL", "ASC",
+    "ASN", "ATN", "BGET", "COS", "COUNT", "DEG", "ERL", "ERR",
+    "EVAL", "EXP", "EXT", "FALSE", "FN", "GET", "INKEY", "INSTR(",
+    "INT", "LEN", "LN", "LOG", "NOT", "OPENUP", "OPENOUT", "PI",
+    "POINT(", "POS", "RAD", "RND", "SGN", "SIN", "SQR", "TAN",
+    "TO", "TRUE", "USR", "VAL", "VPOS", "CHR$", "GET$", "INKEY$",
+    "LEFT$(", "MID$(", "RIGHT$(", "STR$", "STRING$(", "EOF", "AUTO",
+    "DELETE", "LOAD", "LIST", "NEW", "OLD", "RENUMBER", "SAVE", NULL,
+    "PTR", "PAGE", "TIME", "LOMEM", "HIMEM", "SOUND", "BPUT", "CALL",
+    "CHAIN", "CLEAR", "CLOSE", "CLG", "CLS", "DATA", "DEF", "DIM",
+    "DRAW", "END", "ENDPROC", "ENVELOPE", "FOR", "GOSUB", "GOTO",
+    "GCOL", "IF", "INPUT", "LET", "LOCAL", "MODE", "MOVE", "NEXT",
+    "ON", "VDU", "PLOT", "PRINT", "PROC", "READ", "REM", "REPEAT",
+    "REPORT", "RESTORE", "RETURN", "RUN", "STOP", "COLOUR", "TRACE",
+    "UNTIL", "WIDTH", "OSCLI"
+};
+
+/* Decoded program text */
+struct text {
+    char * s;
+    size_t len;
+    size_t capacity;
+};
+
+/* Static function declarations */
+static bool decode_line(struct text * text, const unsigned char * p,
+        const unsigned char * end);
+static bool is_name_char(const int c);
+static void text_add(struct text * text, const char * s, const size_t n);
+static void text_add_word(struct text * text, const char * word);
+
+
+/*********************************************************************
+ *                                                                   *
+ * Public tokenised program functions                                *
+ *                                                                   *
+ *********************************************************************/
+
+/* Decodes a tokenised program into text, with two terminating null
+ * characters as yy_scan_buffer() requires, and sets text_len to its
+ * length without them. Returns NULL if the program is malformed.
+ */
+char *
+tokenised_decode(const char * source, const size_t len, size_t * text_len) {
+    const unsigned char * p = (const unsigned char *) source;
+    const unsigned char * end = p + len;
+    struct text text = { x_malloc(len * 2 + 2), 0, len * 2 + 2 };
+
+    while ( true ) {
+        if ( end - p < 2 || p[0] != '\r' ) {
+            x_free(text.s);
+            return NULL;
+        }
+
+        if ( p[1] == END_OF_PROGRAM ) {
+            break;
+        }
+
+        /* Each line is at least as long as its header */
+        if ( end - p < 4 || p[3] < 4 || end - p < p[3] ) {
+            x_free(text.s);
+            return NULL;
+        }
+
+        char number[16];
+        snprintf(number, sizeof number, "%d ", (p[1] << 8) | p[2]);
+        text_add(&text, number, strlen(number));
+        if ( !decode_line(&text, p + 4, p + p[3]) ) {
+            x_free(text.s);
+            return NULL;
+        }
+        text_add(&text, "\n", 1);
+
+        p += p[3];
+    }
+
+    text_add(&text, "\0\0", 2);
+    *text_len = text.len - 2;
+
+    return text.s;
+}
+
+/* Checks whether a program is in tokenised form, by following the line
+ * headers from the start to the end of program marker
+ */
+bool
+tokenised_detect(const char * source, const size_t len) {
+    const unsigned char * p = (const unsigned char *) source;
+    const unsigned char * end = p + len;
+
+    while ( end - p >= 2 && p[0] == '\r' ) {
+        if ( p[1] == END_OF_PROGRAM ) {
+            return true;
+        }
+
+        if ( end - p < 4 || p[3] < 4 ) {
+            return false;
+        }
+
+        p += p[3];
+    }
+
+    return false;
+}
+
+
+/*********************************************************************
+ *                                                                   *
+ * Static functions                                                  *
+ *                                                                   *
+ *********************************************************************/
+
+/* Decodes the text of a line from p up to end. Returns false if the
+ * line contains a byte which isn't a token, or an incomplete line
+ * number.
+ */
+static bool
+decode_line(struct text * text, const unsigned char * p,
+        const unsigned char * end) {
+    bool quoted = false;
+    bool literal = false;
+    bool after_word = false;
+
+    while ( p < end ) {
+        const int c = *p++;
+
+        if ( quoted || literal || c < 0x80 ) {
+            /* Separate a keyword from a name or number after it */
+            if ( after_word && is_name_char(c) ) {
+                text_add(text, " ", 1);
+            }
+            after_word = false;
+
+            if ( c == '"' && !literal ) {
+                quoted = !quoted;
+            }
+
+            const char ch = c;
+            text_add(text, &ch, 1);
+        } else if ( c == TOKEN_LINE_NUMBER ) {
+            if ( end - p < 3 ) {
+                return false;
+            }
+
+            const int low = ((p[0] << 2) & 0xC0) ^ p[1];
+            const int high = ((p[0] << 4) & 0xC0) ^ p[2];
+            p += 3;
+
+            char number[8];
+            snprintf(number, sizeof number, "%d", (high << 8) | low);
+            text_add_word(text, number);
+            after_word = true;
+        } else {
+            const char * keyword = keywords[c - 0x80];
+            if ( !keyword ) {
+                return false;
+            }
+
+            text_add_word(text, keyword);
+
+            /* The name of a PROC or FN follows it directly */
+            after_word = c != TOKEN_FN && c != TOKEN_PROC;
+            literal = c == TOKEN_DATA || c == TOKEN_REM;
+        }
+    }
+
+    return true;
+}
+
+/* Checks whether a character can be part of a name or a number */
+static bool
+is_name_char(const int c) {
+    return isalnum(c) || c == '_';
+}
+
+/* Adds n characters to the decoded text */
+static void
+text_add(struct text * text, const char * s, const size_t n) {
+    if ( text->len + n > text->capacity ) {
+        text->capacity = (text->len + n) * 2;
+        text->s = x_realloc(text->s, text->capacity);
+    }
+
+    memcpy(text->s + text->len, s, n);
+    text->len += n;
+}
+
+/* Adds a keyword or line number to the decoded text, separated from a
+ * name or number before it
+ */
+static void
+text_add_word(struct text * text, const char * word) {
+    if ( text->len > 0 && is_name_char(text->s[text->len - 1]) ) {
+        text_add(text, " ", 1);
+    }
+
+    text_add(text, word, strlen(word));
+}
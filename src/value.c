@@ -21,8 +21,10 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <string.h>
 
 #include "value.h"
+#include "num_format.h"
 #include "symbols.h"
 #include "util.h"
 
@@ -33,9 +35,13 @@ enum value_type {
     VALUE_STRING = 3
 };
 
-/* Tagged union representing a typed value */
+/* Tagged union representing a typed value. Strings are null
+ * terminated, but may also contain null characters, so their length
+ * is kept with them.
+ */
 struct value {
     enum value_type type;
+    size_t len;
     union {
         double f;
         int32_t n;
@@ -62,7 +68,7 @@ value_copy(struct value * v) {
     } else if ( value_is_int(v) ) {
         return value_int_new(v->value.n);
     } else if ( value_is_string(v) ) {
-        return value_string_new(v->value.s);
+        return value_string_new_len(v->value.s, v->len);
     }
 
     ABORTF("unrecognized value type: %d\n", v->type);
@@ -87,8 +93,20 @@ value_int_new(const int32_t n) {
 /* Constructs a new string value */
 struct value *
 value_string_new(const char * s) {
+    return value_string_new_len(s, strlen(s));
+}
+
+/* Constructs a new string value from len characters, which may
+ * include null characters
+ */
+struct value *
+value_string_new_len(const char * s, const size_t len) {
+    char * copy = x_malloc(len + 1);
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+
     struct value * v = value_new();
-    *v = (struct value){ .type = VALUE_STRING, .value.s = x_strdup(s)};
+    *v = (struct value){ .type = VALUE_STRING, .len = len, .value.s = copy};
     return v;
 }
 
@@ -129,13 +147,27 @@ value_string_peek(struct value * v) {
     return v->value.s;
 }
 
-/* Returns a copy of the string value */
+/* Returns a copy of the string value, including any characters after
+ * a null character
+ */
 char *
 value_string(struct value * v) {
     if ( v->type != VALUE_STRING ) {
         ABORTF("value with type %d is not a string\n", v->type);
     }
-    return x_strdup(v->value.s);
+
+    char * s = x_malloc(v->len + 1);
+    memcpy(s, v->value.s, v->len + 1);
+    return s;
+}
+
+/* Returns the length of the string value */
+size_t
+value_string_len(struct value * v) {
+    if ( v->type != VALUE_STRING ) {
+        ABORTF("value with type %d is not a string\n", v->type);
+    }
+    return v->len;
 }
 
 
@@ -219,6 +251,52 @@ value_next(struct value * v) {
  *                                                                   *
  *********************************************************************/
 
+/* Writes the string representation of a numeric value into buffer,
+ * which must be at least NUM_FORMAT_BUFFER_SIZE bytes, and returns
+ * its length. If format is true, the value of @% is used to specify
+ * a field width.
+ */
+size_t
+value_format(char * buffer, struct value * v, const bool format) {
+    if ( !v ) {
+        ABORT("value is NULL");
+    } else if ( !value_is_numeric(v) ) {
+        ABORT("value is not numeric");
+    }
+
+    const enum number_format mode = format_number();
+    const int places = format_places();
+    int precision;
+
+    switch ( mode ) {
+        case FORMAT_NORMAL:
+            /* PRINT always shows nine significant figures in
+             * the general format.
+             */
+            precision = 9;
+            break;
+
+        case FORMAT_SCIENTIFIC:
+            /* Note this probably won't match the format on
+             * the BBC Micro, where printing 2.345 with
+             * @%=&010209 would give 2.3E0, where 2.3E+00
+             * is more normal here. We'll accept the difference
+             * for now.
+             */
+            precision = places == 0 ? 0 : places - 1;
+            break;
+
+        case FORMAT_FIXED:
+            precision = places;
+            break;
+
+        default:
+            ABORTF("unexpected number format: %d", mode);
+    }
+
+    return num_format(buffer, v, mode, precision, format ? format_width() : 0);
+}
+
 /* Returns a string representation of a value. If format is
  * true, the value of @% is used to specify a field width
  * for numbers.
@@ -231,60 +309,9 @@ value_to_string(struct value * v, const bool format) {
 
     char * s;
     if ( value_is_numeric(v) ) {
-        const int width = format_width();
-        const int places = format_places();
-
-        if ( format ) {
-            /* With field width specifiers */
-
-            switch ( format_number() ) {
-                case FORMAT_NORMAL:
-                    s = x_msprintf("%*.9G", width, places, value_float(v));
-                    break;
-
-                case FORMAT_SCIENTIFIC:
-                    /* Note this probably won't match the format on
-                     * the BBC Micro, where printing 2.345 with
-                     * @%=&010209 would give 2.3E0, where 2.3E+00
-                     * is more normal here. We'll accept the difference
-                     * for now.
-                     */
-                    s = x_msprintf("%*.*E", width, places == 0 ? 0 : places - 1, value_float(v));
-                    break;
-
-                case FORMAT_FIXED:
-                    s = x_msprintf("%*.*F", width, places, value_float(v));
-                    break;
-
-                default:
-                    ABORTF("unexpected number format: %d", format_number());
-            }
-        } else {
-            /* No field width specifiers */
-
-            switch ( format_number() ) {
-                case FORMAT_NORMAL:
-                    s = x_msprintf("%.9G", places, value_float(v));
-                    break;
-
-                case FORMAT_SCIENTIFIC:
-                    /* Note this probably won't match the format on
-                     * the BBC Micro, where printing 2.345 with
-                     * @%=&010209 would give 2.3E0, where 2.3E+00
-                     * is more normal here. We'll accept the difference
-                     * for now.
-                     */
-                    s = x_msprintf("%.*E", places == 0 ? 0 : places - 1, value_float(v));
-                    break;
-
-                case FORMAT_FIXED:
-                    s = x_msprintf("%.*F", places, value_float(v));
-                    break;
-
-                default:
-                    ABORTF("unexpected number format: %d", format_number());
-            }
-        }
+        char buffer[NUM_FORMAT_BUFFER_SIZE];
+        value_format(buffer, v, format);
+        s = x_strdup(buffer);
     } else if ( value_is_string(v) ) {
         s = value_string(v);
     } else {
@@ -306,12 +333,12 @@ void
 value_free(struct value * v) {
     if ( v ) {
         if ( value_is_string(v) ) {
-            free(v->value.s);
+            x_free(v->value.s);
         }
         if ( v->next ) {
             value_free(v->next);
         }
-        free(v);
+        x_free(v);
     }
 }
 
@@ -18,6 +18,7 @@
 #ifndef PG_BBASIC_INTERNAL_VALUE_H
 #define PG_BBASIC_INTERNAL_VALUE_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -29,12 +30,14 @@ struct value * value_copy(struct value * v);
 struct value * value_float_new(const double f);
 struct value * value_int_new(const int32_t n);
 struct value * value_string_new(const char * s);
+struct value * value_string_new_len(const char * s, const size_t len);
 
 /* Getters */
 double value_float(struct value * v);
 int32_t value_int(struct value * v);
 char * value_string_peek(struct value * v);
 char * value_string(struct value * v);
+size_t value_string_len(struct value * v);
 
 /* Type-checking functions */
 bool value_is_float(struct value * v);
@@ -43,7 +46,8 @@ bool value_is_numeric(struct value * v);
 bool value_is_string(struct value * v);
 bool value_is_zero(struct value * v);
 
-/* Stringify function */
+/* Stringify functions */
+size_t value_format(char * buffer, struct value * v, const bool format);
 char * value_to_string(struct value * v, const bool format);
 
 /* List functions */
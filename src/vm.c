@@ -0,0 +1,192 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* VMs for libbbasic.
+ *
+ * The state of a running program is thread-local, so a VM only needs
+ * to hold what outlives a call: the program lines, detached from the
+ * runtime between calls, and the streams. Each call attaches them to
+ * the calling thread and detaches them again before returning, which
+ * is why a VM can move between threads. The lexer and parser are not
+ * reentrant, so loading source is serialised, but loading images and
+ * running are not.
+ */
+
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#include "bbasic.h"
+#include "image.h"
+#include "runtime.h"
+#include "symbols.h"
+#include "util.h"
+#include "yydecls.h"
+
+/* VM structure */
+struct bbasic_vm {
+    struct program * program;
+    FILE * in;
+    FILE * out;
+    FILE * err;
+};
+
+#if HAVE_PTHREAD_H
+/* Lock held while the lexer and parser are in use */
+static pthread_mutex_t parser_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Static function declarations */
+static void vm_enter(struct bbasic_vm * vm);
+static void vm_leave(struct bbasic_vm * vm);
+
+
+/*********************************************************************
+ *                                                                   *
+ * Public VM functions                                               *
+ *                                                                   *
+ *********************************************************************/
+
+/* Creates a VM */
+struct bbasic_vm *
+bbasic_vm_new(void) {
+    return x_calloc(1, sizeof(struct bbasic_vm));
+}
+
+/* Sets the streams for the VM */
+void
+bbasic_vm_set_streams(struct bbasic_vm * vm, FILE * in, FILE * out,
+        FILE * err) {
+    vm->in = in;
+    vm->out = out;
+    vm->err = err;
+}
+
+/* Loads a program into the VM */
+int
+bbasic_vm_load(struct bbasic_vm * vm, const char * source,
+        const size_t len) {
+    vm_enter(vm);
+    runtime_free();
+
+    /* The lexer scans in place, and needs two terminating NULs */
+    char * buffer = x_malloc(len + 2);
+    memcpy(buffer, source, len);
+    buffer[len] = '\0';
+    buffer[len + 1] = '\0';
+
+#if HAVE_PTHREAD_H
+    pthread_mutex_lock(&parser_lock);
+#endif
+    yylineno = 1;
+    yy_scan_buffer(buffer, len + 2);
+    const int status = yyparse();
+    yylex_destroy();
+#if HAVE_PTHREAD_H
+    pthread_mutex_unlock(&parser_lock);
+#endif
+
+    x_free(buffer);
+
+    if ( status != 0 ) {
+        runtime_free();
+    }
+    vm_leave(vm);
+
+    return status == 0 ? 0 : -1;
+}
+
+/* Loads a compiled program image into the VM */
+int
+bbasic_vm_load_image(struct bbasic_vm * vm, const char * filename) {
+    vm_enter(vm);
+    runtime_free();
+    const int status = image_load(filename, false);
+    vm_leave(vm);
+
+    return status == STATUS_OK ? 0 : -1;
+}
+
+/* Runs the program loaded into the VM */
+int
+bbasic_vm_run(struct bbasic_vm * vm) {
+    if ( !vm->program ) {
+        return EXIT_FAILURE;
+    }
+
+    vm_enter(vm);
+    symbol_table_init();
+    int status = program_run();
+#if ENABLE_ANSI_COLOURS
+    reset_colours();
+#endif
+    fflush(program_out());
+    vm_leave(vm);
+
+    if ( status == STATUS_OK ) {
+        return EXIT_SUCCESS;
+    }
+
+    if ( status < 0 && error_is_set() ) {
+        status = error_code();
+    }
+
+    return status > 0 ? status : EXIT_FAILURE;
+}
+
+/* Frees the VM */
+void
+bbasic_vm_free(struct bbasic_vm * vm) {
+    if ( !vm ) {
+        return;
+    }
+
+    vm_enter(vm);
+    runtime_free();
+    vm_leave(vm);
+    x_free(vm);
+}
+
+
+/*********************************************************************
+ *                                                                   *
+ * Static functions                                                  *
+ *                                                                   *
+ *********************************************************************/
+
+/* Attaches the VM's program and streams to the calling thread */
+static void
+vm_enter(struct bbasic_vm * vm) {
+    program_set_streams(vm->in, vm->out, vm->err);
+    program_attach(vm->program);
+    vm->program = NULL;
+}
+
+/* Detaches the program from the calling thread into the VM, and
+ * restores the standard streams
+ */
+static void
+vm_leave(struct bbasic_vm * vm) {
+    vm->program = program_detach();
+    program_set_streams(NULL, NULL, NULL);
+}
@@ -0,0 +1,246 @@
+/*  BBASIC, an interpreter for a subset of BBC BASIC II.
+ *  Copyright (C) 2021 Paul Griffiths.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Watch mode, for the --watch option, which runs a program again
+ * whenever its file changes.
+ *
+ * The program is loaded through edit.c, so when the file changes only
+ * the lines which differ are parsed and linked into the program, which
+ * stays built between runs.
+ *
+ * The directory holding the file is watched with inotify, rather than
+ * the file itself, since editors often save a file by writing a new one
+ * and renaming it over the old one. Without inotify, the file's
+ * modification time and size are checked every quarter of a second.
+ */
+
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#if HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+
+#if HAVE_SYS_INOTIFY_H && HAVE_POLL_H
+#define USE_INOTIFY 1
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
+
+#include "watch.h"
+#include "edit.h"
+#include "runtime.h"
+#include "util.h"
+
+/* Milliseconds to wait for more events after a change, so that a file
+ * saved in several steps is only loaded once
+ */
+#define SETTLE_MS (50)
+
+/* A watched program file */
+struct watch {
+    const char * filename;
+#if USE_INOTIFY
+    int fd;
+    char * name;
+#else
+    struct stat st;
+#endif
+};
+
+/* Static function declarations */
+static void watch_finish(struct watch * watch);
+static bool watch_start(struct watch * watch, const char * filename);
+static bool watch_wait(struct watch * watch);
+
+
+/*********************************************************************
+ *                                                                   *
+ * Public watch mode functions                                       *
+ *                                                                   *
+ *********************************************************************/
+
+/* Runs a program, and runs it again whenever its file changes, until
+ * interrupted while waiting for a change
+ */
+int
+watch_run(const char * filename) {
+    struct watch watch;
+    if ( !watch_start(&watch, filename) ) {
+        return EXIT_FAILURE;
+    }
+
+    program_set_resident(true);
+
+    bool first = true;
+    do {
+        size_t changed;
+        if ( edit_load(filename, &changed) ) {
+            if ( !first ) {
+                fprintf(stderr, "%s: %s changed, %zu lines parsed\n",
+                        PACKAGE, filename, changed);
+            }
+
+            edit_prepare();
+            program_run();
+            fflush(stdout);
+            interrupt = 0;
+        }
+        first = false;
+    } while ( watch_wait(&watch) );
+
+    watch_finish(&watch);
+    edit_free();
+
+    return EXIT_SUCCESS;
+}
+
+
+/*********************************************************************
+ *                                                                   *
+ * Static functions                                                  *
+ *                                                                   *
+ *********************************************************************/
+
+#if USE_INOTIFY
+
+/* Stops watching a program file */
+static void
+watch_finish(struct watch * watch) {
+    close(watch->fd);
+    x_free(watch->name);
+}
+
+/* Starts watching a program file */
+static bool
+watch_start(struct watch * watch, const char * filename) {
+    const char * base = strrchr(filename, '/');
+    watch->filename = filename;
+    watch->name = x_strdup(base ? base + 1 : filename);
+
+    char * dir = x_strdup(filename);
+    char * slash = strrchr(dir, '/');
+    if ( !slash ) {
+        strcpy(dir, ".");
+    } else if ( slash == dir ) {
+        slash[1] = '\0';
+    } else {
+        *slash = '\0';
+    }
+
+    watch->fd = inotify_init1(IN_CLOEXEC);
+    if ( watch->fd == -1 || inotify_add_watch(watch->fd, dir,
+                IN_CLOSE_WRITE | IN_MOVED_TO) == -1 ) {
+        fprintf(stderr, "%s: couldn't watch %s: %s\n", PACKAGE, filename,
+                strerror(errno));
+        if ( watch->fd != -1 ) {
+            close(watch->fd);
+        }
+        x_free(watch->name);
+        x_free(dir);
+        return false;
+    }
+
+    x_free(dir);
+    return true;
+}
+
+/* Waits until a program file changes. Returns false if interrupted. */
+static bool
+watch_wait(struct watch * watch) {
+    union {
+        struct inotify_event event;
+        char bytes[4096];
+    } buffer;
+
+    /* Wait for an event for the file */
+    bool changed = false;
+    while ( !changed ) {
+        const ssize_t n = read(watch->fd, buffer.bytes, sizeof buffer);
+        if ( n <= 0 ) {
+            return false;
+        }
+
+        for ( ssize_t i = 0; i < n; ) {
+            const struct inotify_event * event =
+                (const struct inotify_event *) (buffer.bytes + i);
+            if ( event->len > 0 && !strcmp(event->name, watch->name) ) {
+                changed = true;
+            }
+            i += sizeof *event + event->len;
+        }
+    }
+
+    /* Let the rest of the events from the same save arrive */
+    struct pollfd pfd = { watch->fd, POLLIN, 0 };
+    while ( poll(&pfd, 1, SETTLE_MS) > 0 &&
+            read(watch->fd, buffer.bytes, sizeof buffer) > 0 ) {
+        /* Discard them */
+    }
+
+    return !interrupt;
+}
+
+#else
+
+/* Stops watching a program file */
+static void
+watch_finish(struct watch * watch) {
+    (void) watch;
+}
+
+/* Starts watching a program file */
+static bool
+watch_start(struct watch * watch, const char * filename) {
+    watch->filename = filename;
+    if ( stat(filename, &watch->st) == -1 ) {
+        memset(&watch->st, 0, sizeof watch->st);
+    }
+
+    return true;
+}
+
+/* Waits until a program file changes. Returns false if interrupted. */
+static bool
+watch_wait(struct watch * watch) {
+    const struct timespec interval = { 0, 250000000 };
+    while ( !interrupt ) {
+        nanosleep(&interval, NULL);
+
+        struct stat st;
+        if ( stat(watch->filename, &st) == 0 &&
+                (st.st_mtime != watch->st.st_mtime ||
+                 st.st_size != watch->st.st_size) ) {
+            watch->st = st;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#endif  /* USE_INOTIFY */
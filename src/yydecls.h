@@ -21,10 +21,13 @@
 #include <stdio.h>
 #include <stddef.h>
 
+extern int yylineno;
+
 typedef struct yy_buffer_state * YY_BUFFER_STATE;
 YY_BUFFER_STATE yy_scan_buffer(char *, size_t);
 void yy_delete_buffer(YY_BUFFER_STATE buffer);
 void yyrestart(FILE *);
+int yylex_destroy(void);
 int yyparse(void);
 
 #endif  /* PG_BBASIC_INTERNAL_YYDECLS_H */